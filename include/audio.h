@@ -3,9 +3,10 @@
 
 #include <stdbool.h>
 
+#include "chip8.h"
+
 bool audio_init(void);
-void audio_beep_on(void);
-void audio_beep_off(void);
+void audio_sync(const Chip8 *chip8);
 void audio_destroy(void);
 
 #endif
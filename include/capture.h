@@ -0,0 +1,86 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+// Frames in flight to the encoder, a power of two. 2 KB each, so the default
+// holds four seconds of 60 Hz play in 512 KB.
+#define CAPTURE_DEFAULT_CAPACITY 256
+// Output pixels per high resolution pixel, low resolution pixels are twice
+// as wide and tall
+#define CAPTURE_DEFAULT_SCALE 4
+// GIF delays are in centiseconds and players stretch anything below 2, so
+// frames are timed on a 50 Hz grid and the last one within a step wins
+#define CAPTURE_MIN_DELAY_CS 2
+
+// The screen of one 60 Hz step, as queued by the emulation thread
+typedef struct {
+	uint64_t gfx[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	uint32_t tick; // 60 Hz step the frame appeared at
+	bool hires;
+} CaptureFrame;
+
+/*
+ * Animated GIF recording of one Chip8 instance. The emulation thread copies
+ * each drawn screen into a ring and never waits: when the ring is full the
+ * frame is counted as dropped. A background thread encodes the frames
+ * against a 4-colour palette, one per pixel value of the two planes.
+ * Consecutive identical frames become one frame with a longer delay, and
+ * each frame only stores the rectangle that changed since the previous one.
+ */
+typedef struct Chip8Capture {
+	CaptureFrame *frames;
+	uint32_t capacity;
+	uint32_t mask;
+
+	// Free-running indices, `tail` written by the emulation thread only and
+	// `head` by the encoder only
+	atomic_uint head;
+	atomic_uint tail;
+	uint64_t dropped;
+
+	// Encoder thread state. Images hold one palette index per high resolution
+	// pixel: `canvas` is what the file shows after the frames written so far,
+	// `pending` the newest frame, written once the next one fixes its delay.
+	FILE *file;
+	int scale;
+	uint8_t canvas[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+	uint8_t pending[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+	uint32_t pending_tick;
+	bool has_pending;
+	// LZW dictionary, the code for a prefix code followed by a pixel
+	uint16_t codes[4096][4];
+	uint64_t written;
+	uint64_t duplicates;
+
+	pthread_t thread;
+	atomic_bool stop;
+} Chip8Capture;
+
+/*
+ * Creates the GIF and starts the encoder. `palette` holds the ARGB colours of
+ * the background, plane 1, plane 2 and both planes, NULL for the display's
+ * defaults.
+ */
+bool capture_open(Chip8Capture *capture, const char *path, uint32_t capacity,
+									int scale, const uint32_t *palette);
+// Emulation thread: queues the screen shown from 60 Hz step `tick` on. When
+// the encoder is too far behind the frame is dropped, or with `wait`, which
+// is for runs that are not paced in real time, queued once there is room.
+void capture_frame(Chip8Capture *capture, const Chip8 *chip8, uint32_t tick,
+									 bool wait);
+// Encodes the remaining frames, the last one shown until `end_tick`
+void capture_close(Chip8Capture *capture, uint32_t end_tick);
+
+// Writes the current screen as a PNG in the colours of capture_open. Pixels
+// are stored at 2 bits each but uncompressed, in stored deflate blocks.
+bool capture_png(const char *path, const Chip8 *chip8, int scale,
+								 const uint32_t *palette);
+
+#endif
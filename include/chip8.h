@@ -2,29 +2,84 @@
 #define CHIP8_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHIP8_SCREEN_WIDTH 64
+#define CHIP8_SCREEN_HEIGHT 32
+// SUPER-CHIP/XO-CHIP high resolution mode
+#define CHIP8_HIRES_WIDTH 128
+#define CHIP8_HIRES_HEIGHT 64
+// XO-CHIP bitplanes
+#define CHIP8_PLANES 2
+
+// 64K covers XO-CHIP, CHIP-8 and SUPER-CHIP programs only use the first 4K
+#define CHIP8_MEMORY_SIZE 0x10000
+#define CHIP8_MAX_ROM_SIZE (CHIP8_MEMORY_SIZE - 0x200)
+// The SUPER-CHIP 8x10 font follows the 4x5 one
+#define CHIP8_BIG_FONT_ADDRESS 0x50
+// Memory is tracked for resets in 1K pages, one bit of a uint64_t each
+#define CHIP8_PAGE_SHIFT 10
+#define CHIP8_PAGE_SIZE (1 << CHIP8_PAGE_SHIFT)
+
+// Called whenever the sound timer starts or stops the beeper. Keeps the core
+// free of any audio backend so it can run headless.
+typedef void (*Chip8SoundCallback)(void *userdata, bool on);
+
+// Instruction trace, see trace.h
+struct Chip8Trace;
+
+/*
+ * Quirk profiles: the opcode behaviours that differ between CHIP-8
+ * implementations (VF reset by 8XY1-3, the 8XY6/8XYE shift source, I after
+ * FX55/FX65, BNNN's register and sprite clipping), named after the machine
+ * whose behaviour each one follows.
+ */
+typedef enum {
+	CHIP8_QUIRKS_VIP, // COSMAC VIP, the default
+	CHIP8_QUIRKS_CHIP48,
+	CHIP8_QUIRKS_SCHIP,
+	CHIP8_QUIRKS_XOCHIP,
+	CHIP8_QUIRKS_COUNT,
+} Chip8Quirks;
 
 typedef struct {
 	// 2 byte current opcode
 	unsigned short opcode;
 
-	// 4K memory
-	unsigned char memory[4096];
+	// 64K memory, addresses wrap at the end
+	unsigned char memory[CHIP8_MEMORY_SIZE];
+	// Bytes the last ROM load put at 0x200, zero after a reset
+	size_t rom_size;
 
 	// 15 General Purpose CPU registers V0-VE, 1 carry flag register
 	unsigned char V[16];
 
 	/*
-	 * Index register and Program Counter (0x000 to 0xFFF)
-	 * 0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
-	 * 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
-	 * 0x200-0xFFF - Program ROM and work RAM
+	 * Index register and Program Counter (0x0000 to 0xFFFF)
+	 * 0x000-0x1FF - Chip 8 interpreter (contains font sets in emu)
+	 * 0x000-0x04F - Used for the built in 4x5 pixel font set (0-F)
+	 * 0x050-0x0EF - Used for the SUPER-CHIP 8x10 pixel font set (0-F)
+	 * 0x200-...   - Program ROM and work RAM
 	 */
 	unsigned short I;
 	unsigned short pc;
 
-	// Graphics system - XOR
-	unsigned char gfx[64 * 32];
+	/*
+	 * Graphics system - XOR
+	 * Two 64-bit words per row and plane, bit 63 of word 0 is the leftmost
+	 * pixel (x = 0), so a sprite row is drawn with a shift or rotate and XOR.
+	 * Low resolution only uses rows 0-31 of word 0, exactly one word per row;
+	 * high resolution uses all 64 rows and 128 columns.
+	 */
+	uint64_t gfx[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	bool hires;
+	// Planes that drawing, clearing and scrolling apply to (XO-CHIP FN01)
+	unsigned char planes;
 	bool draw_flag;
+	// Bit y is set when row y may have changed, the front end clears it once
+	// the row has been presented
+	uint64_t dirty_rows;
 
 	// Timer registers
 	unsigned char delay_timer;
@@ -34,16 +89,131 @@ typedef struct {
 	unsigned short stack[16];
 	unsigned short sp;
 
-	// HEX-based keypad (0x0 - 0xF)
-	unsigned char key[16];
-	unsigned char key_prev[16];
+	// HEX-based keypad (0x0 - 0xF), bit i set while key i is held, and the
+	// keys released since the frame started, which is what FX0A waits for
+	uint16_t keys;
+	uint16_t keys_released;
+
+	// SUPER-CHIP RPL user flags, FX75/FX85
+	unsigned char rpl[16];
+
+	// XO-CHIP audio: a 128-sample 1-bit loop (F002) played while the sound
+	// timer runs, at 4000 * 2^((pitch - 64) / 48) samples per second (FX3A).
+	// Until a ROM loads a pattern the plain beeper tone is used.
+	unsigned char pattern[16];
+	unsigned char pitch;
+	bool has_pattern;
+
+	// Per-instance PRNG state for CXNN, see chip8_seed
+	uint64_t rng_state;
+
+	// Selects the specialized dispatch loop, see chip8_run
+	Chip8Quirks quirks;
+
+	// Cycles fast-forwarded through idle loops, and whether the last batch
+	// ended in one, so the host can stop spinning until the next timer tick
+	// or input. Statistics for the front end, not part of the machine state.
+	unsigned long long idle_cycles;
+	bool idle;
+	// A SYS or unknown opcode was reported since the last reset; later ones are
+	// not, since an unknown opcode repeats every cycle
+	bool warned;
+	// Never report them, for harnesses that run arbitrary bytes. Survives
+	// chip8_reset.
+	bool quiet;
+
+	// Sound output hook, NULL when no audio backend is attached
+	Chip8SoundCallback sound_callback;
+	void *sound_userdata;
+	bool sound_on;
+
+	// Instruction trace filled by chip8_run, NULL when not tracing
+	struct Chip8Trace *trace;
+
+	// Pages of memory written since the last chip8_init or chip8_reset, fonts
+	// included. The rest is zero, so these are all chip8_reset has to clear and
+	// all a snapshot has to copy.
+	uint64_t dirty_pages;
 } Chip8;
 
+/*
+ * Complete machine state without the front-end hooks, used by save states
+ * and rewind. Laid out largest members first so the struct has no interior
+ * padding and is a whole number of 64-bit words.
+ *
+ * Most ROMs touch a few KB of the 64K, so only the pages in `memory_pages` are
+ * copied; the rest of memory is zero and left unwritten in `memory`.
+ */
+typedef struct {
+	unsigned char memory[CHIP8_MEMORY_SIZE];
+	uint64_t gfx[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	uint64_t rng_state;
+	uint64_t memory_pages;
+	unsigned short stack[16];
+	unsigned short opcode;
+	unsigned short I;
+	unsigned short pc;
+	unsigned short sp;
+	uint16_t keys;
+	uint16_t keys_released;
+	unsigned char V[16];
+	unsigned char rpl[16];
+	unsigned char pattern[16];
+	unsigned char delay_timer;
+	unsigned char sound_timer;
+	bool hires;
+	unsigned char planes;
+	unsigned char pitch;
+	bool has_pattern;
+	unsigned char reserved[6];
+} Chip8Snapshot;
+
+typedef void (*Chip8CycleFunction)(Chip8 *chip8);
+
 extern const unsigned char chip8_fontset[80];
+extern const unsigned char chip8_big_fontset[160];
+
+// Pixel of plane 0 in the current resolution
+static inline bool chip8_get_pixel(const Chip8 *chip8, int x, int y) {
+	return (chip8->gfx[0][y][x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+// Keypad state as a mask, bit i set while key i is held
+static inline uint16_t chip8_get_keys(const Chip8 *chip8) {
+	return chip8->keys;
+}
+
+// Can be called between any two batches; a key pressed and released within
+// one frame still counts as released for FX0A
+static inline void chip8_set_keys(Chip8 *chip8, uint16_t keys) {
+	chip8->keys_released |= chip8->keys & ~keys;
+	chip8->keys = keys;
+}
+
+// Starts a new frame's edge tracking, before the frame's first batch
+static inline void chip8_clear_key_edges(Chip8 *chip8) {
+	chip8->keys_released = 0;
+}
 
 void chip8_init(Chip8 *chip8);
-void chip8_load_rom(Chip8 *chip8, const char *filename);
+// chip8_init for a machine that was initialised before, cheaper when little
+// memory was written since
+void chip8_reset(Chip8 *chip8);
+void chip8_seed(Chip8 *chip8, uint64_t seed);
+bool chip8_load_rom(Chip8 *chip8, const char *filename);
+bool chip8_load_rom_file(Chip8 *chip8, const char *path);
+bool chip8_load_rom_data(Chip8 *chip8, const unsigned char *data, size_t size);
+void chip8_set_sound_callback(Chip8 *chip8, Chip8SoundCallback callback,
+															void *userdata);
+void chip8_snapshot(const Chip8 *chip8, Chip8Snapshot *snapshot);
+void chip8_restore(Chip8 *chip8, const Chip8Snapshot *snapshot);
 void chip8_emulate_cycle(Chip8 *chip8);
+void chip8_run(Chip8 *chip8, int cycles);
 void chip8_update_timers(Chip8 *chip8);
+unsigned long long chip8_framebuffer_hash(const Chip8 *chip8);
+
+Chip8CycleFunction chip8_cycle_function(Chip8Quirks quirks);
+const char *chip8_quirks_name(Chip8Quirks quirks);
+bool chip8_quirks_parse(const char *name, Chip8Quirks *quirks);
 
 #endif
@@ -0,0 +1,74 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "profile.h"
+
+// Compiled code only covers the first 4 KB, like the block cache and the JIT
+#define CHIP8_AOT_CODE_SIZE 4096
+
+typedef struct Chip8Aot Chip8Aot;
+
+/*
+ * Compiled straight-line run of guest instructions. It starts at the
+ * instruction at pc, which may be anywhere inside the run, and executes at
+ * most `budget` instructions. Returns how many ran, 0 when pc is not an
+ * instruction of the run.
+ */
+typedef int (*Chip8AotCode)(Chip8Aot *aot, Chip8 *chip8, int budget);
+
+typedef struct {
+	uint16_t start;
+	uint16_t end; // one past the last guest byte compiled
+	Chip8AotCode code;
+} Chip8AotRun;
+
+/*
+ * A ROM translated to C by chip8_aot, with the settings it was translated
+ * for. The generated file defines one of these as `chip8_aot_program`.
+ */
+typedef struct {
+	const char *name;
+	const unsigned char *rom;
+	size_t rom_size;
+	Chip8Quirks quirks;
+	int cycles_per_frame; // 0 = front end default
+	Keymap keymap;
+	const Chip8AotRun *runs;
+	int num_runs;
+} Chip8AotProgram;
+
+/*
+ * Runtime state of a compiled program on one Chip8 instance. Runs whose
+ * guest bytes no longer match the ROM (self-modifying code, or a restored
+ * snapshot) are stale, and they and everything the translator could not
+ * reach run on the interpreter.
+ */
+struct Chip8Aot {
+	const Chip8AotProgram *program;
+	int16_t run_at[CHIP8_AOT_CODE_SIZE];
+	uint8_t is_code[CHIP8_AOT_CODE_SIZE];
+	uint8_t stale[CHIP8_AOT_CODE_SIZE];
+
+	// Statistics
+	unsigned long long compiled_cycles;
+	unsigned long long interpreted_cycles;
+	unsigned long long invalidations;
+};
+
+extern const Chip8AotProgram chip8_aot_program;
+
+void chip8_aot_init(Chip8Aot *aot, const Chip8AotProgram *program);
+// Loads the program's ROM and settings into a freshly initialised machine
+void chip8_aot_load(const Chip8AotProgram *program, Chip8 *chip8);
+// Rechecks every run against guest memory, call after chip8_restore
+void chip8_aot_sync(Chip8Aot *aot, const Chip8 *chip8);
+// Called by compiled stores, marks the runs they overwrote stale
+void chip8_aot_written(Chip8Aot *aot, const Chip8 *chip8,
+											 unsigned short address, int length);
+int chip8_aot_run(Chip8Aot *aot, Chip8 *chip8, int cycles);
+
+#endif
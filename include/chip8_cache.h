@@ -0,0 +1,59 @@
+#ifndef CHIP8_CACHE_H
+#define CHIP8_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+/*
+ * One predecoded instruction, or a fused pair of instructions, stored at its
+ * guest address. Consecutive entries form a basic block: only its last entry
+ * may change control flow (jump, call, return, skip or FX0A wait) or write
+ * guest memory.
+ */
+typedef struct {
+	uint8_t kind;		// 0 while not decoded
+	uint8_t cycles; // 1, or 2 for a superinstruction
+	uint8_t x, y, n;
+	uint8_t nn;
+	uint16_t nnn;
+	uint8_t x2, nn2;			 // operands of the second half of a superinstruction
+	uint16_t block_cycles; // guest instructions from here to the block end
+	uint16_t block_bytes;	 // guest bytes from here to the block end
+} Chip8CacheOp;
+
+/*
+ * Predecoded basic-block cache, one per Chip8 instance, covering all 64K of
+ * guest memory. Entries are run direct-threaded: each one jumps straight to
+ * the handler of the next, and only block entry checks the cycle budget and
+ * looks up pc, so a straight run of instructions costs no fetch, decode or
+ * per-instruction budget test.
+ *
+ * It must be reset with chip8_cache_reset after loading a ROM or after guest
+ * memory was modified outside of chip8_cache_run. Stores made while running
+ * (FX33, FX55, XO-CHIP 5XY2) invalidate the overlapping blocks, so
+ * self-modifying ROMs work. No block crosses a page of guest memory, which
+ * bounds what a store has to scan.
+ */
+typedef struct {
+	// CHIP8_MEMORY_SIZE entries each, allocated zeroed by chip8_cache_init
+	Chip8CacheOp *ops;
+	// Bytes covered by any block decoded since the last reset (conservative)
+	uint8_t *is_code;
+	// Pages holding decoded entries, the ones a reset has to clear
+	uint64_t pages;
+
+	// Statistics
+	unsigned long long blocks_built;
+	unsigned long long invalidations;
+} Chip8Cache;
+
+bool chip8_cache_init(Chip8Cache *cache);
+void chip8_cache_reset(Chip8Cache *cache);
+void chip8_cache_destroy(Chip8Cache *cache);
+void chip8_cache_invalidate(Chip8Cache *cache, unsigned short address,
+														unsigned short length);
+int chip8_cache_run(Chip8Cache *cache, Chip8 *chip8, int cycles);
+
+#endif
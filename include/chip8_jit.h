@@ -0,0 +1,70 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define CHIP8_JIT_ARENA_SIZE (4 * 1024 * 1024)
+#define CHIP8_JIT_MAX_BLOCKS 4096
+#define CHIP8_JIT_MAX_BLOCK_LEN 64
+// V registers kept in host registers while translated code runs
+#define CHIP8_JIT_HOST_V 10
+
+// Runs translated code from chip8->pc on, returns the cycles left of `cycles`
+typedef int (*Chip8JitEnter)(Chip8 *chip8, int cycles);
+
+typedef struct {
+	uint16_t start;
+	uint16_t bytes; // guest bytes translated or read from `start` on
+	uint16_t cycles;
+} Chip8JitBlock;
+
+/*
+ * Dynamic recompiler translating guest basic blocks into x86-64 code in an
+ * mmap'd arena, whose pages are made writable only while a block is emitted
+ * into them and are executable otherwise. Like Chip8Cache it must be reset
+ * after loading a ROM; FX33/FX55 writes into translated code invalidate the
+ * stale blocks. On other hosts, or if the arena cannot be mapped,
+ * chip8_jit_init fails and callers should use the interpreter.
+ *
+ * Translated code keeps the CHIP8_JIT_HOST_V registers the ROM image uses
+ * most in host registers and the cycle budget in another, and blocks jump
+ * to each other through `entry` without returning to C. Control only comes
+ * back for blocks not translated yet, a budget that does not cover the next
+ * block, and idle loops. Blocks never cross a page of guest memory.
+ */
+typedef struct {
+	uint8_t *arena;
+	size_t arena_used;
+	// Start of translated code per guest address, the exit stub where there
+	// is none; translated code jumps through it
+	uint8_t *entry[CHIP8_MEMORY_SIZE];
+	Chip8JitEnter enter;
+	// Host register of each V register, -1 for those left in memory
+	int8_t host[16];
+
+	int16_t block_at[CHIP8_MEMORY_SIZE];
+	uint8_t is_code[CHIP8_MEMORY_SIZE];
+	Chip8JitBlock blocks[CHIP8_JIT_MAX_BLOCKS];
+	int num_blocks;
+	// Profile the blocks were translated for, a change flushes them
+	Chip8Quirks quirks;
+
+	// Statistics
+	unsigned long long blocks_compiled;
+	unsigned long long invalidations;
+	unsigned long long flushes;
+	unsigned long long interpreted_cycles;
+} Chip8Jit;
+
+bool chip8_jit_init(Chip8Jit *jit);
+void chip8_jit_reset(Chip8Jit *jit);
+void chip8_jit_invalidate(Chip8Jit *jit, unsigned short address,
+													unsigned short length);
+int chip8_jit_run(Chip8Jit *jit, Chip8 *chip8, int cycles);
+void chip8_jit_destroy(Chip8Jit *jit);
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define DEBUGGER_MAX_CONDITIONS 16
+// Register index of I in watches and conditions, V0-VF are 0-15
+#define DEBUGGER_REGISTER_I 16
+// Instructions shown from pc, and bytes of memory from I, in a DebugView
+#define DEBUGGER_VIEW_INSTRUCTIONS 6
+#define DEBUGGER_VIEW_BYTES 16
+
+typedef enum {
+	DEBUG_EQ,
+	DEBUG_NE,
+	DEBUG_LT,
+	DEBUG_GT,
+	DEBUG_LE,
+	DEBUG_GE,
+} DebugCompare;
+
+/*
+ * Conditional break such as "VF==1 after DXYN": checked after every
+ * instruction whose opcode & mask equals match, and stops whenever it holds.
+ * Without "after" the mask is 0 and it is checked after every instruction,
+ * stopping only when it becomes true, so continuing does not stop again at
+ * once.
+ */
+typedef struct {
+	uint16_t mask;
+	uint16_t match;
+	int reg; // 0-15 for V0-VF, DEBUGGER_REGISTER_I
+	DebugCompare compare;
+	unsigned value;
+	bool held; // result after the last instruction it was checked after
+	char text[32];
+} DebugCondition;
+
+/*
+ * Breakpoints, watchpoints and conditional breaks of one Chip8 instance.
+ * chip8_run knows nothing about them: while any are set, or the debugger is
+ * paused, the front end runs batches on debugger_run instead, which executes
+ * one instruction at a time and checks them all. Without any, nothing is
+ * checked and the dispatch loops run exactly as they would without a
+ * debugger.
+ */
+typedef struct {
+	// One bit per address: pc breakpoints, and bytes watched for writes
+	uint64_t breakpoints[CHIP8_MEMORY_SIZE / 64];
+	uint64_t watched[CHIP8_MEMORY_SIZE / 64];
+	int breakpoint_count;
+	int watched_count;
+	// Registers watched for changes, bit DEBUGGER_REGISTER_I for I
+	uint32_t watched_registers;
+	DebugCondition conditions[DEBUGGER_MAX_CONDITIONS];
+	int num_conditions;
+
+	// Stopped until debugger_continue or debugger_step, and why
+	bool paused;
+	char reason[64];
+	// The next instruction runs even if its address has a breakpoint, so
+	// execution can leave the one it stopped at
+	bool resuming;
+	// Instructions run under the debugger, shown with every stop
+	unsigned long long cycles;
+} Debugger;
+
+// Machine state for the inspector overlay, copied out of the emulation thread
+typedef struct {
+	uint8_t V[16];
+	uint16_t I;
+	uint16_t pc;
+	uint16_t sp;
+	uint16_t stack[16];
+	uint8_t delay_timer;
+	uint8_t sound_timer;
+	uint16_t code[DEBUGGER_VIEW_INSTRUCTIONS]; // opcodes from pc on
+	uint8_t data[DEBUGGER_VIEW_BYTES];				 // memory from I on
+	bool breakpoint[DEBUGGER_VIEW_INSTRUCTIONS];
+	bool paused;
+	char reason[64];
+} DebugView;
+
+void debugger_init(Debugger *debugger);
+
+// Whether batches have to run on debugger_run, checked once per batch
+static inline bool debugger_armed(const Debugger *debugger) {
+	return debugger->paused || debugger->breakpoint_count > 0 ||
+				 debugger->watched_count > 0 || debugger->watched_registers != 0 ||
+				 debugger->num_conditions > 0;
+}
+
+void debugger_set_breakpoint(Debugger *debugger, uint16_t address, bool on);
+bool debugger_has_breakpoint(const Debugger *debugger, uint16_t address);
+// Breaks after a write to any byte from `first` to `last`
+void debugger_watch_memory(Debugger *debugger, uint16_t first, uint16_t last);
+void debugger_watch_register(Debugger *debugger, int reg);
+
+/*
+ * Command-line forms: a breakpoint address ("0x2A4"), a watch ("I", "V3",
+ * "0x300" or "0x300-0x30F") and a condition ("VF==1 after DXYN", "I>=0xF00").
+ * In "after" patterns hex digits must match and X, Y, N and K match any
+ * nibble. Each returns false, changing nothing, when the text does not parse.
+ */
+bool debugger_parse_breakpoint(Debugger *debugger, const char *text);
+bool debugger_parse_watch(Debugger *debugger, const char *text);
+bool debugger_parse_condition(Debugger *debugger, const char *text);
+
+/*
+ * Runs up to `cycles` instructions through chip8_run one at a time and stops
+ * early when a breakpoint, watchpoint or condition fires, which pauses the
+ * debugger with the reason set. Returns the instructions executed, 0 while
+ * paused. Idle loops are not skipped, so a breakpoint inside one is hit.
+ */
+int debugger_run(Debugger *debugger, Chip8 *chip8, int cycles);
+// Runs one instruction and stays paused
+void debugger_step(Debugger *debugger, Chip8 *chip8);
+void debugger_pause(Debugger *debugger, const char *reason);
+void debugger_continue(Debugger *debugger);
+
+void debugger_view(const Debugger *debugger, const Chip8 *chip8,
+									 DebugView *view);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Coarse opcode groups, used to filter traces
+typedef enum {
+	CHIP8_OP_FLOW,	 // Jumps, calls, returns and skips
+	CHIP8_OP_ALU,		 // Register loads and arithmetic
+	CHIP8_OP_MEMORY, // I, BCD, font and register/memory transfers
+	CHIP8_OP_DRAW,	 // Sprites, clearing, scrolling, resolution and planes
+	CHIP8_OP_TIMER,	 // Delay and sound timers, XO-CHIP audio
+	CHIP8_OP_INPUT,	 // Keypad skips and waits
+	CHIP8_OP_OTHER,	 // Machine code calls, exit and unknown opcodes
+	CHIP8_OP_CLASS_COUNT,
+} Chip8OpClass;
+
+/*
+ * Writes the mnemonic for `opcode` in Cowgod's syntax, e.g. "LD V3, 0x1F".
+ * SUPER-CHIP and XO-CHIP opcodes are always decoded, whatever the profile
+ * the program was written for.
+ */
+void chip8_disassemble(uint16_t opcode, char *buffer, size_t size);
+// The opcode's pattern such as "8XY4" or "FX0A", NULL for an unassigned one
+const char *chip8_op_pattern(uint16_t opcode);
+Chip8OpClass chip8_op_class(uint16_t opcode);
+// Whether the instruction writes VX, alone or as the end of a range (FX65)
+bool chip8_op_writes_vx(uint16_t opcode);
+const char *chip8_op_class_name(Chip8OpClass op_class);
+bool chip8_op_class_parse(const char *name, Chip8OpClass *op_class);
+
+#endif
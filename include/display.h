@@ -2,11 +2,16 @@
 #define DISPLAY_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
-#include "chip8.h"
+#include "triple_buffer.h"
 
 bool display_init(void);
-void display_draw(const Chip8 *chip8);
+void display_set_palette(uint32_t foreground_argb, uint32_t background_argb);
+// Background, plane 1, plane 2 and both planes, as ARGB
+void display_get_palette(uint32_t palette[4]);
+void display_invalidate(void);
+bool display_draw(const DisplayFrame *frame);
 void display_destroy(void);
 
 #endif
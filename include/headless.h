@@ -0,0 +1,48 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+#include "chip8_aot.h"
+
+typedef enum {
+	ENGINE_INTERPRETER,
+	ENGINE_CACHE,
+	ENGINE_JIT,
+	ENGINE_AOT,
+} HeadlessEngine;
+
+typedef struct {
+	// ROM file, may be NULL in a statically recompiled build
+	const char *rom_filename;
+	// Compiled ROM the build carries, NULL in other builds
+	const Chip8AotProgram *program;
+	// Input movie to replay, its length is the default run length
+	const char *movie_path;
+	// Binary instruction trace to write, see trace.h
+	const char *trace_path;
+	// Animated GIF of the run to write, see capture.h
+	const char *capture_path;
+	HeadlessEngine engine;
+
+	// Stop after this many instructions (0 = unlimited)
+	unsigned long long max_cycles;
+	// Stop after this many 60 Hz frames (0 = unlimited)
+	unsigned long long max_frames;
+
+	int cycles_per_frame;
+	// Quirk profile from --quirks, otherwise the ROM's profile or the default
+	Chip8Quirks quirks;
+	bool has_quirks;
+	bool quiet;
+} HeadlessOptions;
+
+bool headless_parse_args(HeadlessOptions *options, int argc, char **argv);
+int headless_run(const HeadlessOptions *options);
+int headless_main(int argc, char **argv);
+// Entry point of a statically recompiled build: runs `program` on the aot
+// engine unless a ROM file or another engine is given
+int headless_main_aot(int argc, char **argv, const Chip8AotProgram *program);
+
+#endif
@@ -1,10 +1,64 @@
 #ifndef INPUT_H
 #define INPUT_H
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-#include "chip8.h"
+#include "profile.h"
 
-void process_input(Chip8 *chip8, bool *is_running);
+// Keypad changes in flight between the SDL and emulation threads, a power of
+// two
+#define INPUT_MAX_KEY_EVENTS 64
+
+/*
+ * Emulator controls that are not part of the CHIP-8 keypad. Written by the
+ * SDL thread and read by the emulation thread, except `dump_profile`.
+ */
+typedef struct {
+	atomic_bool rewind; // 'Backspace' held
+	atomic_bool turbo;	// 'Tab' held
+	bool dump_profile;	// 'F9' pressed, only used in PROFILE=1 builds
+	// Instructions-per-frame steps requested with '-' and '=', the emulation
+	// thread takes them with an exchange
+	atomic_int ipf_change;
+	// Debugger requests, taken the same way: 'F5' pauses or continues, 'F6'
+	// steps one instruction and 'F7' toggles a breakpoint at pc
+	atomic_int debug_pauses;
+	atomic_int debug_steps;
+	atomic_int debug_breakpoints;
+	atomic_bool debug_overlay; // 'F8' shows the inspector while running
+} InputControls;
+
+// The whole keypad after a key went down or up, at SDL's event time
+typedef struct {
+	uint64_t time_ns;
+	uint16_t keys;
+} InputKeyEvent;
+
+/*
+ * Single-producer single-consumer ring of keypad changes, filled by
+ * process_input and drained once per frame by the emulation thread, which
+ * spreads the events over the frame's batch by their timestamps.
+ */
+typedef struct {
+	InputKeyEvent events[INPUT_MAX_KEY_EVENTS];
+	atomic_uint head; // Advanced by the emulation thread
+	atomic_uint tail; // Advanced by the SDL thread
+	// Current state, and whether a change was dropped because the ring was
+	// full; `held` is private to the SDL thread
+	uint16_t held;
+	atomic_uint keys;
+	atomic_bool overflowed;
+} InputKeypad;
+
+// Builds the scancode table, call before the first poll and to switch layouts
+void input_set_keymap(Keymap keymap);
+void process_input(bool *is_running, InputControls *controls,
+									 InputKeypad *keypad);
+// Emulation thread: moves up to `max` queued changes into `events`
+int input_take_key_events(InputKeypad *keypad, InputKeyEvent *events,
+													int max);
+uint16_t input_keys(InputKeypad *keypad);
 
 #endif
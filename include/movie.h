@@ -0,0 +1,53 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// No further input in this frame, see movie_apply
+#define MOVIE_NO_EVENT 0xFFFF
+
+// Keypad mask that takes effect before the given cycle of the given frame
+typedef struct {
+	uint32_t frame;
+	uint16_t cycle;
+	uint16_t keys;
+} MovieEvent;
+
+/*
+ * Input movie: the PRNG seed plus every keypad change, keyed by frame and by
+ * cycle within the frame. Replaying it into a freshly loaded instance with
+ * the same quirks and cycles per frame reproduces the recorded run bit for
+ * bit.
+ */
+typedef struct {
+	uint64_t seed;
+	uint64_t rom_hash;
+	Chip8Quirks quirks;
+	uint16_t cycles_per_frame;
+	uint32_t frames;
+
+	MovieEvent *events;
+	size_t count;
+	size_t capacity;
+
+	// Playback cursor and the key mask currently applied
+	size_t cursor;
+	uint16_t keys;
+} Movie;
+
+void movie_init(Movie *movie, const Chip8 *chip8, uint64_t seed,
+								int cycles_per_frame);
+void movie_destroy(Movie *movie);
+bool movie_record(Movie *movie, uint32_t frame, uint16_t cycle,
+									const Chip8 *chip8);
+bool movie_save(const Movie *movie, const char *path);
+bool movie_load(Movie *movie, const char *path);
+bool movie_matches_rom(const Movie *movie, const Chip8 *chip8);
+bool movie_matches_quirks(const Movie *movie, const Chip8 *chip8);
+int movie_apply(Movie *movie, uint32_t frame, uint16_t cycle, Chip8 *chip8);
+
+#endif
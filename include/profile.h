@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+
+#include "chip8.h"
+
+// Keyboard layouts for the keypad, the ids are stored in ROM packs
+typedef enum {
+	KEYMAP_DEFAULT, // 1234/QWER/ASDF/ZXCV as the COSMAC VIP's 4x4 keypad
+	KEYMAP_ARROWS,	// Default, plus arrows for 5/7/8/9 and Space for 6
+	KEYMAP_COUNT,
+} Keymap;
+
+// Per-ROM settings for programs that misbehave at the front end defaults
+typedef struct {
+	const char *name; // ROM file name without directories
+	int cycles_per_frame; // 0 = front end default
+	Chip8Quirks quirks;
+	Keymap keymap;
+} RomProfile;
+
+const RomProfile *profile_find(const char *rom_filename);
+bool keymap_parse(const char *name, Keymap *keymap);
+
+#endif
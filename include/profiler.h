@@ -0,0 +1,62 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+/*
+ * Host-side frame-time probes. Build with `make PROFILE=1` to define
+ * CHIP8_PROFILE; otherwise every PROFILE_* macro expands to nothing and the
+ * profiler is not compiled at all. Histograms are not locked, so each probe
+ * is only ever recorded from one thread: input, convert, upload, present and
+ * input_latency on the SDL thread, the audio probes on the audio thread and
+ * the rest on the emulation thread.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	PROBE_FRAME,				 // Time between the starts of consecutive frames
+	PROBE_INPUT,				 // process_input
+	PROBE_EMULATE,			 // Instruction batch (including turbo)
+	PROBE_TIMERS,				 // chip8_update_timers
+	PROBE_CONVERT,			 // display_draw: packed rows to ARGB pixels
+	PROBE_UPLOAD,				 // display_draw: SDL_UpdateTexture
+	PROBE_PRESENT,			 // display_draw: render copy and SDL_RenderPresent
+	PROBE_SLEEP,				 // Sleeping until the next frame is due
+	PROBE_INPUT_LATENCY, // Keypad event to the next present after it ran
+	// Recorded on the audio thread, which is the only writer of these two
+	PROBE_AUDIO,				 // Audio callback: rendering one buffer
+	PROBE_AUDIO_LATENCY, // Sound event queued to its first sample rendered
+	PROBE_COUNT,
+} ProfilerProbe;
+
+#ifdef CHIP8_PROFILE
+
+uint64_t profiler_now(void);
+void profiler_record(ProfilerProbe probe, uint64_t ns);
+void profiler_mark_frame(void);
+void profiler_reset(void);
+bool profiler_write_json(const char *path);
+bool profiler_write_csv(const char *path);
+
+// Times the statements between PROFILE_BEGIN(name) and PROFILE_END(name, probe)
+// in the same block
+#define PROFILE_BEGIN(name) uint64_t profile_##name = profiler_now()
+#define PROFILE_END(name, probe)                                               \
+	profiler_record((probe), profiler_now() - profile_##name)
+#define PROFILE_FRAME() profiler_mark_frame()
+#define PROFILE_DUMP(prefix)                                                   \
+	do {                                                                         \
+		profiler_write_json(prefix ".json");                                       \
+		profiler_write_csv(prefix ".csv");                                         \
+	} while (0)
+
+#else
+
+#define PROFILE_BEGIN(name) ((void) 0)
+#define PROFILE_END(name, probe) ((void) 0)
+#define PROFILE_FRAME() ((void) 0)
+#define PROFILE_DUMP(prefix) ((void) 0)
+
+#endif
+
+#endif
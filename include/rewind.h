@@ -0,0 +1,67 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define REWIND_SNAPSHOT_WORDS (sizeof(Chip8Snapshot) / sizeof(uint64_t))
+
+// A snapshot seen as the 64-bit words deltas are taken over
+typedef union {
+	Chip8Snapshot state;
+	uint64_t words[REWIND_SNAPSHOT_WORDS];
+} RewindState;
+
+// Where one recorded frame lives in the byte ring
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+	unsigned long long keyframe; // sequence number of the frame it diffs against
+} RewindFrame;
+
+/*
+ * Rewind history of one Chip8 instance. Every pushed frame is stored as the
+ * XOR of its snapshot against the newest keyframe, run-length encoded over
+ * 64-bit words: most of memory and the framebuffer do not change between
+ * frames, so a delta is usually a few hundred bytes. A keyframe (encoded
+ * against an all-zero state) is written every `keyframe_interval` frames.
+ * Memory pages neither state uses are zero in both and are never compared,
+ * so the cost follows the memory a ROM touches rather than the full 64K.
+ *
+ * Encoded frames are appended to a fixed byte ring; when it is full the
+ * oldest keyframe and its deltas are dropped together, so the history always
+ * starts at a keyframe.
+ */
+typedef struct {
+	unsigned char *data;
+	size_t capacity;
+	size_t head; // next write offset in `data`
+	size_t used; // encoded bytes of all recorded frames
+
+	// Frame records indexed by sequence number modulo `max_frames`
+	RewindFrame *frames;
+	size_t max_frames;
+	unsigned long long first; // oldest recorded frame
+	unsigned long long next;	// sequence number of the next push
+
+	int keyframe_interval;
+	unsigned long long reference_seq;
+	bool has_reference;
+	// Unlike a plain snapshot, memory outside its pages is kept zeroed
+	RewindState reference;
+	unsigned char *scratch;
+} Rewind;
+
+bool rewind_init(Rewind *history, size_t capacity, size_t max_frames,
+								 int keyframe_interval);
+void rewind_destroy(Rewind *history);
+void rewind_clear(Rewind *history);
+bool rewind_push(Rewind *history, const Chip8 *chip8);
+bool rewind_pop(Rewind *history, Chip8 *chip8);
+size_t rewind_count(const Rewind *history);
+size_t rewind_bytes(const Rewind *history);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef ROMPACK_H
+#define ROMPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+#define ROMPACK_NAME_SIZE 48
+
+/*
+ * Index entry of a ROM pack, read in place from the mapped file. Fields are
+ * little-endian and naturally aligned, so the layout is the same for every
+ * compiler on the little-endian hosts the emulator targets.
+ */
+typedef struct {
+	char name[ROMPACK_NAME_SIZE]; // Path below roms/, NUL padded
+	uint64_t hash;								// xxHash64 of the ROM image, seed 0
+	uint32_t offset;							// Image position from the start of the pack
+	uint32_t size;
+	uint16_t cycles_per_frame;		// 0 = front end default
+	uint8_t quirks;								// Chip8Quirks, 0 = VIP (default)
+	uint8_t keymap;								// Keymap id, 0 = default layout
+	uint32_t reserved;
+} RomPackEntry;
+
+/*
+ * A ROM pack mapped read-only into memory. Once open, finding a ROM and
+ * loading it into an instance are plain memory operations.
+ */
+typedef struct {
+	const unsigned char *base;
+	size_t size;
+	const RomPackEntry *entries; // Sorted by name
+	uint32_t count;
+} RomPack;
+
+uint64_t rompack_hash(const void *data, size_t size);
+bool rompack_write(const char *path, const RomPackEntry *entries,
+									 const unsigned char *const *images, uint32_t count);
+bool rompack_open(RomPack *pack, const char *path);
+void rompack_close(RomPack *pack);
+const RomPackEntry *rompack_find(const RomPack *pack, const char *name);
+const RomPackEntry *rompack_find_hash(const RomPack *pack, uint64_t hash);
+bool rompack_load(const RomPack *pack, const RomPackEntry *entry, Chip8 *chip8);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Keypad state (bit i = key i held) applied from `frame` onwards
+typedef struct {
+	uint32_t frame;
+	uint16_t keys;
+} RunnerInputEvent;
+
+// One independent emulator instance and its budget
+typedef struct {
+	const unsigned char *rom;
+	size_t rom_size;
+	uint64_t seed;
+
+	// Sorted by frame, may be empty
+	const RunnerInputEvent *input;
+	size_t input_count;
+
+	unsigned long long frames;
+	int cycles_per_frame;
+	Chip8Quirks quirks;
+} RunnerJob;
+
+typedef struct {
+	unsigned long long cycles;
+	// Part of `cycles` fast-forwarded through idle loops
+	unsigned long long idle_cycles;
+	unsigned long long frames;
+	unsigned long long framebuffer_hash;
+} RunnerResult;
+
+// Default live instances per worker thread, see RunnerConfig
+#define RUNNER_LIVE_PER_THREAD 64
+
+typedef struct {
+	int threads;
+	// Frames an instance runs before it goes back to a work queue
+	int slice_frames;
+	/*
+	 * Instances held in memory at once, 0 for RUNNER_LIVE_PER_THREAD per
+	 * thread. Each one is a whole Chip8, about 66 KB with its 64K of guest
+	 * memory, plus the touched pages of a block cache; jobs beyond the limit
+	 * wait until a finished instance is reset for them.
+	 */
+	size_t live_instances;
+	bool use_cache;
+} RunnerConfig;
+
+typedef struct {
+	double elapsed;
+	unsigned long long total_cycles;
+	unsigned long long idle_cycles;
+	unsigned long long slices;
+	unsigned long long steals;
+} RunnerStats;
+
+/*
+ * Runs every job to completion on a pool of worker threads. Each worker owns
+ * a deque of instances; it runs one slice of the instance at the bottom and
+ * pushes it back, and steals from the top of another worker's deque when its
+ * own is empty. An instance whose job finished takes the next job not yet
+ * started, so memory is bounded by the live instances, not the job count.
+ * Results are written at the job's index.
+ */
+bool runner_run(const RunnerJob *jobs, RunnerResult *results, size_t count,
+								const RunnerConfig *config, RunnerStats *stats);
+
+#endif
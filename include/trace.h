@@ -0,0 +1,83 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip8.h"
+
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+// Records held in memory per instance, a power of two. 1 MB stays in L2, a
+// ring that streams through memory costs more than the tracing itself
+#define TRACE_DEFAULT_CAPACITY (1u << 16)
+
+/*
+ * One executed instruction, with the state after it ran. The register an
+ * instruction changes is always its VX (or, for FX65 and the like, ends a
+ * range at VX), so the record keeps VX and the opcode tells readers whether
+ * it was written, see chip8_op_writes_vx. Only the low 32 bits of the
+ * cycle are stored; readers extend them, see trace_read. Cycles that were
+ * skipped as idle loops, or dropped because the flusher fell behind, leave
+ * gaps in the numbering.
+ */
+typedef struct {
+	uint32_t cycle;
+	uint16_t pc; // address the instruction was fetched from
+	uint16_t opcode;
+	uint16_t I;
+	uint8_t vx;
+	uint8_t vf;
+	uint8_t reserved[4];
+} TraceRecord;
+
+// File header, rewritten with the final counts when the trace is closed
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t record_size;
+	uint64_t records;
+	uint64_t dropped;
+} TraceHeader;
+
+/*
+ * Per-instance instruction trace. chip8_run fills the ring while a trace is
+ * attached to the Chip8 and publishes the new records once per batch; a
+ * background thread appends them to the file. The producer never waits: when
+ * the ring is full, records are counted as dropped instead.
+ */
+typedef struct Chip8Trace {
+	TraceRecord *records;
+	uint32_t capacity;
+	uint32_t mask;
+
+	// Free-running indices, `tail` written by the emulation thread only and
+	// `head` by the flusher only
+	atomic_uint head;
+	atomic_uint tail;
+
+	// Emulation thread state
+	uint64_t cycle;
+	uint64_t dropped;
+
+	FILE *file;
+	uint64_t written;
+	pthread_t thread;
+	atomic_bool stop;
+} Chip8Trace;
+
+bool trace_open(Chip8Trace *trace, const char *path, uint32_t capacity);
+void trace_close(Chip8Trace *trace);
+
+/*
+ * Reads a trace file into memory. `cycles` receives each record's full cycle
+ * number, reconstructed from the 32-bit values (gaps must stay below 2^32
+ * cycles). Both arrays are malloc'd.
+ */
+bool trace_read(const char *path, TraceHeader *header, TraceRecord **records,
+								uint64_t **cycles);
+
+#endif
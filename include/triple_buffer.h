@@ -0,0 +1,49 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip8.h"
+#include "debugger.h"
+
+// Everything the display needs of one finished frame
+typedef struct {
+	uint64_t gfx[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+	// Rows that changed since the previous frame the reader took, a superset
+	// is fine since the display compares rows before converting them
+	uint64_t dirty_rows;
+	// Oldest key event that went into this frame, 0 when there was none
+	uint64_t input_ns;
+	bool hires;
+	// Debugger state for the inspector overlay, when it is shown
+	bool has_debug;
+	DebugView debug;
+} DisplayFrame;
+
+/*
+ * Lock-free handoff of frames from one writer thread to one reader thread.
+ * Each side owns one slot and the third is parked in `middle`; publishing and
+ * acquiring swap a slot with it, so neither side ever waits for the other and
+ * the reader always gets the newest frame. Frames the reader skips pass their
+ * dirty rows and input time on to the next one.
+ */
+typedef struct {
+	DisplayFrame frames[3];
+	// Index of the parked slot, plus a flag while the reader has not taken it
+	atomic_uint middle;
+	unsigned back;	// Writer's slot
+	unsigned front; // Reader's slot
+} TripleBuffer;
+
+void triple_buffer_init(TripleBuffer *buffer);
+// Writer: copies the screen of `chip8`, and `debug` unless it is NULL, into
+// a new frame and publishes it
+void triple_buffer_publish(TripleBuffer *buffer, const Chip8 *chip8,
+													 uint64_t input_ns, const DebugView *debug);
+// Reader: the newest published frame, NULL when nothing was published since
+// the last call. It stays valid until the next call.
+const DisplayFrame *triple_buffer_acquire(TripleBuffer *buffer);
+
+#endif
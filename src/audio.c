@@ -1,52 +1,223 @@
 #include "audio.h"
 
+#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_audio.h>
 #include <SDL3/SDL_stdinc.h>
 
+#include "chip8.h"
+#include "profiler.h"
+
 const int AMPLITUDE = 10000;
 const int TONE_HZ = 440;
 const int SAMPLE_RATE = 44100;
 
+// Emulated time runs at 60 frames per second of 735 samples each
+#define SAMPLES_PER_FRAME 735
+// How far ahead of the audio thread events are scheduled, see audio_sync
+#define TARGET_LEAD SAMPLES_PER_FRAME
+#define MAX_LEAD (4 * SAMPLES_PER_FRAME)
+
+// One period of a band-limited square wave at TONE_HZ
+#define WAVETABLE_BITS 11
+#define WAVETABLE_SIZE (1 << WAVETABLE_BITS)
+// Samples a gain change is spread over, so starting or stopping never clicks
+#define RAMP_SAMPLES 64
+#define BUFFER_SAMPLES 1024
+#define QUEUE_SIZE 64
+
+// Everything the audio thread needs to know to render the sound, effective
+// from `time` (in samples since audio_init) on
+typedef struct {
+	uint64_t time;
+#ifdef CHIP8_PROFILE
+	uint64_t queued_ns;
+#endif
+	bool on;
+	bool has_pattern;
+	unsigned char pitch;
+	unsigned char pattern[16];
+} AudioEvent;
+
 static SDL_AudioDeviceID device_id;
 static SDL_AudioStream *stream = NULL;
 
-static volatile bool is_beeping = false;
+static int16_t wavetable[WAVETABLE_SIZE];
+// Phase steps per output sample: the tone, and pattern playback per pitch
+static uint32_t tone_step;
+static uint32_t pattern_steps[256];
+
+/*
+ * Single-producer, single-consumer ring: the emulation thread only writes
+ * `queue_tail`, the audio callback only writes `queue_head`. Indices run
+ * freely and are masked on access.
+ */
+static AudioEvent queue[QUEUE_SIZE];
+static atomic_uint queue_head;
+static atomic_uint queue_tail;
+
+// Samples rendered so far, published by the audio thread
+static atomic_ullong rendered_samples;
+
+// Audio thread state
+static AudioEvent current;
+static uint32_t phase;
+static int gain;
+static int16_t buffer[BUFFER_SAMPLES];
+
+// Emulation thread state: the clock events are stamped with and what was
+// last queued
+static uint64_t emulated_samples;
+static AudioEvent queued;
+
+/*
+ * Sums the odd harmonics of the square wave below Nyquist, with Lanczos sigma
+ * factors to tame the ringing at the edges, and normalises the peak to
+ * AMPLITUDE.
+ */
+static void build_wavetable(void) {
+	static double wave[WAVETABLE_SIZE];
+	int harmonics = SAMPLE_RATE / 2 / TONE_HZ;
+	double peak = 0;
+	for (int i = 0; i < WAVETABLE_SIZE; i++) {
+		double t = 2 * M_PI * i / WAVETABLE_SIZE;
+		double sum = 0;
+		for (int k = 1; k <= harmonics; k += 2) {
+			double x = M_PI * k / (harmonics + 1);
+			sum += sin(x) / x * sin(k * t) / k;
+		}
+		wave[i] = sum;
+		peak = fmax(peak, fabs(sum));
+	}
+	for (int i = 0; i < WAVETABLE_SIZE; i++) {
+		wavetable[i] = (int16_t) lrint(wave[i] / peak * AMPLITUDE);
+	}
+
+	tone_step = (uint32_t) ((double) TONE_HZ / SAMPLE_RATE * 4294967296.0);
+	// The top 7 bits of the phase index the 128 pattern bits
+	for (int pitch = 0; pitch < 256; pitch++) {
+		double rate = 4000 * pow(2, (pitch - 64) / 48.0);
+		pattern_steps[pitch] =
+				(uint32_t) (rate / 128 / SAMPLE_RATE * 4294967296.0);
+	}
+}
+
+static bool queue_push(const AudioEvent *event) {
+	unsigned tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&queue_head, memory_order_acquire);
+	if (tail - head == QUEUE_SIZE) {
+		return false;
+	}
+	queue[tail % QUEUE_SIZE] = *event;
+	atomic_store_explicit(&queue_tail, tail + 1, memory_order_release);
+	return true;
+}
+
+static const AudioEvent *queue_peek(void) {
+	unsigned head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+	return head == tail ? NULL : &queue[head % QUEUE_SIZE];
+}
+
+static void queue_pop(void) {
+	unsigned head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+	atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+}
+
+// Renders `count` samples of the current state, ramping the gain towards it
+static void render(int16_t *out, int count) {
+	int target = current.on ? RAMP_SAMPLES : 0;
+	if (!current.on && gain == 0) {
+		memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	if (current.has_pattern) {
+		// XO-CHIP pattern playback, one bit per step of the top 7 phase bits
+		uint32_t step = pattern_steps[current.pitch];
+		for (int i = 0; i < count; i++) {
+			unsigned bit = phase >> 25;
+			int level = current.pattern[bit >> 3] >> (7 - (bit & 7)) & 1;
+			gain += (gain < target) - (gain > target);
+			out[i] = (int16_t) ((level ? AMPLITUDE : -AMPLITUDE) * gain /
+													RAMP_SAMPLES);
+			phase += step;
+		}
+	} else {
+		for (int i = 0; i < count; i++) {
+			gain += (gain < target) - (gain > target);
+			int16_t level = wavetable[phase >> (32 - WAVETABLE_BITS)];
+			out[i] = (int16_t) (level * gain / RAMP_SAMPLES);
+			phase += tone_step;
+		}
+	}
+}
 
+/*
+ * Renders whatever the stream asks for through the fixed buffer, switching
+ * state exactly at the sample each queued event is stamped with. Events that
+ * are already due apply at the start of the buffer.
+ */
 static void audio_callback(void *userdata, SDL_AudioStream *stream,
 													 int additional_amount, int total_amount) {
 	(void) userdata;
-	(void) additional_amount;
-
-	int num_samples = total_amount / sizeof(Sint16);
-	Sint16 sample_buffer[num_samples];
-
-	static const int wave_period = SAMPLE_RATE / TONE_HZ;
-	static unsigned int wave_pos = 0;
+	(void) total_amount;
+	PROFILE_BEGIN(audio);
 
-	for (int i = 0; i < num_samples; i++) {
-		if (is_beeping) {
-			if ((wave_pos / (wave_period / 2)) % 2) {
-				sample_buffer[i] = AMPLITUDE;
-			} else {
-				sample_buffer[i] = -AMPLITUDE;
+	uint64_t clock =
+			atomic_load_explicit(&rendered_samples, memory_order_relaxed);
+	int remaining = additional_amount / (int) sizeof(int16_t);
+	while (remaining > 0) {
+		int count = remaining < BUFFER_SAMPLES ? remaining : BUFFER_SAMPLES;
+		int done = 0;
+		while (done < count) {
+			int segment = count - done;
+			const AudioEvent *next = queue_peek();
+			if (next != NULL && next->time <= clock) {
+				current = *next;
+				queue_pop();
+#ifdef CHIP8_PROFILE
+				profiler_record(PROBE_AUDIO_LATENCY,
+												profiler_now() - current.queued_ns);
+#endif
+				continue;
 			}
-		} else {
-			sample_buffer[i] = 0;
+			if (next != NULL && next->time - clock < (uint64_t) segment) {
+				segment = (int) (next->time - clock);
+			}
+			render(&buffer[done], segment);
+			done += segment;
+			clock += segment;
 		}
-		wave_pos++;
+		SDL_PutAudioStreamData(stream, buffer, count * sizeof(int16_t));
+		remaining -= count;
 	}
 
-	SDL_PutAudioStreamData(stream, sample_buffer, total_amount);
+	atomic_store_explicit(&rendered_samples, clock, memory_order_relaxed);
+	PROFILE_END(audio, PROBE_AUDIO);
 }
 
 bool audio_init(void) {
 	SDL_AudioSpec desired_spec = {
 			.format = SDL_AUDIO_S16, .channels = 1, .freq = SAMPLE_RATE};
 
+	build_wavetable();
+	memset(&current, 0, sizeof(current));
+	memset(&queued, 0, sizeof(queued));
+	current.pitch = queued.pitch = 64;
+	phase = 0;
+	gain = 0;
+	emulated_samples = 0;
+	atomic_store(&queue_head, 0);
+	atomic_store(&queue_tail, 0);
+	atomic_store(&rendered_samples, 0);
+
 	device_id = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
 	if (device_id == 0) {
 		fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
@@ -70,12 +241,38 @@ bool audio_init(void) {
 	return true;
 }
 
-void audio_beep_on(void) {
-	is_beeping = true;
-}
+/*
+ * Called once per emulated frame, after chip8_update_timers. Advances the
+ * emulated clock by one frame and queues the sound state if it changed, so
+ * events keep their exact spacing in emulated time. The clock is pulled back
+ * into range when emulation stalls or runs ahead (seeking, rewinding) instead
+ * of letting latency build up.
+ */
+void audio_sync(const Chip8 *chip8) {
+	uint64_t played =
+			atomic_load_explicit(&rendered_samples, memory_order_relaxed);
+	emulated_samples += SAMPLES_PER_FRAME;
+	if (emulated_samples < played || emulated_samples > played + MAX_LEAD) {
+		emulated_samples = played + TARGET_LEAD;
+	}
 
-void audio_beep_off(void) {
-	is_beeping = false;
+	AudioEvent event = {.time = emulated_samples, .on = chip8->sound_on};
+	event.has_pattern = chip8->has_pattern;
+	event.pitch = chip8->pitch;
+	memcpy(event.pattern, chip8->pattern, sizeof(event.pattern));
+	if (event.on == queued.on && event.has_pattern == queued.has_pattern &&
+			event.pitch == queued.pitch &&
+			memcmp(event.pattern, queued.pattern, sizeof(event.pattern)) == 0) {
+		return;
+	}
+
+#ifdef CHIP8_PROFILE
+	event.queued_ns = profiler_now();
+#endif
+	// A full queue drops the event, the next frame tries again
+	if (queue_push(&event)) {
+		queued = event;
+	}
 }
 
 void audio_destroy(void) {
@@ -0,0 +1,480 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long the encoder sleeps when the ring is empty
+#define ENCODE_INTERVAL_NS 1000000
+
+// Two bits per pixel is the smallest code size GIF allows, which covers the
+// four colours of both planes
+#define LZW_MIN_CODE_SIZE 2
+#define LZW_CLEAR (1u << LZW_MIN_CODE_SIZE)
+#define LZW_END (LZW_CLEAR + 1)
+#define LZW_FIRST (LZW_CLEAR + 2)
+#define LZW_MAX_CODES 4096
+
+#define GIF_MAX_DELAY_CS 0xFFFF
+
+// Largest stored deflate block
+#define DEFLATE_MAX_STORED 0xFFFF
+
+// The display's colours: Sandy Beige, Deep Sea Blue, Coral and Dark Slate
+static const uint32_t DEFAULT_PALETTE[4] = {0xFFF4E8D1, 0xFF006994, 0xFFFF7F50,
+																						0xFF1B3B4B};
+
+// LZW codes packed LSB first into the length-prefixed sub-blocks of GIF
+typedef struct {
+	FILE *file;
+	uint8_t block[255];
+	int size;
+	uint32_t bits;
+	int count;
+} BitWriter;
+
+static void flush_block(BitWriter *writer) {
+	if (writer->size > 0) {
+		fputc(writer->size, writer->file);
+		fwrite(writer->block, 1, (size_t) writer->size, writer->file);
+		writer->size = 0;
+	}
+}
+
+static void put_code(BitWriter *writer, unsigned code, int width) {
+	writer->bits |= code << writer->count;
+	writer->count += width;
+	while (writer->count >= 8) {
+		writer->block[writer->size++] = (uint8_t) writer->bits;
+		writer->bits >>= 8;
+		writer->count -= 8;
+		if (writer->size == (int) sizeof(writer->block)) {
+			flush_block(writer);
+		}
+	}
+}
+
+static void put_u16(FILE *file, unsigned value) {
+	fputc(value & 0xFF, file);
+	fputc((value >> 8) & 0xFF, file);
+}
+
+// Start of the 60 Hz step `tick` in centiseconds, on the 50 Hz grid
+static uint64_t tick_cs(uint32_t tick) {
+	uint64_t cs = (uint64_t) tick * 100 / 60;
+	return cs - cs % CAPTURE_MIN_DELAY_CS;
+}
+
+// LZW-compresses the rectangle of `image` at x, y in high resolution pixels,
+// each repeated `scale` times across and down
+static void encode_pixels(Chip8Capture *capture, const uint8_t *image, int x,
+													int y, int width, int height) {
+	BitWriter writer = {.file = capture->file};
+	int scale = capture->scale;
+	memset(capture->codes, 0, sizeof(capture->codes));
+	int code_width = LZW_MIN_CODE_SIZE + 1;
+	unsigned next = LZW_FIRST;
+	int prefix = -1;
+
+	fputc(LZW_MIN_CODE_SIZE, capture->file);
+	put_code(&writer, LZW_CLEAR, code_width);
+	for (int row = y * scale; row < (y + height) * scale; row++) {
+		const uint8_t *line = &image[(row / scale) * CHIP8_HIRES_WIDTH];
+		for (int column = x * scale; column < (x + width) * scale; column++) {
+			unsigned pixel = line[column / scale];
+			if (prefix < 0) {
+				prefix = (int) pixel;
+				continue;
+			}
+			uint16_t code = capture->codes[prefix][pixel];
+			if (code != 0) {
+				prefix = code;
+				continue;
+			}
+
+			put_code(&writer, (unsigned) prefix, code_width);
+			if (next < LZW_MAX_CODES) {
+				if (next == 1u << code_width) {
+					code_width++;
+				}
+				capture->codes[prefix][pixel] = (uint16_t) next++;
+			} else {
+				// Full dictionary, start over
+				put_code(&writer, LZW_CLEAR, code_width);
+				memset(capture->codes, 0, sizeof(capture->codes));
+				code_width = LZW_MIN_CODE_SIZE + 1;
+				next = LZW_FIRST;
+			}
+			prefix = (int) pixel;
+		}
+	}
+	put_code(&writer, (unsigned) prefix, code_width);
+	// The decoder adds one more code on reading the last one, and may widen
+	if (next == 1u << code_width && next < LZW_MAX_CODES) {
+		code_width++;
+	}
+	put_code(&writer, LZW_END, code_width);
+	if (writer.count > 0) {
+		put_code(&writer, 0, 8 - writer.count);
+	}
+	flush_block(&writer);
+	fputc(0, capture->file);
+}
+
+// One image of `image` at x, y, shown for `delay` centiseconds on top of the
+// frames before it
+static void write_image(Chip8Capture *capture, const uint8_t *image, int x,
+												int y, int width, int height, unsigned delay) {
+	FILE *file = capture->file;
+	int scale = capture->scale;
+	// Graphic control extension: leave the image in place, no transparency
+	const uint8_t control[] = {0x21, 0xF9, 0x04, 0x04};
+	fwrite(control, 1, sizeof(control), file);
+	put_u16(file, delay);
+	fputc(0, file);
+	fputc(0, file);
+
+	fputc(0x2C, file);
+	put_u16(file, (unsigned) (x * scale));
+	put_u16(file, (unsigned) (y * scale));
+	put_u16(file, (unsigned) (width * scale));
+	put_u16(file, (unsigned) (height * scale));
+	fputc(0, file);
+	encode_pixels(capture, image, x, y, width, height);
+}
+
+// Writes the pending frame as the rectangle that differs from the canvas
+static void write_pending(Chip8Capture *capture, uint64_t delay) {
+	int left = CHIP8_HIRES_WIDTH, right = -1;
+	int top = CHIP8_HIRES_HEIGHT, bottom = -1;
+	for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+		if (memcmp(capture->pending[y], capture->canvas[y],
+							 sizeof(capture->pending[y])) == 0) {
+			continue;
+		}
+		for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+			if (capture->pending[y][x] != capture->canvas[y][x]) {
+				left = x < left ? x : left;
+				right = x > right ? x : right;
+			}
+		}
+		top = y < top ? y : top;
+		bottom = y;
+	}
+	// A frame that merged back into the canvas still needs an image to carry
+	// its delay
+	if (right < 0) {
+		left = right = top = bottom = 0;
+	}
+
+	const uint8_t *image = &capture->pending[0][0];
+	unsigned part = delay > GIF_MAX_DELAY_CS ? GIF_MAX_DELAY_CS
+																					 : (unsigned) delay;
+	write_image(capture, image, left, top, right - left + 1, bottom - top + 1,
+							part);
+	for (delay -= part; delay > 0; delay -= part) {
+		part = delay > GIF_MAX_DELAY_CS ? GIF_MAX_DELAY_CS : (unsigned) delay;
+		write_image(capture, image, 0, 0, 1, 1, part);
+	}
+	memcpy(capture->canvas, capture->pending, sizeof(capture->canvas));
+	capture->written++;
+}
+
+// Palette indices of a queued screen, low resolution pixels doubled
+static void expand_frame(const CaptureFrame *frame,
+												 uint8_t image[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH]) {
+	int shift = frame->hires ? 0 : 1;
+	for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+		const uint64_t *low = frame->gfx[0][y >> shift];
+		const uint64_t *high = frame->gfx[1][y >> shift];
+		for (int x = 0; x < CHIP8_HIRES_WIDTH; x++) {
+			int column = x >> shift;
+			int bit = 63 - (column & 63);
+			image[y][x] = (uint8_t) ((low[column >> 6] >> bit & 1) |
+															 (high[column >> 6] >> bit & 1) << 1);
+		}
+	}
+}
+
+static void encode_frame(Chip8Capture *capture, const CaptureFrame *frame) {
+	uint8_t image[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+	expand_frame(frame, image);
+	if (capture->has_pending) {
+		if (memcmp(image, capture->pending, sizeof(image)) == 0) {
+			capture->duplicates++;
+			return;
+		}
+		// A frame on the same 50 Hz step replaces the pending one, which would
+		// never be shown
+		uint64_t start = tick_cs(capture->pending_tick);
+		uint64_t end = tick_cs(frame->tick);
+		if (end > start) {
+			write_pending(capture, end - start);
+			capture->pending_tick = frame->tick;
+		}
+	} else {
+		capture->pending_tick = frame->tick;
+		capture->has_pending = true;
+	}
+	memcpy(capture->pending, image, sizeof(image));
+}
+
+// Encodes everything queued so far, returns false when idle
+static bool encode_frames(Chip8Capture *capture) {
+	unsigned head = atomic_load_explicit(&capture->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&capture->tail, memory_order_acquire);
+	if (head == tail) {
+		return false;
+	}
+	while (head != tail) {
+		encode_frame(capture, &capture->frames[head & capture->mask]);
+		head++;
+		atomic_store_explicit(&capture->head, head, memory_order_release);
+	}
+	return true;
+}
+
+static void *encode_thread(void *arg) {
+	Chip8Capture *capture = arg;
+	struct timespec interval = {0, ENCODE_INTERVAL_NS};
+	while (!atomic_load_explicit(&capture->stop, memory_order_acquire)) {
+		if (!encode_frames(capture)) {
+			nanosleep(&interval, NULL);
+		}
+	}
+	return NULL;
+}
+
+// GIF89a header for a looping animation on a 4-colour global palette
+static bool write_header(Chip8Capture *capture, const uint32_t *palette) {
+	FILE *file = capture->file;
+	fwrite("GIF89a", 1, 6, file);
+	put_u16(file, (unsigned) (CHIP8_HIRES_WIDTH * capture->scale));
+	put_u16(file, (unsigned) (CHIP8_HIRES_HEIGHT * capture->scale));
+	// Global colour table of 2^(1 + 1) entries, background colour 0
+	fputc(0x91, file);
+	fputc(0, file);
+	fputc(0, file);
+	for (int i = 0; i < 4; i++) {
+		fputc((palette[i] >> 16) & 0xFF, file);
+		fputc((palette[i] >> 8) & 0xFF, file);
+		fputc(palette[i] & 0xFF, file);
+	}
+
+	const uint8_t loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A',
+													'P',	'E',	'2',	'.', '0', 0x03, 0x01, 0x00,
+													0x00, 0x00};
+	return fwrite(loop, 1, sizeof(loop), file) == sizeof(loop);
+}
+
+bool capture_open(Chip8Capture *capture, const char *path, uint32_t capacity,
+									int scale, const uint32_t *palette) {
+	memset(capture, 0, sizeof(*capture));
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		fprintf(stderr, "Error: Capture capacity must be a power of two.\n");
+		return false;
+	}
+	if (scale < 1 || CHIP8_HIRES_WIDTH * scale > 0xFFFF) {
+		fprintf(stderr, "Error: Invalid capture scale %d.\n", scale);
+		return false;
+	}
+
+	capture->frames = malloc(capacity * sizeof(CaptureFrame));
+	if (capture->frames == NULL) {
+		fprintf(stderr, "Error: Failed to allocate capture buffer.\n");
+		return false;
+	}
+	// Touch every page now rather than in the middle of a frame
+	memset(capture->frames, 0, capacity * sizeof(CaptureFrame));
+	capture->capacity = capacity;
+	capture->mask = capacity - 1;
+	capture->scale = scale;
+	// No palette index, so the first frame is written whole
+	memset(capture->canvas, 0xFF, sizeof(capture->canvas));
+
+	capture->file = fopen(path, "wb");
+	if (capture->file == NULL) {
+		perror(path);
+		free(capture->frames);
+		return false;
+	}
+	if (!write_header(capture, palette != NULL ? palette : DEFAULT_PALETTE) ||
+			pthread_create(&capture->thread, NULL, encode_thread, capture) != 0) {
+		fprintf(stderr, "Error: Failed to start capture encoder.\n");
+		fclose(capture->file);
+		free(capture->frames);
+		return false;
+	}
+	return true;
+}
+
+void capture_frame(Chip8Capture *capture, const Chip8 *chip8, uint32_t tick,
+									 bool wait) {
+	unsigned tail = atomic_load_explicit(&capture->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&capture->head, memory_order_acquire);
+	struct timespec interval = {0, ENCODE_INTERVAL_NS};
+	while (wait && tail - head == capture->capacity) {
+		nanosleep(&interval, NULL);
+		head = atomic_load_explicit(&capture->head, memory_order_acquire);
+	}
+	if (tail - head == capture->capacity) {
+		capture->dropped++;
+		return;
+	}
+	CaptureFrame *frame = &capture->frames[tail & capture->mask];
+	memcpy(frame->gfx, chip8->gfx, sizeof(frame->gfx));
+	frame->hires = chip8->hires;
+	frame->tick = tick;
+	atomic_store_explicit(&capture->tail, tail + 1, memory_order_release);
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size) {
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = crc >> 1 ^ (0xEDB88320u & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+static void put_u32_be(uint8_t *out, uint32_t value) {
+	out[0] = (uint8_t) (value >> 24);
+	out[1] = (uint8_t) (value >> 16);
+	out[2] = (uint8_t) (value >> 8);
+	out[3] = (uint8_t) value;
+}
+
+static void write_chunk(FILE *file, const char *type, const uint8_t *data,
+												size_t size) {
+	uint8_t header[8];
+	put_u32_be(header, (uint32_t) size);
+	memcpy(header + 4, type, 4);
+	fwrite(header, 1, sizeof(header), file);
+	fwrite(data, 1, size, file);
+	uint8_t crc[4];
+	put_u32_be(crc, crc32_update(crc32_update(0, header + 4, 4), data, size));
+	fwrite(crc, 1, sizeof(crc), file);
+}
+
+// `raw` as a zlib stream of stored blocks, returns its size
+static size_t store_zlib(const uint8_t *raw, size_t size, uint8_t *out) {
+	size_t length = 0;
+	out[length++] = 0x78;
+	out[length++] = 0x01;
+	uint32_t a = 1, b = 0;
+	size_t done = 0;
+	do {
+		size_t part = size - done > DEFLATE_MAX_STORED ? DEFLATE_MAX_STORED
+																									 : size - done;
+		out[length++] = done + part == size ? 1 : 0;
+		out[length++] = (uint8_t) part;
+		out[length++] = (uint8_t) (part >> 8);
+		out[length++] = (uint8_t) ~part;
+		out[length++] = (uint8_t) (~part >> 8);
+		memcpy(out + length, raw + done, part);
+		length += part;
+		for (size_t i = done; i < done + part; i++) {
+			a = (a + raw[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		done += part;
+	} while (done < size);
+	put_u32_be(out + length, b << 16 | a);
+	return length + 4;
+}
+
+bool capture_png(const char *path, const Chip8 *chip8, int scale,
+								 const uint32_t *palette) {
+	if (scale < 1 || CHIP8_HIRES_WIDTH * scale > 0xFFFF) {
+		fprintf(stderr, "Error: Invalid capture scale %d.\n", scale);
+		return false;
+	}
+	if (palette == NULL) {
+		palette = DEFAULT_PALETTE;
+	}
+	CaptureFrame frame;
+	memcpy(frame.gfx, chip8->gfx, sizeof(frame.gfx));
+	frame.hires = chip8->hires;
+	uint8_t image[CHIP8_HIRES_HEIGHT][CHIP8_HIRES_WIDTH];
+	expand_frame(&frame, image);
+
+	// Rows of a filter byte and four 2-bit pixels per byte, leftmost first
+	uint32_t width = (uint32_t) (CHIP8_HIRES_WIDTH * scale);
+	uint32_t height = (uint32_t) (CHIP8_HIRES_HEIGHT * scale);
+	size_t stride = 1 + width / 4;
+	size_t raw_size = stride * height;
+	size_t blocks = raw_size / DEFLATE_MAX_STORED + 1;
+	uint8_t *raw = calloc(raw_size, 1);
+	uint8_t *stream = malloc(raw_size + 5 * blocks + 6);
+	if (raw == NULL || stream == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		free(raw);
+		free(stream);
+		return false;
+	}
+	for (uint32_t y = 0; y < height; y++) {
+		uint8_t *row = raw + y * stride + 1;
+		const uint8_t *line = image[y / (uint32_t) scale];
+		for (uint32_t x = 0; x < width; x++) {
+			unsigned pixel = line[x / (uint32_t) scale];
+			row[x / 4] |= (uint8_t) (pixel << (6 - 2 * (x % 4)));
+		}
+	}
+	size_t stream_size = store_zlib(raw, raw_size, stream);
+	free(raw);
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		free(stream);
+		return false;
+	}
+	fwrite("\x89PNG\r\n\x1A\n", 1, 8, file);
+	// Bit depth 2, colour type 3 (palette), no interlacing
+	uint8_t header[13] = {0};
+	put_u32_be(header, width);
+	put_u32_be(header + 4, height);
+	header[8] = 2;
+	header[9] = 3;
+	write_chunk(file, "IHDR", header, sizeof(header));
+	uint8_t colours[12];
+	for (int i = 0; i < 4; i++) {
+		colours[3 * i] = (uint8_t) (palette[i] >> 16);
+		colours[3 * i + 1] = (uint8_t) (palette[i] >> 8);
+		colours[3 * i + 2] = (uint8_t) palette[i];
+	}
+	write_chunk(file, "PLTE", colours, sizeof(colours));
+	write_chunk(file, "IDAT", stream, stream_size);
+	write_chunk(file, "IEND", NULL, 0);
+	free(stream);
+	if (ferror(file) || fclose(file) != 0) {
+		fprintf(stderr, "Error: Failed to write %s.\n", path);
+		return false;
+	}
+	return true;
+}
+
+// The last frame must have been queued
+void capture_close(Chip8Capture *capture, uint32_t end_tick) {
+	atomic_store_explicit(&capture->stop, true, memory_order_release);
+	pthread_join(capture->thread, NULL);
+	encode_frames(capture);
+
+	if (capture->has_pending) {
+		uint64_t start = tick_cs(capture->pending_tick);
+		uint64_t end = tick_cs(end_tick);
+		write_pending(capture, end > start ? end - start : CAPTURE_MIN_DELAY_CS);
+	}
+	fputc(0x3B, capture->file);
+	if (ferror(capture->file) || fclose(capture->file) != 0) {
+		fprintf(stderr, "Error: Failed to write capture.\n");
+	}
+	if (capture->dropped > 0) {
+		fprintf(stderr, "Warning: Capture dropped %llu frames.\n",
+						(unsigned long long) capture->dropped);
+	}
+	free(capture->frames);
+	capture->frames = NULL;
+}
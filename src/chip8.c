@@ -1,12 +1,22 @@
 #include "chip8.h"
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "audio.h"
+#include "chip8_ops.h"
+#include "trace.h"
+
+// Batches run on the direct-threaded loop where labels as values exist, and
+// on the switch otherwise or when built with CHIP8_SWITCH_DISPATCH
+#if defined(__GNUC__) && !defined(CHIP8_SWITCH_DISPATCH)
+#define CHIP8_THREADED
+#include "chip8_dispatch.h"
+#endif
 
 const unsigned char chip8_fontset[80] = {
 		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -27,7 +37,48 @@ const unsigned char chip8_fontset[80] = {
 		0xF0, 0x80, 0xF0, 0x80, 0x80	// F
 };
 
+const unsigned char chip8_big_fontset[160] = {
+		0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+		0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+		0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+		0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0	// F
+};
+
+// Marks the pages holding [address, address + size) as written
+static void mark_range(Chip8 *chip8, size_t address, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	size_t last = (address + size - 1) >> CHIP8_PAGE_SHIFT;
+	for (size_t page = address >> CHIP8_PAGE_SHIFT; page <= last; page++) {
+		chip8->dirty_pages |= UINT64_C(1) << page;
+	}
+}
+
 void chip8_init(Chip8 *chip8) {
+	chip8->dirty_pages = UINT64_MAX;
+	chip8->quiet = false;
+	chip8_reset(chip8);
+}
+
+/*
+ * Fuzzers and batch runners reset once per input, where clearing all 64K
+ * would cost more than running the program; only the pages the guest or a
+ * ROM load wrote are cleared.
+ */
+void chip8_reset(Chip8 *chip8) {
 	chip8->pc = 0x200;
 	chip8->opcode = 0;
 	chip8->I = 0;
@@ -36,454 +87,609 @@ void chip8_init(Chip8 *chip8) {
 	memset(chip8->gfx, 0, sizeof(chip8->gfx));
 	memset(chip8->stack, 0, sizeof(chip8->stack));
 	memset(chip8->V, 0, sizeof(chip8->V));
-	memset(chip8->memory, 0, sizeof(chip8->memory));
-	memset(chip8->key, 0, sizeof(chip8->key));
-	memset(chip8->key_prev, 0, sizeof(chip8->key_prev));
+	for (uint64_t pages = chip8->dirty_pages; pages != 0; pages &= pages - 1) {
+		int page = __builtin_ctzll(pages);
+		memset(&chip8->memory[page << CHIP8_PAGE_SHIFT], 0, CHIP8_PAGE_SIZE);
+	}
+	chip8->dirty_pages = 0;
+	chip8->rom_size = 0;
+	chip8->keys = 0;
+	chip8->keys_released = 0;
+	memset(chip8->rpl, 0, sizeof(chip8->rpl));
+	memset(chip8->pattern, 0, sizeof(chip8->pattern));
+	chip8->pitch = 64;
+	chip8->has_pattern = false;
 
 	for (int i = 0; i < 80; ++i) {
 		chip8->memory[i] = chip8_fontset[i];
 	}
+	memcpy(&chip8->memory[CHIP8_BIG_FONT_ADDRESS], chip8_big_fontset,
+				 sizeof(chip8_big_fontset));
+	mark_range(chip8, 0, CHIP8_BIG_FONT_ADDRESS + sizeof(chip8_big_fontset));
+	chip8->hires = false;
+	chip8->planes = 1;
 
 	chip8->delay_timer = 0;
 	chip8->sound_timer = 0;
 
 	chip8->draw_flag = 1;
+	chip8->dirty_rows = UINT64_MAX;
+
+	chip8_seed(chip8, 0);
+	chip8->quirks = CHIP8_QUIRKS_VIP;
+	chip8->idle_cycles = 0;
+	chip8->idle = false;
+	chip8->warned = chip8->quiet;
+
+	chip8->sound_callback = NULL;
+	chip8->sound_userdata = NULL;
+	chip8->sound_on = false;
+	chip8->trace = NULL;
 }
 
-void chip8_load_rom(Chip8 *chip8, const char *filename) {
-	char full_path[256];
-	int result = snprintf(full_path, sizeof(full_path), "roms/%s", filename);
-	if (result < 0 || result >= (int) sizeof(full_path)) {
-		fprintf(stderr, "Error: ROM filename is too long.\n");
-		return;
+void chip8_seed(Chip8 *chip8, uint64_t seed) {
+	// splitmix64 finaliser, spreads nearby seeds and never yields a zero state
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	chip8->rng_state = (z ^ (z >> 31)) | 1;
+}
+
+// Reads a whole ROM file into memory at 0x200 and closes it
+static bool read_rom(Chip8 *chip8, FILE *file) {
+	// Read straight into memory, one spare byte tells an oversized file apart
+	// without seeking
+	size_t bytes_read = fread(&chip8->memory[512], 1, CHIP8_MAX_ROM_SIZE, file);
+	mark_range(chip8, 512, bytes_read);
+	unsigned char extra;
+	bool too_large =
+			bytes_read == CHIP8_MAX_ROM_SIZE && fread(&extra, 1, 1, file) == 1;
+	bool failed = ferror(file) != 0;
+	fclose(file);
+
+	if (too_large) {
+		fprintf(stderr, "Error: ROM file is too large.\n");
+		return false;
+	}
+	if (failed) {
+		fprintf(stderr, "Error while reading ROM file.\n");
+		return false;
 	}
+	chip8->rom_size = bytes_read;
+	return true;
+}
 
-	FILE *file = fopen(full_path, "rb");
+bool chip8_load_rom(Chip8 *chip8, const char *filename) {
+	// The path as given wins, relative names that do not exist fall back to
+	// the roms/ directory
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL && filename[0] != '/') {
+		size_t length = strlen(filename);
+		char *full_path = malloc(sizeof("roms/") + length);
+		if (full_path == NULL) {
+			fprintf(stderr, "Error: Out of memory.\n");
+			return false;
+		}
+		memcpy(full_path, "roms/", sizeof("roms/") - 1);
+		memcpy(full_path + sizeof("roms/") - 1, filename, length + 1);
+		file = fopen(full_path, "rb");
+		free(full_path);
+	}
 	if (file == NULL) {
-		perror("Error opening ROM file\n");
-		return;
+		fprintf(stderr, "Error opening ROM file %s: %s\n", filename,
+						strerror(errno));
+		return false;
 	}
 
-	fseek(file, 0, SEEK_END);
-	long rom_size = ftell(file);
-	rewind(file);
-	if (rom_size > 4096 - 512) {
-		fprintf(stderr, "Error: ROM file size (%ld bytes) is too large.\n",
-						rom_size);
-		fclose(file);
-		return;
+	if (!read_rom(chip8, file)) {
+		return false;
 	}
+	printf("Successfully loaded ROM: %s\n", filename);
+	return true;
+}
 
-	size_t bytes_read = fread(&chip8->memory[512], 1, rom_size, file);
-	if (bytes_read != (size_t) rom_size) {
-		fprintf(stderr, "Error while reading ROM file.\n");
-		fclose(file);
-		return;
+bool chip8_load_rom_file(Chip8 *chip8, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Error opening ROM file %s: %s\n", path, strerror(errno));
+		return false;
 	}
+	return read_rom(chip8, file);
+}
 
-	fclose(file);
-	printf("Successfully loaded ROM: %s (%ld bytes)\n", filename, rom_size);
+bool chip8_load_rom_data(Chip8 *chip8, const unsigned char *data, size_t size) {
+	if (size > CHIP8_MAX_ROM_SIZE) {
+		fprintf(stderr, "Error: ROM size (%zu bytes) is too large.\n", size);
+		return false;
+	}
+	memcpy(&chip8->memory[512], data, size);
+	mark_range(chip8, 512, size);
+	chip8->rom_size = size;
+	return true;
 }
 
-void chip8_emulate_cycle(Chip8 *chip8) {
+void chip8_set_sound_callback(Chip8 *chip8, Chip8SoundCallback callback,
+															void *userdata) {
+	chip8->sound_callback = callback;
+	chip8->sound_userdata = userdata;
+}
+
+void chip8_snapshot(const Chip8 *chip8, Chip8Snapshot *snapshot) {
+	for (uint64_t pages = chip8->dirty_pages; pages != 0; pages &= pages - 1) {
+		size_t offset = (size_t) __builtin_ctzll(pages) << CHIP8_PAGE_SHIFT;
+		memcpy(&snapshot->memory[offset], &chip8->memory[offset], CHIP8_PAGE_SIZE);
+	}
+	memcpy(snapshot->gfx, chip8->gfx, sizeof(snapshot->gfx));
+	snapshot->rng_state = chip8->rng_state;
+	snapshot->memory_pages = chip8->dirty_pages;
+	memcpy(snapshot->stack, chip8->stack, sizeof(snapshot->stack));
+	snapshot->opcode = chip8->opcode;
+	snapshot->I = chip8->I;
+	snapshot->pc = chip8->pc;
+	snapshot->sp = chip8->sp;
+	snapshot->keys = chip8->keys;
+	snapshot->keys_released = chip8->keys_released;
+	memcpy(snapshot->V, chip8->V, sizeof(snapshot->V));
+	memcpy(snapshot->rpl, chip8->rpl, sizeof(snapshot->rpl));
+	memcpy(snapshot->pattern, chip8->pattern, sizeof(snapshot->pattern));
+	snapshot->delay_timer = chip8->delay_timer;
+	snapshot->sound_timer = chip8->sound_timer;
+	snapshot->hires = chip8->hires;
+	snapshot->planes = chip8->planes;
+	snapshot->pitch = chip8->pitch;
+	snapshot->has_pattern = chip8->has_pattern;
+	memset(snapshot->reserved, 0, sizeof(snapshot->reserved));
+}
+
+void chip8_restore(Chip8 *chip8, const Chip8Snapshot *snapshot) {
+	uint64_t stale = chip8->dirty_pages & ~snapshot->memory_pages;
+	for (uint64_t pages = stale; pages != 0; pages &= pages - 1) {
+		size_t offset = (size_t) __builtin_ctzll(pages) << CHIP8_PAGE_SHIFT;
+		memset(&chip8->memory[offset], 0, CHIP8_PAGE_SIZE);
+	}
+	for (uint64_t pages = snapshot->memory_pages; pages != 0;
+			 pages &= pages - 1) {
+		size_t offset = (size_t) __builtin_ctzll(pages) << CHIP8_PAGE_SHIFT;
+		memcpy(&chip8->memory[offset], &snapshot->memory[offset], CHIP8_PAGE_SIZE);
+	}
+	chip8->dirty_pages = snapshot->memory_pages;
+	memcpy(chip8->gfx, snapshot->gfx, sizeof(chip8->gfx));
+	chip8->rng_state = snapshot->rng_state;
+	memcpy(chip8->stack, snapshot->stack, sizeof(chip8->stack));
+	chip8->opcode = snapshot->opcode;
+	chip8->I = snapshot->I;
+	chip8->pc = snapshot->pc;
+	chip8->sp = snapshot->sp;
+	chip8->keys = snapshot->keys;
+	chip8->keys_released = snapshot->keys_released;
+	memcpy(chip8->V, snapshot->V, sizeof(chip8->V));
+	memcpy(chip8->rpl, snapshot->rpl, sizeof(chip8->rpl));
+	memcpy(chip8->pattern, snapshot->pattern, sizeof(chip8->pattern));
+	chip8->delay_timer = snapshot->delay_timer;
+	chip8->sound_timer = snapshot->sound_timer;
+	chip8->hires = snapshot->hires;
+	chip8->planes = snapshot->planes;
+	chip8->pitch = snapshot->pitch;
+	chip8->has_pattern = snapshot->has_pattern;
+	chip8->draw_flag = true;
+	chip8->dirty_rows = UINT64_MAX;
+
+	// Bring the beeper in line with the restored sound timer
+	bool sound_on = chip8->sound_timer > 0;
+	if (sound_on != chip8->sound_on) {
+		chip8->sound_on = sound_on;
+		if (chip8->sound_callback != NULL) {
+			chip8->sound_callback(chip8->sound_userdata, sound_on);
+		}
+	}
+}
+
+/*
+ * One fetch, decode and execute step. Always inlined into the per-profile
+ * functions below, where `quirks` is a constant, so each profile gets its own
+ * switch with the quirk tests folded away.
+ */
+static inline __attribute__((always_inline)) void
+emulate_cycle(Chip8 *chip8, const unsigned quirks) {
 	// Fetch opcode
-	chip8->opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+	chip8->opcode = fetch_opcode(chip8, chip8->pc);
+
+	unsigned short opcode = chip8->opcode;
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int n = opcode & 0x000F;
+	unsigned char nn = opcode & 0x00FF;
+	unsigned short nnn = opcode & 0x0FFF;
 
-	// Decode opcode
-	switch (chip8->opcode & 0xF000) {
+	// Decode and execute opcode, semantics live in chip8_ops.h
+	switch (opcode & 0xF000) {
 	case 0x0000:
-		switch (chip8->opcode) {
-		case 0x00E0: // 00E0: Clears the screen
-			// Execute opcode
-			memset(chip8->gfx, 0, sizeof(chip8->gfx));
-			chip8->draw_flag = true;
-			chip8->pc += 2;
+		switch (opcode) {
+		case 0x00E0:
+			op_cls(chip8, quirks);
 			break;
-
-		case 0x00EE: // 00EE: Returns from subroutine
-			chip8->sp--;
-			chip8->pc = chip8->stack[chip8->sp];
-			chip8->pc += 2;
+		case 0x00EE:
+			op_ret(chip8);
 			break;
-
-		default: // 0NNN: Execute machine language subroutine at address NNN
-			printf("Ignoring SYS opcode: 0x%X\n", chip8->opcode); // Skip opcode
-			chip8->pc += 2;
+		default:
+			if (quirks & QUIRK_SCHIP_OPS) {
+				op_schip_system(chip8, opcode, quirks);
+			} else {
+				op_sys(chip8, opcode);
+			}
 		}
 		break;
 
-	case 0x1000: // 1NNN: Jump to address NNN
-		chip8->pc = chip8->opcode & 0x0FFF;
+	case 0x1000:
+		op_jp(chip8, nnn);
 		break;
-
-	case 0x2000: // 2NNN: Execute subroutine starting at address NNN
-		chip8->stack[chip8->sp] = chip8->pc;
-		chip8->sp++;
-		chip8->pc = chip8->opcode & 0x0FFF;
+	case 0x2000:
+		op_call(chip8, nnn);
 		break;
-
-	case 0x3000: // 3XNN: Skip the following instruction if the value of register
-							 // VX equals NN
-		if (chip8->V[(chip8->opcode & 0x0F00) >> 8] == (chip8->opcode & 0x00FF)) {
-			chip8->pc += 2;
-		}
-		chip8->pc += 2;
+	case 0x3000:
+		op_se_imm(chip8, x, nn, quirks);
 		break;
-
-	case 0x4000: // 4XNN: Skip the following instruction if the value of register
-		// VX is not equal to NN
-		if (chip8->V[(chip8->opcode & 0x0F00) >> 8] != (chip8->opcode & 0x00FF)) {
-			chip8->pc += 2;
-		}
-		chip8->pc += 2;
+	case 0x4000:
+		op_sne_imm(chip8, x, nn, quirks);
 		break;
-
-	case 0x5000: // 5XY0: Skip the following instruction if the value of register
-							 // VX is equal to the value of register VY
-		if (chip8->V[(chip8->opcode & 0x0F00) >> 8] ==
-				chip8->V[(chip8->opcode & 0x00F0) >> 4]) {
-			chip8->pc += 2;
+	case 0x5000:
+		if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x2) {
+			op_save_range(chip8, x, y);
+		} else if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x3) {
+			op_load_range(chip8, x, y);
+		} else {
+			op_se_reg(chip8, x, y, quirks);
 		}
-		chip8->pc += 2;
 		break;
-
-	case 0x6000: // 6XNN: Store number NN in register VX
-		chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->opcode & 0x00FF;
-		chip8->pc += 2;
+	case 0x6000:
+		op_ld_imm(chip8, x, nn);
 		break;
-
-	case 0x7000: // 7XNN: Add the value NN to register VX
-		chip8->V[(chip8->opcode & 0x0F00) >> 8] += chip8->opcode & 0x00FF;
-		chip8->pc += 2;
+	case 0x7000:
+		op_add_imm(chip8, x, nn);
 		break;
 
 	case 0x8000:
-		switch (chip8->opcode & 0x000F) {
-		case 0x0000: // 8XY0: Store the value of register VY in register VX
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] =
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			chip8->pc += 2;
+		switch (n) {
+		case 0x0:
+			op_ld_reg(chip8, x, y);
 			break;
-
-		case 0x0001: // 8XY1: Set VX to VX OR VY
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] |=
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			chip8->V[0xF] = 0;
-			chip8->pc += 2;
+		case 0x1:
+			op_or(chip8, x, y, quirks);
 			break;
-
-		case 0x0002: // 8XY2: Set VX to VX AND VY
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] &=
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			chip8->V[0xF] = 0;
-			chip8->pc += 2;
+		case 0x2:
+			op_and(chip8, x, y, quirks);
 			break;
-
-		case 0x0003: // 8XY3: Set VX to VX XOR VY
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] ^=
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			chip8->V[0xF] = 0;
-			chip8->pc += 2;
+		case 0x3:
+			op_xor(chip8, x, y, quirks);
 			break;
-
-		case 0x0004: // 8XY4: Add the value of register VY to register VX
-								 // Set VF to 01 if a carry occurs
-								 // Set VF to 00 if a carry does not occur
-		{
-			unsigned char vx = (chip8->opcode & 0x0F00) >> 8;
-			unsigned char vy = (chip8->opcode & 0x00F0) >> 4;
-			unsigned short sum = chip8->V[vx] + chip8->V[vy];
-
-			chip8->V[vx] = sum & 0xFF;
-			chip8->V[0xF] = 0;
-			if (sum > 255) {
-				chip8->V[0xF] = 1;
-			}
-			chip8->pc += 2;
+		case 0x4:
+			op_add_reg(chip8, x, y);
 			break;
-		}
-
-		case 0x0005: // 8XY5: Subtract the value of register VY from register VX
-								 // Set VF to 00 if a borrow occurs
-								 // Set VF to 01 if a borrow does not occur
-		{
-			unsigned char vx = (chip8->opcode & 0x0F00) >> 8;
-			unsigned char vy = (chip8->opcode & 0x00F0) >> 4;
-			signed short diff = chip8->V[vx] - chip8->V[vy];
-
-			chip8->V[vx] = diff & 0xFF;
-			chip8->V[0xF] = 1;
-			if (diff < 0) {
-				chip8->V[0xF] = 0;
-			}
-			chip8->pc += 2;
+		case 0x5:
+			op_sub(chip8, x, y);
 			break;
-		}
-
-		case 0x0006: // 8XY6: Store the value of register VY shifted right one bit
-								 // in register VX
-								 // Set register VF to the least significant bit prior to the
-								 // shift
-								 // VY is unchanged
-		{
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] =
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			unsigned char lsb = chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0x01;
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] >>= 1;
-			chip8->V[0xF] = lsb;
-			chip8->pc += 2;
+		case 0x6:
+			op_shr(chip8, x, y, quirks);
 			break;
-		}
-
-		case 0x0007: // 8XY7: Set register VX to the value of VY minus VX
-								 // Set VF to 00 if a borrow occurs
-								 // Set VF to 01 if a borrow does not occur
-		{
-			unsigned char vx = (chip8->opcode & 0x0F00) >> 8;
-			unsigned char vy = (chip8->opcode & 0x00F0) >> 4;
-			signed short diff = chip8->V[vy] - chip8->V[vx];
-
-			chip8->V[vx] = diff & 0xFF;
-			chip8->V[0xF] = 1;
-			if (diff < 0) {
-				chip8->V[0xF] = 0;
-			}
-			chip8->pc += 2;
+		case 0x7:
+			op_subn(chip8, x, y);
 			break;
-		}
-
-		case 0x000E: // 8XYE: Store the value of register VY shifted left one bit
-								 // in register VX
-								 // Set register VF to the most significant bit prior to the
-								 // shift
-								 // VY is unchanged
-		{
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] =
-					chip8->V[(chip8->opcode & 0x00F0) >> 4];
-			unsigned char msb = (chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0x80) >> 7;
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] <<= 1;
-			chip8->V[0xF] = msb;
-			chip8->pc += 2;
+		case 0xE:
+			op_shl(chip8, x, y, quirks);
 			break;
-		}
-
 		default:
-			printf("Unknown opcode [0x8000]: 0x%X\n", chip8->opcode);
+			op_unknown(chip8, " [0x8000]", opcode);
 		}
 		break;
 
-	case 0x9000: // 9XY0: Skip the following instruction if the value of register
-							 // VX is not equal to the value of register VY
-		if (chip8->V[(chip8->opcode & 0x0F00) >> 8] !=
-				chip8->V[(chip8->opcode & 0x00F0) >> 4]) {
-			chip8->pc += 2;
-		}
-		chip8->pc += 2;
+	case 0x9000:
+		op_sne_reg(chip8, x, y, quirks);
 		break;
-
-	case 0xA000: // ANNN: Store memory address NNN in register I
-		chip8->I = chip8->opcode & 0x0FFF;
-		chip8->pc += 2;
+	case 0xA000:
+		op_ld_i(chip8, nnn);
 		break;
-
-	case 0xB000: // BNNN: Jump to address NNN + V0
-		chip8->pc = (chip8->opcode & 0x0FFF) + chip8->V[0x0];
+	case 0xB000:
+		op_jp_v0(chip8, x, nnn, quirks);
 		break;
-
-	case 0xC000: // CXNN: Set VX to a random number with a mask of NN
-	{
-		unsigned char random_number = rand() % 256;
-		chip8->V[(chip8->opcode & 0x0F00) >> 8] =
-				random_number & (chip8->opcode & 0x00FF);
-		chip8->pc += 2;
+	case 0xC000:
+		op_rnd(chip8, x, nn);
 		break;
-	}
-
-	case 0xD000: // DXYN: Draw a sprite at position VX, VY with N bytes of
-							 // sprite data starting at the address stored in I
-							 // Set VF to 01 if any set pixels are changed to unset, and 00
-							 // otherwise
-	{
-		unsigned short cx = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-		unsigned short cy = chip8->V[(chip8->opcode & 0x00F0) >> 4];
-		unsigned short height = chip8->opcode & 0x000F;
-		unsigned short pixel;
-
-		chip8->V[0xF] = 0;
-
-		// Clip if partial sprite out of screen
-		if (cx < 64 && cy < 32) {
-			for (int y = 0; y < height; y++) {
-				pixel = chip8->memory[chip8->I + y];
-				if (cy + y >= 32) {
-					continue;
-				}
-				for (int x = 0; x < 8; x++) {
-					if (cx + x >= 64) {
-						continue;
-					}
-					if ((pixel & (0x80 >> x)) != 0) {
-						if (chip8->gfx[(cx + x) + (cy + y) * 64] == 1) {
-							chip8->V[0xF] = 1;
-						}
-						chip8->gfx[(cx + x) + (cy + y) * 64] ^= 1;
-					}
-				}
-			}
-
-			// Wrap if whole sprite out of screen
-		} else {
-			for (int y = 0; y < height; y++) {
-				pixel = chip8->memory[chip8->I + y];
-				for (int x = 0; x < 8; x++) {
-					if ((pixel & (0x80 >> x)) != 0) {
-						if (chip8->gfx[(cx + x) % 64 + ((cy + y) % 32) * 64] == 1) {
-							chip8->V[0xF] = 1;
-						}
-						chip8->gfx[(cx + x) % 64 + ((cy + y) % 32) * 64] ^= 1;
-					}
-				}
-			}
-		}
-
-		chip8->draw_flag = true;
-		chip8->pc += 2;
+	case 0xD000:
+		op_drw(chip8, x, y, n, quirks);
 		break;
-	}
 
 	case 0xE000:
-		switch (chip8->opcode & 0x00FF) {
-		case 0x009E: // EX9E: Skip the following instruction if the key
-								 // corresponding to the hex value currently stored in register
-								 // VX is pressed
-		{
-			unsigned char key = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			if (chip8->key[key] == 1) {
-				chip8->pc += 2;
-			}
-			chip8->pc += 2;
+		switch (nn) {
+		case 0x9E:
+			op_skp(chip8, x, quirks);
 			break;
-		}
-
-		case 0x00A1: // EXA1: Skip the following instruction if the key
-								 // corresponding to the hex value currently stored in register
-								 // VX is not pressed
-		{
-			unsigned char key = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			if (chip8->key[key] == 0) {
-				chip8->pc += 2;
-			}
-			chip8->pc += 2;
+		case 0xA1:
+			op_sknp(chip8, x, quirks);
 			break;
-		}
-
 		default:
-			printf("Unknown opcode [0xE000]: 0x%X\n", chip8->opcode);
+			op_unknown(chip8, " [0xE000]", opcode);
 		}
 		break;
 
 	case 0xF000:
-		switch (chip8->opcode & 0x00FF) {
-		case 0x0007: // FX07: Store the current value of the delay timer in register
-								 // VX
-			chip8->V[(chip8->opcode & 0x0F00) >> 8] = chip8->delay_timer;
-			chip8->pc += 2;
+		switch (nn) {
+		case 0x00:
+			if ((quirks & QUIRK_XOCHIP_OPS) && opcode == 0xF000) {
+				op_ld_i_long(chip8);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
+			}
 			break;
-
-		case 0x000A: // FX0A: Wait for a keypress and store the result in register
-								 // VX
-		{
-			for (int i = 0; i < 16; i++) {
-				if (chip8->key[i] == 0 && chip8->key_prev[i] == 1) {
-					chip8->V[(chip8->opcode & 0x0F00) >> 8] = i;
-					chip8->pc += 2;
-					break;
-				}
+		case 0x01:
+			if (quirks & QUIRK_XOCHIP_OPS) {
+				op_planes(chip8, x);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
 			}
 			break;
-		}
-
-		case 0x0015: // FX15: Set the delay timer to the value of register VX
-			chip8->delay_timer = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			chip8->pc += 2;
+		case 0x02:
+			if ((quirks & QUIRK_XOCHIP_OPS) && opcode == 0xF002) {
+				op_ld_pattern(chip8);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
+			}
 			break;
-
-		case 0x0018: // FX18: Set the sound timer to the value of register VX
-			chip8->sound_timer = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			chip8->pc += 2;
+		case 0x07:
+			op_ld_vx_dt(chip8, x);
 			break;
-
-		case 0x001E: // FX1E: Add the value stored in register VX to register I
-			chip8->I += chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			chip8->pc += 2;
+		case 0x0A:
+			op_ld_vx_key(chip8, x);
 			break;
-
-		case 0x0029: // FX29: Set I to the memory address of the sprite data
-								 // corresponding to the hexadecimal digit stored in register VX
-		{
-			unsigned char font = chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0x0F;
-			chip8->I = font * 5;
-			chip8->pc += 2;
+		case 0x15:
+			op_ld_dt(chip8, x);
 			break;
-		}
-
-		case 0x0033: // FX33: Store the binary-coded decimal equivalent of the value
-								 // stored in register VX at addresses I, I + 1, and I + 2
-		{
-			unsigned char value = chip8->V[(chip8->opcode & 0x0F00) >> 8];
-			for (int i = 2; i >= 0; i--) {
-				chip8->memory[chip8->I + i] = value % 10;
-				value /= 10;
+		case 0x18:
+			op_ld_st(chip8, x);
+			break;
+		case 0x1E:
+			op_add_i(chip8, x);
+			break;
+		case 0x29:
+			op_ld_font(chip8, x);
+			break;
+		case 0x30:
+			if (quirks & QUIRK_SCHIP_OPS) {
+				op_ld_big_font(chip8, x);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
 			}
-			chip8->pc += 2;
 			break;
-		}
-
-		case 0x0055: // FX55: Store the values of registers V0 to VX inclusive in
-								 // memory starting at address I I is set to I + X + 1 after
-								 // operation
-		{
-			unsigned char num_registers = (chip8->opcode & 0x0F00) >> 8;
-			for (int i = 0; i <= num_registers; i++) {
-				chip8->memory[chip8->I + i] = chip8->V[i];
+		case 0x33:
+			op_bcd(chip8, x);
+			break;
+		case 0x3A:
+			if (quirks & QUIRK_XOCHIP_OPS) {
+				op_pitch(chip8, x);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
 			}
-			chip8->I += num_registers + 1;
-			chip8->pc += 2;
 			break;
-		}
-
-		case 0x0065: // FX65: Fill registers V0 to VX inclusive with the values
-								 // stored in memory starting at address I
-								 // I is set to I + X + 1 after operation
-		{
-			unsigned char num_registers = (chip8->opcode & 0x0F00) >> 8;
-			for (int i = 0; i <= num_registers; i++) {
-				chip8->V[i] = chip8->memory[chip8->I + i];
+		case 0x55:
+			op_store(chip8, x, quirks);
+			break;
+		case 0x65:
+			op_load(chip8, x, quirks);
+			break;
+		case 0x75:
+			if (quirks & QUIRK_SCHIP_OPS) {
+				op_save_flags(chip8, x);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
+			}
+			break;
+		case 0x85:
+			if (quirks & QUIRK_SCHIP_OPS) {
+				op_load_flags(chip8, x);
+			} else {
+				op_unknown(chip8, " [0xF000]", opcode);
 			}
-			chip8->I += num_registers + 1;
-			chip8->pc += 2;
 			break;
-		}
-
 		default:
-			printf("Unknown opcode [0xF000]: 0x%X\n", chip8->opcode);
+			op_unknown(chip8, " [0xF000]", opcode);
 		}
 		break;
 
 	default:
-		printf("Unknown opcode: 0x%X\n", chip8->opcode);
+		op_unknown(chip8, "", opcode);
 	}
 }
 
+/*
+ * Batch with the trace attached: the same steps, each followed by a record of
+ * the state it left. Records are published once at the end of the batch, and
+ * whatever does not fit in the ring is dropped rather than waited for.
+ */
+static inline __attribute__((always_inline)) void
+run_traced(Chip8 *chip8, int cycles, const unsigned quirks) {
+	// Guest memory writes may alias anything, so the hot state lives in locals
+	Chip8Trace *trace = chip8->trace;
+	TraceRecord *records = trace->records;
+	const unsigned mask = trace->mask;
+	unsigned tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&trace->head, memory_order_acquire);
+	unsigned room = trace->capacity - (tail - head);
+	uint64_t cycle = trace->cycle;
+	uint64_t dropped = 0;
+
+	for (int i = 0; i < cycles; i++) {
+		unsigned short pc = chip8->pc;
+		emulate_cycle(chip8, quirks);
+
+		unsigned short opcode = chip8->opcode;
+		if (room > 0) {
+			TraceRecord *record = &records[tail & mask];
+			record->cycle = (uint32_t) cycle;
+			record->pc = pc;
+			record->opcode = opcode;
+			record->I = chip8->I;
+			record->vx = chip8->V[(opcode >> 8) & 0xF];
+			record->vf = chip8->V[0xF];
+			tail++;
+			room--;
+		} else {
+			dropped++;
+		}
+		cycle++;
+
+		if ((opcode & 0xF000) == 0x1000 || (opcode & 0xF0FF) == 0xF00A) {
+			int skipped = skip_idle_loop(chip8, cycles - i - 1);
+			i += skipped;
+			cycle += skipped;
+		}
+	}
+
+	trace->cycle = cycle;
+	trace->dropped += dropped;
+	atomic_store_explicit(&trace->tail, tail, memory_order_release);
+}
+
+// Single-step and traced entry points for every quirk profile
+#define DEFINE_PROFILE_LOOPS(profile, suffix, flags)                           \
+	static void cycle_##suffix(Chip8 *chip8) {                                   \
+		emulate_cycle(chip8, flags);                                               \
+	}                                                                            \
+	static void run_traced_##suffix(Chip8 *chip8, int cycles) {                  \
+		run_traced(chip8, cycles, flags);                                          \
+	}
+FOR_EACH_QUIRK_PROFILE(DEFINE_PROFILE_LOOPS)
+
+// Batch entry points, one threaded loop per profile (see chip8_threaded.h)
+// or the switch in a loop
+#ifdef CHIP8_THREADED
+#define THREADED_RUN run_vip
+#define THREADED_QUIRKS QUIRKS_VIP
+#include "chip8_threaded.h"
+#define THREADED_RUN run_chip48
+#define THREADED_QUIRKS QUIRKS_CHIP48
+#include "chip8_threaded.h"
+#define THREADED_RUN run_schip
+#define THREADED_QUIRKS QUIRKS_SCHIP
+#include "chip8_threaded.h"
+#define THREADED_RUN run_xochip
+#define THREADED_QUIRKS QUIRKS_XOCHIP
+#include "chip8_threaded.h"
+#else
+#define DEFINE_PROFILE_RUN(profile, suffix, flags)                             \
+	static void run_##suffix(Chip8 *chip8, int cycles) {                         \
+		for (int i = 0; i < cycles; i++) {                                         \
+			emulate_cycle(chip8, flags);                                             \
+			if ((chip8->opcode & 0xF000) == 0x1000 ||                                \
+					(chip8->opcode & 0xF0FF) == 0xF00A) {                                \
+				i += skip_idle_loop(chip8, cycles - i - 1);                            \
+			}                                                                        \
+		}                                                                          \
+	}
+FOR_EACH_QUIRK_PROFILE(DEFINE_PROFILE_RUN)
+#endif
+
+#define CYCLE_ENTRY(profile, suffix, flags) [profile] = cycle_##suffix,
+#define RUN_ENTRY(profile, suffix, flags) [profile] = run_##suffix,
+#define RUN_TRACED_ENTRY(profile, suffix, flags)                               \
+	[profile] = run_traced_##suffix,
+static void (*const cycle_functions[CHIP8_QUIRKS_COUNT])(Chip8 *) = {
+		FOR_EACH_QUIRK_PROFILE(CYCLE_ENTRY)};
+static void (*const run_functions[CHIP8_QUIRKS_COUNT])(Chip8 *, int) = {
+		FOR_EACH_QUIRK_PROFILE(RUN_ENTRY)};
+static void (*const run_traced_functions[CHIP8_QUIRKS_COUNT])(Chip8 *, int) = {
+		FOR_EACH_QUIRK_PROFILE(RUN_TRACED_ENTRY)};
+
+static const char *const QUIRKS_NAMES[CHIP8_QUIRKS_COUNT] = {
+		[CHIP8_QUIRKS_VIP] = "vip",
+		[CHIP8_QUIRKS_CHIP48] = "chip48",
+		[CHIP8_QUIRKS_SCHIP] = "schip",
+		[CHIP8_QUIRKS_XOCHIP] = "xochip",
+};
+
+void chip8_emulate_cycle(Chip8 *chip8) {
+	cycle_functions[chip8->quirks](chip8);
+}
+
+// The profile and tracing are picked once per batch, not once per instruction
+void chip8_run(Chip8 *chip8, int cycles) {
+	chip8->idle = false;
+	if (chip8->trace != NULL) {
+		run_traced_functions[chip8->quirks](chip8, cycles);
+	} else {
+		run_functions[chip8->quirks](chip8, cycles);
+	}
+}
+
+Chip8CycleFunction chip8_cycle_function(Chip8Quirks quirks) {
+	return cycle_functions[quirks];
+}
+
+const char *chip8_quirks_name(Chip8Quirks quirks) {
+	return QUIRKS_NAMES[quirks];
+}
+
+bool chip8_quirks_parse(const char *name, Chip8Quirks *quirks) {
+	for (int i = 0; i < CHIP8_QUIRKS_COUNT; i++) {
+		if (strcmp(name, QUIRKS_NAMES[i]) == 0) {
+			*quirks = (Chip8Quirks) i;
+			return true;
+		}
+	}
+	return false;
+}
+
 void chip8_update_timers(Chip8 *chip8) {
 	// Update timers
 	if (chip8->delay_timer > 0) {
 		chip8->delay_timer--;
 	}
-	if (chip8->sound_timer > 0) {
-		audio_beep_on();
+
+	bool sound_on = chip8->sound_timer > 0;
+	if (sound_on) {
 		chip8->sound_timer--;
-	} else {
-		audio_beep_off();
 	}
+
+	// Only notify the backend on edges, not every tick
+	if (sound_on != chip8->sound_on) {
+		chip8->sound_on = sound_on;
+		if (chip8->sound_callback != NULL) {
+			chip8->sound_callback(chip8->sound_userdata, sound_on);
+		}
+	}
+}
+
+static unsigned long long hash_word(unsigned long long hash, uint64_t word) {
+	for (int shift = 56; shift >= 0; shift -= 8) {
+		hash ^= (word >> shift) & 0xFF;
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+unsigned long long chip8_framebuffer_hash(const Chip8 *chip8) {
+	// 64-bit FNV-1a over the packed rows, leftmost pixels first so the hash
+	// does not depend on host endianness. A low resolution screen that only
+	// uses plane 0 hashes exactly its 32 words.
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	int height = chip8->hires ? CHIP8_HIRES_HEIGHT : CHIP8_SCREEN_HEIGHT;
+	int words = chip8->hires ? 2 : 1;
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		uint64_t used = 0;
+		for (int y = 0; plane > 0 && y < height; y++) {
+			used |= chip8->gfx[plane][y][0] | chip8->gfx[plane][y][1];
+		}
+		if (plane > 0 && used == 0) {
+			continue;
+		}
+		// Anything beyond that mixes in a marker first, so it cannot collide
+		// with a plain low resolution screen
+		if (plane > 0 || chip8->hires) {
+			hash = hash_word(hash, 0x100u * plane + words);
+		}
+		for (int y = 0; y < height; y++) {
+			for (int w = 0; w < words; w++) {
+				hash = hash_word(hash, chip8->gfx[plane][y][w]);
+			}
+		}
+	}
+	return hash;
 }
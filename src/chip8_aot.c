@@ -0,0 +1,128 @@
+#include "chip8_aot.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+void chip8_aot_init(Chip8Aot *aot, const Chip8AotProgram *program) {
+	aot->program = program;
+	memset(aot->run_at, 0xFF, sizeof(aot->run_at));
+	memset(aot->is_code, 0, sizeof(aot->is_code));
+	memset(aot->stale, 0, sizeof(aot->stale));
+	aot->compiled_cycles = 0;
+	aot->interpreted_cycles = 0;
+	aot->invalidations = 0;
+
+	// Where runs overlap (code reached at both alignments) the later one wins
+	// the address, and entries it does not have are interpreted
+	for (int i = 0; i < program->num_runs; i++) {
+		const Chip8AotRun *run = &program->runs[i];
+		for (unsigned address = run->start; address < run->end; address++) {
+			aot->run_at[address] = (int16_t) i;
+			aot->is_code[address] = 1;
+		}
+	}
+}
+
+void chip8_aot_load(const Chip8AotProgram *program, Chip8 *chip8) {
+	chip8_load_rom_data(chip8, program->rom, program->rom_size);
+	chip8->quirks = program->quirks;
+}
+
+// A run is stale while its guest bytes differ from the ROM it was compiled
+// from, so writing the original bytes back revives it
+static void check_runs(Chip8Aot *aot, const Chip8 *chip8, unsigned first,
+											 unsigned end) {
+	const Chip8AotProgram *program = aot->program;
+	for (int i = 0; i < program->num_runs; i++) {
+		const Chip8AotRun *run = &program->runs[i];
+		if (run->end <= first || run->start >= end) {
+			continue;
+		}
+		bool stale = memcmp(&chip8->memory[run->start],
+												&program->rom[run->start - 0x200],
+												run->end - run->start) != 0;
+		if (stale && !aot->stale[i]) {
+			aot->invalidations++;
+		}
+		aot->stale[i] = stale;
+	}
+}
+
+void chip8_aot_sync(Chip8Aot *aot, const Chip8 *chip8) {
+	check_runs(aot, chip8, 0, CHIP8_AOT_CODE_SIZE);
+}
+
+void chip8_aot_written(Chip8Aot *aot, const Chip8 *chip8,
+											 unsigned short address, int length) {
+	unsigned end = address + length;
+	if (end > CHIP8_MEMORY_SIZE) {
+		// Writes wrap around to the start of memory
+		chip8_aot_written(aot, chip8, 0, end - CHIP8_MEMORY_SIZE);
+		end = CHIP8_MEMORY_SIZE;
+	}
+	if (end > CHIP8_AOT_CODE_SIZE) {
+		end = CHIP8_AOT_CODE_SIZE;
+	}
+
+	// Most stores go to data, which only costs this scan
+	bool hits_code = false;
+	for (unsigned i = address; i < end; i++) {
+		hits_code |= aot->is_code[i];
+	}
+	if (hits_code) {
+		check_runs(aot, chip8, address, end);
+	}
+}
+
+// One instruction on the interpreter, which may rewrite compiled code too
+static void interpret(Chip8Aot *aot, Chip8 *chip8, unsigned quirks) {
+	unsigned short address = chip8->I;
+	chip8_emulate_cycle(chip8);
+	int length = store_length(chip8->opcode, quirks);
+	if (length > 0) {
+		chip8_aot_written(aot, chip8, address, length);
+	}
+}
+
+int chip8_aot_run(Chip8Aot *aot, Chip8 *chip8, int cycles) {
+	// Code compiled for another profile would be wrong, not just slow
+	if (chip8->quirks != aot->program->quirks) {
+		chip8_run(chip8, cycles);
+		aot->interpreted_cycles += cycles;
+		return cycles;
+	}
+
+	chip8->idle = false;
+	unsigned quirks = quirk_flags(chip8->quirks);
+	const Chip8AotRun *runs = aot->program->runs;
+	int executed = 0;
+	while (executed < cycles) {
+		unsigned short pc = chip8->pc;
+		int index = pc < CHIP8_AOT_CODE_SIZE ? aot->run_at[pc] : -1;
+		int done = 0;
+		if (index >= 0 && !aot->stale[index]) {
+			done = runs[index].code(aot, chip8, cycles - executed);
+		}
+
+		if (done > 0) {
+			executed += done;
+			aot->compiled_cycles += done;
+			// Only a branch back can close an idle loop
+			if (chip8->pc <= pc) {
+				executed += skip_idle_loop(chip8, cycles - executed);
+			}
+		} else {
+			interpret(aot, chip8, quirks);
+			executed++;
+			aot->interpreted_cycles++;
+			if ((chip8->opcode & 0xF000) == 0x1000 ||
+					(chip8->opcode & 0xF0FF) == 0xF00A) {
+				executed += skip_idle_loop(chip8, cycles - executed);
+			}
+		}
+	}
+	return executed;
+}
@@ -0,0 +1,399 @@
+#include "chip8_cache.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+// Same choice of dispatch as the interpreter's batch loop in chip8.c
+#if defined(__GNUC__) && !defined(CHIP8_SWITCH_DISPATCH)
+#define CHIP8_CACHE_THREADED
+#endif
+
+// Every entry kind, in the order of their handlers in chip8_cache_loop.h
+#define FOR_EACH_CACHE_KIND(X)                                                 \
+	X(K_INVALID)                                                                 \
+	X(K_CLS)                                                                     \
+	X(K_RET)                                                                     \
+	X(K_JP)                                                                      \
+	X(K_CALL)                                                                    \
+	X(K_SE_IMM)                                                                  \
+	X(K_SNE_IMM)                                                                 \
+	X(K_SE_REG)                                                                  \
+	X(K_LD_IMM)                                                                  \
+	X(K_ADD_IMM)                                                                 \
+	X(K_LD_REG)                                                                  \
+	X(K_OR)                                                                      \
+	X(K_AND)                                                                     \
+	X(K_XOR)                                                                     \
+	X(K_ADD_REG)                                                                 \
+	X(K_SUB)                                                                     \
+	X(K_SHR)                                                                     \
+	X(K_SUBN)                                                                    \
+	X(K_SHL)                                                                     \
+	X(K_SNE_REG)                                                                 \
+	X(K_LD_I)                                                                    \
+	X(K_JP_V0)                                                                   \
+	X(K_RND)                                                                     \
+	X(K_DRW)                                                                     \
+	X(K_SKP)                                                                     \
+	X(K_SKNP)                                                                    \
+	X(K_LD_VX_DT)                                                                \
+	X(K_LD_VX_KEY)                                                               \
+	X(K_LD_DT)                                                                   \
+	X(K_LD_ST)                                                                   \
+	X(K_ADD_I)                                                                   \
+	X(K_LD_FONT)                                                                 \
+	X(K_BCD)                                                                     \
+	X(K_STORE)                                                                   \
+	X(K_LOAD)                                                                    \
+	X(K_INTERPRET)                                                               \
+	X(K_LD_I_DRW)                                                                \
+	X(K_LD_IMM_LD_IMM)                                                           \
+	X(K_ADD_IMM_SE)                                                              \
+	X(K_ADD_IMM_SNE)                                                             \
+	X(K_LD_IMM_SKP)                                                              \
+	X(K_LD_IMM_SKNP)                                                             \
+	X(K_LD_VX_DT_SE)                                                             \
+	X(K_LD_VX_DT_SNE)
+
+/*
+ * K_INTERPRET is left to the interpreter: SYS, SUPER-CHIP and XO-CHIP
+ * extensions (which depend on the profile), unknown opcodes and the last
+ * instructions of a page. The kinds after it are superinstructions for the
+ * pairs hot in key polling and timer loops: ANNN + DXYN, 6XNN + 6XNN,
+ * 7XNN + 3XNN, 7XNN + 4XNN, 6XNN + EX9E, 6XNN + EXA1, FX07 + 3XNN and
+ * FX07 + 4XNN.
+ */
+#define KIND_ENUM(kind) kind,
+enum { FOR_EACH_CACHE_KIND(KIND_ENUM) K_COUNT };
+#undef KIND_ENUM
+
+static void decode(unsigned short opcode, Chip8CacheOp *op) {
+	memset(op, 0, sizeof(*op));
+	op->cycles = 1;
+	op->x = (opcode & 0x0F00) >> 8;
+	op->y = (opcode & 0x00F0) >> 4;
+	op->n = opcode & 0x000F;
+	op->nn = opcode & 0x00FF;
+	op->nnn = opcode & 0x0FFF;
+
+	static const uint8_t by_high_nibble[16] = {
+			K_INTERPRET, K_JP,			K_CALL,				 K_SE_IMM,		K_SNE_IMM, K_SE_REG,
+			K_LD_IMM,		 K_ADD_IMM, K_INTERPRET, K_SNE_REG,		K_LD_I,		 K_JP_V0,
+			K_RND,			 K_DRW,			K_INTERPRET, K_INTERPRET};
+	op->kind = by_high_nibble[opcode >> 12];
+
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		op->kind = opcode == 0x00E0	 ? K_CLS
+							 : opcode == 0x00EE ? K_RET
+																	: K_INTERPRET;
+		break;
+	case 0x5000:
+		// 5XY2/5XY3 are XO-CHIP register range stores and loads, otherwise the
+		// interpreter ignores the low nibble of 5XY0/9XY0 as well
+		if (op->n == 0x2 || op->n == 0x3) {
+			op->kind = K_INTERPRET;
+		}
+		break;
+	case 0x9000:
+		break;
+	case 0x8000: {
+		static const uint8_t alu[16] = {
+				K_LD_REG,		 K_OR,				K_AND,			 K_XOR,
+				K_ADD_REG,	 K_SUB,				K_SHR,			 K_SUBN,
+				K_INTERPRET, K_INTERPRET, K_INTERPRET, K_INTERPRET,
+				K_INTERPRET, K_INTERPRET, K_SHL,			 K_INTERPRET};
+		op->kind = alu[op->n];
+		break;
+	}
+	case 0xE000:
+		op->kind = op->nn == 0x9E	 ? K_SKP
+							 : op->nn == 0xA1 ? K_SKNP
+																: K_INTERPRET;
+		break;
+	case 0xF000:
+		switch (op->nn) {
+		case 0x07:
+			op->kind = K_LD_VX_DT;
+			break;
+		case 0x0A:
+			op->kind = K_LD_VX_KEY;
+			break;
+		case 0x15:
+			op->kind = K_LD_DT;
+			break;
+		case 0x18:
+			op->kind = K_LD_ST;
+			break;
+		case 0x1E:
+			op->kind = K_ADD_I;
+			break;
+		case 0x29:
+			op->kind = K_LD_FONT;
+			break;
+		case 0x33:
+			op->kind = K_BCD;
+			break;
+		case 0x55:
+			op->kind = K_STORE;
+			break;
+		case 0x65:
+			op->kind = K_LOAD;
+			break;
+		default:
+			op->kind = K_INTERPRET;
+		}
+		break;
+	}
+}
+
+// Ops after which the next pc is not simply pc + 2, or which may have
+// rewritten guest code, end a block
+static bool ends_block(uint8_t kind) {
+	switch (kind) {
+	case K_RET:
+	case K_JP:
+	case K_CALL:
+	case K_SE_IMM:
+	case K_SNE_IMM:
+	case K_SE_REG:
+	case K_SNE_REG:
+	case K_JP_V0:
+	case K_SKP:
+	case K_SKNP:
+	case K_LD_VX_KEY:
+	case K_BCD:
+	case K_STORE:
+	case K_INTERPRET:
+	case K_ADD_IMM_SE:
+	case K_ADD_IMM_SNE:
+	case K_LD_IMM_SKP:
+	case K_LD_IMM_SKNP:
+	case K_LD_VX_DT_SE:
+	case K_LD_VX_DT_SNE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Try to merge `next` into `op` as a superinstruction
+static bool fuse(Chip8CacheOp *op, const Chip8CacheOp *next) {
+	uint8_t fused;
+	if (op->kind == K_LD_I && next->kind == K_DRW) {
+		fused = K_LD_I_DRW;
+	} else if (op->kind == K_LD_IMM && next->kind == K_LD_IMM) {
+		fused = K_LD_IMM_LD_IMM;
+	} else if (op->kind == K_ADD_IMM && next->kind == K_SE_IMM) {
+		fused = K_ADD_IMM_SE;
+	} else if (op->kind == K_ADD_IMM && next->kind == K_SNE_IMM) {
+		fused = K_ADD_IMM_SNE;
+	} else if (op->kind == K_LD_IMM && next->kind == K_SKP) {
+		fused = K_LD_IMM_SKP;
+	} else if (op->kind == K_LD_IMM && next->kind == K_SKNP) {
+		fused = K_LD_IMM_SKNP;
+	} else if (op->kind == K_LD_VX_DT && next->kind == K_SE_IMM) {
+		fused = K_LD_VX_DT_SE;
+	} else if (op->kind == K_LD_VX_DT && next->kind == K_SNE_IMM) {
+		fused = K_LD_VX_DT_SNE;
+	} else {
+		return false;
+	}
+
+	if (fused == K_LD_I_DRW) {
+		// I comes from the first half, the sprite operands from the second
+		op->x = next->x;
+		op->y = next->y;
+		op->n = next->n;
+	} else {
+		op->x2 = next->x;
+		op->nn2 = next->nn;
+	}
+	op->kind = fused;
+	op->cycles = 2;
+	return true;
+}
+
+/*
+ * Decodes the instruction at `address`. The last instructions of a page are
+ * left to the interpreter, which ends the block there: blocks then never run
+ * into the next page, and where one ends depends only on where its
+ * instructions are, not on where it started.
+ */
+static void decode_at(const Chip8 *chip8, unsigned address, Chip8CacheOp *op) {
+	if ((address & (CHIP8_PAGE_SIZE - 1)) + 4 > CHIP8_PAGE_SIZE) {
+		memset(op, 0, sizeof(*op));
+		op->kind = K_INTERPRET;
+		op->cycles = 1;
+		return;
+	}
+	decode(fetch_opcode(chip8, (unsigned short) address), op);
+}
+
+static uint64_t page_bit(unsigned address) {
+	return UINT64_C(1) << ((address & MEMORY_MASK) >> CHIP8_PAGE_SHIFT);
+}
+
+/*
+ * Decodes the block starting at pc. Decoding stops early when it reaches an
+ * entry that is already valid, since that entry's block is the tail of ours.
+ */
+static void build_block(Chip8Cache *cache, const Chip8 *chip8,
+												unsigned short pc) {
+	unsigned short chain[CHIP8_PAGE_SIZE / 2];
+	int length = 0;
+	unsigned address = pc;
+	uint16_t tail_cycles = 0;
+	unsigned end;
+
+	while (true) {
+		Chip8CacheOp *op = &cache->ops[address];
+		if (op->kind != K_INVALID) {
+			tail_cycles = op->block_cycles;
+			end = address + op->block_bytes;
+			break;
+		}
+
+		decode_at(chip8, address, op);
+		unsigned next = address + 2;
+		if (!ends_block(op->kind)) {
+			Chip8CacheOp second;
+			decode_at(chip8, next, &second);
+			if (fuse(op, &second)) {
+				next += 2;
+			}
+		}
+		chain[length++] = (unsigned short) address;
+		if (ends_block(op->kind)) {
+			end = next;
+			break;
+		}
+		address = next;
+	}
+
+	// Walk back so every entry knows the cycles and bytes left in its block
+	for (int i = length - 1; i >= 0; i--) {
+		Chip8CacheOp *op = &cache->ops[chain[i]];
+		tail_cycles += op->cycles;
+		op->block_cycles = tail_cycles;
+		op->block_bytes = (uint16_t) (end - chain[i]);
+	}
+
+	// Only an instruction straddling the end of memory wraps
+	for (unsigned i = pc; i < end; i++) {
+		cache->is_code[i & MEMORY_MASK] = 1;
+	}
+	cache->pages |= page_bit(pc) | page_bit(end - 1);
+	cache->blocks_built++;
+}
+
+bool chip8_cache_init(Chip8Cache *cache) {
+	memset(cache, 0, sizeof(*cache));
+	// Zeroed allocations this large are usually fresh mappings, so only the
+	// pages of entries that get decoded take up memory
+	cache->ops = calloc(CHIP8_MEMORY_SIZE, sizeof(*cache->ops));
+	cache->is_code = calloc(CHIP8_MEMORY_SIZE, 1);
+	if (cache->ops == NULL || cache->is_code == NULL) {
+		chip8_cache_destroy(cache);
+		return false;
+	}
+	return true;
+}
+
+void chip8_cache_reset(Chip8Cache *cache) {
+	for (uint64_t pages = cache->pages; pages != 0; pages &= pages - 1) {
+		size_t address = (size_t) __builtin_ctzll(pages) << CHIP8_PAGE_SHIFT;
+		memset(&cache->ops[address], 0, CHIP8_PAGE_SIZE * sizeof(*cache->ops));
+		memset(&cache->is_code[address], 0, CHIP8_PAGE_SIZE);
+	}
+	cache->pages = 0;
+	cache->blocks_built = 0;
+	cache->invalidations = 0;
+}
+
+void chip8_cache_destroy(Chip8Cache *cache) {
+	free(cache->ops);
+	free(cache->is_code);
+	memset(cache, 0, sizeof(*cache));
+}
+
+// Invalid entries charge nothing at block entry, see chip8_cache_loop.h
+static void invalidate_entry(Chip8Cache *cache, Chip8CacheOp *op) {
+	op->kind = K_INVALID;
+	op->block_cycles = 0;
+	cache->invalidations++;
+}
+
+void chip8_cache_invalidate(Chip8Cache *cache, unsigned short address,
+														unsigned short length) {
+	unsigned int end = address + length;
+	if (end > CHIP8_MEMORY_SIZE) {
+		// Writes wrap around to the start of memory
+		chip8_cache_invalidate(cache, 0, end - CHIP8_MEMORY_SIZE);
+		end = CHIP8_MEMORY_SIZE;
+	}
+
+	bool hits_code = false;
+	for (unsigned int i = address; i < end; i++) {
+		hits_code |= cache->is_code[i];
+	}
+	if (!hits_code) {
+		return;
+	}
+
+	// A stale entry is one whose block extends over the written bytes. Blocks
+	// stay within a page, except a lone instruction in the last byte of the
+	// page before, so it starts in the written pages or right in front.
+	unsigned int first = address & ~(unsigned int) (CHIP8_PAGE_SIZE - 1);
+	if (first > 0) {
+		first--;
+	} else if (cache->ops[MEMORY_MASK].kind != K_INVALID) {
+		invalidate_entry(cache, &cache->ops[MEMORY_MASK]);
+	}
+	for (unsigned int i = first; i < end; i++) {
+		Chip8CacheOp *op = &cache->ops[i];
+		if (op->kind != K_INVALID && i + op->block_bytes > address) {
+			invalidate_entry(cache, op);
+		}
+	}
+}
+
+// Runs one instruction on the interpreter, invalidating any code it stores
+// over; used for opcodes the cache leaves alone and at the end of a batch
+static void interpret(Chip8Cache *cache, Chip8 *chip8, unsigned quirks) {
+	unsigned short address = chip8->I;
+	int length = store_length(fetch_opcode(chip8, chip8->pc), quirks);
+	chip8_emulate_cycle(chip8);
+	if (length > 0) {
+		chip8_cache_invalidate(cache, address, (unsigned short) length);
+	}
+}
+
+// One copy of the run loop per quirk profile, see chip8_cache_loop.h
+#define CACHE_RUN run_vip
+#define CACHE_QUIRKS QUIRKS_VIP
+#include "chip8_cache_loop.h"
+#define CACHE_RUN run_chip48
+#define CACHE_QUIRKS QUIRKS_CHIP48
+#include "chip8_cache_loop.h"
+#define CACHE_RUN run_schip
+#define CACHE_QUIRKS QUIRKS_SCHIP
+#include "chip8_cache_loop.h"
+#define CACHE_RUN run_xochip
+#define CACHE_QUIRKS QUIRKS_XOCHIP
+#include "chip8_cache_loop.h"
+
+#define RUN_ENTRY(profile, suffix, flags) [profile] = run_##suffix,
+static int (*const run_functions[CHIP8_QUIRKS_COUNT])(Chip8Cache *, Chip8 *,
+																											int) = {
+		FOR_EACH_QUIRK_PROFILE(RUN_ENTRY)};
+
+int chip8_cache_run(Chip8Cache *cache, Chip8 *chip8, int cycles) {
+	chip8->idle = false;
+	return run_functions[chip8->quirks](cache, chip8, cycles);
+}
@@ -0,0 +1,232 @@
+/*
+ * Block cache run loop, included by chip8_cache.c once per quirk profile with
+ * CACHE_RUN naming the function and CACHE_QUIRKS its flags, like
+ * chip8_threaded.h.
+ *
+ * Only block entry looks up pc and checks the budget, charging the whole
+ * block up front. Within a block each entry jumps straight to the handler of
+ * the next one, which sits right after it in the entry array. Blocks the
+ * budget ends in are finished on the interpreter: none of their instructions
+ * before the last can jump or store. Same results as chip8_run, including
+ * idle skipping.
+ */
+
+#if !defined(CACHE_RUN) || !defined(CACHE_QUIRKS)
+#error "Define CACHE_RUN and CACHE_QUIRKS before including this file"
+#endif
+
+#ifdef CHIP8_CACHE_THREADED
+// Labels as values are a GNU extension that -Wpedantic reports
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+static int CACHE_RUN(Chip8Cache *cache, Chip8 *chip8, int cycles) {
+	const unsigned quirks = CACHE_QUIRKS;
+#ifdef CHIP8_CACHE_THREADED
+#define HANDLER_ADDRESS(kind) [kind] = &&kind,
+	static const void *const handlers[K_COUNT] = {
+			FOR_EACH_CACHE_KIND(HANDLER_ADDRESS)};
+#undef HANDLER_ADDRESS
+#define HANDLER(kind) kind
+#define DISPATCH() goto *handlers[op->kind]
+#else
+#define HANDLER(kind) case kind
+#define DISPATCH() goto dispatch
+#endif
+	// Entries advance by guest bytes, two per instruction
+#define NEXT(bytes)                                                            \
+	do {                                                                         \
+		op += (bytes);                                                             \
+		DISPATCH();                                                                \
+	} while (0)
+	// Instructions left after the current block
+	int remaining = cycles;
+	const Chip8CacheOp *op;
+
+	// Entries not decoded yet charge no cycles and dispatch to K_INVALID,
+	// which builds the block and comes back here
+block:
+	op = &cache->ops[chip8->pc];
+	if (op->block_cycles > remaining) {
+		for (; remaining > 0; remaining--) {
+			chip8_emulate_cycle(chip8);
+		}
+		return cycles;
+	}
+	remaining -= op->block_cycles;
+	DISPATCH();
+
+#ifndef CHIP8_CACHE_THREADED
+dispatch:
+	switch (op->kind) {
+#endif
+HANDLER(K_INVALID):
+	build_block(cache, chip8, chip8->pc);
+	goto block;
+HANDLER(K_CLS):
+	op_cls(chip8, quirks);
+	NEXT(2);
+HANDLER(K_RET):
+	op_ret(chip8);
+	goto block;
+HANDLER(K_JP):
+	op_jp(chip8, op->nnn);
+	remaining -= skip_idle_loop(chip8, remaining);
+	goto block;
+HANDLER(K_CALL):
+	op_call(chip8, op->nnn);
+	goto block;
+HANDLER(K_SE_IMM):
+	op_se_imm(chip8, op->x, op->nn, quirks);
+	goto block;
+HANDLER(K_SNE_IMM):
+	op_sne_imm(chip8, op->x, op->nn, quirks);
+	goto block;
+HANDLER(K_SE_REG):
+	op_se_reg(chip8, op->x, op->y, quirks);
+	goto block;
+HANDLER(K_LD_IMM):
+	op_ld_imm(chip8, op->x, op->nn);
+	NEXT(2);
+HANDLER(K_ADD_IMM):
+	op_add_imm(chip8, op->x, op->nn);
+	NEXT(2);
+HANDLER(K_LD_REG):
+	op_ld_reg(chip8, op->x, op->y);
+	NEXT(2);
+HANDLER(K_OR):
+	op_or(chip8, op->x, op->y, quirks);
+	NEXT(2);
+HANDLER(K_AND):
+	op_and(chip8, op->x, op->y, quirks);
+	NEXT(2);
+HANDLER(K_XOR):
+	op_xor(chip8, op->x, op->y, quirks);
+	NEXT(2);
+HANDLER(K_ADD_REG):
+	op_add_reg(chip8, op->x, op->y);
+	NEXT(2);
+HANDLER(K_SUB):
+	op_sub(chip8, op->x, op->y);
+	NEXT(2);
+HANDLER(K_SHR):
+	op_shr(chip8, op->x, op->y, quirks);
+	NEXT(2);
+HANDLER(K_SUBN):
+	op_subn(chip8, op->x, op->y);
+	NEXT(2);
+HANDLER(K_SHL):
+	op_shl(chip8, op->x, op->y, quirks);
+	NEXT(2);
+HANDLER(K_SNE_REG):
+	op_sne_reg(chip8, op->x, op->y, quirks);
+	goto block;
+HANDLER(K_LD_I):
+	op_ld_i(chip8, op->nnn);
+	NEXT(2);
+HANDLER(K_JP_V0):
+	op_jp_v0(chip8, op->x, op->nnn, quirks);
+	goto block;
+HANDLER(K_RND):
+	op_rnd(chip8, op->x, op->nn);
+	NEXT(2);
+HANDLER(K_DRW):
+	op_drw(chip8, op->x, op->y, op->n, quirks);
+	NEXT(2);
+HANDLER(K_SKP):
+	op_skp(chip8, op->x, quirks);
+	goto block;
+HANDLER(K_SKNP):
+	op_sknp(chip8, op->x, quirks);
+	goto block;
+HANDLER(K_LD_VX_DT):
+	op_ld_vx_dt(chip8, op->x);
+	NEXT(2);
+HANDLER(K_LD_VX_KEY):
+	op_ld_vx_key(chip8, op->x);
+	remaining -= skip_idle_loop(chip8, remaining);
+	goto block;
+HANDLER(K_LD_DT):
+	op_ld_dt(chip8, op->x);
+	NEXT(2);
+HANDLER(K_LD_ST):
+	op_ld_st(chip8, op->x);
+	NEXT(2);
+HANDLER(K_ADD_I):
+	op_add_i(chip8, op->x);
+	NEXT(2);
+HANDLER(K_LD_FONT):
+	op_ld_font(chip8, op->x);
+	NEXT(2);
+HANDLER(K_BCD): {
+	unsigned short address = chip8->I;
+	op_bcd(chip8, op->x);
+	chip8_cache_invalidate(cache, address, 3);
+	goto block;
+}
+HANDLER(K_STORE): {
+	unsigned short address = chip8->I;
+	op_store(chip8, op->x, quirks);
+	chip8_cache_invalidate(cache, address, op->x + 1);
+	goto block;
+}
+HANDLER(K_LOAD):
+	op_load(chip8, op->x, quirks);
+	NEXT(2);
+HANDLER(K_INTERPRET):
+	interpret(cache, chip8, quirks);
+	if ((chip8->opcode & 0xF000) == 0x1000 ||
+			(chip8->opcode & 0xF0FF) == 0xF00A) {
+		remaining -= skip_idle_loop(chip8, remaining);
+	}
+	goto block;
+HANDLER(K_LD_I_DRW):
+	op_ld_i(chip8, op->nnn);
+	op_drw(chip8, op->x, op->y, op->n, quirks);
+	NEXT(4);
+HANDLER(K_LD_IMM_LD_IMM):
+	chip8->V[op->x] = op->nn;
+	chip8->V[op->x2] = op->nn2;
+	chip8->pc += 4;
+	NEXT(4);
+HANDLER(K_ADD_IMM_SE):
+	op_add_imm(chip8, op->x, op->nn);
+	op_se_imm(chip8, op->x2, op->nn2, quirks);
+	goto block;
+HANDLER(K_ADD_IMM_SNE):
+	op_add_imm(chip8, op->x, op->nn);
+	op_sne_imm(chip8, op->x2, op->nn2, quirks);
+	goto block;
+HANDLER(K_LD_IMM_SKP):
+	op_ld_imm(chip8, op->x, op->nn);
+	op_skp(chip8, op->x2, quirks);
+	goto block;
+HANDLER(K_LD_IMM_SKNP):
+	op_ld_imm(chip8, op->x, op->nn);
+	op_sknp(chip8, op->x2, quirks);
+	goto block;
+HANDLER(K_LD_VX_DT_SE):
+	op_ld_vx_dt(chip8, op->x);
+	op_se_imm(chip8, op->x2, op->nn2, quirks);
+	goto block;
+HANDLER(K_LD_VX_DT_SNE):
+	op_ld_vx_dt(chip8, op->x);
+	op_sne_imm(chip8, op->x2, op->nn2, quirks);
+	goto block;
+#ifndef CHIP8_CACHE_THREADED
+	}
+	goto block;
+#endif
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+}
+
+#ifdef CHIP8_CACHE_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+#undef CACHE_RUN
+#undef CACHE_QUIRKS
@@ -0,0 +1,134 @@
+#ifndef CHIP8_DISPATCH_H
+#define CHIP8_DISPATCH_H
+
+/*
+ * Handler of every one of the 65536 opcodes, for the threaded interpreter in
+ * chip8_threaded.h. Internal to chip8.c. The table is one byte per opcode and
+ * is filled in by the preprocessor at build time: it pastes the four nibbles
+ * of each opcode into a literal, and the macro for the high nibble sorts it.
+ * Opcodes that only exist in some profiles get a handler that tests the
+ * quirks, which the per-profile copies of the loop fold away.
+ */
+
+#include <stdint.h>
+
+enum {
+	H_CLS,
+	H_RET,
+	H_SYSTEM, // 0NNN: SUPER-CHIP/XO-CHIP system opcodes, or SYS
+	H_JP,
+	H_CALL,
+	H_SE_IMM,
+	H_SNE_IMM,
+	H_SE_REG,
+	H_SAVE_RANGE, // 5XY2 on XO-CHIP, 5XY0 elsewhere
+	H_LOAD_RANGE, // 5XY3 on XO-CHIP, 5XY0 elsewhere
+	H_LD_IMM,
+	H_ADD_IMM,
+	// 8XY0 to 8XY7, in opcode order
+	H_LD_REG,
+	H_OR,
+	H_AND,
+	H_XOR,
+	H_ADD_REG,
+	H_SUB,
+	H_SHR,
+	H_SUBN,
+	H_SHL,
+	H_SNE_REG,
+	H_LD_I,
+	H_JP_V0,
+	H_RND,
+	H_DRW,
+	H_SKP,
+	H_SKNP,
+	H_LD_I_LONG,
+	H_PLANES,
+	H_LD_PATTERN,
+	H_LD_VX_DT,
+	H_LD_VX_KEY,
+	H_LD_DT,
+	H_LD_ST,
+	H_ADD_I,
+	H_LD_FONT,
+	H_LD_BIG_FONT,
+	H_BCD,
+	H_PITCH,
+	H_STORE,
+	H_LOAD,
+	H_SAVE_FLAGS,
+	H_LOAD_FLAGS,
+	H_UNKNOWN,
+	H_COUNT,
+};
+
+#define HANDLER(a, b, c, d) HANDLER_##a(0x##a##b##c##d, 0x##c##d, 0x##d)
+#define HANDLER_0(op, nn, n)                                                   \
+	((op) == 0x00E0 ? H_CLS : (op) == 0x00EE ? H_RET : H_SYSTEM)
+#define HANDLER_1(op, nn, n) H_JP
+#define HANDLER_2(op, nn, n) H_CALL
+#define HANDLER_3(op, nn, n) H_SE_IMM
+#define HANDLER_4(op, nn, n) H_SNE_IMM
+#define HANDLER_5(op, nn, n)                                                   \
+	((n) == 0x2 ? H_SAVE_RANGE : (n) == 0x3 ? H_LOAD_RANGE : H_SE_REG)
+#define HANDLER_6(op, nn, n) H_LD_IMM
+#define HANDLER_7(op, nn, n) H_ADD_IMM
+#define HANDLER_8(op, nn, n)                                                   \
+	((n) <= 0x7 ? H_LD_REG + (n) : (n) == 0xE ? H_SHL : H_UNKNOWN)
+#define HANDLER_9(op, nn, n) H_SNE_REG
+#define HANDLER_A(op, nn, n) H_LD_I
+#define HANDLER_B(op, nn, n) H_JP_V0
+#define HANDLER_C(op, nn, n) H_RND
+#define HANDLER_D(op, nn, n) H_DRW
+#define HANDLER_E(op, nn, n)                                                   \
+	((nn) == 0x9E ? H_SKP : (nn) == 0xA1 ? H_SKNP : H_UNKNOWN)
+#define HANDLER_F(op, nn, n)                                                   \
+	((op) == 0xF000	 ? H_LD_I_LONG                                               \
+	 : (nn) == 0x01	 ? H_PLANES                                                  \
+	 : (op) == 0xF002 ? H_LD_PATTERN                                             \
+	 : (nn) == 0x07	 ? H_LD_VX_DT                                                \
+	 : (nn) == 0x0A	 ? H_LD_VX_KEY                                               \
+	 : (nn) == 0x15	 ? H_LD_DT                                                   \
+	 : (nn) == 0x18	 ? H_LD_ST                                                   \
+	 : (nn) == 0x1E	 ? H_ADD_I                                                   \
+	 : (nn) == 0x29	 ? H_LD_FONT                                                 \
+	 : (nn) == 0x30	 ? H_LD_BIG_FONT                                             \
+	 : (nn) == 0x33	 ? H_BCD                                                     \
+	 : (nn) == 0x3A	 ? H_PITCH                                                   \
+	 : (nn) == 0x55	 ? H_STORE                                                   \
+	 : (nn) == 0x65	 ? H_LOAD                                                    \
+	 : (nn) == 0x75	 ? H_SAVE_FLAGS                                              \
+	 : (nn) == 0x85	 ? H_LOAD_FLAGS                                              \
+										: H_UNKNOWN)
+
+// 16, 256 and 4096 consecutive opcodes
+#define HANDLERS_16(a, b, c)                                                   \
+	HANDLER(a, b, c, 0), HANDLER(a, b, c, 1), HANDLER(a, b, c, 2),               \
+			HANDLER(a, b, c, 3), HANDLER(a, b, c, 4), HANDLER(a, b, c, 5),           \
+			HANDLER(a, b, c, 6), HANDLER(a, b, c, 7), HANDLER(a, b, c, 8),           \
+			HANDLER(a, b, c, 9), HANDLER(a, b, c, A), HANDLER(a, b, c, B),           \
+			HANDLER(a, b, c, C), HANDLER(a, b, c, D), HANDLER(a, b, c, E),           \
+			HANDLER(a, b, c, F)
+#define HANDLERS_256(a, b)                                                     \
+	HANDLERS_16(a, b, 0), HANDLERS_16(a, b, 1), HANDLERS_16(a, b, 2),            \
+			HANDLERS_16(a, b, 3), HANDLERS_16(a, b, 4), HANDLERS_16(a, b, 5),        \
+			HANDLERS_16(a, b, 6), HANDLERS_16(a, b, 7), HANDLERS_16(a, b, 8),        \
+			HANDLERS_16(a, b, 9), HANDLERS_16(a, b, A), HANDLERS_16(a, b, B),        \
+			HANDLERS_16(a, b, C), HANDLERS_16(a, b, D), HANDLERS_16(a, b, E),        \
+			HANDLERS_16(a, b, F)
+#define HANDLERS_4096(a)                                                       \
+	HANDLERS_256(a, 0), HANDLERS_256(a, 1), HANDLERS_256(a, 2),                  \
+			HANDLERS_256(a, 3), HANDLERS_256(a, 4), HANDLERS_256(a, 5),              \
+			HANDLERS_256(a, 6), HANDLERS_256(a, 7), HANDLERS_256(a, 8),              \
+			HANDLERS_256(a, 9), HANDLERS_256(a, A), HANDLERS_256(a, B),              \
+			HANDLERS_256(a, C), HANDLERS_256(a, D), HANDLERS_256(a, E),              \
+			HANDLERS_256(a, F)
+
+static const uint8_t opcode_handlers[65536] = {
+		HANDLERS_4096(0), HANDLERS_4096(1), HANDLERS_4096(2), HANDLERS_4096(3),
+		HANDLERS_4096(4), HANDLERS_4096(5), HANDLERS_4096(6), HANDLERS_4096(7),
+		HANDLERS_4096(8), HANDLERS_4096(9), HANDLERS_4096(A), HANDLERS_4096(B),
+		HANDLERS_4096(C), HANDLERS_4096(D), HANDLERS_4096(E), HANDLERS_4096(F),
+};
+
+#endif
@@ -0,0 +1,934 @@
+#include "chip8_jit.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// block_at markers besides a block index
+#define BLOCK_NONE -1
+#define BLOCK_INTERPRET -2
+
+// Worst case code size of one translated guest instruction: an interpreted
+// one spills and reloads every host V register around the call
+#define MAX_OP_BYTES 256
+// The exit stub sits at the start of the arena, the enter stub after it, and
+// blocks follow
+#define ENTER_OFFSET 128
+#define STUBS_SIZE 256
+
+// x86 register numbers as encoded in ModRM and REX
+enum {
+	RAX,
+	RCX,
+	RDX,
+	RBX,
+	RSP,
+	RBP,
+	RSI,
+	RDI,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15,
+};
+#define AL RAX
+#define CL RCX
+
+/*
+ * Translated code keeps the Chip8 pointer in rbx, the cycles left in r12d and
+ * the entry table in r13, with rax and rcx as scratch. V registers get the
+ * rest; caller-saved ones too, since every call out spills and reloads them.
+ */
+static const uint8_t HOST_REGISTERS[CHIP8_JIT_HOST_V] = {
+		RDX, RSI, RDI, R8, R9, R10, R11, RBP, R14, R15};
+
+typedef struct {
+	uint8_t *code;
+	size_t length;
+	// Host register of each V register, -1 where it stays in memory
+	const int8_t *host;
+} Emitter;
+
+static void emit8(Emitter *e, uint8_t byte) {
+	e->code[e->length++] = byte;
+}
+
+static void emit16(Emitter *e, uint16_t value) {
+	memcpy(&e->code[e->length], &value, sizeof(value));
+	e->length += sizeof(value);
+}
+
+static void emit32(Emitter *e, uint32_t value) {
+	memcpy(&e->code[e->length], &value, sizeof(value));
+	e->length += sizeof(value);
+}
+
+static void emit64(Emitter *e, uint64_t value) {
+	memcpy(&e->code[e->length], &value, sizeof(value));
+	e->length += sizeof(value);
+}
+
+// Opcodes above 0xFF are the two-byte 0F xx ones
+static void emit_opcode(Emitter *e, unsigned opcode) {
+	if (opcode > 0xFF) {
+		emit8(e, opcode >> 8);
+	}
+	emit8(e, opcode & 0xFF);
+}
+
+/*
+ * `opcode reg, [rbx + offset]`: guest state is addressed off the Chip8
+ * pointer. `reg` is the register in ModRM.reg or the opcode extension;
+ * byte_reg marks it as an 8-bit operand, where spl-dil need a REX prefix.
+ */
+static void emit_state(Emitter *e, unsigned opcode, uint8_t reg, bool byte_reg,
+											 size_t offset) {
+	if (reg >= R8) {
+		emit8(e, 0x44);
+	} else if (byte_reg && reg >= RSP) {
+		emit8(e, 0x40);
+	}
+	emit_opcode(e, opcode);
+	emit8(e, 0x80 | (reg & 7) << 3 | RBX);
+	emit32(e, (uint32_t) offset);
+}
+
+#define V_OFFSET(x) (offsetof(Chip8, V) + (x))
+
+// `opcode reg, VX` on the byte VX, in its host register or in memory
+static void emit_v(Emitter *e, unsigned opcode, uint8_t reg, int x) {
+	int host = e->host[x];
+	if (host < 0) {
+		emit_state(e, opcode, reg, false, V_OFFSET(x));
+		return;
+	}
+	if (host >= R8) {
+		emit8(e, 0x41);
+	} else if (host >= RSP) {
+		emit8(e, 0x40);
+	}
+	emit_opcode(e, opcode);
+	emit8(e, 0xC0 | (reg & 7) << 3 | (host & 7));
+}
+
+#define emit_load_v(e, reg, x) emit_v(e, 0x8A, reg, x)	// mov r8, VX
+#define emit_store_v(e, reg, x) emit_v(e, 0x88, reg, x) // mov VX, r8
+
+// mov r8, byte [rbx + offset]
+static void emit_load8(Emitter *e, uint8_t reg, size_t offset) {
+	emit_state(e, 0x8A, reg, true, offset);
+}
+
+// mov byte [rbx + offset], r8
+static void emit_store8(Emitter *e, uint8_t reg, size_t offset) {
+	emit_state(e, 0x88, reg, true, offset);
+}
+
+// mov word [rbx + offset], imm16
+static void emit_store16_imm(Emitter *e, size_t offset, uint16_t value) {
+	emit8(e, 0x66);
+	emit_state(e, 0xC7, 0, false, offset);
+	emit16(e, value);
+}
+
+// movzx eax, word [rbx + offset]
+static void emit_load16(Emitter *e, size_t offset) {
+	emit_state(e, 0x0FB7, RAX, false, offset);
+}
+
+// mov word [rbx + offset], ax
+static void emit_store16(Emitter *e, size_t offset) {
+	emit8(e, 0x66);
+	emit_state(e, 0x89, RAX, false, offset);
+}
+
+static void emit_set_pc(Emitter *e, uint16_t pc) {
+	emit_store16_imm(e, offsetof(Chip8, pc), pc);
+}
+
+// Writes the host V registers back before C code looks at the machine
+static void emit_spill(Emitter *e) {
+	for (int x = 0; x < 16; x++) {
+		if (e->host[x] >= 0) {
+			emit_store8(e, (uint8_t) e->host[x], V_OFFSET(x));
+		}
+	}
+}
+
+// Reads them again after C code may have changed them
+static void emit_reload(Emitter *e) {
+	for (int x = 0; x < 16; x++) {
+		if (e->host[x] >= 0) { // movzx r32, byte [VX]
+			emit_state(e, 0x0FB6, (uint8_t) e->host[x], false, V_OFFSET(x));
+		}
+	}
+}
+
+// jmp [r13 + rax * 8]: continues at the guest address in eax
+static void emit_dispatch(Emitter *e) {
+	emit8(e, 0x41);
+	emit8(e, 0xFF);
+	emit8(e, 0x64);
+	emit8(e, 0xC5);
+	emit8(e, 0x00);
+}
+
+// Continues at pc as set by the interpreter
+static void emit_dispatch_pc(Emitter *e) {
+	emit_load16(e, offsetof(Chip8, pc));
+	emit_dispatch(e);
+}
+
+// Continues at a fixed guest address, also left in eax for the exit stub:
+// mov eax, target; jmp [r13 + target * 8]
+static void emit_jump(Emitter *e, uint16_t target) {
+	emit8(e, 0xB8);
+	emit32(e, target);
+	emit8(e, 0x41);
+	emit8(e, 0xFF);
+	emit8(e, 0xA5);
+	emit32(e, (uint32_t) target * sizeof(uint8_t *));
+}
+
+// Returns to C with the guest address in eax as the new pc
+static void emit_exit(Emitter *e, const uint8_t *exit) {
+	emit8(e, 0xE9); // jmp rel32
+	emit32(e, (uint32_t) (exit - (e->code + e->length + 4)));
+}
+
+// Skips `length` bytes when the jcc condition holds, else continues at pc + 2
+static void emit_skip(Emitter *e, uint16_t pc, int length, uint8_t jcc) {
+	emit8(e, jcc); // jcc over the jump to pc + 2
+	emit8(e, 12);
+	emit_jump(e, pc + 2);
+	emit_jump(e, pc + length);
+}
+
+#define JB 0x72
+#define JAE 0x73
+#define JE 0x74
+#define JNE 0x75
+
+// mov rax, imm64; call rax
+static void emit_call(Emitter *e, uint64_t function) {
+	emit8(e, 0x48);
+	emit8(e, 0xB8);
+	emit64(e, function);
+	emit8(e, 0xFF);
+	emit8(e, 0xD0);
+}
+
+// Runs one guest instruction through the profile's interpreter from inside
+// a block
+static void emit_interpret(Emitter *e, uint16_t pc, Chip8Quirks quirks) {
+	emit_set_pc(e, pc);
+	emit_spill(e);
+	emit8(e, 0x48); // mov rdi, rbx
+	emit8(e, 0x89);
+	emit8(e, 0xDF);
+	emit_call(e, (uint64_t) (uintptr_t) chip8_cycle_function(quirks));
+	emit_reload(e);
+}
+
+// FX33/FX55/5XY2: interpret, then drop any block the write landed in
+static void jit_write_helper(Chip8 *chip8, Chip8Jit *jit) {
+	unsigned short opcode = fetch_opcode(chip8, chip8->pc);
+	unsigned short address = chip8->I;
+	int length = store_length(opcode, quirk_flags(chip8->quirks));
+	chip8_emulate_cycle(chip8);
+	chip8_jit_invalidate(jit, address, length);
+}
+
+static void emit_write(Emitter *e, uint16_t pc, Chip8Jit *jit) {
+	emit_set_pc(e, pc);
+	emit_spill(e);
+	emit8(e, 0x48); // mov rdi, rbx
+	emit8(e, 0x89);
+	emit8(e, 0xDF);
+	emit8(e, 0x48); // mov rsi, imm64
+	emit8(e, 0xBE);
+	emit64(e, (uint64_t) (uintptr_t) jit);
+	emit_call(e, (uint64_t) (uintptr_t) jit_write_helper);
+	emit_reload(e);
+}
+
+// ALU ops that compute VX into al and the flag into cl, then write VX and VF
+static void emit_alu(Emitter *e, int x, int y, int n, unsigned quirks) {
+	// Shifts read VX in place instead of VY
+	if ((n == 0x6 || n == 0xE) && (quirks & QUIRK_SHIFT_VX)) {
+		y = x;
+	}
+
+	switch (n) {
+	case 0x0: // 8XY0
+		emit_load_v(e, AL, y);
+		emit_store_v(e, AL, x);
+		return;
+	case 0x1: // 8XY1
+	case 0x2: // 8XY2
+	case 0x3: // 8XY3
+	{
+		static const uint8_t op_al_rm[4] = {0, 0x0A, 0x22, 0x32};
+		emit_load_v(e, AL, x);
+		emit_v(e, op_al_rm[n], AL, y); // or/and/xor al, VY
+		emit_store_v(e, AL, x);
+		if (quirks & QUIRK_VF_RESET) {
+			emit_v(e, 0xC6, 0, 0xF); // mov VF, 0
+			emit8(e, 0);
+		}
+		return;
+	}
+	case 0x4: // 8XY4
+		emit_load_v(e, AL, x);
+		emit_v(e, 0x02, AL, y); // add al, VY
+		emit8(e, 0x0F);					// setc cl
+		emit8(e, 0x92);
+		emit8(e, 0xC1);
+		break;
+	case 0x5: // 8XY5
+	case 0x7: // 8XY7
+		emit_load_v(e, AL, n == 0x5 ? x : y);
+		emit_v(e, 0x2A, AL, n == 0x5 ? y : x); // sub al, VY or VX
+		emit8(e, 0x0F);												 // setnc cl
+		emit8(e, 0x93);
+		emit8(e, 0xC1);
+		break;
+	case 0x6: // 8XY6
+		emit_load_v(e, AL, y);
+		emit8(e, 0x88); // mov cl, al
+		emit8(e, 0xC1);
+		emit8(e, 0x80); // and cl, 1
+		emit8(e, 0xE1);
+		emit8(e, 0x01);
+		emit8(e, 0xD0); // shr al, 1
+		emit8(e, 0xE8);
+		break;
+	case 0xE: // 8XYE
+		emit_load_v(e, AL, y);
+		emit8(e, 0x88); // mov cl, al
+		emit8(e, 0xC1);
+		emit8(e, 0xC0); // shr cl, 7
+		emit8(e, 0xE9);
+		emit8(e, 0x07);
+		emit8(e, 0xD0); // shl al, 1
+		emit8(e, 0xE0);
+		break;
+	}
+	emit_store_v(e, AL, x);
+	emit_store_v(e, CL, 0xF);
+}
+
+typedef enum {
+	OP_NATIVE,				// translated inline, falls through
+	OP_INTERPRET,			// called through the interpreter, falls through
+	OP_BRANCH,				// translated inline, jumps and ends the block
+	OP_INTERPRET_END, // called through the interpreter and ends the block
+	OP_WRITE,					// writes memory, ends the block
+	OP_WAIT,					// never translated, left to the interpreter
+} OpClass;
+
+static OpClass classify(unsigned short opcode, unsigned quirks) {
+	int n = opcode & 0x000F;
+	unsigned char nn = opcode & 0x00FF;
+
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00EE) {
+			return OP_BRANCH;
+		}
+		// SUPER-CHIP's 00FD exit leaves pc in place
+		if (opcode != 0x00E0 && (quirks & QUIRK_SCHIP_OPS)) {
+			return OP_INTERPRET_END;
+		}
+		return OP_INTERPRET;
+	case 0x5000:
+		if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x2) {
+			return OP_WRITE;
+		}
+		if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x3) {
+			return OP_INTERPRET;
+		}
+		return OP_BRANCH;
+	case 0x1000:
+	case 0x2000:
+	case 0x3000:
+	case 0x4000:
+	case 0x9000:
+		return OP_BRANCH;
+	case 0xB000:
+		return OP_INTERPRET_END;
+	case 0xE000:
+		return (nn == 0x9E || nn == 0xA1) ? OP_BRANCH : OP_INTERPRET_END;
+	case 0x6000:
+	case 0x7000:
+	case 0xA000:
+		return OP_NATIVE;
+	case 0x8000:
+		return (n <= 0x7 || n == 0xE) ? OP_NATIVE : OP_INTERPRET_END;
+	case 0xC000:
+	case 0xD000:
+		return OP_INTERPRET;
+	default: // 0xF000
+		switch (nn) {
+		case 0x07:
+		case 0x15:
+		case 0x18:
+		case 0x1E:
+		case 0x29:
+			return OP_NATIVE;
+		case 0x0A:
+			return OP_WAIT;
+		case 0x33:
+		case 0x55:
+			return OP_WRITE;
+		case 0x65:
+			return OP_INTERPRET;
+		default:
+			return OP_INTERPRET_END;
+		}
+	}
+}
+
+static bool is_skip(unsigned short opcode) {
+	switch (opcode & 0xF000) {
+	case 0x3000:
+	case 0x4000:
+	case 0x5000:
+	case 0x9000:
+	case 0xE000:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void emit_native(Emitter *e, unsigned short opcode, unsigned quirks) {
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	unsigned char nn = opcode & 0x00FF;
+	unsigned short nnn = opcode & 0x0FFF;
+
+	switch (opcode & 0xF000) {
+	case 0x6000: // 6XNN
+		emit_v(e, 0xC6, 0, x);
+		emit8(e, nn);
+		break;
+	case 0x7000: // 7XNN
+		emit_v(e, 0x80, 0, x);
+		emit8(e, nn);
+		break;
+	case 0x8000:
+		emit_alu(e, x, y, opcode & 0x000F, quirks);
+		break;
+	case 0xA000: // ANNN
+		emit_store16_imm(e, offsetof(Chip8, I), nnn);
+		break;
+	case 0xF000:
+		switch (nn) {
+		case 0x07: // FX07
+			emit_load8(e, AL, offsetof(Chip8, delay_timer));
+			emit_store_v(e, AL, x);
+			break;
+		case 0x15: // FX15
+			emit_load_v(e, AL, x);
+			emit_store8(e, AL, offsetof(Chip8, delay_timer));
+			break;
+		case 0x18: // FX18
+			emit_load_v(e, AL, x);
+			emit_store8(e, AL, offsetof(Chip8, sound_timer));
+			break;
+		case 0x1E:									// FX1E
+			emit_v(e, 0x0FB6, RAX, x); // movzx eax, VX
+			emit8(e, 0x66);						// add word [I], ax
+			emit_state(e, 0x01, RAX, false, offsetof(Chip8, I));
+			break;
+		case 0x29:									// FX29
+			emit_v(e, 0x0FB6, RAX, x); // movzx eax, VX
+			emit8(e, 0x83);						// and eax, 0xF
+			emit8(e, 0xE0);
+			emit8(e, 0x0F);
+			emit8(e, 0x8D); // lea eax, [rax + rax * 4]
+			emit8(e, 0x04);
+			emit8(e, 0x80);
+			emit_store16(e, offsetof(Chip8, I));
+			break;
+		}
+		break;
+	}
+}
+
+// Whether the 1NNN at `pc` closes a loop idle_loop_length recognizes, which
+// is left to C so skip_idle_loop can fast-forward it
+static bool closes_idle_loop(const Chip8 *chip8, unsigned short pc,
+														 unsigned short nnn) {
+	if (nnn == pc) {
+		return true;
+	}
+	unsigned short poll = fetch_opcode(chip8, nnn);
+	unsigned short test = fetch_opcode(chip8, nnn + 2);
+	return nnn + 4 == pc && (poll & 0xF0FF) == 0xF007 &&
+				 ((test & 0xF000) == 0x3000 || (test & 0xF000) == 0x4000) &&
+				 (test & 0x0F00) == (poll & 0x0F00);
+}
+
+// Ends a block with an OP_BRANCH instruction; skips jump `skip` bytes
+static void emit_branch(Emitter *e, const Chip8 *chip8, unsigned short opcode,
+												uint16_t pc, int skip, const uint8_t *exit) {
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	unsigned char nn = opcode & 0x00FF;
+	unsigned short nnn = opcode & 0x0FFF;
+
+	switch (opcode & 0xF000) {
+	case 0x0000: // 00EE
+		emit_load16(e, offsetof(Chip8, sp));
+		emit8(e, 0xFF); // dec eax
+		emit8(e, 0xC8);
+		emit8(e, 0x83); // and eax, 0xF
+		emit8(e, 0xE0);
+		emit8(e, 0x0F);
+		emit_store16(e, offsetof(Chip8, sp));
+		emit8(e, 0x0F); // movzx eax, word [rbx + rax * 2 + stack]
+		emit8(e, 0xB7);
+		emit8(e, 0x84);
+		emit8(e, 0x43);
+		emit32(e, (uint32_t) offsetof(Chip8, stack));
+		emit8(e, 0x83); // add eax, 2
+		emit8(e, 0xC0);
+		emit8(e, 0x02);
+		emit8(e, 0x0F); // movzx eax, ax
+		emit8(e, 0xB7);
+		emit8(e, 0xC0);
+		emit_dispatch(e);
+		break;
+	case 0x1000: // 1NNN
+		if (closes_idle_loop(chip8, pc, nnn)) {
+			emit8(e, 0xB8); // mov eax, nnn
+			emit32(e, nnn);
+			emit_exit(e, exit);
+		} else {
+			emit_jump(e, nnn);
+		}
+		break;
+	case 0x2000: // 2NNN
+		emit_load16(e, offsetof(Chip8, sp));
+		emit8(e, 0x83); // and eax, 0xF
+		emit8(e, 0xE0);
+		emit8(e, 0x0F);
+		emit8(e, 0x66); // mov word [rbx + rax * 2 + stack], pc
+		emit8(e, 0xC7);
+		emit8(e, 0x84);
+		emit8(e, 0x43);
+		emit32(e, (uint32_t) offsetof(Chip8, stack));
+		emit16(e, pc);
+		emit8(e, 0xFF); // inc eax
+		emit8(e, 0xC0);
+		emit8(e, 0x83); // and eax, 0xF
+		emit8(e, 0xE0);
+		emit8(e, 0x0F);
+		emit_store16(e, offsetof(Chip8, sp));
+		emit_jump(e, nnn);
+		break;
+	case 0x3000: // 3XNN
+	case 0x4000: // 4XNN
+		emit_v(e, 0x80, 7, x); // cmp VX, nn
+		emit8(e, nn);
+		emit_skip(e, pc, skip, (opcode & 0xF000) == 0x3000 ? JE : JNE);
+		break;
+	case 0x5000: // 5XY0
+	case 0x9000: // 9XY0
+		emit_load_v(e, AL, x);
+		emit_v(e, 0x3A, AL, y); // cmp al, VY
+		emit_skip(e, pc, skip, (opcode & 0xF000) == 0x5000 ? JE : JNE);
+		break;
+	case 0xE000:								 // EX9E, EXA1
+		emit_v(e, 0x0FB6, RCX, x); // movzx ecx, VX
+		emit8(e, 0x83);						 // and ecx, 0xF
+		emit8(e, 0xE1);
+		emit8(e, 0x0F);
+		emit_load16(e, offsetof(Chip8, keys));
+		emit8(e, 0x0F); // bt eax, ecx
+		emit8(e, 0xA3);
+		emit8(e, 0xC8);
+		emit_skip(e, pc, skip, nn == 0x9E ? JB : JAE);
+		break;
+	}
+}
+
+/*
+ * Exit: stores pc from eax, spills and returns the cycles left to C.
+ * Enter: saves the callee-saved registers, loads the fixed ones and the V
+ * registers and dispatches on pc. Both use the current host mapping, so they
+ * are emitted again with every new one.
+ */
+static void emit_stubs(Chip8Jit *jit) {
+	static const uint8_t pop_all[] = {
+			0x48, 0x83, 0xC4, 0x08, // add rsp, 8
+			0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,
+			0xC3 // pop r15 ... rbx, ret
+	};
+	static const uint8_t push_all[] = {
+			0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
+			0x48, 0x83, 0xEC, 0x08, // push rbx ... r15, sub rsp, 8
+			0x48, 0x89, 0xFB,				// mov rbx, rdi
+			0x41, 0x89, 0xF4,				// mov r12d, esi
+			0x49, 0xBD							// mov r13, imm64
+	};
+
+	Emitter e = {.code = jit->arena, .length = 0, .host = jit->host};
+	emit_store16(&e, offsetof(Chip8, pc));
+	emit_spill(&e);
+	emit8(&e, 0x44); // mov eax, r12d
+	emit8(&e, 0x89);
+	emit8(&e, 0xE0);
+	for (size_t i = 0; i < sizeof(pop_all); i++) {
+		emit8(&e, pop_all[i]);
+	}
+
+	e.length = ENTER_OFFSET;
+	for (size_t i = 0; i < sizeof(push_all); i++) {
+		emit8(&e, push_all[i]);
+	}
+	emit64(&e, (uint64_t) (uintptr_t) jit->entry);
+	emit_reload(&e);
+	emit_dispatch_pc(&e);
+
+	// ISO C has no object to function pointer cast, copy the address instead
+	uint8_t *enter = jit->arena + ENTER_OFFSET;
+	memcpy(&jit->enter, &enter, sizeof(jit->enter));
+}
+
+// Gives the host registers to the V registers the ROM image names most
+static void choose_host_registers(Chip8Jit *jit, const Chip8 *chip8) {
+	unsigned long uses[16] = {0};
+	for (size_t address = 0x200; address + 1 < 0x200 + chip8->rom_size &&
+															 address + 1 < CHIP8_MEMORY_SIZE;
+			 address += 2) {
+		unsigned short opcode = fetch_opcode(chip8, (unsigned short) address);
+		int x = (opcode & 0x0F00) >> 8;
+		int y = (opcode & 0x00F0) >> 4;
+		switch (opcode & 0xF000) {
+		case 0x8000:
+		case 0xD000:
+			uses[0xF]++;
+			// fall through
+		case 0x5000:
+		case 0x9000:
+			uses[y]++;
+			// fall through
+		case 0x3000:
+		case 0x4000:
+		case 0x6000:
+		case 0x7000:
+		case 0xC000:
+		case 0xE000:
+		case 0xF000:
+			uses[x]++;
+			break;
+		}
+	}
+
+	memset(jit->host, -1, sizeof(jit->host));
+	for (int i = 0; i < CHIP8_JIT_HOST_V; i++) {
+		int best = -1;
+		for (int x = 0; x < 16; x++) {
+			if (jit->host[x] < 0 && (best < 0 || uses[x] > uses[best])) {
+				best = x;
+			}
+		}
+		jit->host[best] = (int8_t) HOST_REGISTERS[i];
+	}
+}
+
+/*
+ * Switches the arena pages holding [offset, offset + length) between writable
+ * and executable. The arena is never both, so a stray guest-controlled store
+ * cannot plant host code; blocks are emitted between two of these calls.
+ */
+static bool protect(Chip8Jit *jit, size_t offset, size_t length, int prot) {
+	size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+	size_t start = offset & ~(page_size - 1);
+	size_t end = offset + length;
+	if (end > CHIP8_JIT_ARENA_SIZE) {
+		end = CHIP8_JIT_ARENA_SIZE;
+	}
+	return mprotect(jit->arena + start, end - start, prot) == 0;
+}
+
+static void flush(Chip8Jit *jit) {
+	for (size_t i = 0; i < CHIP8_MEMORY_SIZE; i++) {
+		jit->entry[i] = jit->arena;
+	}
+	memset(jit->block_at, 0xFF, sizeof(jit->block_at));
+	memset(jit->is_code, 0, sizeof(jit->is_code));
+	jit->num_blocks = 0;
+	// The stubs go first again, with the mapping chosen for the next block
+	jit->arena_used = 0;
+	jit->flushes++;
+}
+
+bool chip8_jit_init(Chip8Jit *jit) {
+	memset(jit, 0, sizeof(*jit));
+	void *arena = mmap(NULL, CHIP8_JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+										 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (arena == MAP_FAILED) {
+		jit->arena = NULL;
+		return false;
+	}
+	jit->arena = arena;
+	chip8_jit_reset(jit);
+	return true;
+}
+
+void chip8_jit_reset(Chip8Jit *jit) {
+	flush(jit);
+	jit->blocks_compiled = 0;
+	jit->invalidations = 0;
+	jit->flushes = 0;
+	jit->interpreted_cycles = 0;
+}
+
+void chip8_jit_destroy(Chip8Jit *jit) {
+	if (jit->arena != NULL) {
+		munmap(jit->arena, CHIP8_JIT_ARENA_SIZE);
+		jit->arena = NULL;
+	}
+}
+
+static void mark_interpreted(Chip8Jit *jit, unsigned short pc) {
+	jit->block_at[pc] = BLOCK_INTERPRET;
+	jit->is_code[pc] = jit->is_code[(pc + 1) & MEMORY_MASK] = 1;
+}
+
+/*
+ * Translates the block at pc. Each one starts by charging its cycles and
+ * exits to C if the budget does not cover them, ends jumping through the
+ * entry table, and stays within the page of guest memory pc is in. An
+ * instruction straddling the page end, and FX0A, are left to the
+ * interpreter.
+ */
+static int compile_block(Chip8Jit *jit, const Chip8 *chip8,
+												 unsigned short pc) {
+	unsigned quirks = quirk_flags(jit->quirks);
+	unsigned page_end =
+			(pc & ~(unsigned) (CHIP8_PAGE_SIZE - 1)) + CHIP8_PAGE_SIZE;
+	if (pc + 2u > page_end ||
+			classify(fetch_opcode(chip8, pc), quirks) == OP_WAIT) {
+		mark_interpreted(jit, pc);
+		return BLOCK_INTERPRET;
+	}
+
+	size_t worst_case = STUBS_SIZE + (CHIP8_JIT_MAX_BLOCK_LEN + 2) * MAX_OP_BYTES;
+	if (jit->num_blocks == CHIP8_JIT_MAX_BLOCKS ||
+			jit->arena_used + worst_case > CHIP8_JIT_ARENA_SIZE) {
+		flush(jit);
+	}
+	size_t first = jit->arena_used;
+	if (!protect(jit, first, worst_case, PROT_READ | PROT_WRITE)) {
+		return BLOCK_INTERPRET;
+	}
+	if (jit->arena_used == 0) {
+		choose_host_registers(jit, chip8);
+		emit_stubs(jit);
+		jit->arena_used = STUBS_SIZE;
+	}
+
+	Emitter e = {
+			.code = jit->arena + jit->arena_used, .length = 0, .host = jit->host};
+	emit8(&e, 0x41); // sub r12d, cycles
+	emit8(&e, 0x83);
+	emit8(&e, 0xEC);
+	size_t charge = e.length;
+	emit8(&e, 0);
+	emit8(&e, 0x0F); // jb overdrawn
+	emit8(&e, 0x82);
+	size_t overdrawn = e.length;
+	emit32(&e, 0);
+
+	unsigned address = pc;
+	unsigned end = pc;
+	uint16_t cycles = 0;
+	for (;;) {
+		if (cycles == CHIP8_JIT_MAX_BLOCK_LEN || address + 2 > page_end) {
+			emit_jump(&e, address & MEMORY_MASK);
+			break;
+		}
+		unsigned short opcode = fetch_opcode(chip8, address);
+		OpClass op_class = classify(opcode, quirks);
+		if (op_class == OP_WAIT) {
+			// Stop in front of FX0A, the exit stub hands it to the interpreter
+			emit_jump(&e, address);
+			break;
+		}
+		end = address + 2;
+		cycles++;
+
+		int skip = 4;
+		if (op_class == OP_BRANCH && is_skip(opcode) &&
+				(quirks & QUIRK_XOCHIP_OPS)) {
+			// XO-CHIP skips over F000 NNNN as a whole; peeking past the page
+			// end is left to the interpreter, which knows how far
+			if (address + 4 > page_end) {
+				op_class = OP_INTERPRET_END;
+			} else {
+				skip = fetch_opcode(chip8, address + 2) == 0xF000 ? 6 : 4;
+				end = address + 4;
+			}
+		}
+
+		if (op_class == OP_NATIVE) {
+			emit_native(&e, opcode, quirks);
+		} else if (op_class == OP_INTERPRET) {
+			emit_interpret(&e, address, jit->quirks);
+		} else if (op_class == OP_BRANCH) {
+			emit_branch(&e, chip8, opcode, address, skip, jit->arena);
+			break;
+		} else {
+			if (op_class == OP_WRITE) {
+				emit_write(&e, address, jit);
+			} else {
+				emit_interpret(&e, address, jit->quirks);
+			}
+			emit_dispatch_pc(&e);
+			break;
+		}
+		address += 2;
+	}
+
+	// Budget short of the block: give the cycles back and let C interpret
+	e.code[charge] = (uint8_t) cycles;
+	uint32_t rel = (uint32_t) (e.length - (overdrawn + 4));
+	memcpy(&e.code[overdrawn], &rel, sizeof(rel));
+	emit8(&e, 0x41); // add r12d, cycles
+	emit8(&e, 0x83);
+	emit8(&e, 0xC4);
+	emit8(&e, (uint8_t) cycles);
+	emit8(&e, 0xB8); // mov eax, pc
+	emit32(&e, pc);
+	emit_exit(&e, jit->arena);
+
+	if (!protect(jit, first, worst_case, PROT_READ | PROT_EXEC)) {
+		// Older blocks may share these pages, none of them can run now
+		flush(jit);
+		return BLOCK_INTERPRET;
+	}
+
+	int index = jit->num_blocks++;
+	Chip8JitBlock *block = &jit->blocks[index];
+	block->start = pc;
+	block->bytes = (uint16_t) (end - pc);
+	block->cycles = cycles;
+	jit->entry[pc] = e.code;
+	jit->arena_used += (e.length + 15) & ~(size_t) 15;
+
+	memset(&jit->is_code[pc], 1, end - pc);
+	jit->block_at[pc] = index;
+	jit->blocks_compiled++;
+	return index;
+}
+
+void chip8_jit_invalidate(Chip8Jit *jit, unsigned short address,
+													unsigned short length) {
+	unsigned int end = address + length;
+	if (end > CHIP8_MEMORY_SIZE) {
+		// Writes wrap around to the start of memory
+		chip8_jit_invalidate(jit, 0, end - CHIP8_MEMORY_SIZE);
+		end = CHIP8_MEMORY_SIZE;
+	}
+
+	bool hits_code = false;
+	for (unsigned int i = address; i < end; i++) {
+		hits_code |= jit->is_code[i];
+	}
+	if (!hits_code) {
+		return;
+	}
+
+	// Blocks stay within their page, so stale ones start in the written pages
+	for (unsigned int i = address & ~(unsigned int) (CHIP8_PAGE_SIZE - 1);
+			 i < end; i++) {
+		int index = jit->block_at[i];
+		if (index == BLOCK_INTERPRET && i + 2 > address) {
+			jit->block_at[i] = BLOCK_NONE;
+		} else if (index >= 0 && i + jit->blocks[index].bytes > address) {
+			jit->block_at[i] = BLOCK_NONE;
+			jit->entry[i] = jit->arena;
+			jit->invalidations++;
+		}
+	}
+}
+
+int chip8_jit_run(Chip8Jit *jit, Chip8 *chip8, int cycles) {
+	chip8->idle = false;
+
+	if (chip8->quirks != jit->quirks) {
+		flush(jit);
+		jit->quirks = chip8->quirks;
+	}
+
+	int remaining = cycles;
+	while (remaining > 0) {
+		unsigned short pc = chip8->pc;
+		int index = jit->block_at[pc];
+		if (index == BLOCK_NONE) {
+			index = compile_block(jit, chip8, pc);
+		}
+
+		// FX0A waits, page straddlers and blocks larger than the remaining
+		// budget run on the interpreter one instruction at a time; translated
+		// code returns on those and on idle loops
+		if (index == BLOCK_INTERPRET || jit->blocks[index].cycles > remaining) {
+			chip8_emulate_cycle(chip8);
+			remaining--;
+			jit->interpreted_cycles++;
+		} else {
+			remaining = jit->enter(chip8, remaining);
+		}
+		remaining -= skip_idle_loop(chip8, remaining);
+	}
+
+	return cycles;
+}
+
+#else
+
+bool chip8_jit_init(Chip8Jit *jit) {
+	memset(jit, 0, sizeof(*jit));
+	return false;
+}
+
+void chip8_jit_reset(Chip8Jit *jit) {
+	(void) jit;
+}
+
+void chip8_jit_invalidate(Chip8Jit *jit, unsigned short address,
+													unsigned short length) {
+	(void) jit;
+	(void) address;
+	(void) length;
+}
+
+int chip8_jit_run(Chip8Jit *jit, Chip8 *chip8, int cycles) {
+	(void) jit;
+	chip8_run(chip8, cycles);
+	return cycles;
+}
+
+void chip8_jit_destroy(Chip8Jit *jit) {
+	(void) jit;
+}
+
+#endif
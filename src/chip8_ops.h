@@ -0,0 +1,747 @@
+#ifndef CHIP8_OPS_H
+#define CHIP8_OPS_H
+
+/*
+ * Opcode semantics shared by every execution engine (switch interpreter,
+ * block cache, ...). Internal to the core: each op takes already decoded
+ * operands and advances pc itself, exactly like one case of the interpreter.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chip8.h"
+
+/*
+ * Behaviour switches making up a quirk profile. Ops that differ between
+ * profiles take them as an argument, and every engine passes a compile-time
+ * constant from a loop stamped out per profile, so the untaken behaviour is
+ * compiled away instead of being tested on each instruction.
+ */
+#define QUIRK_VF_RESET (1u << 0)	// 8XY1/8XY2/8XY3 clear VF
+#define QUIRK_SHIFT_VX (1u << 1)	// 8XY6/8XYE shift VX in place, ignoring VY
+#define QUIRK_I_PLUS_X (1u << 2)	// FX55/FX65 leave I at I + X, not I + X + 1
+#define QUIRK_KEEP_I (1u << 3)		// FX55/FX65 leave I unchanged
+#define QUIRK_JUMP_VX (1u << 4)		// BXNN jumps to XNN + VX instead of NNN + V0
+#define QUIRK_WRAP (1u << 5)			// Sprites wrap at the screen edges, never clip
+// SUPER-CHIP opcodes: hires, 00CN/00FB/00FC scrolling, DXY0, FX30, FX75/FX85
+#define QUIRK_SCHIP_OPS (1u << 6)
+// XO-CHIP opcodes: 00DN, 5XY2/5XY3, F000 NNNN, FN01 planes, F002/FX3A audio
+#define QUIRK_XOCHIP_OPS (1u << 7)
+
+#define QUIRKS_VIP QUIRK_VF_RESET
+#define QUIRKS_CHIP48 (QUIRK_SHIFT_VX | QUIRK_I_PLUS_X | QUIRK_JUMP_VX)
+#define QUIRKS_SCHIP                                                           \
+	(QUIRK_SHIFT_VX | QUIRK_KEEP_I | QUIRK_JUMP_VX | QUIRK_SCHIP_OPS)
+#define QUIRKS_XOCHIP (QUIRK_WRAP | QUIRK_SCHIP_OPS | QUIRK_XOCHIP_OPS)
+
+// Expands X(profile, suffix, flags) once per Chip8Quirks value
+#define FOR_EACH_QUIRK_PROFILE(X)                                              \
+	X(CHIP8_QUIRKS_VIP, vip, QUIRKS_VIP)                                         \
+	X(CHIP8_QUIRKS_CHIP48, chip48, QUIRKS_CHIP48)                                \
+	X(CHIP8_QUIRKS_SCHIP, schip, QUIRKS_SCHIP)                                   \
+	X(CHIP8_QUIRKS_XOCHIP, xochip, QUIRKS_XOCHIP)
+
+// Flags of a profile, for engines that specialize while translating
+static inline unsigned quirk_flags(Chip8Quirks quirks) {
+#define FLAGS_ENTRY(profile, suffix, flags) [profile] = flags,
+	static const unsigned table[CHIP8_QUIRKS_COUNT] = {
+			FOR_EACH_QUIRK_PROFILE(FLAGS_ENTRY)};
+#undef FLAGS_ENTRY
+	return table[quirks];
+}
+
+// Guest addresses wrap at the end of memory, and the stack pointer at the
+// end of the stack, so no guest access can leave the machine
+#define MEMORY_MASK (CHIP8_MEMORY_SIZE - 1)
+#define STACK_MASK 0xF
+
+// Records a store of at most one page starting at `address`, see chip8_reset
+static inline void mark_written(Chip8 *chip8, unsigned address, int length) {
+	unsigned last = (address + length - 1) & MEMORY_MASK;
+	chip8->dirty_pages |= UINT64_C(1) << (address >> CHIP8_PAGE_SHIFT) |
+												UINT64_C(1) << (last >> CHIP8_PAGE_SHIFT);
+}
+
+static inline unsigned short fetch_opcode(const Chip8 *chip8,
+																					unsigned short pc) {
+	return chip8->memory[pc] << 8 | chip8->memory[(pc + 1) & MEMORY_MASK];
+}
+
+// Planes that drawing, clearing and scrolling apply to, only XO-CHIP has more
+// than the first
+static inline unsigned selected_planes(const Chip8 *chip8, unsigned quirks) {
+	return quirks & QUIRK_XOCHIP_OPS ? chip8->planes : 1;
+}
+
+static inline int screen_height(const Chip8 *chip8, unsigned quirks) {
+	return (quirks & QUIRK_SCHIP_OPS) && chip8->hires ? CHIP8_HIRES_HEIGHT
+																										 : CHIP8_SCREEN_HEIGHT;
+}
+
+static inline uint64_t all_rows(int height) {
+	return height == 64 ? UINT64_MAX : (UINT64_C(1) << height) - 1;
+}
+
+// Bytes a taken skip jumps over, XO-CHIP skips F000 NNNN as one instruction
+static inline unsigned short skip_length(const Chip8 *chip8, unsigned quirks) {
+	if ((quirks & QUIRK_XOCHIP_OPS) &&
+			fetch_opcode(chip8, chip8->pc + 2) == 0xF000) {
+		return 6;
+	}
+	return 4;
+}
+
+// 00E0: Clears the screen (the selected planes on XO-CHIP)
+static inline void op_cls(Chip8 *chip8, unsigned quirks) {
+	unsigned planes = selected_planes(chip8, quirks);
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		if (!(planes & (1u << plane))) {
+			continue;
+		}
+		for (int y = 0; y < CHIP8_HIRES_HEIGHT; y++) {
+			uint64_t row = chip8->gfx[plane][y][0] | chip8->gfx[plane][y][1];
+			chip8->dirty_rows |= (uint64_t) (row != 0) << y;
+		}
+		memset(chip8->gfx[plane], 0, sizeof(chip8->gfx[plane]));
+	}
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// 00CN: Scroll the selected planes down N rows
+static inline void op_scroll_down(Chip8 *chip8, int n, unsigned quirks) {
+	int height = screen_height(chip8, quirks);
+	unsigned planes = selected_planes(chip8, quirks);
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		if (planes & (1u << plane)) {
+			uint64_t(*rows)[2] = chip8->gfx[plane];
+			memmove(rows[n], rows[0], (height - n) * sizeof(rows[0]));
+			memset(rows[0], 0, n * sizeof(rows[0]));
+		}
+	}
+	chip8->dirty_rows |= all_rows(height);
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// 00DN: Scroll the selected planes up N rows (XO-CHIP)
+static inline void op_scroll_up(Chip8 *chip8, int n, unsigned quirks) {
+	int height = screen_height(chip8, quirks);
+	unsigned planes = selected_planes(chip8, quirks);
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		if (planes & (1u << plane)) {
+			uint64_t(*rows)[2] = chip8->gfx[plane];
+			memmove(rows[0], rows[n], (height - n) * sizeof(rows[0]));
+			memset(rows[height - n], 0, n * sizeof(rows[0]));
+		}
+	}
+	chip8->dirty_rows |= all_rows(height);
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// 00FB/00FC: Scroll the selected planes 4 pixels right or left, a shift of
+// each row's words
+static inline void op_scroll_sideways(Chip8 *chip8, bool right,
+																			unsigned quirks) {
+	int height = screen_height(chip8, quirks);
+	bool hires = height == CHIP8_HIRES_HEIGHT;
+	unsigned planes = selected_planes(chip8, quirks);
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		if (!(planes & (1u << plane))) {
+			continue;
+		}
+		for (int y = 0; y < height; y++) {
+			uint64_t *row = chip8->gfx[plane][y];
+			if (right) {
+				row[1] = hires ? row[1] >> 4 | row[0] << 60 : 0;
+				row[0] >>= 4;
+			} else {
+				row[0] = row[0] << 4 | (hires ? row[1] >> 60 : 0);
+				row[1] = hires ? row[1] << 4 : 0;
+			}
+		}
+	}
+	chip8->dirty_rows |= all_rows(height);
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// 00FE/00FF: Switch to low or high resolution, which clears the screen
+static inline void op_resolution(Chip8 *chip8, bool hires) {
+	chip8->hires = hires;
+	memset(chip8->gfx, 0, sizeof(chip8->gfx));
+	chip8->dirty_rows = UINT64_MAX;
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// 00EE: Returns from subroutine
+static inline void op_ret(Chip8 *chip8) {
+	chip8->sp = (chip8->sp - 1) & STACK_MASK;
+	chip8->pc = chip8->stack[chip8->sp];
+	chip8->pc += 2;
+}
+
+// 0NNN: Execute machine language subroutine at address NNN. Skipped, with
+// one warning per run: a program that strays into zeroed memory runs 0000
+// on every cycle.
+static inline void op_sys(Chip8 *chip8, unsigned short opcode) {
+	if (!chip8->warned) {
+		printf("Ignoring SYS opcode: 0x%X\n", opcode);
+		chip8->warned = true;
+	}
+	chip8->pc += 2;
+}
+
+// SUPER-CHIP and XO-CHIP 0NNN opcodes, other ones are SYS calls
+static inline void op_schip_system(Chip8 *chip8, unsigned short opcode,
+																	 unsigned quirks) {
+	if ((opcode & 0xFFF0) == 0x00C0) {
+		op_scroll_down(chip8, opcode & 0x000F, quirks);
+		return;
+	}
+	if ((quirks & QUIRK_XOCHIP_OPS) && (opcode & 0xFFF0) == 0x00D0) {
+		op_scroll_up(chip8, opcode & 0x000F, quirks);
+		return;
+	}
+	switch (opcode) {
+	case 0x00FB:
+		op_scroll_sideways(chip8, true, quirks);
+		break;
+	case 0x00FC:
+		op_scroll_sideways(chip8, false, quirks);
+		break;
+	case 0x00FD:
+		// Exit the interpreter: pc stays here, the front end keeps showing the
+		// final screen
+		break;
+	case 0x00FE:
+		op_resolution(chip8, false);
+		break;
+	case 0x00FF:
+		op_resolution(chip8, true);
+		break;
+	default:
+		op_sys(chip8, opcode);
+	}
+}
+
+// 1NNN: Jump to address NNN
+static inline void op_jp(Chip8 *chip8, unsigned short nnn) {
+	chip8->pc = nnn;
+}
+
+// 2NNN: Execute subroutine starting at address NNN
+static inline void op_call(Chip8 *chip8, unsigned short nnn) {
+	chip8->stack[chip8->sp & STACK_MASK] = chip8->pc;
+	chip8->sp = (chip8->sp + 1) & STACK_MASK;
+	chip8->pc = nnn;
+}
+
+// 3XNN: Skip the following instruction if VX equals NN
+static inline void op_se_imm(Chip8 *chip8, int x, unsigned char nn,
+														 unsigned quirks) {
+	chip8->pc += chip8->V[x] == nn ? skip_length(chip8, quirks) : 2;
+}
+
+// 4XNN: Skip the following instruction if VX is not equal to NN
+static inline void op_sne_imm(Chip8 *chip8, int x, unsigned char nn,
+															unsigned quirks) {
+	chip8->pc += chip8->V[x] != nn ? skip_length(chip8, quirks) : 2;
+}
+
+// 5XY0: Skip the following instruction if VX equals VY
+static inline void op_se_reg(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->pc += chip8->V[x] == chip8->V[y] ? skip_length(chip8, quirks) : 2;
+}
+
+// 5XY2: Store VX to VY inclusive in memory starting at I, in either order;
+// I is left unchanged (XO-CHIP)
+static inline void op_save_range(Chip8 *chip8, int x, int y) {
+	int step = x <= y ? 1 : -1;
+	mark_written(chip8, chip8->I, (x <= y ? y - x : x - y) + 1);
+	for (int i = 0, r = x;; i++, r += step) {
+		chip8->memory[(chip8->I + i) & MEMORY_MASK] = chip8->V[r];
+		if (r == y) {
+			break;
+		}
+	}
+	chip8->pc += 2;
+}
+
+// 5XY3: Fill VX to VY inclusive from memory starting at I (XO-CHIP)
+static inline void op_load_range(Chip8 *chip8, int x, int y) {
+	int step = x <= y ? 1 : -1;
+	for (int i = 0, r = x;; i++, r += step) {
+		chip8->V[r] = chip8->memory[(chip8->I + i) & MEMORY_MASK];
+		if (r == y) {
+			break;
+		}
+	}
+	chip8->pc += 2;
+}
+
+// 6XNN: Store number NN in register VX
+static inline void op_ld_imm(Chip8 *chip8, int x, unsigned char nn) {
+	chip8->V[x] = nn;
+	chip8->pc += 2;
+}
+
+// 7XNN: Add the value NN to register VX
+static inline void op_add_imm(Chip8 *chip8, int x, unsigned char nn) {
+	chip8->V[x] += nn;
+	chip8->pc += 2;
+}
+
+// 8XY0: Store the value of register VY in register VX
+static inline void op_ld_reg(Chip8 *chip8, int x, int y) {
+	chip8->V[x] = chip8->V[y];
+	chip8->pc += 2;
+}
+
+// 8XY1: Set VX to VX OR VY, VF is reset on the VIP
+static inline void op_or(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->V[x] |= chip8->V[y];
+	if (quirks & QUIRK_VF_RESET) {
+		chip8->V[0xF] = 0;
+	}
+	chip8->pc += 2;
+}
+
+// 8XY2: Set VX to VX AND VY, VF is reset on the VIP
+static inline void op_and(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->V[x] &= chip8->V[y];
+	if (quirks & QUIRK_VF_RESET) {
+		chip8->V[0xF] = 0;
+	}
+	chip8->pc += 2;
+}
+
+// 8XY3: Set VX to VX XOR VY, VF is reset on the VIP
+static inline void op_xor(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->V[x] ^= chip8->V[y];
+	if (quirks & QUIRK_VF_RESET) {
+		chip8->V[0xF] = 0;
+	}
+	chip8->pc += 2;
+}
+
+// 8XY4: Add VY to VX, VF is set to 01 on carry and 00 otherwise
+static inline void op_add_reg(Chip8 *chip8, int x, int y) {
+	unsigned short sum = chip8->V[x] + chip8->V[y];
+	chip8->V[x] = sum & 0xFF;
+	chip8->V[0xF] = sum > 255;
+	chip8->pc += 2;
+}
+
+// 8XY5: Subtract VY from VX, VF is set to 00 on borrow and 01 otherwise
+static inline void op_sub(Chip8 *chip8, int x, int y) {
+	signed short diff = chip8->V[x] - chip8->V[y];
+	chip8->V[x] = diff & 0xFF;
+	chip8->V[0xF] = diff >= 0;
+	chip8->pc += 2;
+}
+
+// 8XY6: Store VY (VX with QUIRK_SHIFT_VX) shifted right one bit in VX, VF is
+// set to the shifted out bit
+static inline void op_shr(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->V[x] = chip8->V[quirks & QUIRK_SHIFT_VX ? x : y];
+	unsigned char lsb = chip8->V[x] & 0x01;
+	chip8->V[x] >>= 1;
+	chip8->V[0xF] = lsb;
+	chip8->pc += 2;
+}
+
+// 8XY7: Set VX to VY minus VX, VF is set to 00 on borrow and 01 otherwise
+static inline void op_subn(Chip8 *chip8, int x, int y) {
+	signed short diff = chip8->V[y] - chip8->V[x];
+	chip8->V[x] = diff & 0xFF;
+	chip8->V[0xF] = diff >= 0;
+	chip8->pc += 2;
+}
+
+// 8XYE: Store VY (VX with QUIRK_SHIFT_VX) shifted left one bit in VX, VF is
+// set to the shifted out bit
+static inline void op_shl(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->V[x] = chip8->V[quirks & QUIRK_SHIFT_VX ? x : y];
+	unsigned char msb = (chip8->V[x] & 0x80) >> 7;
+	chip8->V[x] <<= 1;
+	chip8->V[0xF] = msb;
+	chip8->pc += 2;
+}
+
+// 9XY0: Skip the following instruction if VX is not equal to VY
+static inline void op_sne_reg(Chip8 *chip8, int x, int y, unsigned quirks) {
+	chip8->pc += chip8->V[x] != chip8->V[y] ? skip_length(chip8, quirks) : 2;
+}
+
+// ANNN: Store memory address NNN in register I
+static inline void op_ld_i(Chip8 *chip8, unsigned short nnn) {
+	chip8->I = nnn;
+	chip8->pc += 2;
+}
+
+// BNNN: Jump to address NNN + V0, or to XNN + VX with QUIRK_JUMP_VX
+static inline void op_jp_v0(Chip8 *chip8, int x, unsigned short nnn,
+														unsigned quirks) {
+	chip8->pc = nnn + chip8->V[quirks & QUIRK_JUMP_VX ? x : 0x0];
+}
+
+// xorshift64 step on the instance's own state, so runs are reproducible and
+// independent instances never share a generator
+static inline unsigned char next_random(Chip8 *chip8) {
+	uint64_t state = chip8->rng_state;
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	chip8->rng_state = state;
+	return state >> 56;
+}
+
+// CXNN: Set VX to a random number with a mask of NN
+static inline void op_rnd(Chip8 *chip8, int x, unsigned char nn) {
+	unsigned char random_number = next_random(chip8);
+	chip8->V[x] = random_number & nn;
+	chip8->pc += 2;
+}
+
+// Sprite row at `address`, one or two bytes wide, in the top bits of a word
+static inline uint64_t sprite_row(const Chip8 *chip8, unsigned address,
+																	int bytes) {
+	uint64_t row = (uint64_t) chip8->memory[address & MEMORY_MASK] << 56;
+	if (bytes == 2) {
+		row |= (uint64_t) chip8->memory[(address + 1) & MEMORY_MASK] << 48;
+	}
+	return row;
+}
+
+// Low resolution: one word per row
+static inline uint64_t draw_lores(Chip8 *chip8, int plane, unsigned cx,
+																	unsigned cy, int height, int bytes,
+																	unsigned address, unsigned quirks) {
+	uint64_t(*rows)[2] = chip8->gfx[plane];
+	uint64_t collision = 0;
+
+	// Clip if partial sprite out of screen
+	if (!(quirks & QUIRK_WRAP) && cx < 64 && cy < 32) {
+		if (height > (int) (32 - cy)) {
+			height = 32 - cy;
+		}
+		for (int row_y = 0; row_y < height; row_y++) {
+			// Columns past the right edge are shifted out of the word
+			uint64_t row = sprite_row(chip8, address + row_y * bytes, bytes) >> cx;
+			collision |= rows[cy + row_y][0] & row;
+			rows[cy + row_y][0] ^= row;
+			chip8->dirty_rows |= (uint64_t) (row != 0) << (cy + row_y);
+		}
+
+		// Wrap if whole sprite out of screen, or always with QUIRK_WRAP
+	} else {
+		unsigned short shift = cx % 64;
+		for (int row_y = 0; row_y < height; row_y++) {
+			uint64_t row = sprite_row(chip8, address + row_y * bytes, bytes);
+			if (shift != 0) {
+				row = row >> shift | row << (64 - shift);
+			}
+			collision |= rows[(cy + row_y) % 32][0] & row;
+			rows[(cy + row_y) % 32][0] ^= row;
+			chip8->dirty_rows |= (uint64_t) (row != 0) << ((cy + row_y) % 32);
+		}
+	}
+	return collision;
+}
+
+// High resolution: the sprite row is split across the row's two words. The
+// start position wraps, the sprite is then clipped or with QUIRK_WRAP wraps.
+static inline uint64_t draw_hires(Chip8 *chip8, int plane, unsigned cx,
+																	unsigned cy, int height, int bytes,
+																	unsigned address, unsigned quirks) {
+	uint64_t(*rows)[2] = chip8->gfx[plane];
+	uint64_t collision = 0;
+	cx %= CHIP8_HIRES_WIDTH;
+	cy %= CHIP8_HIRES_HEIGHT;
+
+	for (int row_y = 0; row_y < height; row_y++) {
+		unsigned y = cy + row_y;
+		if (y >= CHIP8_HIRES_HEIGHT) {
+			if (!(quirks & QUIRK_WRAP)) {
+				break;
+			}
+			y -= CHIP8_HIRES_HEIGHT;
+		}
+
+		uint64_t row = sprite_row(chip8, address + row_y * bytes, bytes);
+		uint64_t left, right;
+		if (cx < 64) {
+			left = row >> cx;
+			right = cx != 0 ? row << (64 - cx) : 0;
+		} else {
+			// Columns past the right edge come back on the left when wrapping
+			left = (quirks & QUIRK_WRAP) && cx != 64 ? row << (128 - cx) : 0;
+			right = row >> (cx - 64);
+		}
+		collision |= (rows[y][0] & left) | (rows[y][1] & right);
+		rows[y][0] ^= left;
+		rows[y][1] ^= right;
+		chip8->dirty_rows |= (uint64_t) ((left | right) != 0) << y;
+	}
+	return collision;
+}
+
+// DXYN: Draw a sprite at position VX, VY with N bytes of sprite data starting
+// at the address stored in I. DXY0 draws a 16x16 sprite on SUPER-CHIP and
+// XO-CHIP, and each selected XO-CHIP plane takes the next sprite's worth of
+// data.
+// Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
+static inline void op_drw(Chip8 *chip8, int x, int y, int n, unsigned quirks) {
+	bool big = (quirks & QUIRK_SCHIP_OPS) && n == 0;
+	int height = big ? 16 : n;
+	int bytes = big ? 2 : 1;
+	bool hires = (quirks & QUIRK_SCHIP_OPS) && chip8->hires;
+	unsigned planes = selected_planes(chip8, quirks);
+	unsigned address = chip8->I;
+	uint64_t collision = 0;
+
+	for (int plane = 0; plane < CHIP8_PLANES; plane++) {
+		if (!(planes & (1u << plane))) {
+			continue;
+		}
+		if (hires) {
+			collision |= draw_hires(chip8, plane, chip8->V[x], chip8->V[y], height,
+															bytes, address, quirks);
+		} else {
+			collision |= draw_lores(chip8, plane, chip8->V[x], chip8->V[y], height,
+															bytes, address, quirks);
+		}
+		address += height * bytes;
+	}
+
+	chip8->V[0xF] = collision != 0;
+	chip8->draw_flag = true;
+	chip8->pc += 2;
+}
+
+// Whether the key in the low nibble of VX is held; the VIP only decodes 4 bits
+static inline bool key_held(const Chip8 *chip8, int x) {
+	return (chip8->keys >> (chip8->V[x] & 0xF)) & 1;
+}
+
+// EX9E: Skip the following instruction if the key stored in VX is pressed
+static inline void op_skp(Chip8 *chip8, int x, unsigned quirks) {
+	chip8->pc += key_held(chip8, x) ? skip_length(chip8, quirks) : 2;
+}
+
+// EXA1: Skip the following instruction if the key stored in VX is not pressed
+static inline void op_sknp(Chip8 *chip8, int x, unsigned quirks) {
+	chip8->pc += !key_held(chip8, x) ? skip_length(chip8, quirks) : 2;
+}
+
+// FX07: Store the current value of the delay timer in register VX
+static inline void op_ld_vx_dt(Chip8 *chip8, int x) {
+	chip8->V[x] = chip8->delay_timer;
+	chip8->pc += 2;
+}
+
+// FX0A: Wait for a keypress and store the result in register VX
+// pc only advances once a key has been released, the lowest one wins
+static inline void op_ld_vx_key(Chip8 *chip8, int x) {
+	if (chip8->keys_released != 0) {
+		chip8->V[x] = __builtin_ctz(chip8->keys_released);
+		chip8->pc += 2;
+	}
+}
+
+// FX15: Set the delay timer to the value of register VX
+static inline void op_ld_dt(Chip8 *chip8, int x) {
+	chip8->delay_timer = chip8->V[x];
+	chip8->pc += 2;
+}
+
+// FX18: Set the sound timer to the value of register VX
+static inline void op_ld_st(Chip8 *chip8, int x) {
+	chip8->sound_timer = chip8->V[x];
+	chip8->pc += 2;
+}
+
+// FX1E: Add the value stored in register VX to register I
+static inline void op_add_i(Chip8 *chip8, int x) {
+	chip8->I += chip8->V[x];
+	chip8->pc += 2;
+}
+
+// FX29: Set I to the address of the font sprite for the digit in VX
+static inline void op_ld_font(Chip8 *chip8, int x) {
+	unsigned char font = chip8->V[x] & 0x0F;
+	chip8->I = font * 5;
+	chip8->pc += 2;
+}
+
+// FX30: Set I to the address of the 8x10 font sprite for the digit in VX
+static inline void op_ld_big_font(Chip8 *chip8, int x) {
+	unsigned char font = chip8->V[x] & 0x0F;
+	chip8->I = CHIP8_BIG_FONT_ADDRESS + font * 10;
+	chip8->pc += 2;
+}
+
+// F000 NNNN: Set I to the 16-bit address in the following word (XO-CHIP)
+static inline void op_ld_i_long(Chip8 *chip8) {
+	chip8->I = fetch_opcode(chip8, chip8->pc + 2);
+	chip8->pc += 4;
+}
+
+// FN01: Select the planes N that drawing, clearing and scrolling apply to
+// (XO-CHIP)
+static inline void op_planes(Chip8 *chip8, int n) {
+	chip8->planes = n & 0x3;
+	chip8->pc += 2;
+}
+
+// F002: Load the 16-byte audio pattern starting at I (XO-CHIP)
+static inline void op_ld_pattern(Chip8 *chip8) {
+	for (int i = 0; i < 16; i++) {
+		chip8->pattern[i] = chip8->memory[(chip8->I + i) & MEMORY_MASK];
+	}
+	chip8->has_pattern = true;
+	chip8->pc += 2;
+}
+
+// FX3A: Set the audio pattern playback pitch to VX (XO-CHIP)
+static inline void op_pitch(Chip8 *chip8, int x) {
+	chip8->pitch = chip8->V[x];
+	chip8->pc += 2;
+}
+
+// FX33: Store the BCD of VX at addresses I, I + 1 and I + 2
+static inline void op_bcd(Chip8 *chip8, int x) {
+	unsigned char value = chip8->V[x];
+	mark_written(chip8, chip8->I, 3);
+	for (int i = 2; i >= 0; i--) {
+		chip8->memory[(chip8->I + i) & MEMORY_MASK] = value % 10;
+		value /= 10;
+	}
+	chip8->pc += 2;
+}
+
+// FX55: Store V0 to VX inclusive in memory starting at I, I is set to
+// I + X + 1 after operation (I + X or unchanged, depending on the quirks)
+static inline void op_store(Chip8 *chip8, int x, unsigned quirks) {
+	mark_written(chip8, chip8->I, x + 1);
+	for (int i = 0; i <= x; i++) {
+		chip8->memory[(chip8->I + i) & MEMORY_MASK] = chip8->V[i];
+	}
+	if (quirks & QUIRK_I_PLUS_X) {
+		chip8->I += x;
+	} else if (!(quirks & QUIRK_KEEP_I)) {
+		chip8->I += x + 1;
+	}
+	chip8->pc += 2;
+}
+
+// FX65: Fill V0 to VX inclusive from memory starting at I, I is set to
+// I + X + 1 after operation (I + X or unchanged, depending on the quirks)
+static inline void op_load(Chip8 *chip8, int x, unsigned quirks) {
+	for (int i = 0; i <= x; i++) {
+		chip8->V[i] = chip8->memory[(chip8->I + i) & MEMORY_MASK];
+	}
+	if (quirks & QUIRK_I_PLUS_X) {
+		chip8->I += x;
+	} else if (!(quirks & QUIRK_KEEP_I)) {
+		chip8->I += x + 1;
+	}
+	chip8->pc += 2;
+}
+
+// FX75: Store V0 to VX inclusive in the RPL user flags (SUPER-CHIP)
+static inline void op_save_flags(Chip8 *chip8, int x) {
+	memcpy(chip8->rpl, chip8->V, x + 1);
+	chip8->pc += 2;
+}
+
+// FX85: Fill V0 to VX inclusive from the RPL user flags (SUPER-CHIP)
+static inline void op_load_flags(Chip8 *chip8, int x) {
+	memcpy(chip8->V, chip8->rpl, x + 1);
+	chip8->pc += 2;
+}
+
+/*
+ * Instructions per iteration when pc is at the head of a loop that cannot
+ * change any state before the next timer tick or key event, 0 otherwise:
+ * - 1NNN jumping to itself
+ * - FX07, 3XNN or 4XNN, then 1NNN back to the FX07: a delay timer poll whose
+ *   exit condition is not met yet, with VX already holding the timer
+ * - FX0A still waiting for a key
+ */
+static inline int idle_loop_length(const Chip8 *chip8) {
+	unsigned short pc = chip8->pc;
+	unsigned short opcode = fetch_opcode(chip8, pc);
+	unsigned short jump_here = 0x1000 | pc;
+	int x = (opcode & 0x0F00) >> 8;
+
+	if (opcode == jump_here && pc < 0x1000) {
+		return 1;
+	}
+	if ((opcode & 0xF0FF) == 0xF00A) {
+		return chip8->keys_released == 0;
+	}
+	if ((opcode & 0xF0FF) == 0xF007 && pc < 0x1000 &&
+			chip8->V[x] == chip8->delay_timer &&
+			fetch_opcode(chip8, pc + 4) == jump_here) {
+		unsigned short test = fetch_opcode(chip8, pc + 2);
+		unsigned char nn = test & 0x00FF;
+		if ((test & 0x0F00) >> 8 != x) {
+			return 0;
+		}
+		if ((test & 0xF000) == 0x3000 && chip8->delay_timer != nn) {
+			return 3;
+		}
+		if ((test & 0xF000) == 0x4000 && chip8->delay_timer == nn) {
+			return 3;
+		}
+	}
+	return 0;
+}
+
+// Fast-forwards over whole iterations of an idle loop at pc, which leaves
+// the machine exactly as running them would. Returns how many of the
+// `remaining` cycles were skipped.
+static inline int skip_idle_loop(Chip8 *chip8, int remaining) {
+	int length = idle_loop_length(chip8);
+	if (length == 0) {
+		return 0;
+	}
+	int skipped = remaining - remaining % length;
+	chip8->idle_cycles += skipped;
+	chip8->idle = true;
+	return skipped;
+}
+
+// Guest bytes the instruction `opcode` stores at I, 0 if it is not a store
+static inline int store_length(unsigned short opcode, unsigned quirks) {
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	if ((opcode & 0xF0FF) == 0xF033) {
+		return 3;
+	}
+	if ((opcode & 0xF0FF) == 0xF055) {
+		return x + 1;
+	}
+	if ((quirks & QUIRK_XOCHIP_OPS) && (opcode & 0xF00F) == 0x5002) {
+		return (x > y ? x - y : y - x) + 1;
+	}
+	return 0;
+}
+
+// Unknown opcodes are reported once and pc is left unchanged
+static inline void op_unknown(Chip8 *chip8, const char *group,
+															unsigned short opcode) {
+	if (!chip8->warned) {
+		printf("Unknown opcode%s: 0x%X\n", group, opcode);
+		chip8->warned = true;
+	}
+}
+
+#endif
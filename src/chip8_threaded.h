@@ -0,0 +1,284 @@
+/*
+ * Direct-threaded batch loop, included by chip8.c once per quirk profile with
+ * THREADED_RUN naming the function and THREADED_QUIRKS its flags. GCC does
+ * not inline functions containing a computed goto, so each profile gets its
+ * own copy this way instead of through an always_inline helper.
+ *
+ * Every handler ends by fetching the next opcode and jumping straight to its
+ * handler through opcode_handlers, so each one has its own indirect branch
+ * and its own history in the predictor. Handlers only extract the operand
+ * fields they use. Same results as emulate_cycle, including idle skipping.
+ */
+
+#if !defined(THREADED_RUN) || !defined(THREADED_QUIRKS)
+#error "Define THREADED_RUN and THREADED_QUIRKS before including this file"
+#endif
+
+// Labels as values are a GNU extension that -Wpedantic reports
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+static void THREADED_RUN(Chip8 *chip8, int cycles) {
+	const unsigned quirks = THREADED_QUIRKS;
+	static const void *const handlers[H_COUNT] = {
+			[H_CLS] = &&cls,
+			[H_RET] = &&ret,
+			[H_SYSTEM] = &&system,
+			[H_JP] = &&jp,
+			[H_CALL] = &&call,
+			[H_SE_IMM] = &&se_imm,
+			[H_SNE_IMM] = &&sne_imm,
+			[H_SE_REG] = &&se_reg,
+			[H_SAVE_RANGE] = &&save_range,
+			[H_LOAD_RANGE] = &&load_range,
+			[H_LD_IMM] = &&ld_imm,
+			[H_ADD_IMM] = &&add_imm,
+			[H_LD_REG] = &&ld_reg,
+			[H_OR] = &&or,
+			[H_AND] = &&and,
+			[H_XOR] = &&xor,
+			[H_ADD_REG] = &&add_reg,
+			[H_SUB] = &&sub,
+			[H_SHR] = &&shr,
+			[H_SUBN] = &&subn,
+			[H_SHL] = &&shl,
+			[H_SNE_REG] = &&sne_reg,
+			[H_LD_I] = &&ld_i,
+			[H_JP_V0] = &&jp_v0,
+			[H_RND] = &&rnd,
+			[H_DRW] = &&drw,
+			[H_SKP] = &&skp,
+			[H_SKNP] = &&sknp,
+			[H_LD_I_LONG] = &&ld_i_long,
+			[H_PLANES] = &&planes,
+			[H_LD_PATTERN] = &&ld_pattern,
+			[H_LD_VX_DT] = &&ld_vx_dt,
+			[H_LD_VX_KEY] = &&ld_vx_key,
+			[H_LD_DT] = &&ld_dt,
+			[H_LD_ST] = &&ld_st,
+			[H_ADD_I] = &&add_i,
+			[H_LD_FONT] = &&ld_font,
+			[H_LD_BIG_FONT] = &&ld_big_font,
+			[H_BCD] = &&bcd,
+			[H_PITCH] = &&pitch,
+			[H_STORE] = &&store,
+			[H_LOAD] = &&load,
+			[H_SAVE_FLAGS] = &&save_flags,
+			[H_LOAD_FLAGS] = &&load_flags,
+			[H_UNKNOWN] = &&unknown,
+	};
+	// Instructions left after the one being executed
+	int remaining = cycles;
+	unsigned short opcode;
+
+#define X ((opcode & 0x0F00) >> 8)
+#define Y ((opcode & 0x00F0) >> 4)
+#define N (opcode & 0x000F)
+#define NN ((unsigned char) (opcode & 0x00FF))
+#define NNN (opcode & 0x0FFF)
+#define NEXT()                                                                 \
+	do {                                                                         \
+		if (--remaining < 0) {                                                     \
+			return;                                                                  \
+		}                                                                          \
+		opcode = fetch_opcode(chip8, chip8->pc);                                   \
+		chip8->opcode = opcode;                                                    \
+		goto *handlers[opcode_handlers[opcode]];                                   \
+	} while (0)
+
+	NEXT();
+
+cls:
+	op_cls(chip8, quirks);
+	NEXT();
+ret:
+	op_ret(chip8);
+	NEXT();
+system:
+	if (quirks & QUIRK_SCHIP_OPS) {
+		op_schip_system(chip8, opcode, quirks);
+	} else {
+		op_sys(chip8, opcode);
+	}
+	NEXT();
+jp:
+	op_jp(chip8, NNN);
+	remaining -= skip_idle_loop(chip8, remaining);
+	NEXT();
+call:
+	op_call(chip8, NNN);
+	NEXT();
+se_imm:
+	op_se_imm(chip8, X, NN, quirks);
+	NEXT();
+sne_imm:
+	op_sne_imm(chip8, X, NN, quirks);
+	NEXT();
+se_reg:
+	op_se_reg(chip8, X, Y, quirks);
+	NEXT();
+save_range:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_save_range(chip8, X, Y);
+	} else {
+		op_se_reg(chip8, X, Y, quirks);
+	}
+	NEXT();
+load_range:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_load_range(chip8, X, Y);
+	} else {
+		op_se_reg(chip8, X, Y, quirks);
+	}
+	NEXT();
+ld_imm:
+	op_ld_imm(chip8, X, NN);
+	NEXT();
+add_imm:
+	op_add_imm(chip8, X, NN);
+	NEXT();
+ld_reg:
+	op_ld_reg(chip8, X, Y);
+	NEXT();
+or:
+	op_or(chip8, X, Y, quirks);
+	NEXT();
+and:
+	op_and(chip8, X, Y, quirks);
+	NEXT();
+xor:
+	op_xor(chip8, X, Y, quirks);
+	NEXT();
+add_reg:
+	op_add_reg(chip8, X, Y);
+	NEXT();
+sub:
+	op_sub(chip8, X, Y);
+	NEXT();
+shr:
+	op_shr(chip8, X, Y, quirks);
+	NEXT();
+subn:
+	op_subn(chip8, X, Y);
+	NEXT();
+shl:
+	op_shl(chip8, X, Y, quirks);
+	NEXT();
+sne_reg:
+	op_sne_reg(chip8, X, Y, quirks);
+	NEXT();
+ld_i:
+	op_ld_i(chip8, NNN);
+	NEXT();
+jp_v0:
+	op_jp_v0(chip8, X, NNN, quirks);
+	NEXT();
+rnd:
+	op_rnd(chip8, X, NN);
+	NEXT();
+drw:
+	op_drw(chip8, X, Y, N, quirks);
+	NEXT();
+skp:
+	op_skp(chip8, X, quirks);
+	NEXT();
+sknp:
+	op_sknp(chip8, X, quirks);
+	NEXT();
+ld_i_long:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_ld_i_long(chip8);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+planes:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_planes(chip8, X);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+ld_pattern:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_ld_pattern(chip8);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+ld_vx_dt:
+	op_ld_vx_dt(chip8, X);
+	NEXT();
+ld_vx_key:
+	op_ld_vx_key(chip8, X);
+	remaining -= skip_idle_loop(chip8, remaining);
+	NEXT();
+ld_dt:
+	op_ld_dt(chip8, X);
+	NEXT();
+ld_st:
+	op_ld_st(chip8, X);
+	NEXT();
+add_i:
+	op_add_i(chip8, X);
+	NEXT();
+ld_font:
+	op_ld_font(chip8, X);
+	NEXT();
+ld_big_font:
+	if (quirks & QUIRK_SCHIP_OPS) {
+		op_ld_big_font(chip8, X);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+bcd:
+	op_bcd(chip8, X);
+	NEXT();
+pitch:
+	if (quirks & QUIRK_XOCHIP_OPS) {
+		op_pitch(chip8, X);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+store:
+	op_store(chip8, X, quirks);
+	NEXT();
+load:
+	op_load(chip8, X, quirks);
+	NEXT();
+save_flags:
+	if (quirks & QUIRK_SCHIP_OPS) {
+		op_save_flags(chip8, X);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+load_flags:
+	if (quirks & QUIRK_SCHIP_OPS) {
+		op_load_flags(chip8, X);
+	} else {
+		op_unknown(chip8, " [0xF000]", opcode);
+	}
+	NEXT();
+unknown:
+	op_unknown(chip8,
+						 (opcode & 0xF000) == 0x8000	 ? " [0x8000]"
+						 : (opcode & 0xF000) == 0xE000 ? " [0xE000]"
+																					 : " [0xF000]",
+						 opcode);
+	NEXT();
+
+#undef X
+#undef Y
+#undef N
+#undef NN
+#undef NNN
+#undef NEXT
+}
+
+#pragma GCC diagnostic pop
+
+#undef THREADED_RUN
+#undef THREADED_QUIRKS
@@ -0,0 +1,350 @@
+#include "debugger.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+void debugger_init(Debugger *debugger) {
+	memset(debugger, 0, sizeof(*debugger));
+}
+
+static bool test_bit(const uint64_t *bits, uint16_t address) {
+	return (bits[address >> 6] >> (address & 63)) & 1;
+}
+
+// Sets or clears one bit, returning whether it changed
+static bool set_bit(uint64_t *bits, uint16_t address, bool on) {
+	uint64_t bit = UINT64_C(1) << (address & 63);
+	bool was_on = (bits[address >> 6] & bit) != 0;
+	if (on) {
+		bits[address >> 6] |= bit;
+	} else {
+		bits[address >> 6] &= ~bit;
+	}
+	return was_on != on;
+}
+
+void debugger_set_breakpoint(Debugger *debugger, uint16_t address, bool on) {
+	if (set_bit(debugger->breakpoints, address, on)) {
+		debugger->breakpoint_count += on ? 1 : -1;
+	}
+}
+
+bool debugger_has_breakpoint(const Debugger *debugger, uint16_t address) {
+	return test_bit(debugger->breakpoints, address);
+}
+
+void debugger_watch_memory(Debugger *debugger, uint16_t first, uint16_t last) {
+	for (unsigned address = first; address <= last; address++) {
+		if (set_bit(debugger->watched, (uint16_t) address, true)) {
+			debugger->watched_count++;
+		}
+	}
+}
+
+void debugger_watch_register(Debugger *debugger, int reg) {
+	debugger->watched_registers |= 1u << reg;
+}
+
+static const char *skip_spaces(const char *text) {
+	while (isspace((unsigned char) *text)) {
+		text++;
+	}
+	return text;
+}
+
+// An address or value in C syntax (0x2A4, 676), NULL if there is none
+static const char *parse_number(const char *text, unsigned max,
+																unsigned *value) {
+	char *end;
+	unsigned long number = strtoul(text, &end, 0);
+	if (end == text || number > max) {
+		return NULL;
+	}
+	*value = (unsigned) number;
+	return end;
+}
+
+// I or V0-VF, NULL if there is none
+static const char *parse_register(const char *text, int *reg) {
+	if (toupper((unsigned char) text[0]) == 'I') {
+		*reg = DEBUGGER_REGISTER_I;
+		return text + 1;
+	}
+	if (toupper((unsigned char) text[0]) == 'V' &&
+			isxdigit((unsigned char) text[1])) {
+		char digit[2] = {text[1], '\0'};
+		*reg = (int) strtol(digit, NULL, 16);
+		return text + 2;
+	}
+	return NULL;
+}
+
+bool debugger_parse_breakpoint(Debugger *debugger, const char *text) {
+	unsigned address;
+	const char *end = parse_number(text, CHIP8_MEMORY_SIZE - 1, &address);
+	if (end == NULL || *skip_spaces(end) != '\0') {
+		return false;
+	}
+	debugger_set_breakpoint(debugger, (uint16_t) address, true);
+	return true;
+}
+
+bool debugger_parse_watch(Debugger *debugger, const char *text) {
+	int reg;
+	const char *end = parse_register(text, &reg);
+	if (end != NULL && *end == '\0') {
+		debugger_watch_register(debugger, reg);
+		return true;
+	}
+
+	unsigned first, last;
+	end = parse_number(text, CHIP8_MEMORY_SIZE - 1, &first);
+	if (end == NULL) {
+		return false;
+	}
+	last = first;
+	if (*end == '-') {
+		end = parse_number(end + 1, CHIP8_MEMORY_SIZE - 1, &last);
+		if (end == NULL || last < first) {
+			return false;
+		}
+	}
+	if (*end != '\0') {
+		return false;
+	}
+	debugger_watch_memory(debugger, (uint16_t) first, (uint16_t) last);
+	return true;
+}
+
+// Longer operators first, so "<=" is not read as "<"
+static const struct {
+	const char *text;
+	DebugCompare compare;
+} OPERATORS[] = {
+		{"==", DEBUG_EQ}, {"!=", DEBUG_NE}, {"<=", DEBUG_LE},
+		{">=", DEBUG_GE}, {"<", DEBUG_LT},	{">", DEBUG_GT},
+};
+
+// Four nibbles such as "DXYN" or "F033", NULL if the text is not one
+static const char *parse_pattern(const char *text, uint16_t *mask,
+																 uint16_t *match) {
+	*mask = 0;
+	*match = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = (char) toupper((unsigned char) text[i]);
+		*mask <<= 4;
+		*match <<= 4;
+		if (isxdigit((unsigned char) c)) {
+			char digit[2] = {c, '\0'};
+			*mask |= 0xF;
+			*match |= (uint16_t) strtol(digit, NULL, 16);
+		} else if (c != 'X' && c != 'Y' && c != 'N' && c != 'K') {
+			return NULL;
+		}
+	}
+	return text + 4;
+}
+
+bool debugger_parse_condition(Debugger *debugger, const char *text) {
+	if (debugger->num_conditions == DEBUGGER_MAX_CONDITIONS) {
+		return false;
+	}
+	DebugCondition condition = {0};
+	const char *cursor = parse_register(skip_spaces(text), &condition.reg);
+	if (cursor == NULL) {
+		return false;
+	}
+
+	cursor = skip_spaces(cursor);
+	size_t i = 0;
+	while (i < sizeof(OPERATORS) / sizeof(OPERATORS[0]) &&
+				 strncmp(cursor, OPERATORS[i].text, strlen(OPERATORS[i].text)) != 0) {
+		i++;
+	}
+	if (i == sizeof(OPERATORS) / sizeof(OPERATORS[0])) {
+		return false;
+	}
+	condition.compare = OPERATORS[i].compare;
+	unsigned max = condition.reg == DEBUGGER_REGISTER_I ? 0xFFFF : 0xFF;
+	cursor = parse_number(skip_spaces(cursor + strlen(OPERATORS[i].text)), max,
+												&condition.value);
+	if (cursor == NULL) {
+		return false;
+	}
+
+	cursor = skip_spaces(cursor);
+	if (strncmp(cursor, "after", 5) == 0 && isspace((unsigned char) cursor[5])) {
+		cursor = parse_pattern(skip_spaces(cursor + 5), &condition.mask,
+													 &condition.match);
+		if (cursor == NULL) {
+			return false;
+		}
+		cursor = skip_spaces(cursor);
+	}
+	if (*cursor != '\0') {
+		return false;
+	}
+
+	snprintf(condition.text, sizeof(condition.text), "%s", skip_spaces(text));
+	debugger->conditions[debugger->num_conditions++] = condition;
+	return true;
+}
+
+static unsigned register_value(const Chip8 *chip8, int reg) {
+	return reg == DEBUGGER_REGISTER_I ? chip8->I : chip8->V[reg];
+}
+
+static bool holds(const DebugCondition *condition, const Chip8 *chip8) {
+	unsigned value = register_value(chip8, condition->reg);
+	switch (condition->compare) {
+	case DEBUG_EQ:
+		return value == condition->value;
+	case DEBUG_NE:
+		return value != condition->value;
+	case DEBUG_LT:
+		return value < condition->value;
+	case DEBUG_GT:
+		return value > condition->value;
+	case DEBUG_LE:
+		return value <= condition->value;
+	case DEBUG_GE:
+		return value >= condition->value;
+	}
+	return false;
+}
+
+static void stop(Debugger *debugger, const char *format, unsigned a,
+								 unsigned b) {
+	if (!debugger->paused) {
+		snprintf(debugger->reason, sizeof(debugger->reason), format, a, b);
+		debugger->paused = true;
+	}
+}
+
+// Watches and conditions after the instruction at `pc` ran; `V` and `I` are
+// the registers before it, and it stored `length` bytes at `address`
+static void check_instruction(Debugger *debugger, const Chip8 *chip8,
+															uint16_t pc, uint16_t opcode,
+															const unsigned char *V, uint16_t I,
+															uint16_t address, int length) {
+	for (int i = 0; i < length && debugger->watched_count > 0; i++) {
+		uint16_t byte = (uint16_t) ((address + i) & MEMORY_MASK);
+		if (test_bit(debugger->watched, byte)) {
+			stop(debugger, "write to 0x%03X at 0x%03X", byte, pc);
+			break;
+		}
+	}
+
+	uint32_t registers = debugger->watched_registers;
+	if ((registers >> DEBUGGER_REGISTER_I) & 1 && chip8->I != I) {
+		stop(debugger, "I changed at 0x%03X", pc, 0);
+	}
+	for (int reg = 0; reg < 16; reg++) {
+		if ((registers >> reg) & 1 && chip8->V[reg] != V[reg]) {
+			stop(debugger, "V%X changed at 0x%03X", (unsigned) reg, pc);
+		}
+	}
+
+	// Every condition is evaluated, so the edges of the plain ones stay
+	// current even when something else stopped first
+	for (int i = 0; i < debugger->num_conditions; i++) {
+		DebugCondition *condition = &debugger->conditions[i];
+		if ((opcode & condition->mask) != condition->match) {
+			continue;
+		}
+		bool was_held = condition->held;
+		condition->held = holds(condition, chip8);
+		if (condition->held && (condition->mask != 0 || !was_held)) {
+			if (!debugger->paused) {
+				snprintf(debugger->reason, sizeof(debugger->reason), "%s at 0x%03X",
+								 condition->text, pc);
+				debugger->paused = true;
+			}
+		}
+	}
+}
+
+// Runs the instruction at pc unless a breakpoint stops it first, returning
+// whether it ran. A watch or condition it sets off pauses after it.
+static bool execute(Debugger *debugger, Chip8 *chip8) {
+	uint16_t pc = chip8->pc;
+	if (!debugger->resuming && test_bit(debugger->breakpoints, pc)) {
+		stop(debugger, "breakpoint at 0x%03X", pc, 0);
+		return false;
+	}
+	debugger->resuming = false;
+
+	uint16_t opcode = fetch_opcode(chip8, pc);
+	uint16_t address = chip8->I;
+	int length = store_length(opcode, quirk_flags(chip8->quirks));
+	unsigned char V[16];
+	memcpy(V, chip8->V, sizeof(V));
+	uint16_t I = chip8->I;
+
+	// One instruction through the normal entry point, so an attached trace
+	// still records it
+	chip8_run(chip8, 1);
+	debugger->cycles++;
+	check_instruction(debugger, chip8, pc, opcode, V, I, address, length);
+	return true;
+}
+
+int debugger_run(Debugger *debugger, Chip8 *chip8, int cycles) {
+	int executed = 0;
+	while (executed < cycles && !debugger->paused) {
+		if (!execute(debugger, chip8)) {
+			break;
+		}
+		executed++;
+	}
+	return executed;
+}
+
+void debugger_step(Debugger *debugger, Chip8 *chip8) {
+	debugger->paused = false;
+	debugger->resuming = true;
+	execute(debugger, chip8);
+	if (!debugger->paused) {
+		snprintf(debugger->reason, sizeof(debugger->reason), "step");
+		debugger->paused = true;
+	}
+}
+
+void debugger_pause(Debugger *debugger, const char *reason) {
+	snprintf(debugger->reason, sizeof(debugger->reason), "%s", reason);
+	debugger->paused = true;
+}
+
+void debugger_continue(Debugger *debugger) {
+	debugger->paused = false;
+	debugger->resuming = true;
+}
+
+void debugger_view(const Debugger *debugger, const Chip8 *chip8,
+									 DebugView *view) {
+	// Cleared first so views can be compared with memcmp
+	memset(view, 0, sizeof(*view));
+	memcpy(view->V, chip8->V, sizeof(view->V));
+	view->I = chip8->I;
+	view->pc = chip8->pc;
+	view->sp = chip8->sp;
+	memcpy(view->stack, chip8->stack, sizeof(view->stack));
+	view->delay_timer = chip8->delay_timer;
+	view->sound_timer = chip8->sound_timer;
+	for (int i = 0; i < DEBUGGER_VIEW_INSTRUCTIONS; i++) {
+		uint16_t address = (uint16_t) (chip8->pc + 2 * i);
+		view->code[i] = fetch_opcode(chip8, address);
+		view->breakpoint[i] = test_bit(debugger->breakpoints, address);
+	}
+	for (int i = 0; i < DEBUGGER_VIEW_BYTES; i++) {
+		view->data[i] = chip8->memory[(chip8->I + i) & MEMORY_MASK];
+	}
+	view->paused = debugger->paused;
+	memcpy(view->reason, debugger->reason, sizeof(view->reason));
+}
@@ -0,0 +1,311 @@
+#include "disasm.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *const CLASS_NAMES[CHIP8_OP_CLASS_COUNT] = {
+		[CHIP8_OP_FLOW] = "flow",		[CHIP8_OP_ALU] = "alu",
+		[CHIP8_OP_MEMORY] = "memory", [CHIP8_OP_DRAW] = "draw",
+		[CHIP8_OP_TIMER] = "timer",		[CHIP8_OP_INPUT] = "input",
+		[CHIP8_OP_OTHER] = "other",
+};
+
+// 8XYN mnemonics, NULL for the unassigned ones
+static const char *const ALU_NAMES[16] = {
+		[0x0] = "LD",	 [0x1] = "OR",	 [0x2] = "AND",	 [0x3] = "XOR",
+		[0x4] = "ADD", [0x5] = "SUB", [0x6] = "SHR",	 [0x7] = "SUBN",
+		[0xE] = "SHL",
+};
+
+// Opcode patterns in the notation of the CHIP-8 references, exact opcodes
+// before the ranges they fall in
+static const struct {
+	uint16_t mask;
+	uint16_t match;
+	const char *pattern;
+} PATTERNS[] = {
+		{0xFFFF, 0x00E0, "00E0"}, {0xFFFF, 0x00EE, "00EE"},
+		{0xFFFF, 0x00FB, "00FB"}, {0xFFFF, 0x00FC, "00FC"},
+		{0xFFFF, 0x00FD, "00FD"}, {0xFFFF, 0x00FE, "00FE"},
+		{0xFFFF, 0x00FF, "00FF"}, {0xFFF0, 0x00C0, "00CN"},
+		{0xFFF0, 0x00D0, "00DN"}, {0xF000, 0x0000, "0NNN"},
+		{0xF000, 0x1000, "1NNN"}, {0xF000, 0x2000, "2NNN"},
+		{0xF000, 0x3000, "3XNN"}, {0xF000, 0x4000, "4XNN"},
+		{0xF00F, 0x5000, "5XY0"}, {0xF00F, 0x5002, "5XY2"},
+		{0xF00F, 0x5003, "5XY3"}, {0xF000, 0x6000, "6XNN"},
+		{0xF000, 0x7000, "7XNN"}, {0xF00F, 0x8000, "8XY0"},
+		{0xF00F, 0x8001, "8XY1"}, {0xF00F, 0x8002, "8XY2"},
+		{0xF00F, 0x8003, "8XY3"}, {0xF00F, 0x8004, "8XY4"},
+		{0xF00F, 0x8005, "8XY5"}, {0xF00F, 0x8006, "8XY6"},
+		{0xF00F, 0x8007, "8XY7"}, {0xF00F, 0x800E, "8XYE"},
+		{0xF00F, 0x9000, "9XY0"}, {0xF000, 0xA000, "ANNN"},
+		{0xF000, 0xB000, "BNNN"}, {0xF000, 0xC000, "CXNN"},
+		{0xF000, 0xD000, "DXYN"}, {0xF0FF, 0xE09E, "EX9E"},
+		{0xF0FF, 0xE0A1, "EXA1"}, {0xFFFF, 0xF000, "F000"},
+		{0xF0FF, 0xF001, "FX01"}, {0xFFFF, 0xF002, "F002"},
+		{0xF0FF, 0xF007, "FX07"}, {0xF0FF, 0xF00A, "FX0A"},
+		{0xF0FF, 0xF015, "FX15"}, {0xF0FF, 0xF018, "FX18"},
+		{0xF0FF, 0xF01E, "FX1E"}, {0xF0FF, 0xF029, "FX29"},
+		{0xF0FF, 0xF030, "FX30"}, {0xF0FF, 0xF033, "FX33"},
+		{0xF0FF, 0xF03A, "FX3A"}, {0xF0FF, 0xF055, "FX55"},
+		{0xF0FF, 0xF065, "FX65"}, {0xF0FF, 0xF075, "FX75"},
+		{0xF0FF, 0xF085, "FX85"},
+};
+
+void chip8_disassemble(uint16_t opcode, char *buffer, size_t size) {
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int n = opcode & 0x000F;
+	int nn = opcode & 0x00FF;
+	int nnn = opcode & 0x0FFF;
+
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00E0) {
+			snprintf(buffer, size, "CLS");
+		} else if (opcode == 0x00EE) {
+			snprintf(buffer, size, "RET");
+		} else if ((opcode & 0xFFF0) == 0x00C0) {
+			snprintf(buffer, size, "SCD %d", n);
+		} else if ((opcode & 0xFFF0) == 0x00D0) {
+			snprintf(buffer, size, "SCU %d", n);
+		} else if (opcode == 0x00FB) {
+			snprintf(buffer, size, "SCR");
+		} else if (opcode == 0x00FC) {
+			snprintf(buffer, size, "SCL");
+		} else if (opcode == 0x00FD) {
+			snprintf(buffer, size, "EXIT");
+		} else if (opcode == 0x00FE) {
+			snprintf(buffer, size, "LOW");
+		} else if (opcode == 0x00FF) {
+			snprintf(buffer, size, "HIGH");
+		} else {
+			snprintf(buffer, size, "SYS 0x%03X", nnn);
+		}
+		return;
+	case 0x1000:
+		snprintf(buffer, size, "JP 0x%03X", nnn);
+		return;
+	case 0x2000:
+		snprintf(buffer, size, "CALL 0x%03X", nnn);
+		return;
+	case 0x3000:
+		snprintf(buffer, size, "SE V%X, 0x%02X", x, nn);
+		return;
+	case 0x4000:
+		snprintf(buffer, size, "SNE V%X, 0x%02X", x, nn);
+		return;
+	case 0x5000:
+		if (n == 0x0) {
+			snprintf(buffer, size, "SE V%X, V%X", x, y);
+		} else if (n == 0x2) {
+			snprintf(buffer, size, "LD [I], V%X-V%X", x, y);
+		} else if (n == 0x3) {
+			snprintf(buffer, size, "LD V%X-V%X, [I]", x, y);
+		} else {
+			break;
+		}
+		return;
+	case 0x6000:
+		snprintf(buffer, size, "LD V%X, 0x%02X", x, nn);
+		return;
+	case 0x7000:
+		snprintf(buffer, size, "ADD V%X, 0x%02X", x, nn);
+		return;
+	case 0x8000:
+		if (ALU_NAMES[n] == NULL) {
+			break;
+		}
+		snprintf(buffer, size, "%s V%X, V%X", ALU_NAMES[n], x, y);
+		return;
+	case 0x9000:
+		if (n != 0) {
+			break;
+		}
+		snprintf(buffer, size, "SNE V%X, V%X", x, y);
+		return;
+	case 0xA000:
+		snprintf(buffer, size, "LD I, 0x%03X", nnn);
+		return;
+	case 0xB000:
+		snprintf(buffer, size, "JP V0, 0x%03X", nnn);
+		return;
+	case 0xC000:
+		snprintf(buffer, size, "RND V%X, 0x%02X", x, nn);
+		return;
+	case 0xD000:
+		snprintf(buffer, size, "DRW V%X, V%X, %d", x, y, n);
+		return;
+	case 0xE000:
+		if (nn == 0x9E) {
+			snprintf(buffer, size, "SKP V%X", x);
+		} else if (nn == 0xA1) {
+			snprintf(buffer, size, "SKNP V%X", x);
+		} else {
+			break;
+		}
+		return;
+	case 0xF000:
+		switch (nn) {
+		case 0x00:
+			if (x != 0) {
+				break;
+			}
+			snprintf(buffer, size, "LD I, long");
+			return;
+		case 0x01:
+			snprintf(buffer, size, "PLANE %d", x);
+			return;
+		case 0x02:
+			if (x != 0) {
+				break;
+			}
+			snprintf(buffer, size, "AUDIO");
+			return;
+		case 0x07:
+			snprintf(buffer, size, "LD V%X, DT", x);
+			return;
+		case 0x0A:
+			snprintf(buffer, size, "LD V%X, K", x);
+			return;
+		case 0x15:
+			snprintf(buffer, size, "LD DT, V%X", x);
+			return;
+		case 0x18:
+			snprintf(buffer, size, "LD ST, V%X", x);
+			return;
+		case 0x1E:
+			snprintf(buffer, size, "ADD I, V%X", x);
+			return;
+		case 0x29:
+			snprintf(buffer, size, "LD F, V%X", x);
+			return;
+		case 0x30:
+			snprintf(buffer, size, "LD HF, V%X", x);
+			return;
+		case 0x33:
+			snprintf(buffer, size, "LD B, V%X", x);
+			return;
+		case 0x3A:
+			snprintf(buffer, size, "PITCH V%X", x);
+			return;
+		case 0x55:
+			snprintf(buffer, size, "LD [I], V%X", x);
+			return;
+		case 0x65:
+			snprintf(buffer, size, "LD V%X, [I]", x);
+			return;
+		case 0x75:
+			snprintf(buffer, size, "LD R, V%X", x);
+			return;
+		case 0x85:
+			snprintf(buffer, size, "LD V%X, R", x);
+			return;
+		}
+		break;
+	}
+	snprintf(buffer, size, "DW 0x%04X", opcode);
+}
+
+const char *chip8_op_pattern(uint16_t opcode) {
+	for (size_t i = 0; i < sizeof(PATTERNS) / sizeof(PATTERNS[0]); i++) {
+		if ((opcode & PATTERNS[i].mask) == PATTERNS[i].match) {
+			return PATTERNS[i].pattern;
+		}
+	}
+	return NULL;
+}
+
+Chip8OpClass chip8_op_class(uint16_t opcode) {
+	int n = opcode & 0x000F;
+	int nn = opcode & 0x00FF;
+
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00EE) {
+			return CHIP8_OP_FLOW;
+		}
+		if (opcode == 0x00E0 || (opcode & 0xFFE0) == 0x00C0 ||
+				(opcode >= 0x00FB && opcode <= 0x00FF && opcode != 0x00FD)) {
+			return CHIP8_OP_DRAW;
+		}
+		return CHIP8_OP_OTHER;
+	case 0x1000:
+	case 0x2000:
+	case 0x3000:
+	case 0x4000:
+	case 0x9000:
+	case 0xB000:
+		return CHIP8_OP_FLOW;
+	case 0x5000:
+		return n == 0 ? CHIP8_OP_FLOW : CHIP8_OP_MEMORY;
+	case 0x6000:
+	case 0x7000:
+	case 0x8000:
+	case 0xC000:
+		return CHIP8_OP_ALU;
+	case 0xA000:
+		return CHIP8_OP_MEMORY;
+	case 0xD000:
+		return CHIP8_OP_DRAW;
+	case 0xE000:
+		return CHIP8_OP_INPUT;
+	}
+
+	switch (nn) {
+	case 0x01:
+		return CHIP8_OP_DRAW;
+	case 0x02:
+	case 0x07:
+	case 0x15:
+	case 0x18:
+	case 0x3A:
+		return CHIP8_OP_TIMER;
+	case 0x0A:
+		return CHIP8_OP_INPUT;
+	case 0x00:
+	case 0x1E:
+	case 0x29:
+	case 0x30:
+	case 0x33:
+	case 0x55:
+	case 0x65:
+	case 0x75:
+	case 0x85:
+		return CHIP8_OP_MEMORY;
+	}
+	return CHIP8_OP_OTHER;
+}
+
+bool chip8_op_writes_vx(uint16_t opcode) {
+	int n = opcode & 0x000F;
+	int nn = opcode & 0x00FF;
+
+	switch (opcode & 0xF000) {
+	case 0x5000:
+		return n == 0x3;
+	case 0x6000:
+	case 0x7000:
+	case 0xC000:
+		return true;
+	case 0x8000:
+		return n <= 0x7 || n == 0xE;
+	case 0xF000:
+		return nn == 0x07 || nn == 0x0A || nn == 0x65 || nn == 0x85;
+	}
+	return false;
+}
+
+const char *chip8_op_class_name(Chip8OpClass op_class) {
+	return CLASS_NAMES[op_class];
+}
+
+bool chip8_op_class_parse(const char *name, Chip8OpClass *op_class) {
+	for (int i = 0; i < CHIP8_OP_CLASS_COUNT; i++) {
+		if (strcmp(name, CLASS_NAMES[i]) == 0) {
+			*op_class = (Chip8OpClass) i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -1,12 +1,22 @@
 #include "display.h"
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL3/SDL.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DISPLAY_X86
+#endif
+
 #include "chip8.h"
+#include "debugger.h"
+#include "disasm.h"
+#include "profiler.h"
 
 #define WINDOW_WIDTH 64
 #define WINDOW_HEIGHT 32
@@ -15,8 +25,86 @@
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
+// SUPER-CHIP/XO-CHIP 128x64 mode, scaled to the same window
+static SDL_Texture *hires_texture = NULL;
+
+static uint32_t pixel_buffer[CHIP8_HIRES_WIDTH * CHIP8_HIRES_HEIGHT];
+
+// Summer Beach Day palette by default: Deep Sea Blue on Sandy Beige
+static uint32_t foreground = 0xFF006994;
+static uint32_t background = 0xFFF4E8D1;
+// XO-CHIP second plane alone, and both planes set: Coral and Dark Slate
+static uint32_t plane2_colour = 0xFFFF7F50;
+static uint32_t overlap_colour = 0xFF1B3B4B;
+
+// Rows as they were last uploaded, so redrawing identical pixels is free
+static uint64_t presented_rows[CHIP8_PLANES][CHIP8_HIRES_HEIGHT][2];
+static bool presented_hires = false;
+static bool needs_full_redraw = true;
+// Inspector state on screen, so an unchanged one is not presented again
+static DebugView presented_debug;
+static bool presented_has_debug = false;
+
+#ifdef DISPLAY_X86
+// Each sprite byte is broadcast to every lane, masked with one bit per lane
+// and compared, giving an all-ones lane for set pixels that selects the
+// foreground colour
+static void expand_row_sse2(uint64_t row, uint32_t *out) {
+	const __m128i bg = _mm_set1_epi32((int) background);
+	const __m128i diff = _mm_set1_epi32((int) (foreground ^ background));
+	const __m128i high_bits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+	const __m128i low_bits = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+	for (int i = 0; i < 8; i++) {
+		__m128i byte = _mm_set1_epi32((int) ((row >> (56 - 8 * i)) & 0xFF));
+		__m128i high = _mm_cmpeq_epi32(_mm_and_si128(byte, high_bits), high_bits);
+		__m128i low = _mm_cmpeq_epi32(_mm_and_si128(byte, low_bits), low_bits);
+		_mm_storeu_si128((__m128i *) (out + 8 * i),
+										 _mm_xor_si128(bg, _mm_and_si128(diff, high)));
+		_mm_storeu_si128((__m128i *) (out + 8 * i + 4),
+										 _mm_xor_si128(bg, _mm_and_si128(diff, low)));
+	}
+}
+
+__attribute__((target("avx2"))) static void expand_row_avx2(uint64_t row,
+																														uint32_t *out) {
+	const __m256i bg = _mm256_set1_epi32((int) background);
+	const __m256i diff = _mm256_set1_epi32((int) (foreground ^ background));
+	const __m256i bits =
+			_mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+	for (int i = 0; i < 8; i++) {
+		__m256i byte = _mm256_set1_epi32((int) ((row >> (56 - 8 * i)) & 0xFF));
+		__m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+		_mm256_storeu_si256((__m256i *) (out + 8 * i),
+												_mm256_xor_si256(bg, _mm256_and_si256(diff, set)));
+	}
+}
+
+// Expands one packed row (bit 63 = x 0) into 64 ARGB pixels, SSE2 is always
+// available on x86-64 and AVX2 is picked in display_init when present
+static void (*expand_row)(uint64_t row, uint32_t *out) = expand_row_sse2;
+#else
+// Expands one packed row (bit 63 = x 0) into 64 ARGB pixels without branches
+static void expand_row_scalar(uint64_t row, uint32_t *out) {
+	uint32_t diff = foreground ^ background;
+	for (int x = 0; x < 64; x++) {
+		uint32_t mask = -(uint32_t) ((row >> (63 - x)) & 1);
+		out[x] = background ^ (diff & mask);
+	}
+}
+
+static void (*expand_row)(uint64_t row, uint32_t *out) = expand_row_scalar;
+#endif
 
-static uint32_t pixel_buffer[64 * 32];
+// Rows with pixels on the second XO-CHIP plane pick one of four colours, rare
+// enough that a scalar loop will do
+static void expand_planes(uint64_t low, uint64_t high, uint32_t *out) {
+	const uint32_t colours[4] = {background, foreground, plane2_colour,
+															 overlap_colour};
+	for (int x = 0; x < 64; x++) {
+		int index = (low >> (63 - x) & 1) | (high >> (63 - x) & 1) << 1;
+		out[x] = colours[index];
+	}
+}
 
 bool display_init(void) {
 	if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
@@ -42,11 +130,23 @@ bool display_init(void) {
 		return false;
 	}
 
+	// Presenting runs on its own thread, so waiting for vblank costs the
+	// emulation nothing and avoids tearing
+	if (!SDL_SetRenderVSync(renderer, 1)) {
+		fprintf(stderr, "Warning: VSync is not available: %s\n", SDL_GetError());
+	}
+
 	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
 															SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH,
 															WINDOW_HEIGHT);
-	if (texture == NULL) {
+	hires_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+																		SDL_TEXTUREACCESS_STREAMING,
+																		CHIP8_HIRES_WIDTH, CHIP8_HIRES_HEIGHT);
+	if (texture == NULL || hires_texture == NULL) {
 		fprintf(stderr, "Error creating texture: %s\n", SDL_GetError());
+		SDL_DestroyTexture(texture);
+		SDL_DestroyTexture(hires_texture);
+		texture = hires_texture = NULL;
 		SDL_DestroyRenderer(renderer);
 		SDL_DestroyWindow(window);
 		SDL_Quit();
@@ -55,38 +155,178 @@ bool display_init(void) {
 		return false;
 	}
 
-	if (!SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST)) {
+	if (!SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST) ||
+			!SDL_SetTextureScaleMode(hires_texture, SDL_SCALEMODE_NEAREST)) {
 		fprintf(stderr, "Nearest neighbour texture filtering failed to enable.");
 	}
 
+#ifdef DISPLAY_X86
+	expand_row = __builtin_cpu_supports("avx2") ? expand_row_avx2 : expand_row_sse2;
+#endif
+	needs_full_redraw = true;
+
 	printf("Display initialized successfully.\n");
 	return true;
 }
 
-void display_draw(const Chip8 *chip8) {
-	for (int i = 0; i < 2048; ++i) {
-		// Summer Beach Day Palette
-		if (chip8->gfx[i]) {
-			// Foreground: Deep Sea Blue
-			pixel_buffer[i] = 0xFF006994;
-		} else {
-			// Background: Sandy Beige
-			pixel_buffer[i] = 0xFFF4E8D1;
+void display_set_palette(uint32_t foreground_argb, uint32_t background_argb) {
+	foreground = foreground_argb;
+	background = background_argb;
+	needs_full_redraw = true;
+}
+
+void display_get_palette(uint32_t palette[4]) {
+	palette[0] = background;
+	palette[1] = foreground;
+	palette[2] = plane2_colour;
+	palette[3] = overlap_colour;
+}
+
+void display_invalidate(void) {
+	needs_full_redraw = true;
+}
+
+// Writes one line of the inspector in SDL's built-in 8x8 font
+static void overlay_line(int line, const char *format, ...) {
+	char text[96];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	SDL_RenderDebugText(renderer, SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE,
+											(float) (SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE * (line + 1)),
+											text);
+}
+
+// Registers, the code at pc and the memory at I over the left of the screen
+static void draw_overlay(const DebugView *view) {
+	const int lines = 8 + DEBUGGER_VIEW_INSTRUCTIONS;
+	SDL_FRect panel = {0, 0, 53.0f * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE,
+										 (float) ((lines + 1) * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE)};
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+	SDL_RenderFillRect(renderer, &panel);
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+
+	const uint8_t *V = view->V;
+	overlay_line(0, "%s", view->paused ? view->reason : "running");
+	overlay_line(1, "PC %04X  I %04X  SP %X  DT %02X  ST %02X", view->pc,
+							 view->I, view->sp, view->delay_timer, view->sound_timer);
+	overlay_line(2, "V0-7 %02X %02X %02X %02X %02X %02X %02X %02X", V[0], V[1],
+							 V[2], V[3], V[4], V[5], V[6], V[7]);
+	overlay_line(3, "V8-F %02X %02X %02X %02X %02X %02X %02X %02X", V[8], V[9],
+							 V[10], V[11], V[12], V[13], V[14], V[15]);
+	char stack[48] = "";
+	for (int i = 0; i < view->sp && i < 8; i++) {
+		snprintf(stack + 5 * i, sizeof(stack) - 5 * i, " %04X", view->stack[i]);
+	}
+	overlay_line(4, "Stack%s", stack);
+	for (int i = 0; i < DEBUGGER_VIEW_INSTRUCTIONS; i++) {
+		char text[32];
+		chip8_disassemble(view->code[i], text, sizeof(text));
+		overlay_line(6 + i, "%c%c %04X  %04X  %s", i == 0 ? '>' : ' ',
+								 view->breakpoint[i] ? '*' : ' ', (view->pc + 2 * i) & 0xFFFF,
+								 view->code[i], text);
+	}
+	const uint8_t *data = view->data;
+	overlay_line(7 + DEBUGGER_VIEW_INSTRUCTIONS,
+							 "[I] %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X %02X "
+							 "%02X %02X %02X %02X %02X",
+							 data[0], data[1], data[2], data[3], data[4], data[5], data[6],
+							 data[7], data[8], data[9], data[10], data[11], data[12],
+							 data[13], data[14], data[15]);
+}
+
+/*
+ * Converts and uploads only the rows that differ from what is on screen, and
+ * skips presenting altogether when nothing does, returning whether it
+ * presented. Low and high resolution use their own texture, a mode switch
+ * redraws everything.
+ */
+bool display_draw(const DisplayFrame *frame) {
+	PROFILE_BEGIN(convert);
+	bool hires = frame->hires;
+	if (hires != presented_hires) {
+		presented_hires = hires;
+		needs_full_redraw = true;
+	}
+	// Closing the inspector uncovers pixels that did not change
+	if (presented_has_debug && !frame->has_debug) {
+		needs_full_redraw = true;
+	}
+	int width = hires ? CHIP8_HIRES_WIDTH : CHIP8_SCREEN_WIDTH;
+	int words = width / 64;
+	uint64_t all_rows = hires ? UINT64_MAX : UINT32_MAX;
+
+	uint64_t candidates =
+			(needs_full_redraw ? UINT64_MAX : frame->dirty_rows) & all_rows;
+	uint64_t changed = 0;
+	while (candidates != 0) {
+		int y = __builtin_ctzll(candidates);
+		candidates &= candidates - 1;
+		const uint64_t *low = frame->gfx[0][y];
+		const uint64_t *high = frame->gfx[1][y];
+		size_t size = sizeof(presented_rows[0][y]);
+		if (!needs_full_redraw && memcmp(low, presented_rows[0][y], size) == 0 &&
+				memcmp(high, presented_rows[1][y], size) == 0) {
+			continue;
+		}
+		for (int word = 0; word < words; word++) {
+			uint32_t *out = &pixel_buffer[y * width + word * 64];
+			if (high[word] == 0) {
+				expand_row(low[word], out);
+			} else {
+				expand_planes(low[word], high[word], out);
+			}
 		}
+		memcpy(presented_rows[0][y], low, size);
+		memcpy(presented_rows[1][y], high, size);
+		changed |= UINT64_C(1) << y;
+	}
+	PROFILE_END(convert, PROBE_CONVERT);
+	bool debug_changed =
+			frame->has_debug &&
+			(!presented_has_debug ||
+			 memcmp(&frame->debug, &presented_debug, sizeof(DebugView)) != 0);
+	if (changed == 0 && !debug_changed) {
+		return false;
 	}
-	SDL_UpdateTexture(texture, NULL, pixel_buffer, 64 * sizeof(uint32_t));
+
+	// One upload covering the first to the last changed row
+	PROFILE_BEGIN(upload);
+	SDL_Texture *target = hires ? hires_texture : texture;
+	if (changed != 0) {
+		int first = __builtin_ctzll(changed);
+		int last = 63 - __builtin_clzll(changed);
+		SDL_Rect span = {0, first, width, last - first + 1};
+		SDL_UpdateTexture(target, &span, &pixel_buffer[first * width],
+											width * sizeof(uint32_t));
+	}
+	PROFILE_END(upload, PROBE_UPLOAD);
+
+	PROFILE_BEGIN(present);
 	SDL_RenderClear(renderer);
-	SDL_RenderTexture(renderer, texture, NULL, NULL);
+	SDL_RenderTexture(renderer, target, NULL, NULL);
+	if (frame->has_debug) {
+		draw_overlay(&frame->debug);
+		presented_debug = frame->debug;
+	}
+	presented_has_debug = frame->has_debug;
 	SDL_RenderPresent(renderer);
+	PROFILE_END(present, PROBE_PRESENT);
+	needs_full_redraw = false;
+	return true;
 }
 
 void display_destroy(void) {
+	SDL_DestroyTexture(hires_texture);
 	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	printf("Display destroyed.\n");
 
 	texture = NULL;
+	hires_texture = NULL;
 	renderer = NULL;
 	window = NULL;
 }
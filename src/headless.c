@@ -0,0 +1,364 @@
+#include "headless.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "chip8.h"
+#include "chip8_aot.h"
+#include "chip8_cache.h"
+#include "chip8_jit.h"
+#include "movie.h"
+#include "profile.h"
+#include "trace.h"
+
+#define DEFAULT_CYCLES_PER_FRAME 8
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s --headless (--cycles N | --frames N) [--ipf N] "
+					"[--engine interp|cache|jit|aot] "
+					"[--quirks vip|chip48|schip|xochip] "
+					"[--movie FILE] [--trace FILE] [--capture FILE.gif] [--quiet] "
+					"<rom_file_name>\n",
+					program);
+}
+
+static bool parse_args(HeadlessOptions *options, int argc, char **argv,
+											 const Chip8AotProgram *program) {
+	memset(options, 0, sizeof(*options));
+	options->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+	options->program = program;
+	if (program != NULL) {
+		options->engine = ENGINE_AOT;
+		if (program->cycles_per_frame > 0) {
+			options->cycles_per_frame = program->cycles_per_frame;
+		}
+	}
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--headless") == 0) {
+			continue;
+		} else if (strcmp(arg, "--quiet") == 0) {
+			options->quiet = true;
+		} else if (strcmp(arg, "--cycles") == 0 && i + 1 < argc) {
+			options->max_cycles = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--frames") == 0 && i + 1 < argc) {
+			options->max_frames = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--ipf") == 0 && i + 1 < argc) {
+			options->cycles_per_frame = atoi(argv[++i]);
+		} else if (strcmp(arg, "--quirks") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			if (!chip8_quirks_parse(name, &options->quirks)) {
+				fprintf(stderr, "Unknown quirk profile: %s\n", name);
+				return false;
+			}
+			options->has_quirks = true;
+		} else if (strcmp(arg, "--movie") == 0 && i + 1 < argc) {
+			options->movie_path = argv[++i];
+		} else if (strcmp(arg, "--trace") == 0 && i + 1 < argc) {
+			options->trace_path = argv[++i];
+		} else if (strcmp(arg, "--capture") == 0 && i + 1 < argc) {
+			options->capture_path = argv[++i];
+		} else if (strcmp(arg, "--engine") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			if (strcmp(name, "interp") == 0) {
+				options->engine = ENGINE_INTERPRETER;
+			} else if (strcmp(name, "cache") == 0) {
+				options->engine = ENGINE_CACHE;
+			} else if (strcmp(name, "jit") == 0) {
+				options->engine = ENGINE_JIT;
+			} else if (strcmp(name, "aot") == 0 && program != NULL) {
+				options->engine = ENGINE_AOT;
+			} else {
+				fprintf(stderr, "Unknown engine: %s\n", name);
+				return false;
+			}
+		} else if (arg[0] == '-') {
+			fprintf(stderr, "Unknown option: %s\n", arg);
+			return false;
+		} else {
+			options->rom_filename = arg;
+		}
+	}
+
+	if ((options->rom_filename == NULL && program == NULL) ||
+			options->cycles_per_frame <= 0 ||
+			(options->max_cycles == 0 && options->max_frames == 0 &&
+			 options->movie_path == NULL)) {
+		print_usage(argv[0]);
+		return false;
+	}
+	return true;
+}
+
+bool headless_parse_args(HeadlessOptions *options, int argc, char **argv) {
+	return parse_args(options, argc, argv, NULL);
+}
+
+static void run_cycles(Chip8 *chip8, Chip8Cache *cache, Chip8Jit *jit,
+											 Chip8Aot *aot, int cycles) {
+	if (aot != NULL) {
+		chip8_aot_run(aot, chip8, cycles);
+	} else if (cache != NULL) {
+		chip8_cache_run(cache, chip8, cycles);
+	} else if (jit != NULL) {
+		chip8_jit_run(jit, chip8, cycles);
+	} else {
+		chip8_run(chip8, cycles);
+	}
+}
+
+int headless_run(const HeadlessOptions *options) {
+	// Everything a failed setup step has to release, see cleanup below
+	int status = 1;
+	Movie movie = {0};
+	Chip8Trace trace;
+	bool has_trace = false;
+	Chip8Capture *capture = NULL;
+	bool capturing = false;
+	Chip8Cache *cache = NULL;
+	Chip8Jit *jit = NULL;
+	Chip8Aot *aot = NULL;
+	unsigned long long cycles = 0;
+	unsigned long long frames = 0;
+
+	Chip8 chip8;
+	chip8_init(&chip8);
+	// A compiled program already carries the settings of the ROM's profile
+	const char *rom_name = options->rom_filename;
+	const RomProfile *profile = NULL;
+	if (rom_name == NULL) {
+		chip8_aot_load(options->program, &chip8);
+		rom_name = options->program->name;
+	} else if (chip8_load_rom(&chip8, rom_name)) {
+		profile = profile_find(rom_name);
+	} else {
+		goto cleanup;
+	}
+	if (options->has_quirks) {
+		chip8.quirks = options->quirks;
+	} else if (profile != NULL) {
+		chip8.quirks = profile->quirks;
+	}
+
+	int cycles_per_frame = options->cycles_per_frame;
+	unsigned long long max_frames = options->max_frames;
+	bool has_movie = options->movie_path != NULL;
+	if (has_movie) {
+		if (!movie_load(&movie, options->movie_path)) {
+			goto cleanup;
+		}
+		if (!movie_matches_rom(&movie, &chip8)) {
+			fprintf(stderr, "Warning: Movie was recorded with a different ROM.\n");
+		}
+		if (!movie_matches_quirks(&movie, &chip8)) {
+			fprintf(stderr,
+							"Error: Movie was recorded with the %s quirks, not %s.\n",
+							chip8_quirks_name(movie.quirks),
+							chip8_quirks_name(chip8.quirks));
+			goto cleanup;
+		}
+		// The recording fixes the seed and frame length, or it would not replay
+		chip8_seed(&chip8, movie.seed);
+		cycles_per_frame = movie.cycles_per_frame;
+		if (max_frames == 0 && options->max_cycles == 0) {
+			max_frames = movie.frames;
+		}
+	}
+
+	// Records are written by the interpreter loop, the other engines run whole
+	// blocks without stepping through it
+	HeadlessEngine engine = options->engine;
+	if (options->trace_path != NULL) {
+		if (engine != ENGINE_INTERPRETER) {
+			fprintf(stderr, "Warning: Tracing runs on the interpreter.\n");
+			engine = ENGINE_INTERPRETER;
+		}
+		if (!trace_open(&trace, options->trace_path, TRACE_DEFAULT_CAPACITY)) {
+			goto cleanup;
+		}
+		has_trace = true;
+		chip8.trace = &trace;
+	}
+
+	if (options->capture_path != NULL) {
+		capture = malloc(sizeof(*capture));
+		if (capture == NULL ||
+				!capture_open(capture, options->capture_path,
+											CAPTURE_DEFAULT_CAPACITY, CAPTURE_DEFAULT_SCALE, NULL)) {
+			goto cleanup;
+		}
+		capturing = true;
+	}
+
+	if (engine == ENGINE_CACHE) {
+		cache = malloc(sizeof(*cache));
+		if (cache == NULL || !chip8_cache_init(cache)) {
+			fprintf(stderr, "Error: Failed to allocate block cache.\n");
+			free(cache);
+			cache = NULL;
+			goto cleanup;
+		}
+	}
+
+	if (engine == ENGINE_JIT) {
+		jit = malloc(sizeof(*jit));
+		if (jit == NULL || !chip8_jit_init(jit)) {
+			// Not fatal: the dispatcher below falls back to the interpreter
+			fprintf(stderr, "Warning: JIT unavailable, using the interpreter.\n");
+			free(jit);
+			jit = NULL;
+		}
+	}
+
+	// Runs that do not match a ROM loaded from a file are interpreted
+	if (engine == ENGINE_AOT) {
+		aot = malloc(sizeof(*aot));
+		if (aot == NULL) {
+			fprintf(stderr, "Error: Failed to allocate compiled program state.\n");
+			goto cleanup;
+		}
+		chip8_aot_init(aot, options->program);
+		chip8_aot_sync(aot, &chip8);
+		if (chip8.quirks != options->program->quirks) {
+			fprintf(stderr, "Warning: ROM was compiled for the %s profile, using "
+											"the interpreter.\n",
+							chip8_quirks_name(options->program->quirks));
+		}
+	}
+
+	double start = now_seconds();
+	// Same schedule as the SDL front end: input, a batch of cycles, then one
+	// timer tick
+	while ((options->max_cycles == 0 || cycles < options->max_cycles) &&
+				 (max_frames == 0 || frames < max_frames)) {
+		int batch = cycles_per_frame;
+		if (options->max_cycles != 0 &&
+				options->max_cycles - cycles < (unsigned long long) batch) {
+			batch = (int) (options->max_cycles - cycles);
+		}
+
+		chip8_clear_key_edges(&chip8);
+		if (has_movie) {
+			// Split the batch wherever the movie changes the keypad mid-frame
+			int done = 0;
+			while (done < batch) {
+				int next = movie_apply(&movie, (uint32_t) frames, done, &chip8);
+				int step = (next < batch ? next : batch) - done;
+				run_cycles(&chip8, cache, jit, aot, step);
+				done += step;
+			}
+		} else {
+			run_cycles(&chip8, cache, jit, aot, batch);
+		}
+		cycles += batch;
+		// Nothing paces a headless run, so it waits for the encoder instead of
+		// dropping frames
+		if (capture != NULL && chip8.draw_flag) {
+			capture_frame(capture, &chip8, (uint32_t) frames, true);
+			chip8.draw_flag = false;
+		}
+		chip8_update_timers(&chip8);
+		frames++;
+	}
+
+	double elapsed = now_seconds() - start;
+	unsigned long long hash = chip8_framebuffer_hash(&chip8);
+	// Flush both before their counts are printed
+	if (has_trace) {
+		chip8.trace = NULL;
+		trace_close(&trace);
+	}
+	if (capturing) {
+		capture_close(capture, (uint32_t) frames);
+		capturing = false;
+	}
+
+	if (!options->quiet) {
+		printf("ROM:          %s\n", rom_name);
+		printf("Cycles:       %llu\n", cycles);
+		printf("Frames:       %llu\n", frames);
+		printf("Elapsed:      %.6f s\n", elapsed);
+		// Skipped idle cycles cost next to nothing, so the rate only counts the
+		// instructions that actually ran
+		unsigned long long executed = cycles - chip8.idle_cycles;
+		printf("Executed:     %llu instructions\n", executed);
+		printf("Idle skipped: %llu cycles (%.1f%%)\n", chip8.idle_cycles,
+					 cycles > 0 ? 100.0 * chip8.idle_cycles / cycles : 0.0);
+		printf("Instr/sec:    %.0f (%.2f MIPS)\n",
+					 elapsed > 0 ? executed / elapsed : 0.0,
+					 elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+	}
+	if (has_trace && !options->quiet) {
+		printf("Trace:        %llu records (%llu dropped)\n",
+					 (unsigned long long) trace.written,
+					 (unsigned long long) trace.dropped);
+	}
+	if (capture != NULL && !options->quiet) {
+		printf("Capture:      %llu images (%llu duplicate frames)\n",
+					 (unsigned long long) capture->written,
+					 (unsigned long long) capture->duplicates);
+	}
+	if (cache != NULL && !options->quiet) {
+		printf("Blocks built: %llu (%llu entries invalidated)\n",
+					 cache->blocks_built, cache->invalidations);
+	}
+	if (jit != NULL && !options->quiet) {
+		printf("JIT blocks:   %llu (%llu invalidated, %llu flushes, %llu cycles "
+					 "interpreted)\n",
+					 jit->blocks_compiled, jit->invalidations, jit->flushes,
+					 jit->interpreted_cycles);
+	}
+	if (aot != NULL && !options->quiet) {
+		printf("Compiled:     %llu cycles (%llu interpreted, %llu runs "
+					 "invalidated)\n",
+					 aot->compiled_cycles, aot->interpreted_cycles, aot->invalidations);
+	}
+	printf("Framebuffer:  %016llx\n", hash);
+	status = 0;
+
+cleanup:
+	// Joins the trace flusher and capture encoder if setup failed after them
+	if (chip8.trace != NULL) {
+		chip8.trace = NULL;
+		trace_close(&trace);
+	}
+	if (capturing) {
+		capture_close(capture, (uint32_t) frames);
+	}
+	if (jit != NULL) {
+		chip8_jit_destroy(jit);
+		free(jit);
+	}
+	free(aot);
+	if (cache != NULL) {
+		chip8_cache_destroy(cache);
+		free(cache);
+	}
+	free(capture);
+	movie_destroy(&movie);
+	return status;
+}
+
+int headless_main(int argc, char **argv) {
+	return headless_main_aot(argc, argv, NULL);
+}
+
+int headless_main_aot(int argc, char **argv, const Chip8AotProgram *program) {
+	HeadlessOptions options;
+	if (!parse_args(&options, argc, argv, program)) {
+		return 1;
+	}
+	return headless_run(&options);
+}
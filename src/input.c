@@ -1,23 +1,102 @@
 #include "input.h"
 
+#include <string.h>
+
 #include <SDL3/SDL.h>
 
-#include "chip8.h"
+#include "display.h"
+
+typedef struct {
+	SDL_Scancode scancode;
+	uint8_t key;
+} KeyBinding;
 
-// A keymap to translate SDL scancodes to CHIP-8 key indexes.
 // CHIP-8 Keypad:    SDL Keyboard:
 // 1 2 3 C           1 2 3 4
 // 4 5 6 D           Q W E R
 // 7 8 9 E           A S D F
 // A 0 B F           Z X C V
-static const SDL_Scancode KEYMAP[16] = {
-		SDL_SCANCODE_X, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3,
-		SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_A,
-		SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_Z, SDL_SCANCODE_C,
-		SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V};
+static const KeyBinding DEFAULT_BINDINGS[] = {
+		{SDL_SCANCODE_1, 0x1}, {SDL_SCANCODE_2, 0x2}, {SDL_SCANCODE_3, 0x3},
+		{SDL_SCANCODE_4, 0xC}, {SDL_SCANCODE_Q, 0x4}, {SDL_SCANCODE_W, 0x5},
+		{SDL_SCANCODE_E, 0x6}, {SDL_SCANCODE_R, 0xD}, {SDL_SCANCODE_A, 0x7},
+		{SDL_SCANCODE_S, 0x8}, {SDL_SCANCODE_D, 0x9}, {SDL_SCANCODE_F, 0xE},
+		{SDL_SCANCODE_Z, 0xA}, {SDL_SCANCODE_X, 0x0}, {SDL_SCANCODE_C, 0xB},
+		{SDL_SCANCODE_V, 0xF},
+};
+
+// Added on top of the default layout, W/A/S/D and E keep working
+static const KeyBinding ARROW_BINDINGS[] = {
+		{SDL_SCANCODE_UP, 0x5},		 {SDL_SCANCODE_LEFT, 0x7},
+		{SDL_SCANCODE_DOWN, 0x8},	 {SDL_SCANCODE_RIGHT, 0x9},
+		{SDL_SCANCODE_SPACE, 0x6},
+};
+
+// Keypad index for every scancode, -1 when the key is not bound
+static int8_t scancode_keys[SDL_SCANCODE_COUNT];
+
+static void bind_keys(const KeyBinding *bindings, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		scancode_keys[bindings[i].scancode] = (int8_t) bindings[i].key;
+	}
+}
+
+void input_set_keymap(Keymap keymap) {
+	memset(scancode_keys, -1, sizeof(scancode_keys));
+	bind_keys(DEFAULT_BINDINGS, SDL_arraysize(DEFAULT_BINDINGS));
+	if (keymap == KEYMAP_ARROWS) {
+		bind_keys(ARROW_BINDINGS, SDL_arraysize(ARROW_BINDINGS));
+	}
+}
+
+// Queues the keypad state after a change. When the ring is full the change is
+// dropped and flagged, and the consumer falls back to the current state.
+static void push_key_event(InputKeypad *keypad, uint64_t time_ns,
+													 uint16_t keys) {
+	if (keys == keypad->held) {
+		return;
+	}
+	keypad->held = keys;
+	atomic_store_explicit(&keypad->keys, keys, memory_order_relaxed);
+
+	unsigned tail = atomic_load_explicit(&keypad->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&keypad->head, memory_order_acquire);
+	if (tail - head == INPUT_MAX_KEY_EVENTS) {
+		atomic_store_explicit(&keypad->overflowed, true, memory_order_release);
+		return;
+	}
+	keypad->events[tail & (INPUT_MAX_KEY_EVENTS - 1)] =
+			(InputKeyEvent) {time_ns, keys};
+	atomic_store_explicit(&keypad->tail, tail + 1, memory_order_release);
+}
+
+int input_take_key_events(InputKeypad *keypad, InputKeyEvent *events,
+													int max) {
+	unsigned head = atomic_load_explicit(&keypad->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&keypad->tail, memory_order_acquire);
+	int count = 0;
+	while (head != tail && count < max) {
+		events[count++] = keypad->events[head++ & (INPUT_MAX_KEY_EVENTS - 1)];
+	}
+	atomic_store_explicit(&keypad->head, head, memory_order_release);
+
+	// Stamped as late as possible, so it lands at the end of the batch
+	if (count < max &&
+			atomic_exchange_explicit(&keypad->overflowed, false,
+															 memory_order_acquire)) {
+		events[count++] = (InputKeyEvent) {UINT64_MAX, input_keys(keypad)};
+	}
+	return count;
+}
+
+uint16_t input_keys(InputKeypad *keypad) {
+	return (uint16_t) atomic_load_explicit(&keypad->keys, memory_order_relaxed);
+}
 
-void process_input(Chip8 *chip8, bool *is_running) {
+void process_input(bool *is_running, InputControls *controls,
+									 InputKeypad *keypad) {
 	SDL_Event event;
+	int key;
 
 	while (SDL_PollEvent(&event)) {
 		switch (event.type) {
@@ -26,6 +105,11 @@ void process_input(Chip8 *chip8, bool *is_running) {
 			*is_running = false;
 			return;
 
+		// The window contents were lost, present the whole screen again
+		case SDL_EVENT_WINDOW_EXPOSED:
+			display_invalidate();
+			break;
+
 		// Handle key being pressed down
 		case SDL_EVENT_KEY_DOWN:
 			// Quit program if 'Esc' key is pressed
@@ -34,19 +118,60 @@ void process_input(Chip8 *chip8, bool *is_running) {
 				return;
 			}
 
-			for (int i = 0; i < 16; i++) {
-				if (event.key.scancode == KEYMAP[i]) {
-					chip8->key[i] = 1; // Set the key state to ON
-				}
+			switch (event.key.scancode) {
+			// Rewind while 'Backspace' is held
+			case SDL_SCANCODE_BACKSPACE:
+				controls->rewind = true;
+				break;
+			// Run the CPU flat out while 'Tab' is held
+			case SDL_SCANCODE_TAB:
+				controls->turbo = true;
+				break;
+			// Step the instructions per frame, auto-repeats while held
+			case SDL_SCANCODE_MINUS:
+				controls->ipf_change--;
+				break;
+			case SDL_SCANCODE_EQUALS:
+				controls->ipf_change++;
+				break;
+			case SDL_SCANCODE_F5:
+				controls->debug_pauses++;
+				break;
+			case SDL_SCANCODE_F6:
+				controls->debug_steps++;
+				break;
+			case SDL_SCANCODE_F7:
+				controls->debug_breakpoints++;
+				break;
+			case SDL_SCANCODE_F8:
+				controls->debug_overlay = !controls->debug_overlay;
+				break;
+			case SDL_SCANCODE_F9:
+				controls->dump_profile = true;
+				break;
+			default:
+				break;
+			}
+
+			key = scancode_keys[event.key.scancode];
+			if (key >= 0) {
+				push_key_event(keypad, event.key.timestamp,
+											 keypad->held | (uint16_t) (1u << key));
 			}
 			break;
 
 		// Handle key being released
 		case SDL_EVENT_KEY_UP:
-			for (int i = 0; i < 16; i++) {
-				if (event.key.scancode == KEYMAP[i]) {
-					chip8->key[i] = 0; // Set the key state to OFF
-				}
+			if (event.key.scancode == SDL_SCANCODE_BACKSPACE) {
+				controls->rewind = false;
+			} else if (event.key.scancode == SDL_SCANCODE_TAB) {
+				controls->turbo = false;
+			}
+
+			key = scancode_keys[event.key.scancode];
+			if (key >= 0) {
+				push_key_event(keypad, event.key.timestamp,
+											 keypad->held & (uint16_t) ~(1u << key));
 			}
 			break;
 		}
@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,23 +8,469 @@
 #include <SDL3/SDL.h>
 
 #include "audio.h"
+#include "capture.h"
 #include "chip8.h"
+#include "chip8_aot.h"
+#include "debugger.h"
+#include "disasm.h"
 #include "display.h"
+#include "headless.h"
 #include "input.h"
+#include "movie.h"
+#include "profile.h"
+#include "profiler.h"
+#include "rewind.h"
+#include "rompack.h"
+#include "trace.h"
+#include "triple_buffer.h"
 
-const int TARGET_FPS = 60;
-const float FRAME_DURATION_MS = 1000.0f / TARGET_FPS;
-const int CYCLES_PER_FRAME = 8;
+// Timers and the display run at exactly 60 Hz
+const Uint64 FRAME_DURATION_NS = SDL_NS_PER_SECOND / 60;
+// A stall longer than this many frames is dropped instead of caught up
+const Uint64 MAX_FRAME_BACKLOG = 4;
+
+const int DEFAULT_CYCLES_PER_FRAME = 8;
+const int MAX_CYCLES_PER_FRAME = 1000;
+
+// Turbo runs the CPU in batches until this much of the frame is used
+const Uint64 TURBO_BUDGET_NS = SDL_NS_PER_SECOND / 80;
+const int TURBO_BATCH = 256;
+
+// 10 minutes of 60 Hz history, deltas are usually 100-200 bytes per frame
+const size_t REWIND_CAPACITY = 8 * 1024 * 1024;
+const size_t REWIND_FRAMES = 10 * 60 * 60;
+const int REWIND_KEYFRAME_INTERVAL = 60;
+
+// Longest the SDL thread sleeps without an event
+const Sint32 WAKE_TIMEOUT_MS = 100;
+
+/*
+ * The cycle of a batch of `cycles` that a key event lands on. The batch
+ * stands for the time between the previous poll and this one, so input keeps
+ * its spacing within the frame and a tap shorter than a frame still reaches
+ * the program as a press and a release.
+ */
+static int event_cycle(Uint64 time_ns, Uint64 window_start, Uint64 window_end,
+											 int cycles) {
+	if (time_ns <= window_start || window_end <= window_start) {
+		return 0;
+	}
+	if (time_ns >= window_end) {
+		return cycles - 1;
+	}
+	return (int) ((time_ns - window_start) * (Uint64) cycles /
+								(window_end - window_start));
+}
+
+// State handed to the emulation thread, which owns the machine, the movie
+// and the rewind history until it exits
+typedef struct {
+	Chip8 *chip8;
+	// Compiled ROM of a `make aot` build, NULL to interpret
+	Chip8Aot *aot;
+	// Breakpoints and watches; batches only run through it while any are set
+	Debugger *debugger;
+	// GIF recording of what is shown, NULL when off
+	Chip8Capture *capture;
+	Movie *movie;
+	Rewind *history;
+	InputControls *controls;
+	InputKeypad *keypad;
+	TripleBuffer *frames;
+	int cycles_per_frame;
+	unsigned long seek_frame;
+	bool is_recording;
+	bool is_playing;
+	// Cleared by either thread to stop both
+	atomic_bool is_running;
+	// Pushed after each published frame to wake the SDL thread
+	Uint32 wake_event;
+	// 60 Hz steps shown so far, set when the thread exits
+	uint32_t ticks;
+} Emulation;
+
+static void wake_display(const Emulation *emulation) {
+	SDL_Event event = {0};
+	event.type = emulation->wake_event;
+	SDL_PushEvent(&event);
+}
+
+// Where and why the debugger stopped, with the next instruction
+static void print_stop(const Emulation *emulation) {
+	DebugView view;
+	debugger_view(emulation->debugger, emulation->chip8, &view);
+	char text[32];
+	chip8_disassemble(view.code[0], text, sizeof(text));
+	printf("Debugger: %s, next 0x%03X %04X %s\n", view.reason, view.pc,
+				 view.code[0], text);
+}
+
+static void run_cycles(const Emulation *emulation, int cycles) {
+	Debugger *debugger = emulation->debugger;
+	if (debugger_armed(debugger)) {
+		// Instrumented, and it may stop part way through the batch
+		if (!debugger->paused) {
+			debugger_run(debugger, emulation->chip8, cycles);
+			if (emulation->aot != NULL) {
+				chip8_aot_sync(emulation->aot, emulation->chip8);
+			}
+			if (debugger->paused) {
+				print_stop(emulation);
+			}
+		}
+	} else if (emulation->aot != NULL) {
+		chip8_aot_run(emulation->aot, emulation->chip8, cycles);
+	} else {
+		chip8_run(emulation->chip8, cycles);
+	}
+}
+
+// Applies the debugger keys, returns whether the inspector needs a new view
+static bool control_debugger(const Emulation *emulation) {
+	Debugger *debugger = emulation->debugger;
+	InputControls *controls = emulation->controls;
+	Chip8 *chip8 = emulation->chip8;
+	int pauses = atomic_exchange(&controls->debug_pauses, 0);
+	int steps = atomic_exchange(&controls->debug_steps, 0);
+	int breakpoints = atomic_exchange(&controls->debug_breakpoints, 0);
+	bool changed = false;
+
+	if (breakpoints % 2 != 0) {
+		bool on = !debugger_has_breakpoint(debugger, chip8->pc);
+		debugger_set_breakpoint(debugger, chip8->pc, on);
+		printf("Debugger: breakpoint at 0x%03X %s\n", chip8->pc,
+					 on ? "set" : "cleared");
+		changed = true;
+	}
+	if (pauses % 2 != 0) {
+		if (debugger->paused) {
+			debugger_continue(debugger);
+			printf("Debugger: continuing\n");
+		} else {
+			debugger_pause(debugger, "paused");
+			print_stop(emulation);
+		}
+		changed = true;
+	}
+	if (steps == 0) {
+		return changed;
+	}
+
+	// A step while running only pauses
+	if (!debugger->paused) {
+		debugger_pause(debugger, "paused");
+	} else {
+		for (int i = 0; i < steps; i++) {
+			debugger_step(debugger, chip8);
+		}
+		if (emulation->aot != NULL) {
+			chip8_aot_sync(emulation->aot, chip8);
+		}
+	}
+	print_stop(emulation);
+	return true;
+}
+
+// Hands the frame to the SDL thread, with the debugger state while the
+// inspector is shown
+static void publish_frame(const Emulation *emulation, uint64_t input_ns,
+													bool show_debugger) {
+	Chip8 *chip8 = emulation->chip8;
+	DebugView view;
+	if (show_debugger) {
+		debugger_view(emulation->debugger, chip8, &view);
+	}
+	triple_buffer_publish(emulation->frames, chip8, input_ns,
+												show_debugger ? &view : NULL);
+	chip8->draw_flag = false;
+	chip8->dirty_rows = 0;
+	wake_display(emulation);
+}
+
+// Runs the machine in fixed 60 Hz steps until either thread stops it
+static int run_emulation(void *data) {
+	Emulation *emulation = data;
+	Chip8 *chip8 = emulation->chip8;
+	Movie *movie = emulation->movie;
+	Rewind *history = emulation->history;
+	InputControls *controls = emulation->controls;
+	Debugger *debugger = emulation->debugger;
+	int cycles_per_frame = emulation->cycles_per_frame;
+	bool is_recording = emulation->is_recording;
+	bool is_playing = emulation->is_playing;
+	InputKeyEvent events[INPUT_MAX_KEY_EVENTS + 1];
+	// Time of the oldest key event not yet published, 0 when there is none
+	Uint64 pending_input_ns = 0;
+	uint32_t frame = 0;
+	// Every step shown, rewound ones too, which is the capture's clock
+	uint32_t tick = 0;
+
+	// Fixed-step loop: real time is accumulated in nanoseconds and consumed one
+	// 60 Hz frame at a time, so sleep overshoot never drifts the timers
+	Uint64 previous_time = SDL_GetTicksNS();
+	Uint64 previous_poll_time = previous_time;
+	Uint64 lag_ns = 0;
+	while (atomic_load(&emulation->is_running)) {
+		Uint64 frame_start_time = SDL_GetTicksNS();
+		lag_ns += frame_start_time - previous_time;
+		previous_time = frame_start_time;
+		if (lag_ns > MAX_FRAME_BACKLOG * FRAME_DURATION_NS) {
+			lag_ns = FRAME_DURATION_NS;
+		}
+
+		// Seeking runs unthrottled and skips rendering up to the target frame
+		bool is_seeking = is_playing && frame < emulation->seek_frame;
+		if (is_seeking) {
+			lag_ns = FRAME_DURATION_NS;
+		} else if (lag_ns < FRAME_DURATION_NS) {
+			PROFILE_BEGIN(sleep);
+			SDL_DelayNS(FRAME_DURATION_NS - lag_ns);
+			PROFILE_END(sleep, PROBE_SLEEP);
+			continue;
+		}
+		lag_ns -= FRAME_DURATION_NS;
+		PROFILE_FRAME();
+
+		// Every event taken here happened before poll_time
+		chip8_clear_key_edges(chip8);
+		int event_count = input_take_key_events(emulation->keypad, events,
+																						INPUT_MAX_KEY_EVENTS + 1);
+		Uint64 poll_time = SDL_GetTicksNS();
+
+		// A movie fixes the frame length, so speed controls only work live
+		bool is_live = !is_recording && !is_playing;
+		int ipf_change = atomic_exchange(&controls->ipf_change, 0);
+		if (ipf_change != 0 && is_live) {
+			cycles_per_frame += ipf_change;
+			if (cycles_per_frame < 1) {
+				cycles_per_frame = 1;
+			} else if (cycles_per_frame > MAX_CYCLES_PER_FRAME) {
+				cycles_per_frame = MAX_CYCLES_PER_FRAME;
+			}
+			printf("Instructions per frame: %d\n", cycles_per_frame);
+		}
+
+		// A stopped debugger runs nothing and holds the timers, only steps move
+		// the machine. Movies need every frame to run, so it is live only.
+		bool debug_changed = is_live && control_debugger(emulation);
+		if (debugger->paused) {
+			chip8_set_keys(chip8, input_keys(emulation->keypad));
+			if (debug_changed) {
+				publish_frame(emulation, 0, true);
+			}
+			previous_poll_time = poll_time;
+			continue;
+		}
+
+		if (atomic_load(&controls->rewind) && history->data != NULL) {
+			// Step back one frame, but keep the keys that are held right now
+			rewind_pop(history, chip8);
+			if (emulation->aot != NULL) {
+				chip8_aot_sync(emulation->aot, chip8);
+			}
+			chip8_set_keys(chip8, input_keys(emulation->keypad));
+			chip8_clear_key_edges(chip8);
+		} else {
+			if (is_recording && !movie_record(movie, frame, 0, chip8)) {
+				fprintf(stderr, "Error: Out of memory, recording stopped.\n");
+				atomic_store(&emulation->is_running, false);
+			}
+
+			PROFILE_BEGIN(emulate);
+			if (is_playing) {
+				// Movie input replaces the keyboard, split where it changes mid-frame
+				int done = 0;
+				while (done < cycles_per_frame) {
+					int next = movie_apply(movie, frame, done, chip8);
+					int end = next < cycles_per_frame ? next : cycles_per_frame;
+					run_cycles(emulation, end - done);
+					done = end;
+				}
+			} else {
+				// Replay the keyboard at the cycles its events map to
+				int done = 0;
+				for (int i = 0; i < event_count; i++) {
+					int cycle = event_cycle(events[i].time_ns, previous_poll_time,
+																	poll_time, cycles_per_frame);
+					if (cycle > done) {
+						run_cycles(emulation, cycle - done);
+						done = cycle;
+					}
+					chip8_set_keys(chip8, events[i].keys);
+					if (is_recording &&
+							!movie_record(movie, frame, (uint16_t) done, chip8)) {
+						fprintf(stderr, "Error: Out of memory, recording stopped.\n");
+						atomic_store(&emulation->is_running, false);
+					}
+				}
+				run_cycles(emulation, cycles_per_frame - done);
+				if (event_count > 0 && pending_input_ns == 0) {
+					pending_input_ns = events[0].time_ns;
+				}
+			}
+
+			// Turbo only speeds up the CPU, the timers below still tick once. A
+			// batch that ends idle has nothing left to do before that tick.
+			while (atomic_load(&controls->turbo) && is_live && !chip8->idle &&
+						 !debugger->paused &&
+						 SDL_GetTicksNS() - frame_start_time < TURBO_BUDGET_NS) {
+				run_cycles(emulation, TURBO_BATCH);
+			}
+			PROFILE_END(emulate, PROBE_EMULATE);
+
+			PROFILE_BEGIN(timers);
+			chip8_update_timers(chip8);
+			PROFILE_END(timers, PROBE_TIMERS);
+			if (history->data != NULL) {
+				rewind_push(history, chip8);
+			}
+			frame++;
+
+			// Hand the keypad back to the player once the movie is over
+			if (is_playing && frame >= movie->frames) {
+				printf("Movie finished at frame %u.\n", frame);
+				is_playing = false;
+				chip8_set_keys(chip8, input_keys(emulation->keypad));
+			}
+		}
+		previous_poll_time = poll_time;
+
+		if (is_seeking) {
+			continue;
+		}
+
+		// Sound changes land on the audio thread stamped with this frame's time
+		audio_sync(chip8);
+
+		// Queued before publishing clears the flag. A slow encoder drops frames
+		// rather than hold up the timers.
+		if (emulation->capture != NULL && chip8->draw_flag) {
+			capture_frame(emulation->capture, chip8, tick, false);
+		}
+		tick++;
+
+		// The only copy of the frame, the SDL thread presents it when it can. The
+		// inspector follows every frame while it is shown.
+		bool show_debugger =
+				atomic_load(&controls->debug_overlay) || debugger->paused;
+		if (chip8->draw_flag || show_debugger || debug_changed) {
+			publish_frame(emulation, pending_input_ns, show_debugger);
+			pending_input_ns = 0;
+		}
+	}
+
+	// The SDL thread may be waiting for an event
+	emulation->ticks = tick;
+	wake_display(emulation);
+	return 0;
+}
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s [--headless ...] [--ipf N] [--palette RRGGBB,RRGGBB] "
+					"[--quirks vip|chip48|schip|xochip] [--keymap default|arrows] "
+					"[--pack FILE] "
+					"[--record FILE | --play FILE [--seek N]] [--trace FILE] "
+					"[--capture FILE.gif] [--break ADDR] [--watch I|VX|ADDR[-ADDR]] [--break-if EXPR] "
+					"<rom_file_name>\n",
+					program);
+}
 
 int main(int argc, char **argv) {
-	srand(time(NULL));
+	// A `make aot` build carries its ROM and the settings it was compiled for,
+	// a ROM named on the command line is interpreted instead
+	const Chip8AotProgram *program = NULL;
+#ifdef CHIP8_AOT
+	program = &chip8_aot_program;
+#endif
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			return headless_main_aot(argc, argv, program);
+		}
+	}
 
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <rom_file_name>\n", argv[0]);
+	const char *rom_filename = NULL;
+	const char *record_path = NULL;
+	const char *play_path = NULL;
+	unsigned long seek_frame = 0;
+	int cycles_per_frame = 0;
+	const char *palette = NULL;
+	const char *pack_path = NULL;
+	const char *trace_path = NULL;
+	const char *capture_path = NULL;
+	Chip8Quirks quirks = CHIP8_QUIRKS_VIP;
+	bool has_quirks = false;
+	Keymap keymap = KEYMAP_DEFAULT;
+	bool has_keymap = false;
+	Debugger debugger;
+	debugger_init(&debugger);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+			cycles_per_frame = atoi(argv[++i]);
+			if (cycles_per_frame <= 0 || cycles_per_frame > MAX_CYCLES_PER_FRAME) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+			palette = argv[++i];
+		} else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+			if (!chip8_quirks_parse(argv[++i], &quirks)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			has_quirks = true;
+		} else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+			if (!keymap_parse(argv[++i], &keymap)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			has_keymap = true;
+		} else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+			pack_path = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+			play_path = argv[++i];
+		} else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+			seek_frame = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+			capture_path = argv[++i];
+		} else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+			if (!debugger_parse_breakpoint(&debugger, argv[++i])) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+			if (!debugger_parse_watch(&debugger, argv[++i])) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--break-if") == 0 && i + 1 < argc) {
+			if (!debugger_parse_condition(&debugger, argv[++i])) {
+				fprintf(stderr, "Error: Invalid condition '%s'.\n", argv[i]);
+				return 1;
+			}
+		} else if (argv[i][0] == '-') {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			rom_filename = argv[i];
+		}
+	}
+	if ((rom_filename == NULL && program == NULL) ||
+			(record_path != NULL && play_path != NULL)) {
+		print_usage(argv[0]);
 		return 1;
 	}
+	if (rom_filename != NULL) {
+		program = NULL;
+	}
 
-	const char *rom_filename = argv[1];
+	if (program != NULL) {
+		rom_filename = program->name;
+	}
 	printf("Attempting to load ROM: %s\n", rom_filename);
 
 	bool is_running = display_init();
@@ -33,6 +480,16 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
+	// Foreground and background colours, e.g. 33FF66,000000
+	unsigned int foreground, background;
+	if (palette != NULL) {
+		if (sscanf(palette, "%6x,%6x", &foreground, &background) == 2) {
+			display_set_palette(0xFF000000 | foreground, 0xFF000000 | background);
+		} else {
+			fprintf(stderr, "Warning: Ignoring invalid palette '%s'.\n", palette);
+		}
+	}
+
 	bool audio_on = audio_init();
 	if (!audio_on) {
 		fprintf(stderr, "Error: Failed to initialize audio. Exiting.\n");
@@ -43,32 +500,239 @@ int main(int argc, char **argv) {
 
 	Chip8 chip8;
 	chip8_init(&chip8);
-	chip8_load_rom(&chip8, rom_filename);
 
-	while (is_running) {
-		Uint64 frame_start_time = SDL_GetTicks();
+	// A pack serves the ROM and its settings from memory, a miss falls back to
+	// the file system
+	RomPack pack = {0};
+	const RomPackEntry *entry = NULL;
+	if (pack_path != NULL && program == NULL &&
+			rompack_open(&pack, pack_path)) {
+		entry = rompack_find(&pack, rom_filename);
+	}
+	if (program != NULL) {
+		chip8_aot_load(program, &chip8);
+	} else if (entry != NULL) {
+		rompack_load(&pack, entry, &chip8);
+	} else {
+		chip8_load_rom(&chip8, rom_filename);
+	}
 
-		memcpy(chip8.key_prev, chip8.key, sizeof(chip8.key));
-		process_input(&chip8, &is_running);
-		for (int i = 0; i < CYCLES_PER_FRAME; i++) {
-			chip8_emulate_cycle(&chip8);
+	// --ipf, --quirks and --keymap win over the compiled program, the pack
+	// entry and the ROM's profile, which win over the defaults
+	const RomProfile *profile = program == NULL ? profile_find(rom_filename)
+																							: NULL;
+	if (cycles_per_frame == 0 && program != NULL) {
+		cycles_per_frame = program->cycles_per_frame;
+	}
+	if (cycles_per_frame == 0 && entry != NULL) {
+		cycles_per_frame = entry->cycles_per_frame;
+	}
+	if (cycles_per_frame == 0 && profile != NULL) {
+		cycles_per_frame = profile->cycles_per_frame;
+	}
+	if (cycles_per_frame == 0) {
+		cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+	}
+	if (!has_quirks && program != NULL) {
+		quirks = program->quirks;
+	} else if (!has_quirks && entry != NULL &&
+						 entry->quirks < CHIP8_QUIRKS_COUNT) {
+		quirks = (Chip8Quirks) entry->quirks;
+	} else if (!has_quirks && profile != NULL) {
+		quirks = profile->quirks;
+	}
+	chip8.quirks = quirks;
+	if (!has_keymap && program != NULL) {
+		keymap = program->keymap;
+	} else if (!has_keymap && entry != NULL && entry->keymap < KEYMAP_COUNT) {
+		keymap = (Keymap) entry->keymap;
+	} else if (!has_keymap && profile != NULL) {
+		keymap = profile->keymap;
+	}
+	input_set_keymap(keymap);
+
+	// A movie fixes the seed and frame length, live runs seed from the clock
+	Movie movie = {0};
+	bool is_recording = record_path != NULL;
+	bool is_playing = play_path != NULL;
+	if (is_playing) {
+		if (!movie_load(&movie, play_path)) {
+			rompack_close(&pack);
+			audio_destroy();
+			display_destroy();
+			SDL_Quit();
+			return 1;
+		}
+		if (!movie_matches_rom(&movie, &chip8)) {
+			fprintf(stderr, "Warning: Movie was recorded with a different ROM.\n");
+		}
+		if (!movie_matches_quirks(&movie, &chip8)) {
+			fprintf(stderr,
+							"Error: Movie was recorded with the %s quirks, not %s.\n",
+							chip8_quirks_name(movie.quirks),
+							chip8_quirks_name(chip8.quirks));
+			movie_destroy(&movie);
+			rompack_close(&pack);
+			audio_destroy();
+			display_destroy();
+			SDL_Quit();
+			return 1;
+		}
+		chip8_seed(&chip8, movie.seed);
+		cycles_per_frame = movie.cycles_per_frame;
+	} else {
+		uint64_t seed = (uint64_t) time(NULL);
+		chip8_seed(&chip8, seed);
+		if (is_recording) {
+			movie_init(&movie, &chip8, seed, cycles_per_frame);
 		}
-		chip8_update_timers(&chip8);
+	}
 
-		if (chip8.draw_flag) {
-			display_draw(&chip8);
-			chip8.draw_flag = false;
+	Chip8Trace trace;
+	if (trace_path != NULL) {
+		if (!trace_open(&trace, trace_path, TRACE_DEFAULT_CAPACITY)) {
+			movie_destroy(&movie);
+			rompack_close(&pack);
+			audio_destroy();
+			display_destroy();
+			SDL_Quit();
+			return 1;
 		}
+		chip8.trace = &trace;
+	}
 
-		Uint64 frame_end_time = SDL_GetTicks();
-		float elapsed_ms = (float) (frame_end_time - frame_start_time);
-		if (elapsed_ms < FRAME_DURATION_MS) {
-			SDL_Delay((Uint32) (FRAME_DURATION_MS - elapsed_ms));
+	// After --palette, so the GIF has the colours on screen
+	Chip8Capture capture;
+	if (capture_path != NULL) {
+		uint32_t colours[4];
+		display_get_palette(colours);
+		if (!capture_open(&capture, capture_path, CAPTURE_DEFAULT_CAPACITY,
+											CAPTURE_DEFAULT_SCALE, colours)) {
+			if (chip8.trace != NULL) {
+				trace_close(&trace);
+			}
+			movie_destroy(&movie);
+			rompack_close(&pack);
+			audio_destroy();
+			display_destroy();
+			SDL_Quit();
+			return 1;
 		}
 	}
 
+	// Records are written by the interpreter loop, and code compiled for
+	// another profile would only be interpreted anyway
+	Chip8Aot aot;
+	Chip8Aot *compiled = NULL;
+	if (program != NULL && trace_path != NULL) {
+		fprintf(stderr, "Warning: Tracing runs on the interpreter.\n");
+	} else if (program != NULL && quirks != program->quirks) {
+		fprintf(stderr, "Warning: ROM was compiled for the %s profile, using "
+										"the interpreter.\n",
+						chip8_quirks_name(program->quirks));
+	} else if (program != NULL) {
+		chip8_aot_init(&aot, program);
+		compiled = &aot;
+	}
+
+	// Stopping part way through a frame would desynchronise a movie too
+	if ((is_recording || is_playing) && debugger_armed(&debugger)) {
+		fprintf(stderr, "Warning: The debugger only runs in live play.\n");
+		debugger_init(&debugger);
+	}
+
+	// Rewinding would desynchronise a movie, so it is only on for live play
+	Rewind history = {0};
+	if (!is_recording && !is_playing &&
+			!rewind_init(&history, REWIND_CAPACITY, REWIND_FRAMES,
+									 REWIND_KEYFRAME_INTERVAL)) {
+		fprintf(stderr, "Warning: Failed to allocate rewind buffer.\n");
+	}
+	InputControls controls = {0};
+	InputKeypad keypad = {0};
+	TripleBuffer frames;
+	triple_buffer_init(&frames);
+	Emulation emulation = {
+			.chip8 = &chip8,
+			.aot = compiled,
+			.debugger = &debugger,
+			.capture = capture_path != NULL ? &capture : NULL,
+			.movie = &movie,
+			.history = &history,
+			.controls = &controls,
+			.keypad = &keypad,
+			.frames = &frames,
+			.cycles_per_frame = cycles_per_frame,
+			.seek_frame = seek_frame,
+			.is_recording = is_recording,
+			.is_playing = is_playing,
+			.is_running = true,
+			.wake_event = SDL_RegisterEvents(1),
+	};
+	printf("Running at %d instructions per frame\n", cycles_per_frame);
+
+	int status = 0;
+	SDL_Thread *thread = SDL_CreateThread(run_emulation, "emulation", &emulation);
+	if (thread == NULL) {
+		fprintf(stderr, "Error: Failed to start emulation: %s\n", SDL_GetError());
+		atomic_store(&emulation.is_running, false);
+		status = 1;
+	}
+
+	// This thread only handles events and presents, so a present blocked on
+	// vsync or the compositor never holds up the emulation or its timers
+	const DisplayFrame *shown = NULL;
+	while (atomic_load(&emulation.is_running)) {
+		// Input and newly published frames both wake the thread, the timeout
+		// only matters if a wake event is ever lost
+		SDL_WaitEventTimeout(NULL, WAKE_TIMEOUT_MS);
+		bool keep_running = true;
+		PROFILE_BEGIN(input);
+		process_input(&keep_running, &controls, &keypad);
+		PROFILE_END(input, PROBE_INPUT);
+		if (!keep_running) {
+			atomic_store(&emulation.is_running, false);
+		}
+		if (controls.dump_profile) {
+			PROFILE_DUMP("profile");
+			controls.dump_profile = false;
+		}
+
+		// A redraw of the frame on screen only presents after an expose event
+		const DisplayFrame *latest = triple_buffer_acquire(&frames);
+		if (latest != NULL) {
+			shown = latest;
+		}
+		if (shown != NULL && display_draw(shown) && latest != NULL &&
+				latest->input_ns != 0) {
+#ifdef CHIP8_PROFILE
+			profiler_record(PROBE_INPUT_LATENCY, SDL_GetTicksNS() - latest->input_ns);
+#endif
+		}
+	}
+	SDL_WaitThread(thread, NULL);
+
+	if (is_recording && movie_save(&movie, record_path)) {
+		printf("Recorded %u frames to %s\n", movie.frames, record_path);
+	}
+	printf("Skipped %llu idle cycles.\n", chip8.idle_cycles);
+	if (chip8.trace != NULL) {
+		chip8.trace = NULL;
+		trace_close(&trace);
+		printf("Traced %llu instructions to %s\n",
+					 (unsigned long long) trace.written, trace_path);
+	}
+	if (capture_path != NULL) {
+		capture_close(&capture, emulation.ticks);
+		printf("Captured %llu images to %s\n",
+					 (unsigned long long) capture.written, capture_path);
+	}
+	PROFILE_DUMP("profile");
+	movie_destroy(&movie);
+	rewind_destroy(&history);
+	rompack_close(&pack);
 	audio_destroy();
 	display_destroy();
 	SDL_Quit();
-	return 0;
+	return status;
 }
@@ -0,0 +1,216 @@
+#include "movie.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+/*
+ * File layout, all fields little-endian:
+ *   "CH8M", u16 version, u16 cycles per frame, u64 seed, u64 ROM hash,
+ *   u32 frames, u32 event count, u32 quirk profile, then per event u32 frame,
+ *   u16 cycle, u16 key mask
+ */
+#define MOVIE_MAGIC "CH8M"
+#define MOVIE_VERSION 2
+#define HEADER_SIZE 36
+#define EVENT_SIZE 8
+
+static void put_u16(unsigned char *out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+	put_u16(out, value & 0xFFFF);
+	put_u16(out + 2, value >> 16);
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+	put_u32(out, value & 0xFFFFFFFF);
+	put_u32(out + 4, value >> 32);
+}
+
+static uint16_t get_u16(const unsigned char *in) {
+	return (uint16_t) (in[0] | in[1] << 8);
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+	return get_u16(in) | (uint32_t) get_u16(in + 2) << 16;
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+	return get_u32(in) | (uint64_t) get_u32(in + 4) << 32;
+}
+
+// FNV-1a over the loaded ROM, catches replaying against the wrong one
+static uint64_t rom_hash(const Chip8 *chip8) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0x200; i < 0x200 + chip8->rom_size; i++) {
+		hash ^= chip8->memory[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+void movie_init(Movie *movie, const Chip8 *chip8, uint64_t seed,
+								int cycles_per_frame) {
+	memset(movie, 0, sizeof(*movie));
+	movie->seed = seed;
+	movie->rom_hash = rom_hash(chip8);
+	movie->quirks = chip8->quirks;
+	movie->cycles_per_frame = (uint16_t) cycles_per_frame;
+}
+
+void movie_destroy(Movie *movie) {
+	free(movie->events);
+	memset(movie, 0, sizeof(*movie));
+}
+
+// Appends an event if the keypad changed since the last recorded one
+bool movie_record(Movie *movie, uint32_t frame, uint16_t cycle,
+									const Chip8 *chip8) {
+	if (frame >= movie->frames) {
+		movie->frames = frame + 1;
+	}
+
+	uint16_t keys = chip8_get_keys(chip8);
+	if (keys == movie->keys) {
+		return true;
+	}
+	if (movie->count == movie->capacity) {
+		size_t capacity = movie->capacity ? movie->capacity * 2 : 256;
+		MovieEvent *grown =
+				realloc(movie->events, capacity * sizeof(*movie->events));
+		if (grown == NULL) {
+			return false;
+		}
+		movie->events = grown;
+		movie->capacity = capacity;
+	}
+	movie->events[movie->count++] = (MovieEvent) {frame, cycle, keys};
+	movie->keys = keys;
+	return true;
+}
+
+bool movie_save(const Movie *movie, const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror("Error opening movie file");
+		return false;
+	}
+
+	unsigned char header[HEADER_SIZE];
+	memcpy(header, MOVIE_MAGIC, 4);
+	put_u16(header + 4, MOVIE_VERSION);
+	put_u16(header + 6, movie->cycles_per_frame);
+	put_u64(header + 8, movie->seed);
+	put_u64(header + 16, movie->rom_hash);
+	put_u32(header + 24, movie->frames);
+	put_u32(header + 28, (uint32_t) movie->count);
+	put_u32(header + 32, movie->quirks);
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+	for (size_t i = 0; ok && i < movie->count; i++) {
+		unsigned char record[EVENT_SIZE];
+		put_u32(record, movie->events[i].frame);
+		put_u16(record + 4, movie->events[i].cycle);
+		put_u16(record + 6, movie->events[i].keys);
+		ok = fwrite(record, sizeof(record), 1, file) == 1;
+	}
+
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "Error while writing movie file.\n");
+		return false;
+	}
+	return true;
+}
+
+bool movie_load(Movie *movie, const char *path) {
+	memset(movie, 0, sizeof(*movie));
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror("Error opening movie file");
+		return false;
+	}
+
+	unsigned char header[HEADER_SIZE];
+	if (fread(header, sizeof(header), 1, file) != 1 ||
+			memcmp(header, MOVIE_MAGIC, 4) != 0 ||
+			get_u16(header + 4) != MOVIE_VERSION || get_u16(header + 6) == 0 ||
+			get_u32(header + 32) >= CHIP8_QUIRKS_COUNT) {
+		fprintf(stderr, "Error: %s is not a CHIP-8 movie.\n", path);
+		fclose(file);
+		return false;
+	}
+	movie->cycles_per_frame = get_u16(header + 6);
+	movie->seed = get_u64(header + 8);
+	movie->rom_hash = get_u64(header + 16);
+	movie->frames = get_u32(header + 24);
+	size_t count = get_u32(header + 28);
+	movie->quirks = (Chip8Quirks) get_u32(header + 32);
+
+	movie->events = malloc((count ? count : 1) * sizeof(*movie->events));
+	if (movie->events == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		fclose(file);
+		return false;
+	}
+	movie->capacity = count;
+
+	for (size_t i = 0; i < count; i++) {
+		unsigned char record[EVENT_SIZE];
+		if (fread(record, sizeof(record), 1, file) != 1) {
+			fprintf(stderr, "Error: Movie file is truncated.\n");
+			fclose(file);
+			movie_destroy(movie);
+			return false;
+		}
+		movie->events[i] = (MovieEvent) {get_u32(record), get_u16(record + 4),
+																		 get_u16(record + 6)};
+	}
+	movie->count = count;
+
+	fclose(file);
+	return true;
+}
+
+bool movie_matches_rom(const Movie *movie, const Chip8 *chip8) {
+	return movie->rom_hash == rom_hash(chip8);
+}
+
+// The quirks change what the same input does, so a movie only replays under
+// the profile it was recorded with
+bool movie_matches_quirks(const Movie *movie, const Chip8 *chip8) {
+	return movie->quirks == chip8->quirks;
+}
+
+/*
+ * Applies every event due at or before `cycle` of `frame` and keeps the keypad
+ * at the recorded mask, overriding any live input. Events that land on the same
+ * cycle, such as a tap shorter than one instruction, are applied one by one so
+ * the release edge FX0A waits for is not folded away. Returns the cycle of the
+ * next event in this frame, or MOVIE_NO_EVENT.
+ */
+int movie_apply(Movie *movie, uint32_t frame, uint16_t cycle, Chip8 *chip8) {
+	while (movie->cursor < movie->count) {
+		const MovieEvent *event = &movie->events[movie->cursor];
+		if (event->frame > frame ||
+				(event->frame == frame && event->cycle > cycle)) {
+			break;
+		}
+		movie->keys = event->keys;
+		movie->cursor++;
+		chip8_set_keys(chip8, movie->keys);
+	}
+	chip8_set_keys(chip8, movie->keys);
+
+	if (movie->cursor < movie->count &&
+			movie->events[movie->cursor].frame == frame) {
+		return movie->events[movie->cursor].cycle;
+	}
+	return MOVIE_NO_EVENT;
+}
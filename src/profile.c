@@ -0,0 +1,53 @@
+#include "profile.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// ROMs that need a different instructions-per-frame rate or quirk profile
+// than the defaults. Most games expect roughly 8-10 instructions per frame; a
+// few Octo jam entries were written for much faster interpreters and crawl at
+// that rate. Others were written for Octo and break under the CHIP-48 and
+// SUPER-CHIP shift and load/store behaviour, so they are pinned to XO-CHIP,
+// which matches Octo's defaults. Games that steer with 5/7/8/9 (Octo's
+// WASD) also get the arrow keys.
+static const RomProfile PROFILES[] = {
+		{"br8kout.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"chipwar.ch8", 0, CHIP8_QUIRKS_XOCHIP, KEYMAP_DEFAULT},
+		{"danm8ku.ch8", 0, CHIP8_QUIRKS_XOCHIP, KEYMAP_ARROWS},
+		{"flightrunner.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"glitchGhost.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"masquer8.ch8", 0, CHIP8_QUIRKS_XOCHIP, KEYMAP_DEFAULT},
+		{"mastermind.ch8", 0, CHIP8_QUIRKS_XOCHIP, KEYMAP_ARROWS},
+		{"octoachip8story.ch8", 30, CHIP8_QUIRKS_VIP, KEYMAP_DEFAULT},
+		{"octorancher.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"slipperyslope.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"spacejam.ch8", 0, CHIP8_QUIRKS_VIP, KEYMAP_ARROWS},
+		{"wdl.ch8", 0, CHIP8_QUIRKS_XOCHIP, KEYMAP_DEFAULT},
+};
+
+static const char *const KEYMAP_NAMES[KEYMAP_COUNT] = {
+		[KEYMAP_DEFAULT] = "default",
+		[KEYMAP_ARROWS] = "arrows",
+};
+
+const RomProfile *profile_find(const char *rom_filename) {
+	const char *name = strrchr(rom_filename, '/');
+	name = name != NULL ? name + 1 : rom_filename;
+
+	for (size_t i = 0; i < sizeof(PROFILES) / sizeof(PROFILES[0]); i++) {
+		if (strcmp(PROFILES[i].name, name) == 0) {
+			return &PROFILES[i];
+		}
+	}
+	return NULL;
+}
+
+bool keymap_parse(const char *name, Keymap *keymap) {
+	for (int i = 0; i < KEYMAP_COUNT; i++) {
+		if (strcmp(name, KEYMAP_NAMES[i]) == 0) {
+			*keymap = (Keymap) i;
+			return true;
+		}
+	}
+	return false;
+}
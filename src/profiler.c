@@ -0,0 +1,189 @@
+#include "profiler.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Log-linear histogram in the style of HdrHistogram: every power of two is
+ * split into 16 linear sub-buckets, so any recorded value is known to within
+ * 1/16 (about 6%) of itself from 1 ns up to the full 64-bit range.
+ */
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[NUM_BUCKETS];
+} Histogram;
+
+static const char *const PROBE_NAMES[PROBE_COUNT] = {
+		"frame", "input", "emulate", "timers",
+		"convert", "upload", "present", "sleep", "input_latency", "audio",
+		"audio_latency",
+};
+
+static Histogram histograms[PROBE_COUNT];
+
+static int bucket_index(uint64_t value) {
+	if (value < SUB_BUCKETS) {
+		return (int) value;
+	}
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BUCKET_BITS;
+	int sub = (int) ((value >> shift) & (SUB_BUCKETS - 1));
+	return (shift + 1) * SUB_BUCKETS + sub;
+}
+
+// Smallest value that lands in the bucket
+static uint64_t bucket_value(int index) {
+	if (index < SUB_BUCKETS) {
+		return (uint64_t) index;
+	}
+	int shift = index / SUB_BUCKETS - 1;
+	uint64_t sub = index % SUB_BUCKETS;
+	return (SUB_BUCKETS + sub) << shift;
+}
+
+static uint64_t percentile(const Histogram *histogram, double fraction) {
+	if (histogram->count == 0) {
+		return 0;
+	}
+	uint64_t target = (uint64_t) (fraction * (double) histogram->count);
+	if (target == 0) {
+		target = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= target) {
+			uint64_t value = bucket_value(i);
+			return value > histogram->max ? histogram->max : value;
+		}
+	}
+	return histogram->max;
+}
+
+uint64_t profiler_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void profiler_record(ProfilerProbe probe, uint64_t ns) {
+	Histogram *histogram = &histograms[probe];
+	if (histogram->count == 0 || ns < histogram->min) {
+		histogram->min = ns;
+	}
+	if (ns > histogram->max) {
+		histogram->max = ns;
+	}
+	histogram->count++;
+	histogram->sum += ns;
+	histogram->buckets[bucket_index(ns)]++;
+}
+
+static uint64_t last_frame_start;
+
+// Called at the start of every frame, records the frame-to-frame interval
+void profiler_mark_frame(void) {
+	uint64_t now = profiler_now();
+	if (last_frame_start != 0) {
+		profiler_record(PROBE_FRAME, now - last_frame_start);
+	}
+	last_frame_start = now;
+}
+
+void profiler_reset(void) {
+	memset(histograms, 0, sizeof(histograms));
+	last_frame_start = 0;
+}
+
+bool profiler_write_json(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror("Error opening profile file");
+		return false;
+	}
+
+	fprintf(file, "{\n  \"unit\": \"ns\",\n  \"probes\": {\n");
+	for (int p = 0; p < PROBE_COUNT; p++) {
+		const Histogram *histogram = &histograms[p];
+		fprintf(file,
+						"    \"%s\": {\"count\": %llu, \"mean\": %llu, \"min\": %llu, "
+						"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, "
+						"\"max\": %llu,\n      \"buckets\": [",
+						PROBE_NAMES[p], (unsigned long long) histogram->count,
+						(unsigned long long) (histogram->count
+																			? histogram->sum / histogram->count
+																			: 0),
+						(unsigned long long) histogram->min,
+						(unsigned long long) percentile(histogram, 0.50),
+						(unsigned long long) percentile(histogram, 0.90),
+						(unsigned long long) percentile(histogram, 0.99),
+						(unsigned long long) percentile(histogram, 0.999),
+						(unsigned long long) histogram->max);
+
+		// Only non-empty buckets, as [lower bound, count] pairs
+		bool first = true;
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			if (histogram->buckets[i] != 0) {
+				fprintf(file, "%s[%llu, %llu]", first ? "" : ", ",
+								(unsigned long long) bucket_value(i),
+								(unsigned long long) histogram->buckets[i]);
+				first = false;
+			}
+		}
+		fprintf(file, "]}%s\n", p + 1 < PROBE_COUNT ? "," : "");
+	}
+	fprintf(file, "  }\n}\n");
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Error while writing %s.\n", path);
+		return false;
+	}
+	printf("Profile written to %s\n", path);
+	return true;
+}
+
+bool profiler_write_csv(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror("Error opening profile file");
+		return false;
+	}
+
+	fprintf(file, "probe,count,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,"
+								"max_ns\n");
+	for (int p = 0; p < PROBE_COUNT; p++) {
+		const Histogram *histogram = &histograms[p];
+		fprintf(file, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+						PROBE_NAMES[p], (unsigned long long) histogram->count,
+						(unsigned long long) (histogram->count
+																			? histogram->sum / histogram->count
+																			: 0),
+						(unsigned long long) histogram->min,
+						(unsigned long long) percentile(histogram, 0.50),
+						(unsigned long long) percentile(histogram, 0.90),
+						(unsigned long long) percentile(histogram, 0.99),
+						(unsigned long long) percentile(histogram, 0.999),
+						(unsigned long long) histogram->max);
+	}
+
+	if (fclose(file) != 0) {
+		fprintf(stderr, "Error while writing %s.\n", path);
+		return false;
+	}
+	printf("Profile written to %s\n", path);
+	return true;
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include "rewind.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+
+_Static_assert(sizeof(Chip8Snapshot) % sizeof(uint64_t) == 0,
+							 "Chip8Snapshot must be a whole number of words");
+_Static_assert(offsetof(Chip8Snapshot, memory) == 0,
+							 "memory must come first in Chip8Snapshot");
+
+#define PAGE_WORDS (CHIP8_PAGE_SIZE / sizeof(uint64_t))
+#define MEMORY_WORDS (CHIP8_MEMORY_SIZE / sizeof(uint64_t))
+
+// Each run is a header of two 16-bit counts (unchanged words, changed words)
+// followed by the XOR of the changed words
+#define RUN_HEADER_SIZE 4
+#define MAX_ENCODED_SIZE                                                       \
+	(REWIND_SNAPSHOT_WORDS * (sizeof(uint64_t) + RUN_HEADER_SIZE))
+
+static const RewindState ZERO_STATE;
+
+static bool has_page(uint64_t pages, size_t word) {
+	return (pages >> (word / PAGE_WORDS)) & 1;
+}
+
+// Word `i` of a snapshot, whose memory outside its pages is left unwritten
+static uint64_t word_at(const RewindState *state, size_t i) {
+	if (i < MEMORY_WORDS && !has_page(state->state.memory_pages, i)) {
+		return 0;
+	}
+	return state->words[i];
+}
+
+static size_t encode_delta(const RewindState *state,
+													 const RewindState *reference, unsigned char *out) {
+	uint64_t either = state->state.memory_pages | reference->state.memory_pages;
+	size_t size = 0;
+	size_t i = 0;
+	while (i < REWIND_SNAPSHOT_WORDS) {
+		size_t start = i;
+		while (i < REWIND_SNAPSHOT_WORDS) {
+			if (i < MEMORY_WORDS && i % PAGE_WORDS == 0 && !has_page(either, i)) {
+				// Zero in both
+				i += PAGE_WORDS;
+			} else if (word_at(state, i) == reference->words[i]) {
+				i++;
+			} else {
+				break;
+			}
+		}
+		uint16_t unchanged = (uint16_t) (i - start);
+
+		start = i;
+		while (i < REWIND_SNAPSHOT_WORDS &&
+					 word_at(state, i) != reference->words[i]) {
+			i++;
+		}
+		uint16_t changed = (uint16_t) (i - start);
+
+		memcpy(out + size, &unchanged, sizeof(unchanged));
+		memcpy(out + size + 2, &changed, sizeof(changed));
+		size += RUN_HEADER_SIZE;
+		for (size_t w = start; w < i; w++) {
+			uint64_t delta = word_at(state, w) ^ reference->words[w];
+			memcpy(out + size, &delta, sizeof(delta));
+			size += sizeof(delta);
+		}
+	}
+	return size;
+}
+
+// XORs an encoded delta onto `words`, which must hold the reference state
+static void apply_delta(uint64_t *words, const unsigned char *in, size_t size) {
+	size_t i = 0;
+	size_t pos = 0;
+	while (pos < size) {
+		uint16_t unchanged, changed;
+		memcpy(&unchanged, in + pos, sizeof(unchanged));
+		memcpy(&changed, in + pos + 2, sizeof(changed));
+		pos += RUN_HEADER_SIZE;
+		i += unchanged;
+		for (uint16_t w = 0; w < changed; w++, i++) {
+			uint64_t delta;
+			memcpy(&delta, in + pos, sizeof(delta));
+			words[i] ^= delta;
+			pos += sizeof(delta);
+		}
+	}
+}
+
+static RewindFrame *frame_at(const Rewind *history, unsigned long long seq) {
+	return &history->frames[seq % history->max_frames];
+}
+
+// Makes `state` the reference, zeroing the pages only the old one used
+static void set_reference(Rewind *history, const RewindState *state) {
+	RewindState *reference = &history->reference;
+	uint64_t stale = reference->state.memory_pages & ~state->state.memory_pages;
+	for (uint64_t pages = stale; pages != 0; pages &= pages - 1) {
+		size_t word = (size_t) __builtin_ctzll(pages) * PAGE_WORDS;
+		memset(&reference->words[word], 0, CHIP8_PAGE_SIZE);
+	}
+	for (uint64_t pages = state->state.memory_pages; pages != 0;
+			 pages &= pages - 1) {
+		size_t word = (size_t) __builtin_ctzll(pages) * PAGE_WORDS;
+		memcpy(&reference->words[word], &state->words[word], CHIP8_PAGE_SIZE);
+	}
+	memcpy(&reference->words[MEMORY_WORDS], &state->words[MEMORY_WORDS],
+				 sizeof(reference->words) - CHIP8_MEMORY_SIZE);
+}
+
+// Rebuilds the reference from the keyframe recorded as `seq`
+static void load_keyframe(Rewind *history, unsigned long long seq) {
+	const RewindFrame *key = frame_at(history, seq);
+	set_reference(history, &ZERO_STATE);
+	apply_delta(history->reference.words, history->data + key->offset,
+							key->size);
+	history->reference_seq = seq;
+	history->has_reference = true;
+}
+
+static void drop_oldest(Rewind *history) {
+	history->used -= frame_at(history, history->first)->size;
+	history->first++;
+}
+
+// Frees room for `size` bytes and returns where they go. The ring is written
+// in order, so the frames in the way are always the oldest ones.
+static size_t reserve(Rewind *history, size_t size) {
+	size_t offset = history->head;
+	if (offset + size > history->capacity) {
+		// Frames in the unused tail are older than anything at the start
+		while (history->first < history->next &&
+					 frame_at(history, history->first)->offset >= offset) {
+			drop_oldest(history);
+		}
+		offset = 0;
+	}
+	while (history->first < history->next) {
+		const RewindFrame *oldest = frame_at(history, history->first);
+		bool overlaps = oldest->offset >= offset && oldest->offset < offset + size;
+		bool full = history->next - history->first >= history->max_frames;
+		if (!overlaps && !full) {
+			break;
+		}
+		drop_oldest(history);
+	}
+
+	// Deltas are useless without their keyframe
+	while (history->first < history->next &&
+				 frame_at(history, history->first)->keyframe != history->first) {
+		drop_oldest(history);
+	}
+	if (history->first == history->next) {
+		offset = 0;
+	}
+	return offset;
+}
+
+bool rewind_init(Rewind *history, size_t capacity, size_t max_frames,
+								 int keyframe_interval) {
+	memset(history, 0, sizeof(*history));
+	if (capacity > UINT32_MAX || max_frames == 0 || keyframe_interval <= 0) {
+		return false;
+	}
+	history->data = malloc(capacity);
+	history->frames = malloc(max_frames * sizeof(*history->frames));
+	history->scratch = malloc(MAX_ENCODED_SIZE);
+	if (history->data == NULL || history->frames == NULL ||
+			history->scratch == NULL) {
+		rewind_destroy(history);
+		return false;
+	}
+	history->capacity = capacity;
+	history->max_frames = max_frames;
+	history->keyframe_interval = keyframe_interval;
+	return true;
+}
+
+void rewind_destroy(Rewind *history) {
+	free(history->data);
+	free(history->frames);
+	free(history->scratch);
+	memset(history, 0, sizeof(*history));
+}
+
+void rewind_clear(Rewind *history) {
+	history->head = 0;
+	history->used = 0;
+	history->first = history->next;
+	history->has_reference = false;
+}
+
+bool rewind_push(Rewind *history, const Chip8 *chip8) {
+	RewindState current;
+	chip8_snapshot(chip8, &current.state);
+
+	bool keyframe = !history->has_reference ||
+									history->reference_seq < history->first ||
+									history->next - history->reference_seq >=
+											(unsigned long long) history->keyframe_interval;
+	size_t size, offset;
+	for (;;) {
+		size = encode_delta(&current, keyframe ? &ZERO_STATE : &history->reference,
+												history->scratch);
+		if (size > history->capacity) {
+			return false;
+		}
+		offset = reserve(history, size);
+		// Making room may have dropped the keyframe this delta was taken against
+		if (keyframe || history->reference_seq >= history->first) {
+			break;
+		}
+		keyframe = true;
+	}
+
+	memcpy(history->data + offset, history->scratch, size);
+	if (keyframe) {
+		set_reference(history, &current);
+		history->reference_seq = history->next;
+		history->has_reference = true;
+	}
+
+	RewindFrame *frame = frame_at(history, history->next);
+	frame->offset = (uint32_t) offset;
+	frame->size = (uint32_t) size;
+	frame->keyframe = history->reference_seq;
+	history->next++;
+	history->head = offset + size;
+	history->used += size;
+	return true;
+}
+
+/*
+ * Restores the newest recorded frame and removes it from the history. A delta
+ * is XORed onto the reference in place and then off again, which touches only
+ * the words it changes.
+ */
+bool rewind_pop(Rewind *history, Chip8 *chip8) {
+	if (history->first == history->next) {
+		return false;
+	}
+	unsigned long long seq = history->next - 1;
+	const RewindFrame *frame = frame_at(history, seq);
+
+	if (!history->has_reference || frame->keyframe != history->reference_seq) {
+		// Only reachable after the reference was popped
+		load_keyframe(history, frame->keyframe);
+	}
+	if (frame->keyframe == seq) {
+		chip8_restore(chip8, &history->reference.state);
+	} else {
+		const unsigned char *delta = history->data + frame->offset;
+		apply_delta(history->reference.words, delta, frame->size);
+		chip8_restore(chip8, &history->reference.state);
+		apply_delta(history->reference.words, delta, frame->size);
+	}
+
+	history->next = seq;
+	history->head = frame->offset;
+	history->used -= frame->size;
+	if (history->reference_seq == seq) {
+		history->has_reference = false;
+	}
+	return true;
+}
+
+size_t rewind_count(const Rewind *history) {
+	return (size_t) (history->next - history->first);
+}
+
+size_t rewind_bytes(const Rewind *history) {
+	return history->used;
+}
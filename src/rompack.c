@@ -0,0 +1,269 @@
+#include "rompack.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+/*
+ * File layout: a 16-byte header ("C8PK", u32 version, u32 entry count,
+ * u32 reserved), the entry table sorted by name, then the ROM images.
+ */
+#define ROMPACK_MAGIC "C8PK"
+#define ROMPACK_VERSION 1
+#define HEADER_SIZE 16
+
+_Static_assert(sizeof(RomPackEntry) == 72, "RomPackEntry must not be padded");
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t value, int bits) {
+	return value << bits | value >> (64 - bits);
+}
+
+static uint64_t read64(const unsigned char *in) {
+	uint64_t value;
+	memcpy(&value, in, sizeof(value));
+	return value;
+}
+
+static uint32_t read32(const unsigned char *in) {
+	uint32_t value;
+	memcpy(&value, in, sizeof(value));
+	return value;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+	acc += input * XXH_PRIME2;
+	acc = rotl64(acc, 31);
+	return acc * XXH_PRIME1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t value) {
+	acc ^= xxh_round(0, value);
+	return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// xxHash64 with seed 0, little-endian hosts only like the rest of the format
+uint64_t rompack_hash(const void *data, size_t size) {
+	const unsigned char *in = data;
+	const unsigned char *end = in + size;
+	uint64_t hash;
+
+	if (size >= 32) {
+		uint64_t v1 = XXH_PRIME1 + XXH_PRIME2;
+		uint64_t v2 = XXH_PRIME2;
+		uint64_t v3 = 0;
+		uint64_t v4 = -XXH_PRIME1;
+		for (; end - in >= 32; in += 32) {
+			v1 = xxh_round(v1, read64(in));
+			v2 = xxh_round(v2, read64(in + 8));
+			v3 = xxh_round(v3, read64(in + 16));
+			v4 = xxh_round(v4, read64(in + 24));
+		}
+		hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		hash = xxh_merge(hash, v1);
+		hash = xxh_merge(hash, v2);
+		hash = xxh_merge(hash, v3);
+		hash = xxh_merge(hash, v4);
+	} else {
+		hash = XXH_PRIME5;
+	}
+	hash += size;
+
+	for (; end - in >= 8; in += 8) {
+		hash ^= xxh_round(0, read64(in));
+		hash = rotl64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+	if (end - in >= 4) {
+		hash ^= read32(in) * XXH_PRIME1;
+		hash = rotl64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+		in += 4;
+	}
+	for (; in < end; in++) {
+		hash ^= *in * XXH_PRIME5;
+		hash = rotl64(hash, 11) * XXH_PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static const RomPackEntry *sort_entries;
+
+static int compare_names(const void *a, const void *b) {
+	uint32_t left = *(const uint32_t *) a;
+	uint32_t right = *(const uint32_t *) b;
+	return strcmp(sort_entries[left].name, sort_entries[right].name);
+}
+
+/*
+ * Writes `count` ROMs into a new pack. Each entry must have its name and
+ * metadata filled in; hash, offset and size are computed here from the image
+ * of the same index.
+ */
+bool rompack_write(const char *path, const RomPackEntry *entries,
+									 const unsigned char *const *images, uint32_t count) {
+	uint32_t *order = malloc((count ? count : 1) * sizeof(*order));
+	RomPackEntry *table = calloc(count ? count : 1, sizeof(*table));
+	if (order == NULL || table == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		free(order);
+		free(table);
+		return false;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		order[i] = i;
+	}
+	sort_entries = entries;
+	qsort(order, count, sizeof(*order), compare_names);
+
+	uint64_t offset = HEADER_SIZE + (uint64_t) count * sizeof(RomPackEntry);
+	for (uint32_t i = 0; i < count; i++) {
+		const RomPackEntry *source = &entries[order[i]];
+		if (source->size > CHIP8_MAX_ROM_SIZE ||
+				offset + source->size > UINT32_MAX) {
+			fprintf(stderr, "Error: %s does not fit in a ROM pack.\n", source->name);
+			free(order);
+			free(table);
+			return false;
+		}
+		table[i] = *source;
+		table[i].hash = rompack_hash(images[order[i]], source->size);
+		table[i].offset = (uint32_t) offset;
+		table[i].reserved = 0;
+		offset += source->size;
+	}
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror("Error opening ROM pack");
+		free(order);
+		free(table);
+		return false;
+	}
+
+	unsigned char header[HEADER_SIZE] = {0};
+	uint32_t version = ROMPACK_VERSION;
+	memcpy(header, ROMPACK_MAGIC, 4);
+	memcpy(header + 4, &version, sizeof(version));
+	memcpy(header + 8, &count, sizeof(count));
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+						fwrite(table, sizeof(*table), count, file) == count;
+	for (uint32_t i = 0; ok && i < count; i++) {
+		ok = fwrite(images[order[i]], 1, table[i].size, file) == table[i].size;
+	}
+
+	if (fclose(file) != 0 || !ok) {
+		fprintf(stderr, "Error while writing ROM pack.\n");
+		ok = false;
+	}
+	free(order);
+	free(table);
+	return ok;
+}
+
+bool rompack_open(RomPack *pack, const char *path) {
+	memset(pack, 0, sizeof(*pack));
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("Error opening ROM pack");
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size < HEADER_SIZE) {
+		fprintf(stderr, "Error: %s is not a ROM pack.\n", path);
+		close(fd);
+		return false;
+	}
+	size_t size = (size_t) info.st_size;
+	void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after the descriptor is closed
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror("Error mapping ROM pack");
+		return false;
+	}
+
+	const unsigned char *bytes = base;
+	uint32_t version, count;
+	memcpy(&version, bytes + 4, sizeof(version));
+	memcpy(&count, bytes + 8, sizeof(count));
+	bool ok = memcmp(bytes, ROMPACK_MAGIC, 4) == 0 &&
+						version == ROMPACK_VERSION &&
+						count <= (size - HEADER_SIZE) / sizeof(RomPackEntry);
+
+	// Validate once so lookups and loads never have to
+	const RomPackEntry *entries = (const RomPackEntry *) (bytes + HEADER_SIZE);
+	for (uint32_t i = 0; ok && i < count; i++) {
+		ok = entries[i].name[ROMPACK_NAME_SIZE - 1] == '\0' &&
+				 entries[i].size <= CHIP8_MAX_ROM_SIZE &&
+				 (uint64_t) entries[i].offset + entries[i].size <= size;
+	}
+	if (!ok) {
+		fprintf(stderr, "Error: %s is not a valid ROM pack.\n", path);
+		munmap(base, size);
+		return false;
+	}
+
+	pack->base = bytes;
+	pack->size = size;
+	pack->entries = entries;
+	pack->count = count;
+	return true;
+}
+
+void rompack_close(RomPack *pack) {
+	if (pack->base != NULL) {
+		munmap((void *) pack->base, pack->size);
+	}
+	memset(pack, 0, sizeof(*pack));
+}
+
+// Binary search on the name-sorted table
+const RomPackEntry *rompack_find(const RomPack *pack, const char *name) {
+	uint32_t low = 0;
+	uint32_t high = pack->count;
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		int order = strcmp(pack->entries[mid].name, name);
+		if (order == 0) {
+			return &pack->entries[mid];
+		}
+		if (order < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return NULL;
+}
+
+const RomPackEntry *rompack_find_hash(const RomPack *pack, uint64_t hash) {
+	for (uint32_t i = 0; i < pack->count; i++) {
+		if (pack->entries[i].hash == hash) {
+			return &pack->entries[i];
+		}
+	}
+	return NULL;
+}
+
+bool rompack_load(const RomPack *pack, const RomPackEntry *entry, Chip8 *chip8) {
+	return chip8_load_rom_data(chip8, pack->base + entry->offset, entry->size);
+}
@@ -0,0 +1,313 @@
+#include "runner.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+
+// A slot that runs one job after another, see start_job
+typedef struct {
+	Chip8 chip8;
+	Chip8Cache *cache;
+	const RunnerJob *job;
+	size_t next_input;
+	unsigned long long frame;
+	unsigned long long cycles;
+} Instance;
+
+// Ring buffer of instance ids: the owner works at the tail, thieves at the head
+typedef struct {
+	pthread_mutex_t lock;
+	size_t *items;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+} Deque;
+
+typedef struct {
+	const RunnerJob *jobs;
+	RunnerResult *results;
+	size_t count;
+
+	Instance *instances;
+	size_t live;
+	Deque *deques;
+	int threads;
+	int slice_frames;
+	// Next job to hand to a slot, and jobs not finished yet
+	atomic_size_t next_job;
+	atomic_size_t remaining;
+	atomic_bool failed;
+	atomic_ullong slices;
+	atomic_ullong steals;
+	atomic_ullong total_cycles;
+	atomic_ullong idle_cycles;
+} Runner;
+
+typedef struct {
+	Runner *runner;
+	int index;
+} Worker;
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void deque_push_tail(Deque *deque, size_t id) {
+	pthread_mutex_lock(&deque->lock);
+	deque->items[deque->tail % deque->capacity] = id;
+	deque->tail++;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop_tail(Deque *deque, size_t *id) {
+	bool found = false;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail != deque->head) {
+		deque->tail--;
+		*id = deque->items[deque->tail % deque->capacity];
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static bool deque_steal_head(Deque *deque, size_t *id) {
+	bool found = false;
+	// Thieves skip a busy deque instead of waiting on it
+	if (pthread_mutex_trylock(&deque->lock) != 0) {
+		return false;
+	}
+	if (deque->tail != deque->head) {
+		*id = deque->items[deque->head % deque->capacity];
+		deque->head++;
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+// Puts a slot back into the state chip8_init and a fresh cache would leave it
+// in, then loads the job; only the pages the last job touched are cleared
+static bool start_job(Runner *runner, Instance *instance, size_t index) {
+	const RunnerJob *job = &runner->jobs[index];
+	Chip8 *chip8 = &instance->chip8;
+	chip8_reset(chip8);
+	chip8_seed(chip8, job->seed);
+	chip8->quirks = job->quirks;
+	if (instance->cache != NULL) {
+		chip8_cache_reset(instance->cache);
+	}
+	instance->job = job;
+	instance->next_input = 0;
+	instance->frame = 0;
+	instance->cycles = 0;
+	return chip8_load_rom_data(chip8, job->rom, job->rom_size);
+}
+
+static void finish_job(Runner *runner, Instance *instance) {
+	RunnerResult *result = &runner->results[instance->job - runner->jobs];
+	result->cycles = instance->cycles;
+	result->idle_cycles = instance->chip8.idle_cycles;
+	result->frames = instance->frame;
+	result->framebuffer_hash = chip8_framebuffer_hash(&instance->chip8);
+	atomic_fetch_add(&runner->total_cycles, instance->cycles);
+	atomic_fetch_add(&runner->idle_cycles, instance->chip8.idle_cycles);
+	atomic_fetch_sub(&runner->remaining, 1);
+}
+
+// Gives the slot the next job nobody has taken, returns false when none are
+// left. A ROM that fails to load fails the run but still counts as done.
+static bool take_next_job(Runner *runner, Instance *instance) {
+	while (true) {
+		size_t index = atomic_fetch_add(&runner->next_job, 1);
+		if (index >= runner->count) {
+			return false;
+		}
+		if (start_job(runner, instance, index)) {
+			return true;
+		}
+		atomic_store(&runner->failed, true);
+		atomic_fetch_sub(&runner->remaining, 1);
+	}
+}
+
+// Runs up to `frames` frames, returns true once the instance is finished
+static bool run_slice(Instance *instance, int frames) {
+	const RunnerJob *job = instance->job;
+	Chip8 *chip8 = &instance->chip8;
+
+	for (int f = 0; f < frames && instance->frame < job->frames; f++) {
+		// Same frame schedule as the SDL front end: input, batch, timers
+		chip8_clear_key_edges(chip8);
+		while (instance->next_input < job->input_count &&
+					 job->input[instance->next_input].frame <= instance->frame) {
+			chip8_set_keys(chip8, job->input[instance->next_input].keys);
+			instance->next_input++;
+		}
+
+		if (instance->cache != NULL) {
+			chip8_cache_run(instance->cache, chip8, job->cycles_per_frame);
+		} else {
+			chip8_run(chip8, job->cycles_per_frame);
+		}
+		chip8_update_timers(chip8);
+
+		instance->cycles += job->cycles_per_frame;
+		instance->frame++;
+	}
+
+	return instance->frame >= job->frames;
+}
+
+static void *worker_main(void *arg) {
+	Worker *worker = arg;
+	Runner *runner = worker->runner;
+	Deque *own = &runner->deques[worker->index];
+
+	while (atomic_load(&runner->remaining) > 0) {
+		size_t id;
+		if (!deque_pop_tail(own, &id)) {
+			bool stolen = false;
+			for (int k = 1; k < runner->threads && !stolen; k++) {
+				int victim = (worker->index + k) % runner->threads;
+				stolen = deque_steal_head(&runner->deques[victim], &id);
+			}
+			if (!stolen) {
+				sched_yield();
+				continue;
+			}
+			atomic_fetch_add(&runner->steals, 1);
+		}
+
+		Instance *instance = &runner->instances[id];
+		bool finished = run_slice(instance, runner->slice_frames);
+		atomic_fetch_add(&runner->slices, 1);
+		if (finished) {
+			finish_job(runner, instance);
+			if (take_next_job(runner, instance)) {
+				deque_push_tail(own, id);
+			}
+		} else {
+			deque_push_tail(own, id);
+		}
+	}
+
+	return NULL;
+}
+
+static bool init_instances(Runner *runner, bool use_cache) {
+	for (size_t i = 0; i < runner->live; i++) {
+		Instance *instance = &runner->instances[i];
+		chip8_init(&instance->chip8);
+		if (use_cache) {
+			instance->cache = malloc(sizeof(*instance->cache));
+			if (instance->cache == NULL || !chip8_cache_init(instance->cache)) {
+				free(instance->cache);
+				instance->cache = NULL;
+				return false;
+			}
+		}
+		// Jobs whose ROM failed to load can leave slots without one
+		if (take_next_job(runner, instance)) {
+			deque_push_tail(&runner->deques[i % runner->threads], i);
+		}
+	}
+	return !atomic_load(&runner->failed);
+}
+
+bool runner_run(const RunnerJob *jobs, RunnerResult *results, size_t count,
+								const RunnerConfig *config, RunnerStats *stats) {
+	Runner runner = {0};
+	runner.jobs = jobs;
+	runner.results = results;
+	runner.count = count;
+	runner.threads = config->threads > 0 ? config->threads : 1;
+	runner.slice_frames = config->slice_frames > 0 ? config->slice_frames : 1;
+	size_t live = config->live_instances > 0
+										? config->live_instances
+										: (size_t) runner.threads * RUNNER_LIVE_PER_THREAD;
+	runner.live = live < count ? live : count;
+	atomic_init(&runner.next_job, 0);
+	atomic_init(&runner.remaining, count);
+	atomic_init(&runner.failed, false);
+	atomic_init(&runner.slices, 0);
+	atomic_init(&runner.steals, 0);
+	atomic_init(&runner.total_cycles, 0);
+	atomic_init(&runner.idle_cycles, 0);
+
+	runner.instances = calloc(runner.live, sizeof(*runner.instances));
+	runner.deques = calloc(runner.threads, sizeof(*runner.deques));
+	pthread_t *threads = calloc(runner.threads, sizeof(*threads));
+	Worker *workers = calloc(runner.threads, sizeof(*workers));
+	bool ok = runner.instances != NULL && runner.deques != NULL &&
+						threads != NULL && workers != NULL;
+
+	// Every slot sits in at most one deque, so `live` entries always suffice
+	for (int t = 0; ok && t < runner.threads; t++) {
+		Deque *deque = &runner.deques[t];
+		pthread_mutex_init(&deque->lock, NULL);
+		deque->capacity = runner.live + 1;
+		deque->items = malloc(deque->capacity * sizeof(*deque->items));
+		ok = deque->items != NULL;
+	}
+	ok = ok && init_instances(&runner, config->use_cache);
+
+	if (ok) {
+		double start = now_seconds();
+		int started = 0;
+		for (; started < runner.threads; started++) {
+			workers[started].runner = &runner;
+			workers[started].index = started;
+			if (pthread_create(&threads[started], NULL, worker_main,
+												 &workers[started]) != 0) {
+				fprintf(stderr, "Error: Failed to start worker thread.\n");
+				break;
+			}
+		}
+		// Workers that did start still drain everything by stealing
+		if (started == 0) {
+			ok = false;
+		}
+		for (int t = 0; t < started; t++) {
+			pthread_join(threads[t], NULL);
+		}
+		if (atomic_load(&runner.failed)) {
+			ok = false;
+		}
+
+		if (ok && stats != NULL) {
+			stats->elapsed = now_seconds() - start;
+			stats->total_cycles = atomic_load(&runner.total_cycles);
+			stats->idle_cycles = atomic_load(&runner.idle_cycles);
+			stats->slices = atomic_load(&runner.slices);
+			stats->steals = atomic_load(&runner.steals);
+		}
+	}
+
+	for (size_t i = 0; runner.instances != NULL && i < runner.live; i++) {
+		if (runner.instances[i].cache != NULL) {
+			chip8_cache_destroy(runner.instances[i].cache);
+			free(runner.instances[i].cache);
+		}
+	}
+	for (int t = 0; runner.deques != NULL && t < runner.threads; t++) {
+		if (runner.deques[t].items != NULL) {
+			pthread_mutex_destroy(&runner.deques[t].lock);
+			free(runner.deques[t].items);
+		}
+	}
+	free(runner.instances);
+	free(runner.deques);
+	free(threads);
+	free(workers);
+	return ok;
+}
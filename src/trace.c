@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Static_assert(sizeof(TraceRecord) == 16, "TraceRecord must not be padded");
+_Static_assert(sizeof(TraceHeader) == 24, "TraceHeader must not be padded");
+
+// How long the flusher sleeps when the ring is empty
+#define FLUSH_INTERVAL_NS 100000
+
+// Appends everything published so far to the file, returns false when idle
+static bool flush_records(Chip8Trace *trace) {
+	unsigned head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+	if (head == tail) {
+		return false;
+	}
+
+	// At most two runs, split where the ring wraps
+	while (head != tail) {
+		unsigned start = head & trace->mask;
+		unsigned count = tail - head;
+		if (count > trace->capacity - start) {
+			count = trace->capacity - start;
+		}
+		fwrite(&trace->records[start], sizeof(TraceRecord), count, trace->file);
+		trace->written += count;
+		head += count;
+	}
+	atomic_store_explicit(&trace->head, head, memory_order_release);
+	return true;
+}
+
+static void *flush_thread(void *arg) {
+	Chip8Trace *trace = arg;
+	struct timespec interval = {0, FLUSH_INTERVAL_NS};
+	while (!atomic_load_explicit(&trace->stop, memory_order_acquire)) {
+		if (!flush_records(trace)) {
+			nanosleep(&interval, NULL);
+		}
+	}
+	return NULL;
+}
+
+static bool write_header(Chip8Trace *trace) {
+	TraceHeader header = {
+			.version = TRACE_VERSION,
+			.record_size = sizeof(TraceRecord),
+			.records = trace->written,
+			.dropped = trace->dropped,
+	};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	return fseek(trace->file, 0, SEEK_SET) == 0 &&
+				 fwrite(&header, sizeof(header), 1, trace->file) == 1;
+}
+
+bool trace_open(Chip8Trace *trace, const char *path, uint32_t capacity) {
+	memset(trace, 0, sizeof(*trace));
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		fprintf(stderr, "Error: Trace capacity must be a power of two.\n");
+		return false;
+	}
+
+	trace->records = malloc(capacity * sizeof(TraceRecord));
+	if (trace->records == NULL) {
+		fprintf(stderr, "Error: Failed to allocate trace buffer.\n");
+		return false;
+	}
+	// Touch every page now rather than in the middle of a batch, this also
+	// zeroes the reserved bytes the producer never writes
+	memset(trace->records, 0, capacity * sizeof(TraceRecord));
+	trace->capacity = capacity;
+	trace->mask = capacity - 1;
+
+	trace->file = fopen(path, "wb");
+	if (trace->file == NULL) {
+		perror(path);
+		free(trace->records);
+		return false;
+	}
+	// Counts are filled in by trace_close
+	if (!write_header(trace) ||
+			pthread_create(&trace->thread, NULL, flush_thread, trace) != 0) {
+		fprintf(stderr, "Error: Failed to start trace writer.\n");
+		fclose(trace->file);
+		free(trace->records);
+		return false;
+	}
+	return true;
+}
+
+// Detach the trace from its Chip8 first, the last batch must have ended
+void trace_close(Chip8Trace *trace) {
+	atomic_store_explicit(&trace->stop, true, memory_order_release);
+	pthread_join(trace->thread, NULL);
+	flush_records(trace);
+
+	if (!write_header(trace) || fclose(trace->file) != 0) {
+		fprintf(stderr, "Error: Failed to write trace.\n");
+	}
+	if (trace->dropped > 0) {
+		fprintf(stderr, "Warning: Trace dropped %llu records.\n",
+						(unsigned long long) trace->dropped);
+	}
+	free(trace->records);
+	trace->records = NULL;
+}
+
+bool trace_read(const char *path, TraceHeader *header, TraceRecord **records,
+								uint64_t **cycles) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	if (fread(header, sizeof(*header), 1, file) != 1 ||
+			memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != TRACE_VERSION ||
+			header->record_size != sizeof(TraceRecord)) {
+		fprintf(stderr, "Error: %s is not a trace file.\n", path);
+		fclose(file);
+		return false;
+	}
+
+	// A trace that was never closed has no count, take whatever was flushed
+	if (header->records == 0 && fseek(file, 0, SEEK_END) == 0) {
+		long size = ftell(file);
+		if (size > (long) sizeof(*header)) {
+			header->records = (size - sizeof(*header)) / sizeof(TraceRecord);
+		}
+		fseek(file, sizeof(*header), SEEK_SET);
+	}
+
+	*records = malloc((header->records + 1) * sizeof(**records));
+	*cycles = malloc((header->records + 1) * sizeof(**cycles));
+	if (*records == NULL || *cycles == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		free(*records);
+		free(*cycles);
+		fclose(file);
+		return false;
+	}
+	header->records =
+			fread(*records, sizeof(TraceRecord), header->records, file);
+	fclose(file);
+
+	// Cycle numbers only grow, a smaller low half means it wrapped
+	uint64_t cycle = 0;
+	for (uint64_t i = 0; i < header->records; i++) {
+		uint64_t next = (cycle & ~(uint64_t) UINT32_MAX) | (*records)[i].cycle;
+		if (next < cycle) {
+			next += (uint64_t) 1 << 32;
+		}
+		(*cycles)[i] = cycle = next;
+	}
+	return true;
+}
@@ -0,0 +1,54 @@
+#include "triple_buffer.h"
+
+#include <string.h>
+
+#define TRIPLE_BUFFER_FRESH 4u
+#define TRIPLE_BUFFER_INDEX 3u
+
+void triple_buffer_init(TripleBuffer *buffer) {
+	memset(buffer->frames, 0, sizeof(buffer->frames));
+	buffer->back = 0;
+	buffer->front = 1;
+	atomic_store(&buffer->middle, 2);
+}
+
+void triple_buffer_publish(TripleBuffer *buffer, const Chip8 *chip8,
+													 uint64_t input_ns, const DebugView *debug) {
+	DisplayFrame *frame = &buffer->frames[buffer->back];
+	memcpy(frame->gfx, chip8->gfx, sizeof(frame->gfx));
+	frame->hires = chip8->hires;
+	frame->dirty_rows = chip8->dirty_rows;
+	frame->input_ns = input_ns;
+	frame->has_debug = debug != NULL;
+	if (debug != NULL) {
+		frame->debug = *debug;
+	}
+
+	// The reader never writes a slot, so the parked frame can be read even if
+	// the reader takes it meanwhile; then its rows are merely redrawn twice
+	unsigned middle = atomic_load_explicit(&buffer->middle, memory_order_relaxed);
+	if (middle & TRIPLE_BUFFER_FRESH) {
+		const DisplayFrame *skipped = &buffer->frames[middle & TRIPLE_BUFFER_INDEX];
+		frame->dirty_rows |= skipped->dirty_rows;
+		if (skipped->input_ns != 0 &&
+				(frame->input_ns == 0 || skipped->input_ns < frame->input_ns)) {
+			frame->input_ns = skipped->input_ns;
+		}
+	}
+
+	middle = atomic_exchange_explicit(&buffer->middle,
+																		buffer->back | TRIPLE_BUFFER_FRESH,
+																		memory_order_acq_rel);
+	buffer->back = middle & TRIPLE_BUFFER_INDEX;
+}
+
+const DisplayFrame *triple_buffer_acquire(TripleBuffer *buffer) {
+	unsigned middle = atomic_load_explicit(&buffer->middle, memory_order_relaxed);
+	if (!(middle & TRIPLE_BUFFER_FRESH)) {
+		return NULL;
+	}
+	middle = atomic_exchange_explicit(&buffer->middle, buffer->front,
+																		memory_order_acq_rel);
+	buffer->front = middle & TRIPLE_BUFFER_INDEX;
+	return &buffer->frames[buffer->front];
+}
@@ -0,0 +1,606 @@
+// Static recompiler: walks a ROM's control flow from 0x200 and writes C that
+// runs it on the runtime in chip8_aot.h, see `make aot`
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip8.h"
+#include "chip8_aot.h"
+#include "chip8_ops.h"
+#include "disasm.h"
+#include "profile.h"
+
+// Longest jump table followed behind a BNNN, one 1NNN per possible V0 step
+#define MAX_TABLE_ENTRIES 128
+
+static const char *const QUIRKS_ENUMS[CHIP8_QUIRKS_COUNT] = {
+		[CHIP8_QUIRKS_VIP] = "CHIP8_QUIRKS_VIP",
+		[CHIP8_QUIRKS_CHIP48] = "CHIP8_QUIRKS_CHIP48",
+		[CHIP8_QUIRKS_SCHIP] = "CHIP8_QUIRKS_SCHIP",
+		[CHIP8_QUIRKS_XOCHIP] = "CHIP8_QUIRKS_XOCHIP",
+};
+
+static const char *const KEYMAP_ENUMS[KEYMAP_COUNT] = {
+		[KEYMAP_DEFAULT] = "KEYMAP_DEFAULT",
+		[KEYMAP_ARROWS] = "KEYMAP_ARROWS",
+};
+
+// One guest instruction as a C statement, with the addresses it may continue at
+typedef struct {
+	char code[160];
+	uint8_t length; // 2, or 4 for F000 NNNN
+	// Control may leave the straight line, or the instruction stored to
+	// memory that compiled code may live in
+	bool ends_run;
+	bool stores;
+	bool falls_through; // pc + length is a successor
+	// Skips and FX0A: the run goes on only if pc is at the next instruction
+	bool conditional;
+	uint16_t target;		// another successor, when has_target
+	bool has_target;
+	bool is_table_jump; // BNNN, whose targets are guessed from a jump table
+} Instruction;
+
+typedef struct {
+	Chip8 chip8; // ROM image the code is read from
+	unsigned quirks;
+	unsigned limit; // one past the last byte that may be compiled
+
+	Instruction instructions[CHIP8_AOT_CODE_SIZE];
+	bool visited[CHIP8_AOT_CODE_SIZE];
+	bool reachable[CHIP8_AOT_CODE_SIZE]; // visited and compiled
+	uint16_t worklist[CHIP8_AOT_CODE_SIZE];
+	int worklist_size;
+
+	// Statistics
+	int compiled;
+	int uncompiled;
+	int tables;
+	int table_targets;
+} Translator;
+
+static Translator translator;
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s [--quirks vip|chip48|schip|xochip] [--ipf N] "
+					"[--keymap default|arrows] [-o FILE] <rom_file_name>\n",
+					program);
+}
+
+// Reads the ROM like chip8_load_rom, trying roms/ when the path is missing
+static unsigned char *read_rom(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		char full_path[1024];
+		snprintf(full_path, sizeof(full_path), "roms/%s", path);
+		file = fopen(full_path, "rb");
+	}
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	unsigned char *data = malloc(CHIP8_MAX_ROM_SIZE + 1);
+	*size = data != NULL ? fread(data, 1, CHIP8_MAX_ROM_SIZE + 1, file) : 0;
+	fclose(file);
+	if (data == NULL || *size == 0 || *size > CHIP8_MAX_ROM_SIZE) {
+		fprintf(stderr, "Error: Failed to read %s.\n", path);
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+static void add_target(Translator *t, unsigned address) {
+	if (address >= 0x200 && address < t->limit && !t->visited[address]) {
+		t->visited[address] = true;
+		t->worklist[t->worklist_size++] = (uint16_t) address;
+	}
+}
+
+// Skips continue after the next instruction, or jump over it
+static void set_skip(Translator *t, Instruction *ins, unsigned short pc) {
+	bool long_next = (t->quirks & QUIRK_XOCHIP_OPS) &&
+									 fetch_opcode(&t->chip8, pc + 2) == 0xF000;
+	ins->conditional = true;
+	ins->target = pc + (long_next ? 6 : 4);
+	ins->has_target = true;
+}
+
+static void set_store(Instruction *ins, const char *op, int length) {
+	snprintf(ins->code, sizeof(ins->code),
+					 "unsigned short address = chip8->I;\n"
+					 "\t\t%s;\n"
+					 "\t\tchip8_aot_written(aot, chip8, address, %d);",
+					 op, length);
+	ins->stores = true;
+	ins->ends_run = true;
+}
+
+/*
+ * The C for the instruction at pc: the same op the interpreter's switch calls
+ * for it, with constant operands. Returns false for opcodes the interpreter
+ * reports as unknown, which are left to it.
+ */
+static bool translate(Translator *t, unsigned short pc, Instruction *ins) {
+	memset(ins, 0, sizeof(*ins));
+	ins->length = 2;
+	ins->falls_through = true;
+	if (pc + 2u > t->limit) {
+		return false;
+	}
+
+	unsigned short opcode = fetch_opcode(&t->chip8, pc);
+	unsigned quirks = t->quirks;
+	int x = (opcode & 0x0F00) >> 8;
+	int y = (opcode & 0x00F0) >> 4;
+	int n = opcode & 0x000F;
+	unsigned nn = opcode & 0x00FF;
+	unsigned nnn = opcode & 0x0FFF;
+	char *code = ins->code;
+	size_t size = sizeof(ins->code);
+	char op[64];
+
+	switch (opcode & 0xF000) {
+	case 0x0000:
+		if (opcode == 0x00E0) {
+			snprintf(code, size, "op_cls(chip8, QUIRKS);");
+		} else if (opcode == 0x00EE) {
+			// Return addresses are followed from the calls
+			snprintf(code, size, "op_ret(chip8);");
+			ins->ends_run = true;
+			ins->falls_through = false;
+		} else if (quirks & QUIRK_SCHIP_OPS) {
+			snprintf(code, size, "op_schip_system(chip8, 0x%04X, QUIRKS);", opcode);
+			if (opcode == 0x00FD) {
+				ins->ends_run = true;
+				ins->falls_through = false;
+			}
+		} else {
+			snprintf(code, size, "op_sys(chip8, 0x%04X);", opcode);
+		}
+		break;
+	case 0x1000:
+		snprintf(code, size, "op_jp(chip8, 0x%03X);", nnn);
+		ins->ends_run = true;
+		ins->falls_through = false;
+		ins->target = nnn;
+		ins->has_target = true;
+		break;
+	case 0x2000:
+		snprintf(code, size, "op_call(chip8, 0x%03X);", nnn);
+		ins->ends_run = true;
+		ins->target = nnn;
+		ins->has_target = true;
+		break;
+	case 0x3000:
+		snprintf(code, size, "op_se_imm(chip8, %d, 0x%02X, QUIRKS);", x, nn);
+		set_skip(t, ins, pc);
+		break;
+	case 0x4000:
+		snprintf(code, size, "op_sne_imm(chip8, %d, 0x%02X, QUIRKS);", x, nn);
+		set_skip(t, ins, pc);
+		break;
+	case 0x5000:
+		if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x2) {
+			snprintf(op, sizeof(op), "op_save_range(chip8, %d, %d)", x, y);
+			set_store(ins, op, (x > y ? x - y : y - x) + 1);
+		} else if ((quirks & QUIRK_XOCHIP_OPS) && n == 0x3) {
+			snprintf(code, size, "op_load_range(chip8, %d, %d);", x, y);
+		} else {
+			snprintf(code, size, "op_se_reg(chip8, %d, %d, QUIRKS);", x, y);
+			set_skip(t, ins, pc);
+		}
+		break;
+	case 0x6000:
+		snprintf(code, size, "op_ld_imm(chip8, %d, 0x%02X);", x, nn);
+		break;
+	case 0x7000:
+		snprintf(code, size, "op_add_imm(chip8, %d, 0x%02X);", x, nn);
+		break;
+	case 0x8000: {
+		static const char *const ALU[16] = {
+				[0x0] = "op_ld_reg(chip8, %d, %d);",
+				[0x1] = "op_or(chip8, %d, %d, QUIRKS);",
+				[0x2] = "op_and(chip8, %d, %d, QUIRKS);",
+				[0x3] = "op_xor(chip8, %d, %d, QUIRKS);",
+				[0x4] = "op_add_reg(chip8, %d, %d);",
+				[0x5] = "op_sub(chip8, %d, %d);",
+				[0x6] = "op_shr(chip8, %d, %d, QUIRKS);",
+				[0x7] = "op_subn(chip8, %d, %d);",
+				[0xE] = "op_shl(chip8, %d, %d, QUIRKS);",
+		};
+		if (ALU[n] == NULL) {
+			return false;
+		}
+		snprintf(code, size, ALU[n], x, y);
+		break;
+	}
+	case 0x9000:
+		snprintf(code, size, "op_sne_reg(chip8, %d, %d, QUIRKS);", x, y);
+		set_skip(t, ins, pc);
+		break;
+	case 0xA000:
+		snprintf(code, size, "op_ld_i(chip8, 0x%03X);", nnn);
+		break;
+	case 0xB000:
+		snprintf(code, size, "op_jp_v0(chip8, %d, 0x%03X, QUIRKS);", x, nnn);
+		ins->ends_run = true;
+		ins->falls_through = false;
+		ins->is_table_jump = true;
+		break;
+	case 0xC000:
+		snprintf(code, size, "op_rnd(chip8, %d, 0x%02X);", x, nn);
+		break;
+	case 0xD000:
+		snprintf(code, size, "op_drw(chip8, %d, %d, %d, QUIRKS);", x, y, n);
+		break;
+	case 0xE000:
+		if (nn == 0x9E) {
+			snprintf(code, size, "op_skp(chip8, %d, QUIRKS);", x);
+		} else if (nn == 0xA1) {
+			snprintf(code, size, "op_sknp(chip8, %d, QUIRKS);", x);
+		} else {
+			return false;
+		}
+		set_skip(t, ins, pc);
+		break;
+	case 0xF000:
+		switch (nn) {
+		case 0x00:
+			if (!(quirks & QUIRK_XOCHIP_OPS) || opcode != 0xF000 ||
+					pc + 4u > t->limit) {
+				return false;
+			}
+			snprintf(code, size, "op_ld_i_long(chip8);");
+			ins->length = 4;
+			break;
+		case 0x01:
+			if (!(quirks & QUIRK_XOCHIP_OPS)) {
+				return false;
+			}
+			snprintf(code, size, "op_planes(chip8, %d);", x);
+			break;
+		case 0x02:
+			if (!(quirks & QUIRK_XOCHIP_OPS) || opcode != 0xF002) {
+				return false;
+			}
+			snprintf(code, size, "op_ld_pattern(chip8);");
+			break;
+		case 0x07:
+			snprintf(code, size, "op_ld_vx_dt(chip8, %d);", x);
+			break;
+		case 0x0A:
+			// Waits by staying at pc
+			snprintf(code, size, "op_ld_vx_key(chip8, %d);", x);
+			ins->conditional = true;
+			ins->target = pc;
+			ins->has_target = true;
+			break;
+		case 0x15:
+			snprintf(code, size, "op_ld_dt(chip8, %d);", x);
+			break;
+		case 0x18:
+			snprintf(code, size, "op_ld_st(chip8, %d);", x);
+			break;
+		case 0x1E:
+			snprintf(code, size, "op_add_i(chip8, %d);", x);
+			break;
+		case 0x29:
+			snprintf(code, size, "op_ld_font(chip8, %d);", x);
+			break;
+		case 0x30:
+			if (!(quirks & QUIRK_SCHIP_OPS)) {
+				return false;
+			}
+			snprintf(code, size, "op_ld_big_font(chip8, %d);", x);
+			break;
+		case 0x33:
+			snprintf(op, sizeof(op), "op_bcd(chip8, %d)", x);
+			set_store(ins, op, 3);
+			break;
+		case 0x3A:
+			if (!(quirks & QUIRK_XOCHIP_OPS)) {
+				return false;
+			}
+			snprintf(code, size, "op_pitch(chip8, %d);", x);
+			break;
+		case 0x55:
+			snprintf(op, sizeof(op), "op_store(chip8, %d, QUIRKS)", x);
+			set_store(ins, op, x + 1);
+			break;
+		case 0x65:
+			snprintf(code, size, "op_load(chip8, %d, QUIRKS);", x);
+			break;
+		case 0x75:
+			if (!(quirks & QUIRK_SCHIP_OPS)) {
+				return false;
+			}
+			snprintf(code, size, "op_save_flags(chip8, %d);", x);
+			break;
+		case 0x85:
+			if (!(quirks & QUIRK_SCHIP_OPS)) {
+				return false;
+			}
+			snprintf(code, size, "op_load_flags(chip8, %d);", x);
+			break;
+		default:
+			return false;
+		}
+		break;
+	}
+	return true;
+}
+
+/*
+ * BNNN jumps to NNN plus a register. Programs use it to index a table of
+ * 1NNN jumps, so the table is followed for as long as it holds jumps; other
+ * targets are only found at run time and interpreted.
+ */
+static void add_table_targets(Translator *t, unsigned short base) {
+	t->tables++;
+	add_target(t, base);
+	for (int i = 0; i < MAX_TABLE_ENTRIES; i++) {
+		unsigned address = base + 2u * i;
+		if (address + 2 > t->limit ||
+				(fetch_opcode(&t->chip8, address) & 0xF000) != 0x1000) {
+			break;
+		}
+		add_target(t, address);
+		t->table_targets++;
+	}
+}
+
+static void explore(Translator *t) {
+	add_target(t, 0x200);
+	while (t->worklist_size > 0) {
+		unsigned short pc = t->worklist[--t->worklist_size];
+		Instruction *ins = &t->instructions[pc];
+		if (!translate(t, pc, ins)) {
+			t->uncompiled++;
+			continue;
+		}
+		t->reachable[pc] = true;
+		t->compiled++;
+
+		if (ins->falls_through) {
+			add_target(t, pc + ins->length);
+		}
+		if (ins->has_target) {
+			add_target(t, ins->target);
+		}
+		if (ins->is_table_jump) {
+			add_table_targets(t, fetch_opcode(&t->chip8, pc) & 0x0FFF);
+		}
+	}
+}
+
+// Writes the run starting at `start` as one function, returns its end
+static unsigned emit_run(Translator *t, FILE *out, unsigned short start,
+												 bool *assigned) {
+	// Only stores use the runtime state, and only longer runs the budget
+	bool stores = false;
+	int length = 0;
+	unsigned end = start;
+	for (unsigned pc = start;; pc += t->instructions[pc].length) {
+		const Instruction *ins = &t->instructions[pc];
+		stores |= ins->stores;
+		length++;
+		end = pc + ins->length;
+		if (ins->ends_run || end >= t->limit || !t->reachable[end] ||
+				assigned[end]) {
+			break;
+		}
+	}
+
+	fprintf(out, "\nstatic int run_%04X(Chip8Aot *aot, Chip8 *chip8, int budget) {\n",
+					start);
+	if (!stores) {
+		fprintf(out, "\t(void) aot;\n");
+	}
+	if (length == 1) {
+		fprintf(out, "\t(void) budget;\n");
+	}
+	fprintf(out, "\tint executed = 0;\n\tswitch (chip8->pc) {\n");
+	for (unsigned pc = start; pc < end; pc += t->instructions[pc].length) {
+		const Instruction *ins = &t->instructions[pc];
+		char text[32];
+		chip8_disassemble(fetch_opcode(&t->chip8, pc), text, sizeof(text));
+		assigned[pc] = true;
+
+		bool last = pc + ins->length == end;
+		if (ins->stores) {
+			fprintf(out, "\tcase 0x%04X: { // %s\n\t\t%s\n", pc, text, ins->code);
+		} else {
+			fprintf(out, "\tcase 0x%04X: // %s\n\t\t%s\n", pc, text, ins->code);
+		}
+		if (last) {
+			fprintf(out, "\t\treturn executed + 1;\n");
+		} else if (ins->conditional) {
+			fprintf(out,
+							"\t\tif (++executed == budget || chip8->pc != 0x%04X) {\n"
+							"\t\t\treturn executed;\n"
+							"\t\t}\n"
+							"\t\t__attribute__((fallthrough));\n",
+							pc + ins->length);
+		} else {
+			fprintf(out, "\t\tif (++executed == budget) {\n"
+									 "\t\t\treturn executed;\n"
+									 "\t\t}\n"
+									 "\t\t__attribute__((fallthrough));\n");
+		}
+		if (ins->stores) {
+			fprintf(out, "\t}\n");
+		}
+	}
+	fprintf(out, "\tdefault:\n\t\treturn 0;\n\t}\n}\n");
+	return end;
+}
+
+// ROM names end up in a string literal
+static void print_name(FILE *out, const char *name) {
+	fputc('"', out);
+	for (const char *c = name; *c != '\0'; c++) {
+		fputc(*c == '"' || *c == '\\' || *c < ' ' ? '_' : *c, out);
+	}
+	fputc('"', out);
+}
+
+static void emit_program(Translator *t, FILE *out, const char *name,
+												 const unsigned char *rom, size_t rom_size,
+												 Chip8Quirks quirks, int cycles_per_frame,
+												 Keymap keymap) {
+	fprintf(out,
+					"// Generated by chip8_aot from %s, do not edit.\n"
+					"// %d instructions compiled, %d left to the interpreter, %d jump "
+					"tables with %d entries\n",
+					name, t->compiled, t->uncompiled, t->tables, t->table_targets);
+	fprintf(out, "#include \"chip8_aot.h\"\n#include \"chip8_ops.h\"\n\n");
+	fprintf(out, "#define QUIRKS 0x%02Xu // %s\n\n", t->quirks,
+					chip8_quirks_name(quirks));
+
+	fprintf(out, "static const unsigned char rom[%zu] = {", rom_size);
+	for (size_t i = 0; i < rom_size; i++) {
+		fprintf(out, "%s0x%02X,", i % 12 == 0 ? "\n\t" : " ", rom[i]);
+	}
+	fprintf(out, "\n};\n");
+
+	// Runs go in address order, each one as long as control falls through
+	static bool assigned[CHIP8_AOT_CODE_SIZE];
+	static uint16_t starts[CHIP8_AOT_CODE_SIZE], ends[CHIP8_AOT_CODE_SIZE];
+	int num_runs = 0;
+	for (unsigned pc = 0x200; pc < t->limit; pc++) {
+		if (t->reachable[pc] && !assigned[pc]) {
+			starts[num_runs] = (uint16_t) pc;
+			ends[num_runs] = (uint16_t) emit_run(t, out, (uint16_t) pc, assigned);
+			num_runs++;
+		}
+	}
+
+	if (num_runs > 0) {
+		fprintf(out, "\nstatic const Chip8AotRun runs[] = {\n");
+		for (int i = 0; i < num_runs; i++) {
+			fprintf(out, "\t\t{0x%04X, 0x%04X, run_%04X},\n", starts[i], ends[i],
+							starts[i]);
+		}
+		fprintf(out, "};\n");
+	}
+
+	fprintf(out, "\nconst Chip8AotProgram chip8_aot_program = {\n\t\t.name = ");
+	print_name(out, name);
+	fprintf(out,
+					",\n"
+					"\t\t.rom = rom,\n"
+					"\t\t.rom_size = sizeof(rom),\n"
+					"\t\t.quirks = %s,\n"
+					"\t\t.cycles_per_frame = %d,\n"
+					"\t\t.keymap = %s,\n",
+					QUIRKS_ENUMS[quirks], cycles_per_frame, KEYMAP_ENUMS[keymap]);
+	if (num_runs > 0) {
+		fprintf(out, "\t\t.runs = runs,\n"
+								 "\t\t.num_runs = sizeof(runs) / sizeof(runs[0]),\n");
+	} else {
+		fprintf(out, "\t\t.runs = NULL,\n\t\t.num_runs = 0,\n");
+	}
+	fprintf(out, "};\n");
+}
+
+int main(int argc, char **argv) {
+	const char *rom_filename = NULL;
+	const char *output_path = NULL;
+	int cycles_per_frame = -1;
+	Chip8Quirks quirks = CHIP8_QUIRKS_VIP;
+	bool has_quirks = false;
+	Keymap keymap = KEYMAP_DEFAULT;
+	bool has_keymap = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+			if (!chip8_quirks_parse(argv[++i], &quirks)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			has_quirks = true;
+		} else if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+			cycles_per_frame = atoi(argv[++i]);
+			if (cycles_per_frame <= 0) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+			if (!keymap_parse(argv[++i], &keymap)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			has_keymap = true;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output_path = argv[++i];
+		} else if (argv[i][0] == '-') {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			rom_filename = argv[i];
+		}
+	}
+	if (rom_filename == NULL) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	size_t rom_size;
+	unsigned char *rom = read_rom(rom_filename, &rom_size);
+	if (rom == NULL) {
+		return 1;
+	}
+
+	// The options win over the ROM's profile, like in the front end
+	const RomProfile *profile = profile_find(rom_filename);
+	if (!has_quirks && profile != NULL) {
+		quirks = profile->quirks;
+	}
+	if (!has_keymap && profile != NULL) {
+		keymap = profile->keymap;
+	}
+	if (cycles_per_frame < 0) {
+		cycles_per_frame = profile != NULL ? profile->cycles_per_frame : 0;
+	}
+
+	Translator *t = &translator;
+	chip8_init(&t->chip8);
+	chip8_load_rom_data(&t->chip8, rom, rom_size);
+	t->quirks = quirk_flags(quirks);
+	t->limit = 0x200 + rom_size;
+	if (t->limit > CHIP8_AOT_CODE_SIZE) {
+		t->limit = CHIP8_AOT_CODE_SIZE;
+	}
+	explore(t);
+
+	FILE *out = stdout;
+	if (output_path != NULL) {
+		out = fopen(output_path, "w");
+		if (out == NULL) {
+			perror(output_path);
+			free(rom);
+			return 1;
+		}
+	}
+	const char *name = strrchr(rom_filename, '/');
+	name = name != NULL ? name + 1 : rom_filename;
+	emit_program(t, out, name, rom, rom_size, quirks, cycles_per_frame, keymap);
+
+	bool failed = ferror(out) != 0;
+	if (out != stdout) {
+		failed |= fclose(out) != 0;
+	}
+	free(rom);
+	if (failed) {
+		fprintf(stderr, "Error: Failed to write %s.\n",
+						output_path != NULL ? output_path : "output");
+		return 1;
+	}
+	fprintf(stderr, "%s: %d instructions compiled, %d interpreted, %d jump "
+									"tables\n",
+					name, t->compiled, t->uncompiled, t->tables);
+	return 0;
+}
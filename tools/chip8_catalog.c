@@ -0,0 +1,580 @@
+// Runs every ROM below a directory headlessly and writes launcher previews
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "chip8.h"
+#include "chip8_dispatch.h"
+#include "chip8_ops.h"
+#include "disasm.h"
+#include "profile.h"
+#include "rompack.h"
+#include "runner.h"
+
+#define DEFAULT_FRAMES 600
+#define DEFAULT_ATTRACT_FRAMES 300
+#define DEFAULT_SCALE 2
+#define DEFAULT_CYCLES_PER_FRAME 8
+
+// Random input presses one key, or none, for the first RANDOM_HOLD_FRAMES of
+// every RANDOM_INTERVAL_FRAMES, so FX0A waits see a release each time
+#define RANDOM_INTERVAL_FRAMES 12
+#define RANDOM_HOLD_FRAMES 8
+
+// Distinct patterns chip8_op_pattern returns
+#define MAX_PATTERNS 64
+
+typedef struct {
+	char name[1024]; // path below the root, e.g. "chip8/br8kout.ch8"
+	char path[2048];
+} CatalogRom;
+
+typedef struct {
+	CatalogRom *roms;
+	size_t count;
+	size_t capacity;
+} RomList;
+
+typedef struct {
+	const char *out_dir;
+	unsigned long frames;
+	unsigned long attract_frames; // 0 = no animation
+	unsigned long thumbnail_frame;
+	int scale;
+	int cycles_per_frame; // 0 = the ROM's profile, then the default
+	bool has_quirks;
+	Chip8Quirks quirks;
+	// Keypad script in the runner's format, or NULL for random input
+	const RunnerInputEvent *input;
+	size_t input_count;
+	bool no_input;
+	uint64_t seed;
+} CatalogConfig;
+
+// ROMs handed out to the workers in order
+typedef struct {
+	const RomList *list;
+	const CatalogConfig *config;
+	atomic_size_t next;
+	atomic_bool failed;
+} Catalog;
+
+// What one run of a ROM observed
+typedef struct {
+	unsigned long long instructions;
+	unsigned long long unknown;
+	unsigned long key_wait_frames;
+	unsigned long draw_frames;
+	int cycles_per_frame;
+	Chip8Quirks quirks;
+	// Executions of every opcode
+	uint32_t counts[65536];
+} RomStats;
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s [--out DIR] [--threads N] [--frames N] [--attract N] "
+					"[--thumbnail N] [--scale N] [--ipf N] "
+					"[--quirks vip|chip48|schip|xochip] "
+					"[--input FILE|random|none] [--seed N] <rom_dir>\n",
+					program);
+}
+
+static bool has_rom_extension(const char *name) {
+	size_t length = strlen(name);
+	return length > 4 && strcmp(name + length - 4, ".ch8") == 0;
+}
+
+static bool add_rom(RomList *list, const char *path, const char *name) {
+	if (list->count == list->capacity) {
+		size_t capacity = list->capacity ? list->capacity * 2 : 64;
+		CatalogRom *roms = realloc(list->roms, capacity * sizeof(*roms));
+		if (roms == NULL) {
+			fprintf(stderr, "Error: Out of memory.\n");
+			return false;
+		}
+		list->roms = roms;
+		list->capacity = capacity;
+	}
+	CatalogRom *rom = &list->roms[list->count++];
+	snprintf(rom->name, sizeof(rom->name), "%s", name);
+	snprintf(rom->path, sizeof(rom->path), "%s", path);
+	return true;
+}
+
+// `prefix` is the path below the root, which names the ROM's outputs
+static bool scan_directory(RomList *list, const char *root,
+													 const char *prefix) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%s%s", root, *prefix ? "/" : "", prefix);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return false;
+	}
+
+	bool ok = true;
+	struct dirent *item;
+	while (ok && (item = readdir(dir)) != NULL) {
+		if (item->d_name[0] == '.') {
+			continue;
+		}
+
+		char name[1024];
+		char child[2048];
+		snprintf(name, sizeof(name), "%s%s%s", prefix, *prefix ? "/" : "",
+						 item->d_name);
+		snprintf(child, sizeof(child), "%s/%s", root, name);
+
+		struct stat info;
+		if (stat(child, &info) != 0) {
+			perror(child);
+			ok = false;
+		} else if (S_ISDIR(info.st_mode)) {
+			ok = scan_directory(list, root, name);
+		} else if (S_ISREG(info.st_mode) && has_rom_extension(name)) {
+			ok = add_rom(list, child, name);
+		}
+	}
+	closedir(dir);
+	return ok;
+}
+
+// Directory order depends on the file system, names do not
+static int compare_roms(const void *a, const void *b) {
+	return strcmp(((const CatalogRom *) a)->name, ((const CatalogRom *) b)->name);
+}
+
+// Input scripts hold one "<frame> <hex key mask>" pair per line, as for
+// chip8_runner
+static RunnerInputEvent *read_input(const char *path, size_t *count) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	size_t capacity = 64;
+	RunnerInputEvent *events = malloc(capacity * sizeof(*events));
+	unsigned int frame, keys;
+	*count = 0;
+	while (events != NULL && fscanf(file, "%u %x", &frame, &keys) == 2) {
+		if (*count == capacity) {
+			capacity *= 2;
+			RunnerInputEvent *grown = realloc(events, capacity * sizeof(*events));
+			if (grown == NULL) {
+				free(events);
+				events = NULL;
+				break;
+			}
+			events = grown;
+		}
+		events[(*count)++] = (RunnerInputEvent) {frame, (uint16_t) keys};
+	}
+	fclose(file);
+	return events;
+}
+
+static uint64_t next_input(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Keys held during `frame`; `event` is the next script event not applied yet
+static uint16_t frame_keys(const CatalogConfig *config, unsigned long frame,
+													 size_t *event, uint16_t keys, uint64_t *random) {
+	if (config->no_input) {
+		return 0;
+	}
+	if (config->input != NULL) {
+		while (*event < config->input_count &&
+					 config->input[*event].frame <= frame) {
+			keys = config->input[(*event)++].keys;
+		}
+		return keys;
+	}
+	unsigned long phase = frame % RANDOM_INTERVAL_FRAMES;
+	if (phase == 0) {
+		uint64_t value = next_input(random);
+		return (value & 3) == 0 ? 0 : (uint16_t) (1u << ((value >> 2) & 0xF));
+	}
+	return phase < RANDOM_HOLD_FRAMES ? keys : 0;
+}
+
+// Whether the profile runs `opcode`, or reports it as unknown, following the
+// handler checks of the interpreter loops
+static bool is_known(uint16_t opcode, unsigned quirks) {
+	switch (opcode_handlers[opcode]) {
+	case H_UNKNOWN:
+		return false;
+	case H_LD_I_LONG:
+	case H_PLANES:
+	case H_LD_PATTERN:
+	case H_PITCH:
+		return (quirks & QUIRK_XOCHIP_OPS) != 0;
+	case H_LD_BIG_FONT:
+	case H_SAVE_FLAGS:
+	case H_LOAD_FLAGS:
+		return (quirks & QUIRK_SCHIP_OPS) != 0;
+	}
+	return true;
+}
+
+// "chip8/br8kout.ch8" becomes DIR/chip8_br8kout plus `extension`
+static void output_path(char *path, size_t size, const char *out_dir,
+												const char *name, const char *extension) {
+	char base[1024];
+	snprintf(base, sizeof(base), "%s", name);
+	base[strlen(base) - 4] = '\0';
+	for (char *c = base; *c != '\0'; c++) {
+		if (*c == '/') {
+			*c = '_';
+		}
+	}
+	snprintf(path, size, "%s/%s%s", out_dir, base, extension);
+}
+
+static const char *file_name(const char *path) {
+	const char *slash = strrchr(path, '/');
+	return slash != NULL ? slash + 1 : path;
+}
+
+/*
+ * Runs the ROM for config->frames frames one instruction at a time, counting
+ * the opcodes it executes, and writes the thumbnail and the animation of the
+ * last frames on the way. Idle loops are run rather than skipped, which
+ * gives the same machine state.
+ */
+static bool run_rom(const CatalogConfig *config, const CatalogRom *rom,
+										Chip8 *chip8, Chip8Capture *capture, RomStats *stats,
+										const char *png_path, const char *gif_path) {
+	const RomProfile *profile = profile_find(rom->name);
+	stats->cycles_per_frame = config->cycles_per_frame;
+	if (stats->cycles_per_frame == 0 && profile != NULL) {
+		stats->cycles_per_frame = profile->cycles_per_frame;
+	}
+	if (stats->cycles_per_frame == 0) {
+		stats->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+	}
+	stats->quirks = config->has_quirks ? config->quirks
+							: profile != NULL			 ? profile->quirks
+																		 : CHIP8_QUIRKS_VIP;
+
+	chip8_reset(chip8);
+	if (!chip8_load_rom_file(chip8, rom->path)) {
+		return false;
+	}
+	chip8->quirks = stats->quirks;
+	// Seeded from the name, so a ROM gets the same run in any catalogue
+	uint64_t hash = rompack_hash(rom->name, strlen(rom->name));
+	chip8_seed(chip8, config->seed ^ hash);
+	uint64_t random = (config->seed ^ hash) | 1;
+	Chip8CycleFunction cycle = chip8_cycle_function(stats->quirks);
+
+	unsigned long attract_start = config->attract_frames < config->frames
+																		? config->frames - config->attract_frames
+																		: 0;
+	bool animate = config->attract_frames > 0;
+	size_t event = 0;
+	uint16_t keys = 0;
+	bool ok = true;
+	for (unsigned long frame = 0; frame < config->frames; frame++) {
+		if (animate && frame == attract_start) {
+			if (!capture_open(capture, gif_path, CAPTURE_DEFAULT_CAPACITY,
+												config->scale, NULL)) {
+				return false;
+			}
+			// The screen the animation opens on, whether or not it is redrawn
+			capture_frame(capture, chip8, 0, true);
+		}
+
+		keys = frame_keys(config, frame, &event, keys, &random);
+		chip8_clear_key_edges(chip8);
+		chip8_set_keys(chip8, keys);
+		for (int i = 0; i < stats->cycles_per_frame; i++) {
+			stats->counts[fetch_opcode(chip8, chip8->pc)]++;
+			cycle(chip8);
+		}
+		stats->instructions += (unsigned long long) stats->cycles_per_frame;
+
+		if ((fetch_opcode(chip8, chip8->pc) & 0xF0FF) == 0xF00A) {
+			stats->key_wait_frames++;
+		}
+		if (chip8->draw_flag) {
+			stats->draw_frames++;
+			if (animate && frame >= attract_start) {
+				capture_frame(capture, chip8, (uint32_t) (frame - attract_start),
+											true);
+			}
+			chip8->draw_flag = false;
+		}
+		chip8_update_timers(chip8);
+		if (frame + 1 == config->thumbnail_frame) {
+			ok = capture_png(png_path, chip8, config->scale, NULL) && ok;
+		}
+	}
+	if (animate) {
+		capture_close(capture, (uint32_t) (config->frames - attract_start));
+	}
+	return ok;
+}
+
+typedef struct {
+	const char *pattern;
+	unsigned long long count;
+} PatternCount;
+
+static int compare_patterns(const void *a, const void *b) {
+	return strcmp(((const PatternCount *) a)->pattern,
+								((const PatternCount *) b)->pattern);
+}
+
+static bool write_summary(const char *path, const CatalogConfig *config,
+													const CatalogRom *rom, const Chip8 *chip8,
+													const RomStats *stats, const char *png_path,
+													const char *gif_path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	fprintf(file, "{\n  \"rom\": \"%s\",\n  \"quirks\": \"%s\",\n",
+					rom->name, chip8_quirks_name(stats->quirks));
+	fprintf(file, "  \"ipf\": %d,\n  \"frames\": %lu,\n",
+					stats->cycles_per_frame, config->frames);
+	fprintf(file, "  \"instructions\": %llu,\n", stats->instructions);
+
+	// Executions per pattern, listed in pattern order
+	PatternCount patterns[MAX_PATTERNS];
+	int num_patterns = 0;
+	for (unsigned opcode = 0; opcode < 65536; opcode++) {
+		const char *pattern = chip8_op_pattern((uint16_t) opcode);
+		if (stats->counts[opcode] == 0 || pattern == NULL) {
+			continue;
+		}
+		int i = 0;
+		while (i < num_patterns && patterns[i].pattern != pattern) {
+			i++;
+		}
+		if (i == num_patterns && num_patterns < MAX_PATTERNS) {
+			patterns[num_patterns++] = (PatternCount) {pattern, 0};
+		}
+		if (i < num_patterns) {
+			patterns[i].count += stats->counts[opcode];
+		}
+	}
+	qsort(patterns, (size_t) num_patterns, sizeof(*patterns), compare_patterns);
+	fprintf(file, "  \"opcodes\": {");
+	for (int i = 0; i < num_patterns; i++) {
+		fprintf(file, "%s\"%s\": %llu", i > 0 ? ", " : "", patterns[i].pattern,
+						patterns[i].count);
+	}
+	fprintf(file, "},\n");
+
+	fprintf(file, "  \"unknown_opcodes\": %llu,\n", stats->unknown);
+	fprintf(file, "  \"idles_in_fx0a\": %s,\n  \"key_wait_frames\": %lu,\n",
+					stats->key_wait_frames > 0 ? "true" : "false",
+					stats->key_wait_frames);
+	fprintf(file, "  \"draw_frames\": %lu,\n  \"draws_per_second\": %.1f,\n",
+					stats->draw_frames,
+					config->frames > 0 ? 60.0 * stats->draw_frames / config->frames
+														 : 0.0);
+	fprintf(file, "  \"framebuffer_hash\": \"%016llx\"",
+					chip8_framebuffer_hash(chip8));
+	if (png_path != NULL) {
+		fprintf(file, ",\n  \"thumbnail\": \"%s\"", file_name(png_path));
+	}
+	if (gif_path != NULL) {
+		fprintf(file, ",\n  \"attract\": \"%s\"", file_name(gif_path));
+	}
+	fprintf(file, "\n}\n");
+	return fclose(file) == 0;
+}
+
+static bool catalog_rom(const CatalogConfig *config, const CatalogRom *rom,
+												Chip8 *chip8, Chip8Capture *capture,
+												RomStats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	char png_path[2048], gif_path[2048], json_path[2048];
+	output_path(png_path, sizeof(png_path), config->out_dir, rom->name, ".png");
+	output_path(gif_path, sizeof(gif_path), config->out_dir, rom->name, ".gif");
+	output_path(json_path, sizeof(json_path), config->out_dir, rom->name,
+							".json");
+	if (!run_rom(config, rom, chip8, capture, stats, png_path, gif_path)) {
+		return false;
+	}
+
+	unsigned quirks = quirk_flags(stats->quirks);
+	for (unsigned opcode = 0; opcode < 65536; opcode++) {
+		if (stats->counts[opcode] != 0 && !is_known((uint16_t) opcode, quirks)) {
+			stats->unknown += stats->counts[opcode];
+		}
+	}
+	if (!write_summary(json_path, config, rom, chip8, stats,
+										 config->thumbnail_frame > 0 ? png_path : NULL,
+										 config->attract_frames > 0 ? gif_path : NULL)) {
+		return false;
+	}
+	printf("%-40s %-6s %6.1f draws/s %s%s\n", rom->name,
+				 chip8_quirks_name(stats->quirks),
+				 config->frames > 0 ? 60.0 * stats->draw_frames / config->frames : 0.0,
+				 stats->key_wait_frames > 0 ? "FX0A" : "",
+				 stats->unknown > 0 ? " unknown-opcodes" : "");
+	return true;
+}
+
+static void *worker(void *arg) {
+	Catalog *catalog = arg;
+	Chip8 *chip8 = malloc(sizeof(*chip8));
+	Chip8Capture *capture = malloc(sizeof(*capture));
+	RomStats *stats = malloc(sizeof(*stats));
+	if (chip8 == NULL || capture == NULL || stats == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		atomic_store(&catalog->failed, true);
+	} else {
+		chip8_init(chip8);
+		size_t i;
+		while ((i = atomic_fetch_add(&catalog->next, 1)) < catalog->list->count) {
+			const CatalogRom *rom = &catalog->list->roms[i];
+			if (!catalog_rom(catalog->config, rom, chip8, capture, stats)) {
+				fprintf(stderr, "Error: Failed to catalogue %s.\n", rom->name);
+				atomic_store(&catalog->failed, true);
+			}
+		}
+	}
+	free(chip8);
+	free(capture);
+	free(stats);
+	return NULL;
+}
+
+static double now_seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	CatalogConfig config = {
+			.out_dir = "bin/catalog",
+			.frames = DEFAULT_FRAMES,
+			.attract_frames = DEFAULT_ATTRACT_FRAMES,
+			.scale = DEFAULT_SCALE,
+			.seed = 1,
+	};
+	int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	long thumbnail_frame = -1; // -1 = the last frame
+	const char *input = "random";
+	const char *root = NULL;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--out") == 0 && i + 1 < argc) {
+			config.out_dir = argv[++i];
+		} else if (strcmp(arg, "--threads") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(arg, "--frames") == 0 && i + 1 < argc) {
+			config.frames = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--attract") == 0 && i + 1 < argc) {
+			config.attract_frames = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--thumbnail") == 0 && i + 1 < argc) {
+			thumbnail_frame = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--scale") == 0 && i + 1 < argc) {
+			config.scale = atoi(argv[++i]);
+		} else if (strcmp(arg, "--ipf") == 0 && i + 1 < argc) {
+			config.cycles_per_frame = atoi(argv[++i]);
+		} else if (strcmp(arg, "--quirks") == 0 && i + 1 < argc) {
+			if (!chip8_quirks_parse(argv[++i], &config.quirks)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			config.has_quirks = true;
+		} else if (strcmp(arg, "--input") == 0 && i + 1 < argc) {
+			input = argv[++i];
+		} else if (strcmp(arg, "--seed") == 0 && i + 1 < argc) {
+			config.seed = strtoull(argv[++i], NULL, 0);
+		} else if (arg[0] == '-' || root != NULL) {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			root = arg;
+		}
+	}
+	// The thumbnail is taken after its frame ran, 0 writes none
+	config.thumbnail_frame =
+			thumbnail_frame < 0 ? config.frames : (unsigned long) thumbnail_frame;
+	if (root == NULL || threads <= 0 || config.frames == 0 ||
+			config.thumbnail_frame > config.frames || config.scale < 1 ||
+			config.cycles_per_frame < 0) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	RunnerInputEvent *events = NULL;
+	if (strcmp(input, "none") == 0) {
+		config.no_input = true;
+	} else if (strcmp(input, "random") != 0) {
+		events = read_input(input, &config.input_count);
+		if (events == NULL) {
+			return 1;
+		}
+		config.input = events;
+	}
+
+	RomList list = {0};
+	if (!scan_directory(&list, root, "")) {
+		free(list.roms);
+		free(events);
+		return 1;
+	}
+	qsort(list.roms, list.count, sizeof(*list.roms), compare_roms);
+	if (mkdir(config.out_dir, 0755) != 0 && errno != EEXIST) {
+		perror(config.out_dir);
+		free(list.roms);
+		free(events);
+		return 1;
+	}
+
+	Catalog catalog = {.list = &list, .config = &config};
+	if ((size_t) threads > list.count) {
+		threads = list.count > 0 ? (int) list.count : 1;
+	}
+	pthread_t *workers = malloc((size_t) threads * sizeof(*workers));
+	if (workers == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		free(list.roms);
+		free(events);
+		return 1;
+	}
+	double start = now_seconds();
+	int started = 0;
+	while (started < threads &&
+				 pthread_create(&workers[started], NULL, worker, &catalog) == 0) {
+		started++;
+	}
+	if (started == 0) {
+		fprintf(stderr, "Error: Failed to start workers.\n");
+		atomic_store(&catalog.failed, true);
+	}
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	printf("Catalogued %zu ROMs into %s in %.2fs on %d threads\n", list.count,
+				 config.out_dir, now_seconds() - start, started);
+
+	free(workers);
+	free(list.roms);
+	free(events);
+	return atomic_load(&catalog.failed) ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+// Fuzzing entry point: runs each input as a ROM for a few frames on the
+// interpreter. Builds as a libFuzzer/AFL++ target, or with
+// CHIP8_FUZZ_STANDALONE as a driver that replays inputs and measures speed.
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip8.h"
+
+/*
+ * Input layout: byte 0 picks the quirk profile, bytes 1-2 are a keypad mask
+ * that is held on odd frames (so FX0A also sees releases) and the rest is
+ * the ROM. 4 frames of 250 instructions keep an execution near 10 µs.
+ */
+#define FUZZ_HEADER_SIZE 3
+#define FUZZ_FRAMES 4
+#define FUZZ_CYCLES_PER_FRAME 250
+
+static Chip8 chip8;
+static bool initialised = false;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	// Only the pages the previous input wrote are cleared
+	if (initialised) {
+		chip8_reset(&chip8);
+	} else {
+		chip8_init(&chip8);
+		// Most inputs hit unknown opcodes, reporting each would flood stdout
+		chip8.quiet = true;
+		chip8_reset(&chip8);
+		initialised = true;
+	}
+	if (size < FUZZ_HEADER_SIZE) {
+		return 0;
+	}
+
+	chip8.quirks = (Chip8Quirks) (data[0] % CHIP8_QUIRKS_COUNT);
+	uint16_t keys = (uint16_t) (data[1] | data[2] << 8);
+	size_t rom_size = size - FUZZ_HEADER_SIZE;
+	if (rom_size > CHIP8_MAX_ROM_SIZE) {
+		rom_size = CHIP8_MAX_ROM_SIZE;
+	}
+	chip8_load_rom_data(&chip8, data + FUZZ_HEADER_SIZE, rom_size);
+
+	for (int frame = 0; frame < FUZZ_FRAMES; frame++) {
+		chip8_clear_key_edges(&chip8);
+		chip8_set_keys(&chip8, frame & 1 ? keys : 0);
+		chip8_run(&chip8, FUZZ_CYCLES_PER_FRAME);
+		chip8_update_timers(&chip8);
+	}
+	return 0;
+}
+
+#ifdef CHIP8_FUZZ_STANDALONE
+
+// Random inputs for --bench, the size of a typical small ROM
+#define BENCH_INPUT_SIZE 512
+#define BENCH_INPUTS 1024
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s <input>...\n"
+					"       %s --bench SECONDS [<input>...]\n",
+					program, program);
+}
+
+static unsigned char *read_file(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+	unsigned char *data = malloc(FUZZ_HEADER_SIZE + CHIP8_MAX_ROM_SIZE);
+	if (data != NULL) {
+		*size = fread(data, 1, FUZZ_HEADER_SIZE + CHIP8_MAX_ROM_SIZE, file);
+	}
+	fclose(file);
+	return data;
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs the inputs round-robin, or random ones when there are none
+static int bench(double seconds, unsigned char **inputs, size_t *sizes,
+								 int count) {
+	static unsigned char random_inputs[BENCH_INPUTS][BENCH_INPUT_SIZE];
+	if (count == 0) {
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for (int i = 0; i < BENCH_INPUTS; i++) {
+			for (int j = 0; j < BENCH_INPUT_SIZE; j++) {
+				state ^= state << 13;
+				state ^= state >> 7;
+				state ^= state << 17;
+				random_inputs[i][j] = (unsigned char) state;
+			}
+		}
+	}
+
+	unsigned long long execs = 0;
+	double start = now_seconds();
+	double elapsed = 0;
+	do {
+		// Check the clock every 1024 runs only
+		for (int i = 0; i < 1024; i++, execs++) {
+			if (count > 0) {
+				int index = (int) (execs % (unsigned) count);
+				LLVMFuzzerTestOneInput(inputs[index], sizes[index]);
+			} else {
+				LLVMFuzzerTestOneInput(random_inputs[execs % BENCH_INPUTS],
+															 BENCH_INPUT_SIZE);
+			}
+		}
+		elapsed = now_seconds() - start;
+	} while (elapsed < seconds);
+
+	printf("%llu execs in %.2f s: %.0f execs/sec\n", execs, elapsed,
+				 execs / elapsed);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	double bench_seconds = 0;
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "--bench") == 0) {
+		bench_seconds = atof(argv[2]);
+		first = 3;
+	}
+	if (bench_seconds <= 0 && first == 3) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (bench_seconds == 0 && argc < 2) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	int count = argc - first;
+	unsigned char **inputs = calloc(count + 1, sizeof(*inputs));
+	size_t *sizes = calloc(count + 1, sizeof(*sizes));
+	if (inputs == NULL || sizes == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return 1;
+	}
+	int result = 0;
+	for (int i = 0; i < count && result == 0; i++) {
+		inputs[i] = read_file(argv[first + i], &sizes[i]);
+		if (inputs[i] == NULL) {
+			result = 1;
+		}
+	}
+
+	if (result == 0 && bench_seconds > 0) {
+		result = bench(bench_seconds, inputs, sizes, count);
+	} else if (result == 0) {
+		// A crashing input takes the process down before its line is printed
+		for (int i = 0; i < count; i++) {
+			LLVMFuzzerTestOneInput(inputs[i], sizes[i]);
+			printf("%s: ok\n", argv[first + i]);
+			fflush(stdout);
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		free(inputs[i]);
+	}
+	free(inputs);
+	free(sizes);
+	return result;
+}
+
+#endif
@@ -0,0 +1,11 @@
+// Standalone headless runner, linked only against the SDL-free core. Built
+// with CHIP8_AOT it also links a ROM compiled by chip8_aot and runs that.
+#include "headless.h"
+
+int main(int argc, char **argv) {
+#ifdef CHIP8_AOT
+	return headless_main_aot(argc, argv, &chip8_aot_program);
+#else
+	return headless_main(argc, argv);
+#endif
+}
@@ -0,0 +1,159 @@
+// Packs every .ch8 file below a directory into one indexed ROM pack
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "profile.h"
+#include "rompack.h"
+
+typedef struct {
+	RomPackEntry *entries;
+	unsigned char **images;
+	uint32_t count;
+	uint32_t capacity;
+} PackList;
+
+static void print_usage(const char *program) {
+	fprintf(stderr, "Usage: %s [--roms DIR] <output.pack>\n", program);
+}
+
+static bool has_rom_extension(const char *name) {
+	size_t length = strlen(name);
+	return length > 4 && strcmp(name + length - 4, ".ch8") == 0;
+}
+
+static bool add_rom(PackList *list, const char *path, const char *name) {
+	if (strlen(name) >= ROMPACK_NAME_SIZE) {
+		fprintf(stderr, "Warning: Skipping %s, name is too long.\n", path);
+		return true;
+	}
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	unsigned char *image = malloc(CHIP8_MAX_ROM_SIZE + 1);
+	size_t size =
+			image != NULL ? fread(image, 1, CHIP8_MAX_ROM_SIZE + 1, file) : 0;
+	fclose(file);
+	if (image == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return false;
+	}
+	if (size > CHIP8_MAX_ROM_SIZE) {
+		fprintf(stderr, "Warning: Skipping %s, ROM is too large.\n", path);
+		free(image);
+		return true;
+	}
+
+	if (list->count == list->capacity) {
+		uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+		RomPackEntry *entries =
+				realloc(list->entries, capacity * sizeof(*entries));
+		if (entries != NULL) {
+			list->entries = entries;
+		}
+		unsigned char **images = realloc(list->images, capacity * sizeof(*images));
+		if (images != NULL) {
+			list->images = images;
+		}
+		if (entries == NULL || images == NULL) {
+			fprintf(stderr, "Error: Out of memory.\n");
+			free(image);
+			return false;
+		}
+		list->capacity = capacity;
+	}
+
+	// Per-ROM settings come from the built-in profile table for now
+	RomPackEntry *entry = &list->entries[list->count];
+	memset(entry, 0, sizeof(*entry));
+	strcpy(entry->name, name);
+	entry->size = (uint32_t) size;
+	const RomProfile *profile = profile_find(name);
+	if (profile != NULL) {
+		entry->cycles_per_frame = (uint16_t) profile->cycles_per_frame;
+		entry->quirks = (uint8_t) profile->quirks;
+		entry->keymap = (uint8_t) profile->keymap;
+	}
+	list->images[list->count++] = image;
+	return true;
+}
+
+// `prefix` is the path below the root, used as the ROM's name in the pack
+static bool scan_directory(PackList *list, const char *root,
+													 const char *prefix) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s%s%s", root, *prefix ? "/" : "", prefix);
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		perror(path);
+		return false;
+	}
+
+	bool ok = true;
+	struct dirent *item;
+	while (ok && (item = readdir(dir)) != NULL) {
+		if (item->d_name[0] == '.') {
+			continue;
+		}
+
+		char name[1024];
+		char child[2048];
+		snprintf(name, sizeof(name), "%s%s%s", prefix, *prefix ? "/" : "",
+						 item->d_name);
+		snprintf(child, sizeof(child), "%s/%s", root, name);
+
+		struct stat info;
+		if (stat(child, &info) != 0) {
+			perror(child);
+			ok = false;
+		} else if (S_ISDIR(info.st_mode)) {
+			ok = scan_directory(list, root, name);
+		} else if (S_ISREG(info.st_mode) && has_rom_extension(name)) {
+			ok = add_rom(list, child, name);
+		}
+	}
+	closedir(dir);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	const char *root = "roms";
+	const char *output = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--roms") == 0 && i + 1 < argc) {
+			root = argv[++i];
+		} else if (argv[i][0] == '-' || output != NULL) {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			output = argv[i];
+		}
+	}
+	if (output == NULL) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	PackList list = {0};
+	bool ok = scan_directory(&list, root, "") &&
+						rompack_write(output, list.entries,
+													(const unsigned char *const *) list.images,
+													list.count);
+	if (ok) {
+		printf("Packed %u ROMs into %s\n", list.count, output);
+	}
+
+	for (uint32_t i = 0; i < list.count; i++) {
+		free(list.images[i]);
+	}
+	free(list.images);
+	free(list.entries);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+// Runs thousands of independent headless instances across all cores
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "rompack.h"
+#include "runner.h"
+
+#define MAX_ROMS 64
+
+typedef struct {
+	unsigned char data[CHIP8_MAX_ROM_SIZE + 1];
+	const unsigned char *image; // data, or the ROM's bytes in a mapped pack
+	size_t size;
+	const char *path;
+	int cycles_per_frame; // 0 = --ipf
+	Chip8Quirks quirks;
+} Rom;
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s [--threads N] [--instances N] [--frames N] [--ipf N] "
+					"[--slice N] [--live N] [--engine interp|cache] [--input FILE] "
+					"[--scale] [--hashes] [--quirks vip|chip48|schip|xochip] "
+					"[--pack FILE] <rom_path|name|hash>...\n",
+					program);
+}
+
+static bool read_rom(Rom *rom, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	rom->size = fread(rom->data, 1, sizeof(rom->data), file);
+	rom->image = rom->data;
+	rom->path = path;
+	const RomProfile *profile = profile_find(path);
+	if (profile != NULL) {
+		rom->cycles_per_frame = profile->cycles_per_frame;
+		rom->quirks = profile->quirks;
+	}
+	fclose(file);
+	return true;
+}
+
+static void use_pack_entry(Rom *rom, const RomPack *pack,
+													 const RomPackEntry *entry) {
+	rom->image = pack->base + entry->offset;
+	rom->size = entry->size;
+	rom->path = entry->name;
+	rom->cycles_per_frame = entry->cycles_per_frame;
+	rom->quirks = entry->quirks < CHIP8_QUIRKS_COUNT ? (Chip8Quirks) entry->quirks
+																									 : CHIP8_QUIRKS_VIP;
+}
+
+// With a pack, ROMs are picked by name or by 16-digit hex hash
+static bool find_rom(Rom *rom, const RomPack *pack, const char *arg) {
+	if (pack->base == NULL) {
+		return read_rom(rom, arg);
+	}
+
+	const RomPackEntry *entry = rompack_find(pack, arg);
+	char *end;
+	unsigned long long hash = strtoull(arg, &end, 16);
+	if (entry == NULL && strlen(arg) == 16 && *end == '\0') {
+		entry = rompack_find_hash(pack, hash);
+	}
+	if (entry == NULL) {
+		fprintf(stderr, "Error: %s is not in the ROM pack.\n", arg);
+		return false;
+	}
+	use_pack_entry(rom, pack, entry);
+	return true;
+}
+
+// Input scripts hold one "<frame> <hex key mask>" pair per line
+static RunnerInputEvent *read_input(const char *path, size_t *count) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return NULL;
+	}
+
+	size_t capacity = 64;
+	RunnerInputEvent *events = malloc(capacity * sizeof(*events));
+	unsigned int frame, keys;
+	*count = 0;
+	while (events != NULL && fscanf(file, "%u %x", &frame, &keys) == 2) {
+		if (*count == capacity) {
+			capacity *= 2;
+			RunnerInputEvent *grown = realloc(events, capacity * sizeof(*events));
+			if (grown == NULL) {
+				free(events);
+				events = NULL;
+				break;
+			}
+			events = grown;
+		}
+		events[(*count)++] = (RunnerInputEvent) {frame, (uint16_t) keys};
+	}
+	fclose(file);
+	return events;
+}
+
+static bool run_once(const RunnerJob *jobs, RunnerResult *results,
+										 size_t count, const RunnerConfig *config) {
+	RunnerStats stats;
+	if (!runner_run(jobs, results, count, config, &stats)) {
+		fprintf(stderr, "Error: Runner failed.\n");
+		return false;
+	}
+
+	printf("threads=%-3d instances=%zu cycles=%llu idle=%.1f%% elapsed=%.3fs "
+				 "instance-cycles/sec=%.0f slices=%llu steals=%llu\n",
+				 config->threads, count, stats.total_cycles,
+				 stats.total_cycles > 0
+						 ? 100.0 * stats.idle_cycles / stats.total_cycles
+						 : 0.0,
+				 stats.elapsed,
+				 stats.elapsed > 0 ? stats.total_cycles / stats.elapsed : 0.0,
+				 stats.slices, stats.steals);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	RunnerConfig config = {
+			.threads = (int) sysconf(_SC_NPROCESSORS_ONLN),
+			.slice_frames = 60,
+			.use_cache = false,
+	};
+	size_t instances = 1000;
+	unsigned long long frames = 600;
+	int cycles_per_frame = 0;
+	const char *input_path = NULL;
+	const char *pack_path = NULL;
+	Chip8Quirks quirks = CHIP8_QUIRKS_VIP;
+	bool has_quirks = false;
+	const char *rom_args[MAX_ROMS];
+	bool scale = false;
+	bool hashes = false;
+	static Rom roms[MAX_ROMS];
+	int num_roms = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--threads") == 0 && i + 1 < argc) {
+			config.threads = atoi(argv[++i]);
+		} else if (strcmp(arg, "--instances") == 0 && i + 1 < argc) {
+			instances = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--frames") == 0 && i + 1 < argc) {
+			frames = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--ipf") == 0 && i + 1 < argc) {
+			cycles_per_frame = atoi(argv[++i]);
+		} else if (strcmp(arg, "--slice") == 0 && i + 1 < argc) {
+			config.slice_frames = atoi(argv[++i]);
+		} else if (strcmp(arg, "--live") == 0 && i + 1 < argc) {
+			config.live_instances = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--engine") == 0 && i + 1 < argc) {
+			config.use_cache = strcmp(argv[++i], "cache") == 0;
+		} else if (strcmp(arg, "--input") == 0 && i + 1 < argc) {
+			input_path = argv[++i];
+		} else if (strcmp(arg, "--scale") == 0) {
+			scale = true;
+		} else if (strcmp(arg, "--hashes") == 0) {
+			hashes = true;
+		} else if (strcmp(arg, "--quirks") == 0 && i + 1 < argc) {
+			if (!chip8_quirks_parse(argv[++i], &quirks)) {
+				print_usage(argv[0]);
+				return 1;
+			}
+			has_quirks = true;
+		} else if (strcmp(arg, "--pack") == 0 && i + 1 < argc) {
+			pack_path = argv[++i];
+		} else if (arg[0] == '-' || num_roms == MAX_ROMS) {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			rom_args[num_roms++] = arg;
+		}
+	}
+
+	// ROM bytes stay in the mapped pack for the whole run
+	RomPack pack = {0};
+	if (pack_path != NULL && !rompack_open(&pack, pack_path)) {
+		return 1;
+	}
+	for (int i = 0; i < num_roms; i++) {
+		if (!find_rom(&roms[i], &pack, rom_args[i])) {
+			rompack_close(&pack);
+			return 1;
+		}
+	}
+	// A pack without ROM arguments runs everything in it
+	if (num_roms == 0) {
+		while ((uint32_t) num_roms < pack.count && num_roms < MAX_ROMS) {
+			use_pack_entry(&roms[num_roms], &pack, &pack.entries[num_roms]);
+			num_roms++;
+		}
+	}
+	if (num_roms == 0 || instances == 0 || config.threads <= 0 ||
+			cycles_per_frame < 0) {
+		print_usage(argv[0]);
+		rompack_close(&pack);
+		return 1;
+	}
+
+	size_t input_count = 0;
+	RunnerInputEvent *input = NULL;
+	if (input_path != NULL &&
+			(input = read_input(input_path, &input_count)) == NULL) {
+		return 1;
+	}
+
+	// ROMs are assigned round-robin, each instance gets its own seed
+	RunnerJob *jobs = calloc(instances, sizeof(*jobs));
+	RunnerResult *results = calloc(instances, sizeof(*results));
+	if (jobs == NULL || results == NULL) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return 1;
+	}
+	// --ipf and --quirks win over the pack entry or ROM profile, then the
+	// defaults
+	for (size_t i = 0; i < instances; i++) {
+		const Rom *rom = &roms[i % num_roms];
+		int rom_cycles = cycles_per_frame;
+		if (rom_cycles == 0) {
+			rom_cycles = rom->cycles_per_frame != 0 ? rom->cycles_per_frame : 8;
+		}
+		jobs[i] = (RunnerJob) {
+				.rom = rom->image,
+				.rom_size = rom->size,
+				.seed = i,
+				.input = input,
+				.input_count = input_count,
+				.frames = frames,
+				.cycles_per_frame = rom_cycles,
+				.quirks = has_quirks ? quirks : rom->quirks,
+		};
+	}
+
+	bool ok = true;
+	if (scale) {
+		int max_threads = config.threads;
+		for (int t = 1; ok && t <= max_threads; t *= 2) {
+			config.threads = t;
+			ok = run_once(jobs, results, instances, &config);
+			if (t < max_threads && t * 2 > max_threads) {
+				t = max_threads / 2;
+			}
+		}
+	} else {
+		ok = run_once(jobs, results, instances, &config);
+	}
+
+	for (size_t i = 0; ok && hashes && i < instances; i++) {
+		printf("%zu %s %016llx\n", i, roms[i % num_roms].path,
+					 results[i].framebuffer_hash);
+	}
+
+	free(jobs);
+	free(results);
+	free(input);
+	rompack_close(&pack);
+	return ok ? 0 : 1;
+}
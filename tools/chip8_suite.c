@@ -0,0 +1,626 @@
+// Golden-image conformance checks and the performance regression benchmark
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+#include "chip8_cache.h"
+#include "chip8_jit.h"
+
+#define MAX_CHECKPOINTS 16
+#define MAX_KEY_EVENTS 16
+#define MAX_BENCH_RESULTS 256
+// Each benchmark keeps its best run, which filters out scheduler noise. A run
+// repeats the ROM until it took long enough to time reliably, which matters
+// for ROMs that spend most frames in skipped idle loops
+#define BENCH_REPEATS 5
+#define BENCH_MIN_SECONDS 0.1
+
+typedef enum {
+	ENGINE_INTERP,
+	ENGINE_CACHE,
+	ENGINE_JIT,
+	ENGINE_COUNT,
+} Engine;
+
+static const char *const ENGINE_NAMES[ENGINE_COUNT] = {"interp", "cache",
+																											 "jit"};
+
+// The keypad mask held from `frame` on, until the next event
+typedef struct {
+	unsigned long frame;
+	uint16_t keys;
+} KeyEvent;
+
+typedef struct {
+	unsigned long frame;
+	unsigned long long hash;
+} Checkpoint;
+
+// One line of the golden file, or of the benchmark list
+typedef struct {
+	char rom[256];
+	char quirks_name[16];
+	Chip8Quirks quirks;
+	int cycles_per_frame;
+	KeyEvent keys[MAX_KEY_EVENTS];
+	int key_count;
+	Checkpoint checkpoints[MAX_CHECKPOINTS];
+	int checkpoint_count;
+	unsigned long frames;
+} SuiteCase;
+
+typedef struct {
+	char rom[256];
+	char engine[16];
+	// Per pass over the ROM, `instructions` counts the ones actually executed
+	unsigned long long instructions;
+	unsigned long long idle_cycles;
+	unsigned long long frames;
+	double seconds;
+	double ips;
+	double fps;
+	long peak_rss_kb;
+} BenchResult;
+
+static const char *roms_dir = "roms";
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s check [--roms DIR] [--update] <golden.txt>\n"
+					"       %s bench [--roms DIR] [--report FILE] [--baseline FILE] "
+					"[--threshold PCT] [--save-baseline] <bench.txt>\n",
+					program, program);
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*
+ * Instance of one engine running a ROM, driven exactly like the headless
+ * runner: keypad, a batch of cycles, then one timer tick per frame.
+ */
+typedef struct {
+	Chip8 chip8;
+	Chip8Cache *cache;
+	Chip8Jit *jit;
+	Engine engine;
+	unsigned long frame;
+} Machine;
+
+static bool machine_init(Machine *machine, const SuiteCase *suite_case,
+												 Engine engine) {
+	memset(machine, 0, sizeof(*machine));
+	machine->engine = engine;
+	chip8_init(&machine->chip8);
+	machine->chip8.quirks = suite_case->quirks;
+
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s", roms_dir, suite_case->rom);
+	if (!chip8_load_rom_file(&machine->chip8, path)) {
+		return false;
+	}
+
+	if (engine == ENGINE_CACHE) {
+		machine->cache = malloc(sizeof(*machine->cache));
+		if (machine->cache == NULL || !chip8_cache_init(machine->cache)) {
+			fprintf(stderr, "Error: Failed to allocate block cache.\n");
+			free(machine->cache);
+			machine->cache = NULL;
+			return false;
+		}
+	} else if (engine == ENGINE_JIT) {
+		machine->jit = malloc(sizeof(*machine->jit));
+		if (machine->jit == NULL || !chip8_jit_init(machine->jit)) {
+			// Without a JIT the case would silently test the interpreter twice
+			fprintf(stderr, "Error: JIT unavailable.\n");
+			free(machine->jit);
+			machine->jit = NULL;
+			return false;
+		}
+	}
+	return true;
+}
+
+static void machine_destroy(Machine *machine) {
+	if (machine->jit != NULL) {
+		chip8_jit_destroy(machine->jit);
+		free(machine->jit);
+	}
+	if (machine->cache != NULL) {
+		chip8_cache_destroy(machine->cache);
+		free(machine->cache);
+	}
+}
+
+static void machine_run_frames(Machine *machine, const SuiteCase *suite_case,
+															 unsigned long frames) {
+	Chip8 *chip8 = &machine->chip8;
+	int cycles = suite_case->cycles_per_frame;
+	for (unsigned long end = machine->frame + frames; machine->frame < end;
+			 machine->frame++) {
+		chip8_clear_key_edges(chip8);
+		for (int i = 0; i < suite_case->key_count; i++) {
+			if (suite_case->keys[i].frame == machine->frame) {
+				chip8_set_keys(chip8, suite_case->keys[i].keys);
+			}
+		}
+
+		if (machine->cache != NULL) {
+			chip8_cache_run(machine->cache, chip8, cycles);
+		} else if (machine->jit != NULL) {
+			chip8_jit_run(machine->jit, chip8, cycles);
+		} else {
+			chip8_run(chip8, cycles);
+		}
+		chip8_update_timers(chip8);
+	}
+}
+
+/*
+ * Parses `<rom> <quirks> <ipf>` followed by any number of `keys=MASK@FRAME`,
+ * `frame:hash` or bare frame count fields. Returns false on blank and
+ * comment lines as well as on errors, which set `*error`.
+ */
+static bool parse_case(char *line, SuiteCase *suite_case, bool *error) {
+	*error = false;
+	memset(suite_case, 0, sizeof(*suite_case));
+	char *token = strtok(line, " \t\r\n");
+	if (token == NULL || token[0] == '#') {
+		return false;
+	}
+	snprintf(suite_case->rom, sizeof(suite_case->rom), "%s", token);
+
+	token = strtok(NULL, " \t\r\n");
+	if (token == NULL || !chip8_quirks_parse(token, &suite_case->quirks)) {
+		*error = true;
+		return false;
+	}
+	snprintf(suite_case->quirks_name, sizeof(suite_case->quirks_name), "%s",
+					 token);
+
+	token = strtok(NULL, " \t\r\n");
+	suite_case->cycles_per_frame = token != NULL ? atoi(token) : 0;
+	if (suite_case->cycles_per_frame <= 0) {
+		*error = true;
+		return false;
+	}
+
+	while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+		char *end;
+		if (strncmp(token, "keys=", 5) == 0) {
+			for (char *event = strtok(token + 5, ","); event != NULL;
+					 event = strtok(NULL, ",")) {
+				if (suite_case->key_count == MAX_KEY_EVENTS) {
+					*error = true;
+					return false;
+				}
+				KeyEvent *key = &suite_case->keys[suite_case->key_count++];
+				key->keys = (uint16_t) strtoul(event, &end, 16);
+				if (*end != '@') {
+					*error = true;
+					return false;
+				}
+				key->frame = strtoul(end + 1, NULL, 10);
+			}
+			// strtok was restarted on the key list, so it has to be the last field
+			break;
+		}
+
+		unsigned long frame = strtoul(token, &end, 10);
+		if (*end == ':') {
+			if (suite_case->checkpoint_count == MAX_CHECKPOINTS) {
+				*error = true;
+				return false;
+			}
+			Checkpoint *checkpoint =
+					&suite_case->checkpoints[suite_case->checkpoint_count++];
+			checkpoint->frame = frame;
+			checkpoint->hash = strtoull(end + 1, NULL, 16);
+		} else if (*end == '\0') {
+			suite_case->frames = frame;
+		} else {
+			*error = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Runs one golden case on every engine and compares the framebuffer hash at
+ * each checkpoint. With `update`, prints the line again with the hashes the
+ * interpreter produced instead.
+ */
+static bool check_case(const SuiteCase *suite_case, bool update) {
+	bool passed = true;
+	unsigned long long actual[MAX_CHECKPOINTS];
+	for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+		Machine machine;
+		if (!machine_init(&machine, suite_case, (Engine) engine)) {
+			machine_destroy(&machine);
+			return false;
+		}
+
+		for (int i = 0; i < suite_case->checkpoint_count; i++) {
+			const Checkpoint *checkpoint = &suite_case->checkpoints[i];
+			machine_run_frames(&machine, suite_case,
+												 checkpoint->frame - machine.frame);
+			unsigned long long hash = chip8_framebuffer_hash(&machine.chip8);
+			if (engine == ENGINE_INTERP) {
+				actual[i] = hash;
+			}
+			unsigned long long expected = update ? actual[i] : checkpoint->hash;
+			if (hash != expected) {
+				fprintf(stderr,
+								"FAIL %s (%s, %s): frame %lu hash %016llx, expected "
+								"%016llx\n",
+								suite_case->rom, suite_case->quirks_name,
+								ENGINE_NAMES[engine], checkpoint->frame, hash, expected);
+				passed = false;
+			}
+		}
+		machine_destroy(&machine);
+	}
+
+	if (update) {
+		printf("%s %s %d", suite_case->rom, suite_case->quirks_name,
+					 suite_case->cycles_per_frame);
+		for (int i = 0; i < suite_case->checkpoint_count; i++) {
+			printf(" %lu:%016llx", suite_case->checkpoints[i].frame, actual[i]);
+		}
+		for (int i = 0; i < suite_case->key_count; i++) {
+			printf("%s%04x@%lu", i == 0 ? " keys=" : ",", suite_case->keys[i].keys,
+						 suite_case->keys[i].frame);
+		}
+		printf("\n");
+	}
+	return passed;
+}
+
+static int run_check(const char *golden_path, bool update) {
+	FILE *file = fopen(golden_path, "r");
+	if (file == NULL) {
+		perror(golden_path);
+		return 1;
+	}
+
+	int cases = 0;
+	int failures = 0;
+	int line_number = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_number++;
+		if (update && (line[0] == '#' || line[0] == '\n')) {
+			fputs(line, stdout);
+			continue;
+		}
+
+		SuiteCase suite_case;
+		bool error;
+		if (!parse_case(line, &suite_case, &error)) {
+			if (error) {
+				fprintf(stderr, "%s:%d: Malformed test case.\n", golden_path,
+								line_number);
+				failures++;
+			}
+			continue;
+		}
+		// Checkpoints must be in order, the engines only run forwards
+		for (int i = 1; i < suite_case.checkpoint_count; i++) {
+			if (suite_case.checkpoints[i].frame <=
+					suite_case.checkpoints[i - 1].frame) {
+				fprintf(stderr, "%s:%d: Checkpoints are out of order.\n",
+								golden_path, line_number);
+				error = true;
+			}
+		}
+
+		cases++;
+		if (error || !check_case(&suite_case, update)) {
+			failures++;
+		}
+	}
+	fclose(file);
+
+	fprintf(stderr, "%d of %d cases passed on %d engines\n", cases - failures,
+					cases, ENGINE_COUNT);
+	return failures == 0 ? 0 : 1;
+}
+
+/*
+ * Benchmarks one ROM on one engine in a child process, so its peak RSS is
+ * measured on its own and a crash fails only this entry.
+ */
+static bool bench_case(const SuiteCase *suite_case, Engine engine,
+											 BenchResult *result) {
+	memset(result, 0, sizeof(*result));
+	snprintf(result->rom, sizeof(result->rom), "%s", suite_case->rom);
+	snprintf(result->engine, sizeof(result->engine), "%s", ENGINE_NAMES[engine]);
+
+	int fds[2];
+	if (pipe(fds) != 0) {
+		perror("pipe");
+		return false;
+	}
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		close(fds[0]);
+		BenchResult best = *result;
+		for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+			double total = 0;
+			int passes = 0;
+			while (total < BENCH_MIN_SECONDS) {
+				Machine machine;
+				if (!machine_init(&machine, suite_case, engine)) {
+					_exit(1);
+				}
+				double start = now_seconds();
+				machine_run_frames(&machine, suite_case, suite_case->frames);
+				total += now_seconds() - start;
+				passes++;
+				best.idle_cycles = machine.chip8.idle_cycles;
+				machine_destroy(&machine);
+			}
+
+			double elapsed = total / passes;
+			if (repeat == 0 || elapsed < best.seconds) {
+				best.seconds = elapsed;
+			}
+		}
+		best.frames = suite_case->frames;
+		best.instructions =
+				(unsigned long long) suite_case->frames * suite_case->cycles_per_frame -
+				best.idle_cycles;
+		ssize_t written = write(fds[1], &best, sizeof(best));
+		_exit(written == (ssize_t) sizeof(best) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	ssize_t got = read(fds[0], result, sizeof(*result));
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) != 0 || got != (ssize_t) sizeof(*result)) {
+		fprintf(stderr, "FAIL %s (%s): benchmark did not complete\n",
+						suite_case->rom, ENGINE_NAMES[engine]);
+		return false;
+	}
+
+	// ru_maxrss is in kilobytes on Linux
+	result->peak_rss_kb = usage.ru_maxrss;
+	if (result->seconds > 0) {
+		result->ips = result->instructions / result->seconds;
+		result->fps = result->frames / result->seconds;
+	}
+	return true;
+}
+
+static bool write_report(const char *path, const BenchResult *results,
+												 int count) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	// One result per line, which is also what read_report relies on
+	fprintf(file, "{\n  \"results\": [\n");
+	for (int i = 0; i < count; i++) {
+		const BenchResult *result = &results[i];
+		fprintf(file,
+						"    {\"rom\": \"%s\", \"engine\": \"%s\", \"ips\": %.0f, "
+						"\"fps\": %.1f, \"instructions\": %llu, \"idle_cycles\": %llu, "
+						"\"frames\": %llu, \"seconds\": %.9f, \"peak_rss_kb\": %ld}%s\n",
+						result->rom, result->engine, result->ips, result->fps,
+						result->instructions, result->idle_cycles, result->frames,
+						result->seconds, result->peak_rss_kb, i + 1 < count ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	return fclose(file) == 0;
+}
+
+// Reads a report written by write_report, returns -1 if there is none
+static int read_report(const char *path, BenchResult *results, int capacity) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+	int count = 0;
+	char line[1024];
+	while (count < capacity && fgets(line, sizeof(line), file) != NULL) {
+		BenchResult *result = &results[count];
+		memset(result, 0, sizeof(*result));
+		if (sscanf(line,
+							 " {\"rom\": \"%255[^\"]\", \"engine\": \"%15[^\"]\", \"ips\": "
+							 "%lf, \"fps\": %lf",
+							 result->rom, result->engine, &result->ips,
+							 &result->fps) == 4) {
+			count++;
+		}
+	}
+	fclose(file);
+	return count;
+}
+
+/*
+ * Compares executed instructions and frames per second against the baseline.
+ * Entries missing from the baseline are reported but do not fail the run.
+ */
+static bool compare_report(const BenchResult *results, int count,
+													 const BenchResult *baseline, int baseline_count,
+													 double threshold) {
+	bool passed = true;
+	for (int i = 0; i < count; i++) {
+		const BenchResult *result = &results[i];
+		const BenchResult *base = NULL;
+		for (int j = 0; j < baseline_count && base == NULL; j++) {
+			if (strcmp(baseline[j].rom, result->rom) == 0 &&
+					strcmp(baseline[j].engine, result->engine) == 0) {
+				base = &baseline[j];
+			}
+		}
+		if (base == NULL || base->ips <= 0 || base->fps <= 0) {
+			fprintf(stderr, "NEW  %-32s %-6s %9.2f MIPS %10.0f fps\n", result->rom,
+							result->engine, result->ips / 1e6, result->fps);
+			continue;
+		}
+
+		double ips_change = 100.0 * (result->ips - base->ips) / base->ips;
+		double fps_change = 100.0 * (result->fps - base->fps) / base->fps;
+		bool regressed = ips_change < -threshold || fps_change < -threshold;
+		fprintf(stderr,
+						"%s %-32s %-6s %9.2f MIPS (%+6.1f%%) %10.0f fps (%+6.1f%%)\n",
+						regressed ? "FAIL" : "ok  ", result->rom, result->engine,
+						result->ips / 1e6, ips_change, result->fps, fps_change);
+		passed = passed && !regressed;
+	}
+	return passed;
+}
+
+static int run_bench(const char *list_path, const char *report_path,
+										 const char *baseline_path, double threshold,
+										 bool save_baseline) {
+	FILE *file = fopen(list_path, "r");
+	if (file == NULL) {
+		perror(list_path);
+		return 1;
+	}
+
+	static BenchResult results[MAX_BENCH_RESULTS];
+	int count = 0;
+	bool ok = true;
+	int line_number = 0;
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		line_number++;
+		SuiteCase suite_case;
+		bool error;
+		if (!parse_case(line, &suite_case, &error)) {
+			if (error) {
+				fprintf(stderr, "%s:%d: Malformed benchmark.\n", list_path,
+								line_number);
+				ok = false;
+			}
+			continue;
+		}
+		if (suite_case.frames == 0) {
+			fprintf(stderr, "%s:%d: Benchmark needs a frame count.\n", list_path,
+							line_number);
+			ok = false;
+			continue;
+		}
+
+		for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+			if (count == MAX_BENCH_RESULTS) {
+				fprintf(stderr, "Error: Too many benchmarks.\n");
+				ok = false;
+				break;
+			}
+			if (bench_case(&suite_case, (Engine) engine, &results[count])) {
+				count++;
+			} else {
+				ok = false;
+			}
+		}
+	}
+	fclose(file);
+
+	if (report_path != NULL && !write_report(report_path, results, count)) {
+		ok = false;
+	}
+	if (baseline_path == NULL) {
+		return ok ? 0 : 1;
+	}
+
+	if (save_baseline) {
+		if (!write_report(baseline_path, results, count)) {
+			return 1;
+		}
+		fprintf(stderr, "Saved baseline to %s\n", baseline_path);
+		return ok ? 0 : 1;
+	}
+
+	// Baselines are per machine; a run with nothing to compare against would
+	// pass without checking anything
+	static BenchResult baseline[MAX_BENCH_RESULTS];
+	int baseline_count = read_report(baseline_path, baseline, MAX_BENCH_RESULTS);
+	if (baseline_count < 0) {
+		fprintf(stderr,
+						"Error: No baseline at %s, save one with --save-baseline "
+						"(make bench-baseline).\n",
+						baseline_path);
+		return 1;
+	}
+
+	if (!compare_report(results, count, baseline, baseline_count, threshold)) {
+		fprintf(stderr, "Performance regressed by more than %.0f%%\n", threshold);
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	bool bench = strcmp(argv[1], "bench") == 0;
+	if (!bench && strcmp(argv[1], "check") != 0) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	const char *input = NULL;
+	const char *report_path = NULL;
+	const char *baseline_path = NULL;
+	double threshold = 10;
+	bool update = false;
+	bool save_baseline = false;
+	for (int i = 2; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--roms") == 0 && i + 1 < argc) {
+			roms_dir = argv[++i];
+		} else if (!bench && strcmp(arg, "--update") == 0) {
+			update = true;
+		} else if (bench && strcmp(arg, "--report") == 0 && i + 1 < argc) {
+			report_path = argv[++i];
+		} else if (bench && strcmp(arg, "--baseline") == 0 && i + 1 < argc) {
+			baseline_path = argv[++i];
+		} else if (bench && strcmp(arg, "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else if (bench && strcmp(arg, "--save-baseline") == 0) {
+			save_baseline = true;
+		} else if (arg[0] == '-' || input != NULL) {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			input = arg;
+		}
+	}
+	if (input == NULL) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	return bench ? run_bench(input, report_path, baseline_path, threshold,
+													 save_baseline)
+							 : run_check(input, update);
+}
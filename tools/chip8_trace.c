@@ -0,0 +1,193 @@
+// Disassembles, filters and compares binary instruction traces
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "trace.h"
+
+#define DEFAULT_CONTEXT 8
+
+typedef struct {
+	TraceHeader header;
+	TraceRecord *records;
+	uint64_t *cycles;
+} Trace;
+
+// Which records `dump` prints
+typedef struct {
+	unsigned pc_low;
+	unsigned pc_high;
+	bool has_class;
+	Chip8OpClass op_class;
+} TraceFilter;
+
+static void print_usage(const char *program) {
+	fprintf(stderr,
+					"Usage: %s dump [--pc LOW-HIGH] [--class "
+					"flow|alu|memory|draw|timer|input|other] <trace>\n"
+					"       %s diff [--context N] <trace> <trace>\n",
+					program, program);
+}
+
+static bool load_trace(Trace *trace, const char *path) {
+	return trace_read(path, &trace->header, &trace->records, &trace->cycles);
+}
+
+static void free_trace(Trace *trace) {
+	free(trace->records);
+	free(trace->cycles);
+}
+
+static void print_record(const TraceRecord *record, uint64_t cycle) {
+	char text[32];
+	chip8_disassemble(record->opcode, text, sizeof(text));
+	printf("%12llu  %04X  %04X  %-18s", (unsigned long long) cycle, record->pc,
+				 record->opcode, text);
+	if (chip8_op_writes_vx(record->opcode)) {
+		printf(" V%X=%02X", (record->opcode >> 8) & 0xF, record->vx);
+	} else {
+		printf("      ");
+	}
+	printf(" I=%04X VF=%02X\n", record->I, record->vf);
+}
+
+static bool matches(const TraceFilter *filter, const TraceRecord *record) {
+	return record->pc >= filter->pc_low && record->pc <= filter->pc_high &&
+				 (!filter->has_class ||
+					chip8_op_class(record->opcode) == filter->op_class);
+}
+
+static int dump(const char *path, const TraceFilter *filter) {
+	Trace trace;
+	if (!load_trace(&trace, path)) {
+		return 1;
+	}
+	printf("# %llu records, %llu dropped\n",
+				 (unsigned long long) trace.header.records,
+				 (unsigned long long) trace.header.dropped);
+
+	// Gaps are only worth showing in the unfiltered listing
+	bool show_gaps = filter->pc_low == 0 && filter->pc_high == 0xFFFF &&
+									 !filter->has_class;
+	for (uint64_t i = 0; i < trace.header.records; i++) {
+		if (show_gaps && i > 0 && trace.cycles[i] > trace.cycles[i - 1] + 1) {
+			printf("%12s  (%llu cycles skipped or dropped)\n", "...",
+						 (unsigned long long) (trace.cycles[i] - trace.cycles[i - 1] - 1));
+		}
+		if (matches(filter, &trace.records[i])) {
+			print_record(&trace.records[i], trace.cycles[i]);
+		}
+	}
+	free_trace(&trace);
+	return 0;
+}
+
+static bool same_record(const TraceRecord *a, const TraceRecord *b) {
+	return a->pc == b->pc && a->opcode == b->opcode && a->I == b->I &&
+				 a->vx == b->vx && a->vf == b->vf;
+}
+
+/*
+ * Walks both traces in cycle order and stops at the first cycle both have
+ * recorded differently. Cycles only one side has (idle skips, dropped
+ * records, a longer run) are counted but not treated as a difference.
+ */
+static int diff(const char *path_a, const char *path_b, int context) {
+	Trace a, b;
+	if (!load_trace(&a, path_a)) {
+		return 1;
+	}
+	if (!load_trace(&b, path_b)) {
+		free_trace(&a);
+		return 1;
+	}
+
+	uint64_t i = 0, j = 0;
+	uint64_t common = 0, only_a = 0, only_b = 0;
+	int result = 0;
+	while (i < a.header.records && j < b.header.records) {
+		if (a.cycles[i] < b.cycles[j]) {
+			i++;
+			only_a++;
+		} else if (a.cycles[i] > b.cycles[j]) {
+			j++;
+			only_b++;
+		} else if (same_record(&a.records[i], &b.records[j])) {
+			i++;
+			j++;
+			common++;
+		} else {
+			printf("Traces diverge at cycle %llu:\n",
+						 (unsigned long long) a.cycles[i]);
+			uint64_t first = i > (uint64_t) context ? i - context : 0;
+			for (uint64_t k = first; k < i; k++) {
+				printf("   ");
+				print_record(&a.records[k], a.cycles[k]);
+			}
+			printf("-  ");
+			print_record(&a.records[i], a.cycles[i]);
+			printf("+  ");
+			print_record(&b.records[j], b.cycles[j]);
+			result = 1;
+			break;
+		}
+	}
+
+	if (result == 0) {
+		only_a += a.header.records - i;
+		only_b += b.header.records - j;
+		printf("Traces match: %llu common records, %llu only in %s, %llu only "
+					 "in %s\n",
+					 (unsigned long long) common, (unsigned long long) only_a, path_a,
+					 (unsigned long long) only_b, path_b);
+	}
+	free_trace(&a);
+	free_trace(&b);
+	return result;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 ||
+			(strcmp(argv[1], "dump") != 0 && strcmp(argv[1], "diff") != 0)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+	bool is_diff = strcmp(argv[1], "diff") == 0;
+
+	TraceFilter filter = {.pc_low = 0, .pc_high = 0xFFFF};
+	int context = DEFAULT_CONTEXT;
+	const char *paths[2] = {NULL, NULL};
+	int path_count = 0;
+	for (int i = 2; i < argc; i++) {
+		const char *arg = argv[i];
+		if (!is_diff && strcmp(arg, "--pc") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%x-%x", &filter.pc_low, &filter.pc_high) != 2) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (!is_diff && strcmp(arg, "--class") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			if (!chip8_op_class_parse(name, &filter.op_class)) {
+				fprintf(stderr, "Unknown opcode class: %s\n", name);
+				return 1;
+			}
+			filter.has_class = true;
+		} else if (is_diff && strcmp(arg, "--context") == 0 && i + 1 < argc) {
+			context = atoi(argv[++i]);
+		} else if (arg[0] == '-' || path_count == (is_diff ? 2 : 1)) {
+			print_usage(argv[0]);
+			return 1;
+		} else {
+			paths[path_count++] = arg;
+		}
+	}
+	if (path_count != (is_diff ? 2 : 1)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	return is_diff ? diff(paths[0], paths[1], context) : dump(paths[0], &filter);
+}